@@ -49,7 +49,8 @@ enum mgos_imu_acc_type {
   ACC_MPU6000,
   ACC_MPU6050,
   ACC_MPU6886,
-  ACC_ICM20948
+  ACC_ICM20948,
+  ACC_REPLAY
 };
 
 enum mgos_imu_gyro_type {
@@ -64,7 +65,8 @@ enum mgos_imu_gyro_type {
   GYRO_MPU6000,
   GYRO_MPU6050,
   GYRO_MPU6886,
-  GYRO_ICM20948
+  GYRO_ICM20948,
+  GYRO_REPLAY
 };
 
 enum mgos_imu_mag_type {
@@ -77,7 +79,8 @@ enum mgos_imu_mag_type {
   MAG_LSM303DLM,
   MAG_HMC5883L,
   MAG_LSM9DS1,
-  MAG_ICM20948
+  MAG_ICM20948,
+  MAG_REPLAY
 };
 
 struct mgos_imu;
@@ -85,6 +88,11 @@ struct mgos_imu;
 struct mgos_imu *mgos_imu_create(void);
 void mgos_imu_destroy(struct mgos_imu **imu);
 
+// Completion callback of the mgos_imu_*_create_i2c_async() calls. `ok` is true
+// if the sensor was created, or false if creating it failed, in which case the
+// sensor has been destroyed.
+typedef void (*mgos_imu_create_cb)(struct mgos_imu *imu, bool ok, void *cb_arg);
+
 // Gyroscope functions
 struct mgos_imu_gyro_opts {
   enum mgos_imu_gyro_type type;   // Gyroscope type.
@@ -94,6 +102,19 @@ struct mgos_imu_gyro_opts {
 };
 
 bool mgos_imu_gyroscope_create_i2c(struct mgos_imu *imu, struct mgos_i2c *i2c, uint8_t i2caddr, const struct mgos_imu_gyro_opts *opts);
+
+// Same as mgos_imu_gyroscope_create_i2c(), but waits out the chip's reset and
+// startup delays on timers instead of in mgos_usleep(), so that sensors on
+// other chips or buses can be created at the same time. Detection happens
+// before the call returns; `cb` is called from the mgos task when the sensor is
+// ready, and mgos_imu_gyroscope_get() fails until then. Sensors on the same
+// chip (eg the accelerometer, gyroscope and magnetometer of an MPU9250) must
+// be created one after the other, by chaining them from `cb`.
+// Will return true if creation has started, in which case `cb` will be called
+// exactly once, unless the sensor is destroyed first. Returns false if the
+// sensor was not detected, in which case `cb` is not called.
+bool mgos_imu_gyroscope_create_i2c_async(struct mgos_imu *imu, struct mgos_i2c *i2c, uint8_t i2caddr, const struct mgos_imu_gyro_opts *opts, mgos_imu_create_cb cb, void *cb_arg);
+
 bool mgos_imu_gyroscope_destroy(struct mgos_imu *imu);
 bool mgos_imu_gyroscope_present(struct mgos_imu *imu);
 
@@ -107,6 +128,15 @@ bool mgos_imu_gyroscope_get(struct mgos_imu *imu, float *x, float *y, float *z);
 bool mgos_imu_gyroscope_get_offset(struct mgos_imu *imu, float *x, float *y, float *z);
 bool mgos_imu_gyroscope_set_offset(struct mgos_imu *imu, float x, float y, float z);
 
+// Program a gyroscope offset in units of degrees/sec into the chip's own offset
+// registers. The offset is given along the (oriented) axes returned by
+// mgos_imu_gyroscope_get(), and the chip adds it to every sample, including
+// samples drained from its FIFO, so it composes with set_offset() above.
+// The offset is rounded to the resolution of the offset registers.
+// Will return true upon success, false if the chip has no offset registers or
+// the offset is out of range.
+bool mgos_imu_gyroscope_set_hw_offset(struct mgos_imu *imu, float x, float y, float z);
+
 // Get/set gyroscope scale in units of degrees/sec
 // The driver will set the scale to at least the given `scale` parameter, eg 1000
 // Will return true upon success, false if setting the scale is not feasible.
@@ -119,6 +149,26 @@ bool mgos_imu_gyroscope_set_scale(struct mgos_imu *imu, float scale);
 bool mgos_imu_gyroscope_get_odr(struct mgos_imu *imu, float *hertz);
 bool mgos_imu_gyroscope_set_odr(struct mgos_imu *imu, float hertz);
 
+// Get/set the cutoff of the gyroscope's digital low pass filter in Hertz
+// The driver will set the highest cutoff that is at most the given `hertz`
+// parameter, or the lowest cutoff if there is none. On some chips the cutoffs
+// follow the data rate, so set the data rate first.
+// Will return true upon success, false if the chip has no configurable filter.
+bool mgos_imu_gyroscope_get_bandwidth(struct mgos_imu *imu, float *hertz);
+bool mgos_imu_gyroscope_set_bandwidth(struct mgos_imu *imu, float hertz);
+
+// Auto-range: step the scale up (see set_scale()) when a sample comes within
+// 2% of the end of the range, and back down once all samples stayed under 40%
+// of the range for `hold_ms`. Each sample is converted with the scale it was
+// measured at: while the chip switches range, mgos_imu_gyroscope_get() returns
+// the last sample from before the switch.
+// Will return true upon success, false if the chip's scale cannot be set.
+bool mgos_imu_gyroscope_set_autorange(struct mgos_imu *imu, bool enable, uint32_t hold_ms);
+
+// Returns in `clipped` whether the last sample returned by
+// mgos_imu_gyroscope_get() hit the end of the range on any axis.
+bool mgos_imu_gyroscope_get_clipped(struct mgos_imu *imu, bool *clipped);
+
 // Get/set gyroscope axes orientation relatve to accelerometer
 // *vector is a list of 9 floats which determine how much of a certain sensor axis
 // should be blended into calls to mgos_imu_gyroscope_get().
@@ -138,6 +188,11 @@ struct mgos_imu_acc_opts {
 };
 
 bool mgos_imu_accelerometer_create_i2c(struct mgos_imu *imu, struct mgos_i2c *i2c, uint8_t i2caddr, const struct mgos_imu_acc_opts *opts);
+
+// Same as mgos_imu_accelerometer_create_i2c(), without blocking.
+// See mgos_imu_gyroscope_create_i2c_async() for details.
+bool mgos_imu_accelerometer_create_i2c_async(struct mgos_imu *imu, struct mgos_i2c *i2c, uint8_t i2caddr, const struct mgos_imu_acc_opts *opts, mgos_imu_create_cb cb, void *cb_arg);
+
 bool mgos_imu_accelerometer_destroy(struct mgos_imu *imu);
 bool mgos_imu_accelerometer_present(struct mgos_imu *imu);
 
@@ -151,6 +206,10 @@ bool mgos_imu_accelerometer_get(struct mgos_imu *imu, float *x, float *y, float
 bool mgos_imu_accelerometer_get_offset(struct mgos_imu *imu, float *x, float *y, float *z);
 bool mgos_imu_accelerometer_set_offset(struct mgos_imu *imu, float x, float y, float z);
 
+// Program an accelerometer offset in units of G into the chip's own offset
+// registers. See mgos_imu_gyroscope_set_hw_offset() for details.
+bool mgos_imu_accelerometer_set_hw_offset(struct mgos_imu *imu, float x, float y, float z);
+
 // Get/set accelerometer scale in units of G
 // The driver will set the scale to at least the given `scale` parameter, eg 20 m/s/s
 // Will return true upon success, false if setting the scale is not feasible.
@@ -163,6 +222,15 @@ bool mgos_imu_accelerometer_set_scale(struct mgos_imu *imu, float scale);
 bool mgos_imu_accelerometer_get_odr(struct mgos_imu *imu, float *hertz);
 bool mgos_imu_accelerometer_set_odr(struct mgos_imu *imu, float hertz);
 
+// Get/set accelerometer low pass filter cutoff in units Hertz
+// See mgos_imu_gyroscope_set_bandwidth() for details.
+bool mgos_imu_accelerometer_get_bandwidth(struct mgos_imu *imu, float *hertz);
+bool mgos_imu_accelerometer_set_bandwidth(struct mgos_imu *imu, float hertz);
+
+// Auto-range and clipping, see mgos_imu_gyroscope_set_autorange().
+bool mgos_imu_accelerometer_set_autorange(struct mgos_imu *imu, bool enable, uint32_t hold_ms);
+bool mgos_imu_accelerometer_get_clipped(struct mgos_imu *imu, bool *clipped);
+
 
 // Magnetometer functions
 struct mgos_imu_mag_opts {
@@ -173,6 +241,11 @@ struct mgos_imu_mag_opts {
 };
 
 bool mgos_imu_magnetometer_create_i2c(struct mgos_imu *imu, struct mgos_i2c *i2c, uint8_t i2caddr, const struct mgos_imu_mag_opts *opts);
+
+// Same as mgos_imu_magnetometer_create_i2c(), without blocking.
+// See mgos_imu_gyroscope_create_i2c_async() for details.
+bool mgos_imu_magnetometer_create_i2c_async(struct mgos_imu *imu, struct mgos_i2c *i2c, uint8_t i2caddr, const struct mgos_imu_mag_opts *opts, mgos_imu_create_cb cb, void *cb_arg);
+
 bool mgos_imu_magnetometer_destroy(struct mgos_imu *imu);
 bool mgos_imu_magnetometer_present(struct mgos_imu *imu);
 
@@ -182,6 +255,11 @@ const char *mgos_imu_magnetometer_get_name(struct mgos_imu *imu);
 // Return magnetometer data in units of Gauss
 bool mgos_imu_magnetometer_get(struct mgos_imu *imu, float *x, float *y, float *z);
 
+// Program a magnetometer offset in units of Gauss (for example, the negated
+// hard-iron bias) into the chip's own offset registers. See
+// mgos_imu_gyroscope_set_hw_offset() for details.
+bool mgos_imu_magnetometer_set_hw_offset(struct mgos_imu *imu, float x, float y, float z);
+
 // Get/set magnetometer scale in units of Gauss
 // The driver will set the scale to at least the given `scale` parameter, eg 400
 // Will return true upon success, false if setting the scale is not feasible.
@@ -205,6 +283,351 @@ bool mgos_imu_magnetometer_get_orientation(struct mgos_imu *imu, float v[9]);
 bool mgos_imu_magnetometer_set_orientation(struct mgos_imu *imu, float v[9]);
 
 
+// Calibration and filter state functions
+// The state blob holds gyroscope and accelerometer offsets, magnetometer bias,
+// the orientation matrices, and (optionally) the Madgwick filter quaternion,
+// gain and rate. Each sensor's section is keyed by sensor type and I2C address,
+// and is only restored onto the same sensor. Use this together with
+// opts.no_rst to warm start after a deep sleep: create the sensors with
+// no_rst=true, then restore the state to skip filter re-convergence.
+#define MGOS_IMU_STATE_SIZE    (160)
+
+struct mgos_imu_madgwick;
+
+// Serialize state into `buf`, which must hold at least MGOS_IMU_STATE_SIZE
+// bytes, for example an RTC memory buffer that survives deep sleep. `*len` is
+// the size of `buf` on input and the number of bytes used on output. The
+// `filter` may be NULL, in which case no filter state is stored.
+// Will return true upon success, false otherwise.
+bool mgos_imu_state_serialize(struct mgos_imu *imu, struct mgos_imu_madgwick *filter, void *buf, size_t *len);
+
+// Restore state from a buffer filled by mgos_imu_state_serialize(). Sections
+// taken from a different sensor are skipped. The `filter` may be NULL.
+// Will return true upon success, false if the blob is missing, corrupt or of
+// an unknown version, in which case nothing is restored.
+bool mgos_imu_state_restore(struct mgos_imu *imu, struct mgos_imu_madgwick *filter, const void *buf, size_t len);
+
+// Save/load state to/from a file in the filesystem, see above.
+bool mgos_imu_state_save(struct mgos_imu *imu, struct mgos_imu_madgwick *filter, const char *filename);
+bool mgos_imu_state_load(struct mgos_imu *imu, struct mgos_imu_madgwick *filter, const char *filename);
+
+
+// Autodetect functions
+// Sensors found by mgos_imu_autodetect(). Types are *_NONE for sensors that
+// were not found.
+struct mgos_imu_autodetect {
+  enum mgos_imu_acc_type  acc_type;
+  uint8_t                 acc_addr;
+  enum mgos_imu_gyro_type gyro_type;
+  uint8_t                 gyro_addr;
+  enum mgos_imu_mag_type  mag_type;
+  uint8_t                 mag_addr;
+};
+
+// Probe `i2c` for all supported chips at their usual addresses, reading each
+// identification register once, and skipping addresses that do not answer and
+// sensors that were already found. The magnetometer behind an MPU9250 or
+// ICM20948 is found by enabling the I2C bypass of its host chip. Pass the
+// types and addresses to mgos_imu_*_create_i2c(), accelerometer first.
+// If `filename` is given, the result is saved there, and on later calls the
+// saved chips are verified with one register read each instead of a full scan.
+// A full scan is only done again if the verification fails.
+// Will return true if at least one sensor was found, false otherwise.
+bool mgos_imu_autodetect(struct mgos_i2c *i2c, const char *filename, struct mgos_imu_autodetect *found);
+
+
+// Replay functions
+// Attach ACC_REPLAY, GYRO_REPLAY and MAG_REPLAY sensors to an empty `imu`, which
+// read their samples from a recorded trace instead of I2C, through the same
+// mgos_imu_*_get() path as real chips. The trace is either a binary log as
+// written by the recorder, or CSV with lines of
+//   ts_us, ax, ay, az [, gx, gy, gz [, mx, my, mz]]
+// in G, degrees/sec and Gauss; the columns on the first line decide which
+// sensors are attached, and lines starting with '#' or a non-number are skipped.
+// The sensors advance through the trace in lockstep: each frame is returned
+// once to each sensor. At the end of the trace reads fail, or if `loop` is set,
+// the trace starts over.
+// Will return true upon success, false otherwise.
+bool mgos_imu_replay_create(struct mgos_imu *imu, const char *filename, bool loop);
+
+// Timestamp in microseconds of the trace frame last read.
+// Will return true upon success, false if `imu` is not replaying a trace.
+bool mgos_imu_replay_get_timestamp(struct mgos_imu *imu, uint32_t *ts_us);
+
+
+// Motion wakeup functions
+// Called with `moving` set when the chip woke up on motion and the sensors are
+// back at their data rates, and cleared when the sensors went back to low power.
+typedef void (*mgos_imu_motion_cb)(struct mgos_imu *imu, bool moving, void *user_data);
+
+// Put the accelerometer into its low power, accelerometer only wake on motion
+// mode, which wakes up when the acceleration changes by more than `threshold`
+// G for `duration_ms`. On chips without a duration counter (MPU925x and
+// ICM20948) `duration_ms` is ignored. When woken, the data rates the sensors
+// had are restored and `cb` is called. Once mgos_imu_accelerometer_get() (or,
+// if it is not called, a 100ms poll) has seen no change above `threshold` for
+// `quiet_ms`, the sensors go back to low power and `cb` is called again.
+// `int_gpio` is the GPIO wired to the chip's interrupt pin, INT1 on MPU925x,
+// ICM20948 and LSM6DSL or INT2 on LSM9DS1; if it is -1 the chip is polled.
+// While in low power, gyroscope reads return stale data.
+// Will return true upon success, false if the accelerometer has no wake on
+// motion mode.
+bool mgos_imu_set_motion_wakeup(struct mgos_imu *imu, float threshold, uint32_t duration_ms, uint32_t quiet_ms, int int_gpio, mgos_imu_motion_cb cb, void *user_data);
+
+// Stop motion wakeup, and restore the sensors' data rates if in low power.
+bool mgos_imu_clear_motion_wakeup(struct mgos_imu *imu);
+
+// Returns true unless motion wakeup is set and the sensors are in low power.
+bool mgos_imu_motion_is_awake(struct mgos_imu *imu);
+
+
+// Adaptive data rate functions
+#define MGOS_IMU_ODR_MAX_TIERS    (4)
+
+// One step of the data rate ladder, ordered from rest to violent motion.
+// A data rate of 0 leaves that sensor's rate alone. The thresholds are the
+// activity above which the next tier is entered: the gyroscope magnitude in
+// degrees/sec, and the standard deviation of the accelerometer magnitude in G.
+// A threshold of 0 is not used.
+struct mgos_imu_odr_tier {
+  float acc_odr;
+  float gyro_odr;
+  float mag_odr;
+  float gyro_thr;
+  float acc_thr;
+};
+
+struct mgos_imu_odr_ctrl_opts {
+  struct mgos_imu_odr_tier tiers[MGOS_IMU_ODR_MAX_TIERS];
+  uint8_t                  num_tiers;
+  float                    hysteresis; // Fraction of the thresholds of the tier below that activity must drop under to step down, eg 0.5
+  uint32_t                 hold_ms;    // How long activity must stay under that before stepping down
+  uint16_t                 window;     // Samples the accelerometer variance is averaged over, 0 for 16
+};
+
+// Called after the data rates changed, with the tier now in use.
+typedef void (*mgos_imu_odr_cb)(struct mgos_imu *imu, uint8_t tier, void *user_data);
+
+// Step the data rates of the sensors between tiers, following the activity
+// seen in mgos_imu_accelerometer_get() and mgos_imu_gyroscope_get(). Stepping up
+// is immediate, stepping down waits out `hold_ms`, one tier at a time. Starts
+// at tier 0. If `filter` is not NULL, its update rate is set to the gyroscope
+// data rate at every change (as read back from the chip, which may round it),
+// so that the application should run its filter loop at the gyroscope rate.
+// While the sensors are in low power for motion wakeup, the tier is kept.
+// Will return true upon success, false if the options are not valid.
+bool mgos_imu_set_odr_ctrl(struct mgos_imu *imu, const struct mgos_imu_odr_ctrl_opts *opts, struct mgos_imu_madgwick *filter, mgos_imu_odr_cb cb, void *user_data);
+bool mgos_imu_clear_odr_ctrl(struct mgos_imu *imu);
+
+// Returns the tier in use, or false if the controller is not set.
+bool mgos_imu_get_odr_tier(struct mgos_imu *imu, uint8_t *tier);
+
+
+// Filter chain functions
+// A chain of up to MGOS_IMU_FILTER_MAX_STAGES stages, run in order on x,y,z
+// samples. Each stage keeps separate state for every axis it applies to.
+#define MGOS_IMU_FILTER_MAX_STAGES    (4)
+#define MGOS_IMU_FILTER_MAX_WINDOW    (32)  // Moving average samples
+#define MGOS_IMU_FILTER_MAX_MEDIAN    (9)   // Median samples
+
+#define MGOS_IMU_FILTER_AXIS_X        (0x01)
+#define MGOS_IMU_FILTER_AXIS_Y        (0x02)
+#define MGOS_IMU_FILTER_AXIS_Z        (0x04)
+#define MGOS_IMU_FILTER_AXIS_ALL      (0x07)
+
+enum mgos_imu_filter_type {
+  MGOS_IMU_FILTER_LOWPASS = 0,  // 2nd order low pass, -3dB at `freq` for q=0.7071
+  MGOS_IMU_FILTER_NOTCH,        // 2nd order notch centered on `freq`, `q` is freq/bandwidth
+  MGOS_IMU_FILTER_MOVING_AVG,   // Mean of the last `len` samples
+  MGOS_IMU_FILTER_MEDIAN,       // Median of the last `len` samples, to reject spikes
+};
+
+struct mgos_imu_filter_stage {
+  enum mgos_imu_filter_type type;
+  uint8_t                   axes; // MGOS_IMU_FILTER_AXIS_* bits, 0 for all axes
+  float                     freq; // Low pass and notch frequency, in Hz
+  float                     q;    // Low pass and notch quality factor, 0 for 0.7071
+  uint8_t                   len;  // Moving average and median window, in samples
+};
+
+struct mgos_imu_filter;
+
+// Create a chain of `num_stages` stages for samples arriving at `odr` Hz.
+// Returns NULL if a stage is not valid, eg a frequency at or above odr/2.
+struct mgos_imu_filter *mgos_imu_filter_create(const struct mgos_imu_filter_stage *stages, uint8_t num_stages, float odr);
+bool mgos_imu_filter_destroy(struct mgos_imu_filter **filter);
+
+// Recompute the low pass and notch coefficients for a new data rate, keeping
+// the state. Stages at or above the new odr/2 pass samples through until the
+// rate goes up again.
+bool mgos_imu_filter_set_odr(struct mgos_imu_filter *filter, float odr);
+
+// Forget all past samples. The next sample primes the stages as if it had
+// always been the input, so the output starts without a transient.
+bool mgos_imu_filter_reset(struct mgos_imu_filter *filter);
+
+// Filter `n` samples in place. `xyz` holds them as x,y,z triplets, oldest
+// first, eg as returned by mgos_imu_l3gd20_fifo_drain().
+bool mgos_imu_filter_process(struct mgos_imu_filter *filter, float *xyz, size_t n);
+
+// Run `filter` on every sample returned by mgos_imu_*_get() (and FIFO drains
+// of that sensor), after offsets and orientation are applied. Pass NULL to
+// detach it. The filter stays owned by the caller, and should not be shared
+// between sensors. While the adaptive data rate controller is set, it keeps
+// the filter's data rate in step with the sensor's.
+bool mgos_imu_accelerometer_set_filter(struct mgos_imu *imu, struct mgos_imu_filter *filter);
+bool mgos_imu_gyroscope_set_filter(struct mgos_imu *imu, struct mgos_imu_filter *filter);
+bool mgos_imu_magnetometer_set_filter(struct mgos_imu *imu, struct mgos_imu_filter *filter);
+
+
+// Vibration spectrum functions
+// Collects accelerometer samples into blocks, and reduces each block to a few
+// features per axis: RMS, energy in frequency bands and the strongest peaks.
+#define MGOS_IMU_SPECTRUM_MAX_BANDS    (8)
+#define MGOS_IMU_SPECTRUM_MAX_PEAKS    (4)
+
+enum mgos_imu_spectrum_window {
+  MGOS_IMU_SPECTRUM_WINDOW_HANN = 0,
+  MGOS_IMU_SPECTRUM_WINDOW_HAMMING,
+  MGOS_IMU_SPECTRUM_WINDOW_RECT,
+};
+
+struct mgos_imu_spectrum_opts {
+  uint16_t                      size;        // Samples per block, a power of 2 from 16 to 1024
+  float                         odr;         // Sample rate, in Hz
+  enum mgos_imu_spectrum_window window;
+  bool                          fixed_point; // Q15 FFT, for chips without a floating point unit
+  float                         range;       // Fixed point: full scale of the samples in G, 0 for 16
+  float                         band_edges[MGOS_IMU_SPECTRUM_MAX_BANDS + 1]; // In Hz, increasing
+  uint8_t                       num_bands;
+  uint8_t                       num_peaks;
+};
+
+struct mgos_imu_spectrum_features {
+  uint32_t block;                                         // Block number, from 0
+  float    rms[3];                                        // In G, with the block mean removed
+  float    band_energy[3][MGOS_IMU_SPECTRUM_MAX_BANDS];   // Mean square in G^2, per band
+  float    peak_freq[3][MGOS_IMU_SPECTRUM_MAX_PEAKS];     // In Hz, strongest first, 0 if there are fewer peaks
+  float    peak_amp[3][MGOS_IMU_SPECTRUM_MAX_PEAKS];      // Sine amplitude, in G
+};
+
+struct mgos_imu_spectrum;
+
+// Called from mgos_imu_spectrum_add() each time a block is complete.
+typedef void (*mgos_imu_spectrum_cb)(struct mgos_imu_spectrum *sp, const struct mgos_imu_spectrum_features *features, void *user_data);
+
+// Returns NULL if the options are not valid.
+struct mgos_imu_spectrum *mgos_imu_spectrum_create(const struct mgos_imu_spectrum_opts *opts, mgos_imu_spectrum_cb cb, void *user_data);
+bool mgos_imu_spectrum_destroy(struct mgos_imu_spectrum **sp);
+
+// Add `n` samples, as x,y,z triplets in G, oldest first, eg from a FIFO drain.
+// Blocks do not overlap; samples past the end of a block start the next one.
+bool mgos_imu_spectrum_add(struct mgos_imu_spectrum *sp, const float *xyz, size_t n);
+
+// Read one sample with mgos_imu_accelerometer_get() and add it, unless it is
+// the previous sample again, eg while auto-range switches the range.
+bool mgos_imu_spectrum_read(struct mgos_imu *imu, struct mgos_imu_spectrum *sp);
+
+// Drop a partly filled block.
+bool mgos_imu_spectrum_reset(struct mgos_imu_spectrum *sp);
+
+// Features of the last complete block. Returns false if there is none yet.
+bool mgos_imu_spectrum_get(struct mgos_imu_spectrum *sp, struct mgos_imu_spectrum_features *features);
+
+
+// Aggregator functions
+// Summarizes x,y,z samples over windows, eg a second of them, so that
+// telemetry can publish one record per window instead of every sample. Memory
+// use does not depend on the window length.
+struct mgos_imu_aggregator_opts {
+  uint32_t window_samples;  // Close a window after this many samples, 0 for no limit
+  uint32_t window_ms;       // or when a sample arrives this long after its first one, 0 for no limit
+};
+
+struct mgos_imu_aggregate {
+  uint32_t window;          // Window number, from 0
+  uint32_t count;           // Samples in the window
+  int64_t  start_us;        // mgos_uptime_micros() of the first sample
+  float    min[3];
+  float    max[3];
+  float    mean[3];
+  float    rms[3];
+  float    stddev[3];
+  float    p2p[3];          // Peak to peak, max - min
+};
+
+struct mgos_imu_aggregator;
+
+// Called each time a window closes.
+typedef void (*mgos_imu_aggregator_cb)(struct mgos_imu_aggregator *agg, const struct mgos_imu_aggregate *aggregate, void *user_data);
+
+// Returns NULL if neither window limit is set.
+struct mgos_imu_aggregator *mgos_imu_aggregator_create(const struct mgos_imu_aggregator_opts *opts, mgos_imu_aggregator_cb cb, void *user_data);
+bool mgos_imu_aggregator_destroy(struct mgos_imu_aggregator **agg);
+
+// Add `n` samples, as x,y,z triplets, oldest first, eg from a FIFO drain.
+bool mgos_imu_aggregator_add(struct mgos_imu_aggregator *agg, const float *xyz, size_t n);
+
+// Close the current window now, if it has samples.
+bool mgos_imu_aggregator_flush(struct mgos_imu_aggregator *agg);
+
+// The last closed window. Returns false if there is none yet.
+bool mgos_imu_aggregator_get(struct mgos_imu_aggregator *agg, struct mgos_imu_aggregate *aggregate);
+
+// Attach an aggregator to a sensor. It then gets every sample that
+// mgos_imu_*_get() returns, or that a FIFO drain of that sensor returns, after
+// the filter chain. Pass NULL to detach it. The aggregator stays owned by the
+// caller.
+bool mgos_imu_accelerometer_set_aggregator(struct mgos_imu *imu, struct mgos_imu_aggregator *agg);
+bool mgos_imu_gyroscope_set_aggregator(struct mgos_imu *imu, struct mgos_imu_aggregator *agg);
+bool mgos_imu_magnetometer_set_aggregator(struct mgos_imu *imu, struct mgos_imu_aggregator *agg);
+
+
+// Stats functions
+// Read latency histogram buckets: bucket i counts reads that took less than
+// 64us << i, the last bucket counts all slower reads.
+#define MGOS_IMU_STATS_BUCKETS    (8)
+
+struct mgos_imu_sensor_stats {
+  uint32_t reads;                                // Successful reads
+  uint32_t read_errors;                          // Failed reads
+  uint32_t i2c_bytes;                            // Register bytes read and written by reads
+  uint32_t overruns;                             // Times the chip reported dropping samples
+  uint32_t clipped;                              // Samples at the end of the range on any axis
+  uint32_t latency_min_us;
+  uint32_t latency_avg_us;
+  uint32_t latency_max_us;
+  uint32_t latency_hist[MGOS_IMU_STATS_BUCKETS];
+};
+
+struct mgos_imu_fusion_stats {
+  uint32_t cycles;                               // Madgwick update(), predict() and correct_*() calls
+  uint32_t cycle_avg_us;
+  uint32_t cycle_max_us;
+  uint32_t conversions;                          // Madgwick get_angles() calls
+  uint32_t conversion_avg_us;
+};
+
+struct mgos_imu_stats {
+  struct mgos_imu_sensor_stats acc;
+  struct mgos_imu_sensor_stats gyro;
+  struct mgos_imu_sensor_stats mag;
+  struct mgos_imu_fusion_stats fusion;
+};
+
+// Enable or disable counting for all sensors currently attached to `imu`, and
+// for `filter`, which may be NULL. Stats are off by default, in which case they
+// cost a pointer check per read. Enabling them again resets the counters.
+// Will return true upon success, false otherwise.
+bool mgos_imu_stats_enable(struct mgos_imu *imu, struct mgos_imu_madgwick *filter, bool enable);
+
+// Get a snapshot of the counters. Sensors without stats enabled read as zero.
+// The `filter` may be NULL.
+// Will return true upon success, false otherwise.
+bool mgos_imu_get_stats(struct mgos_imu *imu, struct mgos_imu_madgwick *filter, struct mgos_imu_stats *stats);
+bool mgos_imu_reset_stats(struct mgos_imu *imu, struct mgos_imu_madgwick *filter);
+
+
 // Initialization function for MGOS -- currently a noop.
 bool mgos_imu_init(void);
 
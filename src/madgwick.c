@@ -37,6 +37,95 @@ static float invSqrt(float x) {
   return conv.f;
 }
 
+// Returns the gain to use for this update, following the beta schedule.
+static float mgos_imu_madgwick_beta(const struct mgos_imu_madgwick *filter) {
+  if (filter->counter < filter->beta_init_count) {
+    return filter->beta_init;
+  }
+  return filter->beta;
+}
+
+// Returns true if the accelerometer sample should not be used for correction.
+// Squared norms are compared, to avoid a square root per sample.
+static bool mgos_imu_madgwick_acc_gated(struct mgos_imu_madgwick *filter, float ax, float ay, float az) {
+  float n2, lo, hi;
+
+  if (filter->acc_norm_tol <= 0.0f) {
+    return false;
+  }
+  n2 = ax * ax + ay * ay + az * az;
+  lo = filter->acc_norm - filter->acc_norm_tol;
+  hi = filter->acc_norm + filter->acc_norm_tol;
+  if ((lo > 0.0f && n2 < lo * lo) || n2 > hi * hi) {
+    filter->acc_gated++;
+    return true;
+  }
+  return false;
+}
+
+// Returns true if the magnetometer sample should not be used for correction.
+// The dip angle is taken against the gravity direction estimated by the filter.
+static bool mgos_imu_madgwick_mag_gated(struct mgos_imu_madgwick *filter, float mx, float my, float mz) {
+  float n2, lo, hi;
+  float vx, vy, vz, dip;
+
+  if (filter->mag_norm_tol <= 0.0f && filter->mag_dip_tol <= 0.0f) {
+    return false;
+  }
+  n2 = mx * mx + my * my + mz * mz;
+  if (filter->mag_norm_tol > 0.0f) {
+    lo = filter->mag_norm - filter->mag_norm_tol;
+    hi = filter->mag_norm + filter->mag_norm_tol;
+    if ((lo > 0.0f && n2 < lo * lo) || n2 > hi * hi) {
+      filter->mag_gated++;
+      return true;
+    }
+  }
+  if (filter->mag_dip_tol > 0.0f && n2 > 0.0f) {
+    // Estimated direction of gravity (up)
+    vx  = 2.0f * (filter->q1 * filter->q3 - filter->q0 * filter->q2);
+    vy  = 2.0f * (filter->q0 * filter->q1 + filter->q2 * filter->q3);
+    vz  = filter->q0 * filter->q0 - filter->q1 * filter->q1 - filter->q2 * filter->q2 + filter->q3 * filter->q3;
+    // invSqrt() is approximate, so a field along gravity can land just past
+    // +-1, where asinf() returns NaN, which would pass the tolerance check.
+    dip = asinf(fminf(1.0f, fmaxf(-1.0f, -(mx * vx + my * vy + mz * vz) * invSqrt(n2))));
+    if (fabsf(dip - filter->mag_dip) > filter->mag_dip_tol) {
+      filter->mag_gated++;
+      return true;
+    }
+  }
+  return false;
+}
+
+static int64_t mgos_imu_madgwick_stats_start(const struct mgos_imu_madgwick *filter) {
+  if (!filter || !filter->stats) {
+    return 0;
+  }
+  return mgos_uptime_micros();
+}
+
+static void mgos_imu_madgwick_stats_fusion(struct mgos_imu_madgwick *filter, int64_t start) {
+  uint32_t us;
+
+  if (!filter || !filter->stats) {
+    return;
+  }
+  us = (uint32_t)(mgos_uptime_micros() - start);
+  filter->fusion_cycles++;
+  filter->fusion_us += us;
+  if (us > filter->fusion_max_us) {
+    filter->fusion_max_us = us;
+  }
+}
+
+static void mgos_imu_madgwick_stats_conversion(struct mgos_imu_madgwick *filter, int64_t start) {
+  if (!filter || !filter->stats) {
+    return;
+  }
+  filter->conversions++;
+  filter->conversion_us += (uint64_t)(mgos_uptime_micros() - start);
+}
+
 struct mgos_imu_madgwick *mgos_imu_madgwick_create(void) {
   struct mgos_imu_madgwick *filter;
 
@@ -72,16 +161,161 @@ bool mgos_imu_madgwick_reset(struct mgos_imu_madgwick *filter) {
   if (!filter) {
     return false;
   }
-  filter->q0      = 1.0f;
-  filter->q1      = 0.0f;
-  filter->q2      = 0.0f;
-  filter->q3      = 0.0f;
-  filter->counter = 0;
+  filter->q0          = 1.0f;
+  filter->q1          = 0.0f;
+  filter->q2          = 0.0f;
+  filter->q3          = 0.0f;
+  filter->counter     = 0;
+  filter->acc_counter = 0;
+  filter->mag_counter = 0;
+  filter->acc_gated   = 0;
+  filter->mag_gated   = 0;
+  return true;
+}
+
+bool mgos_imu_madgwick_init(struct mgos_imu_madgwick *filter, float ax, float ay, float az, float mx, float my, float mz) {
+  float recipNorm;
+  float nx, ny, nz, wx, wy, wz;
+  float r00, r01, r02, r10, r11, r12, r20, r21, r22;
+  float trace, s;
+
+  if (!filter) {
+    return false;
+  }
+  if ((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f)) {
+    return false;
+  }
+
+  // This runs once, so use sqrtf() rather than the approximate invSqrt(), whose
+  // error would otherwise show up as a few degrees of initial attitude error.
+
+  // Up: normalised accelerometer measurement
+  recipNorm = 1.0f / sqrtf(ax * ax + ay * ay + az * az);
+  ax       *= recipNorm;
+  ay       *= recipNorm;
+  az       *= recipNorm;
+
+  // Without a magnetometer, pick the sensor axis least aligned with up as the
+  // heading reference, which yields yaw=0.
+  if ((mx == 0.0f) && (my == 0.0f) && (mz == 0.0f)) {
+    if (fabsf(ax) < 0.9f) {
+      mx = 1.0f;
+    } else {
+      my = 1.0f;
+    }
+  }
+
+  // West: up x mag
+  wx        = ay * mz - az * my;
+  wy        = az * mx - ax * mz;
+  wz        = ax * my - ay * mx;
+  recipNorm = 1.0f / sqrtf(wx * wx + wy * wy + wz * wz);
+  wx       *= recipNorm;
+  wy       *= recipNorm;
+  wz       *= recipNorm;
+
+  // North: west x up
+  nx = wy * az - wz * ay;
+  ny = wz * ax - wx * az;
+  nz = wx * ay - wy * ax;
+
+  // Rows of the rotation matrix are the earth axes in sensor coordinates.
+  r00 = nx;
+  r01 = ny;
+  r02 = nz;
+  r10 = wx;
+  r11 = wy;
+  r12 = wz;
+  r20 = ax;
+  r21 = ay;
+  r22 = az;
+
+  trace = r00 + r11 + r22;
+  if (trace > 0.0f) {
+    s          = 0.5f / sqrtf(trace + 1.0f);
+    filter->q0 = 0.25f / s;
+    filter->q1 = (r21 - r12) * s;
+    filter->q2 = (r02 - r20) * s;
+    filter->q3 = (r10 - r01) * s;
+  } else if (r00 > r11 && r00 > r22) {
+    s          = 2.0f * sqrtf(1.0f + r00 - r11 - r22);
+    filter->q0 = (r21 - r12) / s;
+    filter->q1 = 0.25f * s;
+    filter->q2 = (r01 + r10) / s;
+    filter->q3 = (r02 + r20) / s;
+  } else if (r11 > r22) {
+    s          = 2.0f * sqrtf(1.0f + r11 - r00 - r22);
+    filter->q0 = (r02 - r20) / s;
+    filter->q1 = (r01 + r10) / s;
+    filter->q2 = 0.25f * s;
+    filter->q3 = (r12 + r21) / s;
+  } else {
+    s          = 2.0f * sqrtf(1.0f + r22 - r00 - r11);
+    filter->q0 = (r10 - r01) / s;
+    filter->q1 = (r02 + r20) / s;
+    filter->q2 = (r12 + r21) / s;
+    filter->q3 = 0.25f * s;
+  }
+
+  // Normalise quaternion
+  recipNorm           = 1.0f / sqrtf(filter->q0 * filter->q0 + filter->q1 * filter->q1 + filter->q2 * filter->q2 + filter->q3 * filter->q3);
+  filter->q0         *= recipNorm;
+  filter->q1         *= recipNorm;
+  filter->q2         *= recipNorm;
+  filter->q3         *= recipNorm;
+  filter->counter     = 0;
+  filter->acc_counter = 0;
+  filter->mag_counter = 0;
+  filter->acc_gated   = 0;
+  filter->mag_gated   = 0;
+  return true;
+}
+
+bool mgos_imu_madgwick_set_acc_gating(struct mgos_imu_madgwick *filter, float norm, float tolerance) {
+  if (!filter) {
+    return false;
+  }
+  filter->acc_norm     = norm;
+  filter->acc_norm_tol = tolerance;
+  return true;
+}
+
+bool mgos_imu_madgwick_set_mag_gating(struct mgos_imu_madgwick *filter, float norm, float norm_tolerance, float dip, float dip_tolerance) {
+  if (!filter) {
+    return false;
+  }
+  filter->mag_norm     = norm;
+  filter->mag_norm_tol = norm_tolerance;
+  filter->mag_dip      = dip;
+  filter->mag_dip_tol  = dip_tolerance;
+  return true;
+}
+
+bool mgos_imu_madgwick_get_gated(struct mgos_imu_madgwick *filter, uint32_t *acc_gated, uint32_t *mag_gated) {
+  if (!filter) {
+    return false;
+  }
+  if (acc_gated) {
+    *acc_gated = filter->acc_gated;
+  }
+  if (mag_gated) {
+    *mag_gated = filter->mag_gated;
+  }
+  return true;
+}
+
+bool mgos_imu_madgwick_set_beta_schedule(struct mgos_imu_madgwick *filter, float beta_init, uint32_t count) {
+  if (!filter) {
+    return false;
+  }
+  filter->beta_init       = beta_init;
+  filter->beta_init_count = count;
   return true;
 }
 
 static bool mgos_imu_madgwick_updateIMU(struct mgos_imu_madgwick *filter, float gx, float gy, float gz, float ax, float ay, float az) {
   float recipNorm;
+  float beta;
   float s0, s1, s2, s3;
   float qDot1, qDot2, qDot3, qDot4;
   float _2q0, _2q1, _2q2, _2q3, _4q0, _4q1, _4q2, _8q1, _8q2, q0q0, q1q1, q2q2, q3q3;
@@ -129,10 +363,11 @@ static bool mgos_imu_madgwick_updateIMU(struct mgos_imu_madgwick *filter, float
     s3       *= recipNorm;
 
     // Apply feedback step
-    qDot1 -= filter->beta * s0;
-    qDot2 -= filter->beta * s1;
-    qDot3 -= filter->beta * s2;
-    qDot4 -= filter->beta * s3;
+    beta   = mgos_imu_madgwick_beta(filter);
+    qDot1 -= beta * s0;
+    qDot2 -= beta * s1;
+    qDot3 -= beta * s2;
+    qDot4 -= beta * s3;
   }
 
   // Integrate rate of change of quaternion to yield quaternion
@@ -152,16 +387,25 @@ static bool mgos_imu_madgwick_updateIMU(struct mgos_imu_madgwick *filter, float
   return true;
 }
 
-bool mgos_imu_madgwick_update(struct mgos_imu_madgwick *filter, float gx, float gy, float gz, float ax, float ay, float az, float mx, float my, float mz) {
+static bool mgos_imu_madgwick_update_step(struct mgos_imu_madgwick *filter, float gx, float gy, float gz, float ax, float ay, float az, float mx, float my, float mz) {
   if (!filter) {
     return false;
   }
   float recipNorm;
+  float beta;
   float s0, s1, s2, s3;
   float qDot1, qDot2, qDot3, qDot4;
   float hx, hy;
   float _2q0mx, _2q0my, _2q0mz, _2q1mx, _2bx, _2bz, _4bx, _4bz, _2q0, _2q1, _2q2, _2q3, _2q0q2, _2q2q3, q0q0, q0q1, q0q2, q0q3, q1q1, q1q2, q1q3, q2q2, q2q3, q3q3;
 
+  // Gated samples are treated as missing
+  if (!((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f)) && mgos_imu_madgwick_acc_gated(filter, ax, ay, az)) {
+    ax = ay = az = 0.0f;
+  }
+  if (!((mx == 0.0f) && (my == 0.0f) && (mz == 0.0f)) && mgos_imu_madgwick_mag_gated(filter, mx, my, mz)) {
+    mx = my = mz = 0.0f;
+  }
+
   // Use IMU algorithm if magnetometer measurement invalid (avoids NaN in magnetometer normalisation)
   if ((mx == 0.0f) && (my == 0.0f) && (mz == 0.0f)) {
     mgos_imu_madgwick_updateIMU(filter, gx, gy, gz, ax, ay, az);
@@ -230,10 +474,11 @@ bool mgos_imu_madgwick_update(struct mgos_imu_madgwick *filter, float gx, float
     s3       *= recipNorm;
 
     // Apply feedback step
-    qDot1 -= filter->beta * s0;
-    qDot2 -= filter->beta * s1;
-    qDot3 -= filter->beta * s2;
-    qDot4 -= filter->beta * s3;
+    beta   = mgos_imu_madgwick_beta(filter);
+    qDot1 -= beta * s0;
+    qDot2 -= beta * s1;
+    qDot3 -= beta * s2;
+    qDot4 -= beta * s3;
   }
 
   // Integrate rate of change of quaternion to yield quaternion
@@ -253,6 +498,218 @@ bool mgos_imu_madgwick_update(struct mgos_imu_madgwick *filter, float gx, float
   return true;
 }
 
+bool mgos_imu_madgwick_update(struct mgos_imu_madgwick *filter, float gx, float gy, float gz, float ax, float ay, float az, float mx, float my, float mz) {
+  int64_t start = mgos_imu_madgwick_stats_start(filter);
+  bool    ret   = mgos_imu_madgwick_update_step(filter, gx, gy, gz, ax, ay, az, mx, my, mz);
+
+  mgos_imu_madgwick_stats_fusion(filter, start);
+  return ret;
+}
+
+// Apply a normalised gradient step, scaled by beta and the time since the last
+// correction of this kind, and renormalise the Quaternion.
+static void mgos_imu_madgwick_apply_step(struct mgos_imu_madgwick *filter, uint32_t *last_counter, float s0, float s1, float s2, float s3) {
+  float recipNorm;
+  float step;
+  float dt;
+
+  recipNorm = invSqrt(s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3);             // normalise step magnitude
+  if (filter->counter == *last_counter) {
+    dt = filter->inv_freq;
+  } else {
+    dt = (float)(filter->counter - *last_counter) * filter->inv_freq;
+  }
+  // Don't let a long gap (the first correction, or a stalled sensor) turn into
+  // one huge step.
+  if (dt > 0.25f) {
+    dt = 0.25f;
+  }
+  *last_counter = filter->counter;
+  step          = mgos_imu_madgwick_beta(filter) * dt * recipNorm;
+
+  filter->q0 -= step * s0;
+  filter->q1 -= step * s1;
+  filter->q2 -= step * s2;
+  filter->q3 -= step * s3;
+
+  // Normalise quaternion
+  recipNorm   = invSqrt(filter->q0 * filter->q0 + filter->q1 * filter->q1 + filter->q2 * filter->q2 + filter->q3 * filter->q3);
+  filter->q0 *= recipNorm;
+  filter->q1 *= recipNorm;
+  filter->q2 *= recipNorm;
+  filter->q3 *= recipNorm;
+}
+
+static bool mgos_imu_madgwick_predict_step(struct mgos_imu_madgwick *filter, float gx, float gy, float gz) {
+  float recipNorm;
+  float qDot1, qDot2, qDot3, qDot4;
+
+  if (!filter) {
+    return false;
+  }
+
+  // Rate of change of quaternion from gyroscope
+  qDot1 = 0.5f * (-filter->q1 * gx - filter->q2 * gy - filter->q3 * gz);
+  qDot2 = 0.5f * (filter->q0 * gx + filter->q2 * gz - filter->q3 * gy);
+  qDot3 = 0.5f * (filter->q0 * gy - filter->q1 * gz + filter->q3 * gx);
+  qDot4 = 0.5f * (filter->q0 * gz + filter->q1 * gy - filter->q2 * gx);
+
+  // Integrate rate of change of quaternion to yield quaternion
+  filter->q0 += qDot1 * filter->inv_freq;
+  filter->q1 += qDot2 * filter->inv_freq;
+  filter->q2 += qDot3 * filter->inv_freq;
+  filter->q3 += qDot4 * filter->inv_freq;
+
+  // Normalise quaternion
+  recipNorm   = invSqrt(filter->q0 * filter->q0 + filter->q1 * filter->q1 + filter->q2 * filter->q2 + filter->q3 * filter->q3);
+  filter->q0 *= recipNorm;
+  filter->q1 *= recipNorm;
+  filter->q2 *= recipNorm;
+  filter->q3 *= recipNorm;
+
+  filter->counter++;
+  return true;
+}
+
+bool mgos_imu_madgwick_predict(struct mgos_imu_madgwick *filter, float gx, float gy, float gz) {
+  int64_t start = mgos_imu_madgwick_stats_start(filter);
+  bool    ret   = mgos_imu_madgwick_predict_step(filter, gx, gy, gz);
+
+  mgos_imu_madgwick_stats_fusion(filter, start);
+  return ret;
+}
+
+static bool mgos_imu_madgwick_correct_acc_step(struct mgos_imu_madgwick *filter, float ax, float ay, float az) {
+  float recipNorm;
+  float s0, s1, s2, s3;
+  float _2q0, _2q1, _2q2, _2q3, _4q0, _4q1, _4q2, _8q1, _8q2, q0q0, q1q1, q2q2, q3q3;
+
+  if (!filter) {
+    return false;
+  }
+  if ((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f)) {
+    return false;
+  }
+  if (mgos_imu_madgwick_acc_gated(filter, ax, ay, az)) {
+    return false;
+  }
+
+  // Normalise accelerometer measurement
+  recipNorm = invSqrt(ax * ax + ay * ay + az * az);
+  ax       *= recipNorm;
+  ay       *= recipNorm;
+  az       *= recipNorm;
+
+  // Auxiliary variables to avoid repeated arithmetic
+  _2q0 = 2.0f * filter->q0;
+  _2q1 = 2.0f * filter->q1;
+  _2q2 = 2.0f * filter->q2;
+  _2q3 = 2.0f * filter->q3;
+  _4q0 = 4.0f * filter->q0;
+  _4q1 = 4.0f * filter->q1;
+  _4q2 = 4.0f * filter->q2;
+  _8q1 = 8.0f * filter->q1;
+  _8q2 = 8.0f * filter->q2;
+  q0q0 = filter->q0 * filter->q0;
+  q1q1 = filter->q1 * filter->q1;
+  q2q2 = filter->q2 * filter->q2;
+  q3q3 = filter->q3 * filter->q3;
+
+  // Gradient decent algorithm corrective step
+  s0 = _4q0 * q2q2 + _2q2 * ax + _4q0 * q1q1 - _2q1 * ay;
+  s1 = _4q1 * q3q3 - _2q3 * ax + 4.0f * q0q0 * filter->q1 - _2q0 * ay - _4q1 + _8q1 * q1q1 + _8q1 * q2q2 + _4q1 * az;
+  s2 = 4.0f * q0q0 * filter->q2 + _2q0 * ax + _4q2 * q3q3 - _2q3 * ay - _4q2 + _8q2 * q1q1 + _8q2 * q2q2 + _4q2 * az;
+  s3 = 4.0f * q1q1 * filter->q3 - _2q1 * ax + 4.0f * q2q2 * filter->q3 - _2q2 * ay;
+  if ((s0 == 0.0f) && (s1 == 0.0f) && (s2 == 0.0f) && (s3 == 0.0f)) {
+    filter->acc_counter = filter->counter;
+    return true;
+  }
+
+  mgos_imu_madgwick_apply_step(filter, &filter->acc_counter, s0, s1, s2, s3);
+  return true;
+}
+
+bool mgos_imu_madgwick_correct_acc(struct mgos_imu_madgwick *filter, float ax, float ay, float az) {
+  int64_t start = mgos_imu_madgwick_stats_start(filter);
+  bool    ret   = mgos_imu_madgwick_correct_acc_step(filter, ax, ay, az);
+
+  mgos_imu_madgwick_stats_fusion(filter, start);
+  return ret;
+}
+
+static bool mgos_imu_madgwick_correct_mag_step(struct mgos_imu_madgwick *filter, float mx, float my, float mz) {
+  float recipNorm;
+  float s0, s1, s2, s3;
+  float hx, hy, fx, fy, fz;
+  float _2q0mx, _2q0my, _2q0mz, _2q1mx, _2bx, _2bz, _4bx, _4bz, _2q1, _2q2, q0q0, q0q1, q0q2, q0q3, q1q1, q1q2, q1q3, q2q2, q2q3, q3q3;
+
+  if (!filter) {
+    return false;
+  }
+  if ((mx == 0.0f) && (my == 0.0f) && (mz == 0.0f)) {
+    return false;
+  }
+  if (mgos_imu_madgwick_mag_gated(filter, mx, my, mz)) {
+    return false;
+  }
+
+  // Normalise magnetometer measurement
+  recipNorm = invSqrt(mx * mx + my * my + mz * mz);
+  mx       *= recipNorm;
+  my       *= recipNorm;
+  mz       *= recipNorm;
+
+  // Auxiliary variables to avoid repeated arithmetic
+  _2q0mx = 2.0f * filter->q0 * mx;
+  _2q0my = 2.0f * filter->q0 * my;
+  _2q0mz = 2.0f * filter->q0 * mz;
+  _2q1mx = 2.0f * filter->q1 * mx;
+  _2q1   = 2.0f * filter->q1;
+  _2q2   = 2.0f * filter->q2;
+  q0q0   = filter->q0 * filter->q0;
+  q0q1   = filter->q0 * filter->q1;
+  q0q2   = filter->q0 * filter->q2;
+  q0q3   = filter->q0 * filter->q3;
+  q1q1   = filter->q1 * filter->q1;
+  q1q2   = filter->q1 * filter->q2;
+  q1q3   = filter->q1 * filter->q3;
+  q2q2   = filter->q2 * filter->q2;
+  q2q3   = filter->q2 * filter->q3;
+  q3q3   = filter->q3 * filter->q3;
+
+  // Reference direction of Earth's magnetic field
+  hx   = mx * q0q0 - _2q0my * filter->q3 + _2q0mz * filter->q2 + mx * q1q1 + _2q1 * my * filter->q2 + _2q1 * mz * filter->q3 - mx * q2q2 - mx * q3q3;
+  hy   = _2q0mx * filter->q3 + my * q0q0 - _2q0mz * filter->q1 + _2q1mx * filter->q2 - my * q1q1 + my * q2q2 + _2q2 * mz * filter->q3 - my * q3q3;
+  _2bx = sqrtf(hx * hx + hy * hy);
+  _2bz = -_2q0mx * filter->q2 + _2q0my * filter->q1 + mz * q0q0 + _2q1mx * filter->q3 - mz * q1q1 + _2q2 * my * filter->q3 - mz * q2q2 + mz * q3q3;
+  _4bx = 2.0f * _2bx;
+  _4bz = 2.0f * _2bz;
+
+  // Magnetometer part of the gradient decent algorithm corrective step
+  fx = _2bx * (0.5f - q2q2 - q3q3) + _2bz * (q1q3 - q0q2) - mx;
+  fy = _2bx * (q1q2 - q0q3) + _2bz * (q0q1 + q2q3) - my;
+  fz = _2bx * (q0q2 + q1q3) + _2bz * (0.5f - q1q1 - q2q2) - mz;
+  s0 = -_2bz * filter->q2 * fx + (-_2bx * filter->q3 + _2bz * filter->q1) * fy + _2bx * filter->q2 * fz;
+  s1 = _2bz * filter->q3 * fx + (_2bx * filter->q2 + _2bz * filter->q0) * fy + (_2bx * filter->q3 - _4bz * filter->q1) * fz;
+  s2 = (-_4bx * filter->q2 - _2bz * filter->q0) * fx + (_2bx * filter->q1 + _2bz * filter->q3) * fy + (_2bx * filter->q0 - _4bz * filter->q2) * fz;
+  s3 = (-_4bx * filter->q3 + _2bz * filter->q1) * fx + (-_2bx * filter->q0 + _2bz * filter->q2) * fy + _2bx * filter->q1 * fz;
+  if ((s0 == 0.0f) && (s1 == 0.0f) && (s2 == 0.0f) && (s3 == 0.0f)) {
+    filter->mag_counter = filter->counter;
+    return true;
+  }
+
+  mgos_imu_madgwick_apply_step(filter, &filter->mag_counter, s0, s1, s2, s3);
+  return true;
+}
+
+bool mgos_imu_madgwick_correct_mag(struct mgos_imu_madgwick *filter, float mx, float my, float mz) {
+  int64_t start = mgos_imu_madgwick_stats_start(filter);
+  bool    ret   = mgos_imu_madgwick_correct_mag_step(filter, mx, my, mz);
+
+  mgos_imu_madgwick_stats_fusion(filter, start);
+  return ret;
+}
+
 bool mgos_imu_madgwick_get_quaternion(struct mgos_imu_madgwick *filter, float *q0, float *q1, float *q2, float *q3) {
   if (!filter) {
     return false;
@@ -272,7 +729,7 @@ bool mgos_imu_madgwick_get_quaternion(struct mgos_imu_madgwick *filter, float *q
   return true;
 }
 
-bool mgos_imu_madgwick_get_angles(struct mgos_imu_madgwick *filter, float *roll, float *pitch, float *yaw) {
+static bool mgos_imu_madgwick_get_angles_step(struct mgos_imu_madgwick *filter, float *roll, float *pitch, float *yaw) {
   if (!filter) {
     return false;
   }
@@ -288,6 +745,14 @@ bool mgos_imu_madgwick_get_angles(struct mgos_imu_madgwick *filter, float *roll,
   return true;
 }
 
+bool mgos_imu_madgwick_get_angles(struct mgos_imu_madgwick *filter, float *roll, float *pitch, float *yaw) {
+  int64_t start = mgos_imu_madgwick_stats_start(filter);
+  bool    ret   = mgos_imu_madgwick_get_angles_step(filter, roll, pitch, yaw);
+
+  mgos_imu_madgwick_stats_conversion(filter, start);
+  return ret;
+}
+
 bool mgos_imu_madgwick_get_counter(struct mgos_imu_madgwick *filter, uint32_t *counter) {
   if (!filter || !counter) {
     return false;
@@ -29,6 +29,24 @@ struct mgos_imu_madgwick {
   float    freq;
   float    inv_freq;
   uint32_t counter;
+  float    beta_init;
+  uint32_t beta_init_count;
+  uint32_t acc_counter;
+  uint32_t mag_counter;
+  float    acc_norm;
+  float    acc_norm_tol;
+  float    mag_norm;
+  float    mag_norm_tol;
+  float    mag_dip;
+  float    mag_dip_tol;
+  uint32_t acc_gated;
+  uint32_t mag_gated;
+  bool     stats;
+  uint32_t fusion_cycles;
+  uint32_t fusion_max_us;
+  uint64_t fusion_us;
+  uint32_t conversions;
+  uint64_t conversion_us;
 };
 
 /* Create a new filter and initialize it by resetting the Quaternion and setting
@@ -51,6 +69,24 @@ bool mgos_imu_madgwick_set_params(struct mgos_imu_madgwick *filter, float freque
  */
 bool mgos_imu_madgwick_reset(struct mgos_imu_madgwick *filter);
 
+/* Initializes the filter Quaternion directly from an accelerometer and
+ * magnetometer sample (TRIAD), so that the filter starts out at the true
+ * attitude instead of converging to it from {1,0,0,0}. Units are the same as
+ * for `mgos_imu_madgwick_update()`, and an average of a few samples may be
+ * passed in to reduce noise. The inputs of mx/my/mz can be passed as 0.0, in
+ * which case only roll and pitch are initialized, with yaw set to zero.
+ * The filter counter is reset, which restarts the beta schedule (see below).
+ * Returns true on success, false if the accelerometer sample is all zeros.
+ */
+bool mgos_imu_madgwick_init(struct mgos_imu_madgwick *filter, float ax, float ay, float az, float mx, float my, float mz);
+
+/* Sets a gain schedule: the first `count` updates after a reset or init use
+ * `beta_init` (typically much larger than the gain given to set_params(), eg
+ * 2.5), after which the configured gain is used. A count of 0 disables the
+ * schedule, which is the default.
+ */
+bool mgos_imu_madgwick_set_beta_schedule(struct mgos_imu_madgwick *filter, float beta_init, uint32_t count);
+
 /* Run an update cycle on the filter. Inputs gx/gy/gz are in any calibrated input (for example,
  * m/s/s or G), inputs of ax/ay/az are in Rads/sec, inputs of mx/my/mz are in any calibrated
  * input (for example, uTesla or Gauss). The inputs of mx/my/mz can be passed as 0.0, in which
@@ -59,6 +95,41 @@ bool mgos_imu_madgwick_reset(struct mgos_imu_madgwick *filter);
  */
 bool mgos_imu_madgwick_update(struct mgos_imu_madgwick *filter, float gx, float gy, float gz, float ax, float ay, float az, float mx, float my, float mz);
 
+/* Split form of `mgos_imu_madgwick_update()`, for sensors running at different
+ * rates. `mgos_imu_madgwick_predict()` propagates the Quaternion with a gyroscope
+ * sample only, and is cheap enough to run at gyroscope rate; it is expected to be
+ * called at `freq` per second and increments the filter counter. The correction
+ * functions run the gradient descent step for a single sensor, and should be
+ * called only when that sensor delivered a fresh sample. Their step is scaled by
+ * the time since the previous correction of the same kind, so the effective gain
+ * does not depend on the sensor rate. Units are as for `mgos_imu_madgwick_update()`.
+ * Returns true on success, false on failure or if the sample is all zeros or
+ * gated (see below).
+ */
+bool mgos_imu_madgwick_predict(struct mgos_imu_madgwick *filter, float gx, float gy, float gz);
+bool mgos_imu_madgwick_correct_acc(struct mgos_imu_madgwick *filter, float ax, float ay, float az);
+bool mgos_imu_madgwick_correct_mag(struct mgos_imu_madgwick *filter, float mx, float my, float mz);
+
+/* Measurement gating. Accelerometer samples whose magnitude differs from `norm`
+ * (eg 1.0 for G) by more than `tolerance` are not used for correction, as they
+ * are dominated by linear acceleration. Likewise magnetometer samples whose
+ * magnitude differs from `norm` by more than `norm_tolerance`, or whose dip
+ * angle (in Radians, positive when the field points down into the earth)
+ * differs from `dip` by more than `dip_tolerance`, are not used, as they are
+ * likely disturbed. A tolerance of 0 disables that check, which is the default.
+ * Gated samples fall back to the gyroscope-only path: `mgos_imu_madgwick_update()`
+ * ignores the gated sensor, and the correction functions return false.
+ */
+bool mgos_imu_madgwick_set_acc_gating(struct mgos_imu_madgwick *filter, float norm, float tolerance);
+bool mgos_imu_madgwick_set_mag_gating(struct mgos_imu_madgwick *filter, float norm, float norm_tolerance, float dip, float dip_tolerance);
+
+/*
+ * Returns the number of accelerometer and magnetometer samples that were gated
+ * since the last reset or init. Either pointer may be NULL.
+ * Returns true on success, false in case of error.
+ */
+bool mgos_imu_madgwick_get_gated(struct mgos_imu_madgwick *filter, uint32_t *acc_gated, uint32_t *mag_gated);
+
 /*
  * Returns AHRS Quaternion, as values between -1.0 and +1.0.
  * Each of q0, q1, q2, q3 pointers may be NULL, in which case they will not be
@@ -78,8 +149,8 @@ bool mgos_imu_madgwick_get_quaternion(struct mgos_imu_madgwick *filter, float *q
 bool mgos_imu_madgwick_get_angles(struct mgos_imu_madgwick *filter, float *roll, float *pitch, float *yaw);
 
 /*
- * Returns filter counter. Each call to `mgos_imu_madgwick_update()` increments the
- * counter by one.
+ * Returns filter counter. Each call to `mgos_imu_madgwick_update()` or
+ * `mgos_imu_madgwick_predict()` increments the counter by one.
  * Returns true on success, false in case of error, in which case the value of
  * counter is undetermined.
  */
@@ -0,0 +1,545 @@
+//=============================================================================================
+// madgwick_batch.c
+//=============================================================================================
+//
+// Structure-of-arrays variant of madgwick.c. The arithmetic follows
+// mgos_imu_madgwick_update() and mgos_imu_madgwick_updateIMU() step by step,
+// including the fast inverse square-root, so results match the scalar filter.
+// Instead of branching on missing accelerometer or magnetometer data, all
+// paths are computed and the result is selected per lane.
+//
+//=============================================================================================
+#include "madgwick_batch.h"
+
+#if defined(MGOS_IMU_MADGWICK_BATCH_NO_SIMD)
+#define MADGWICK_BATCH_SCALAR
+#elif defined(__AVX2__)
+#define MADGWICK_BATCH_AVX2
+#elif defined(__SSE2__)
+#define MADGWICK_BATCH_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define MADGWICK_BATCH_NEON
+#else
+#define MADGWICK_BATCH_SCALAR
+#endif
+
+//-------------------------------------------------------------------------------------------
+// Vector primitives: vf is a vector of floats, vm a per-lane mask.
+
+#if defined(MADGWICK_BATCH_AVX2)
+#include <immintrin.h>
+#define VF_WIDTH    8
+typedef __m256   vf;
+typedef __m256   vm;
+
+static inline vf vf_set1(float x) {
+  return _mm256_set1_ps(x);
+}
+static inline vf vf_load(const float *p) {
+  return _mm256_loadu_ps(p);
+}
+static inline void vf_store(float *p, vf a) {
+  _mm256_storeu_ps(p, a);
+}
+static inline vf vf_add(vf a, vf b) {
+  return _mm256_add_ps(a, b);
+}
+static inline vf vf_sub(vf a, vf b) {
+  return _mm256_sub_ps(a, b);
+}
+static inline vf vf_mul(vf a, vf b) {
+  return _mm256_mul_ps(a, b);
+}
+static inline vf vf_sqrt(vf a) {
+  return _mm256_sqrt_ps(a);
+}
+static inline vm vf_eqz(vf a) {
+  return _mm256_cmp_ps(a, _mm256_setzero_ps(), _CMP_EQ_OQ);
+}
+static inline vm vm_and(vm a, vm b) {
+  return _mm256_and_ps(a, b);
+}
+static inline vm vm_andnot(vm a, vm b) {
+  return _mm256_andnot_ps(a, b);
+}
+static inline bool vm_any(vm a) {
+  return _mm256_movemask_ps(a) != 0;
+}
+static inline vf vf_select(vm m, vf a, vf b) {
+  return _mm256_blendv_ps(b, a, m);
+}
+static inline vf vf_invsqrt_bits(vf a) {
+  __m256i i = _mm256_castps_si256(a);
+
+  i = _mm256_sub_epi32(_mm256_set1_epi32(0x5f3759df), _mm256_srli_epi32(i, 1));
+  return _mm256_castsi256_ps(i);
+}
+
+#elif defined(MADGWICK_BATCH_SSE2)
+#include <emmintrin.h>
+#define VF_WIDTH    4
+typedef __m128   vf;
+typedef __m128   vm;
+
+static inline vf vf_set1(float x) {
+  return _mm_set1_ps(x);
+}
+static inline vf vf_load(const float *p) {
+  return _mm_loadu_ps(p);
+}
+static inline void vf_store(float *p, vf a) {
+  _mm_storeu_ps(p, a);
+}
+static inline vf vf_add(vf a, vf b) {
+  return _mm_add_ps(a, b);
+}
+static inline vf vf_sub(vf a, vf b) {
+  return _mm_sub_ps(a, b);
+}
+static inline vf vf_mul(vf a, vf b) {
+  return _mm_mul_ps(a, b);
+}
+static inline vf vf_sqrt(vf a) {
+  return _mm_sqrt_ps(a);
+}
+static inline vm vf_eqz(vf a) {
+  return _mm_cmpeq_ps(a, _mm_setzero_ps());
+}
+static inline vm vm_and(vm a, vm b) {
+  return _mm_and_ps(a, b);
+}
+static inline vm vm_andnot(vm a, vm b) {
+  return _mm_andnot_ps(a, b);
+}
+static inline bool vm_any(vm a) {
+  return _mm_movemask_ps(a) != 0;
+}
+static inline vf vf_select(vm m, vf a, vf b) {
+  return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b));
+}
+static inline vf vf_invsqrt_bits(vf a) {
+  __m128i i = _mm_castps_si128(a);
+
+  i = _mm_sub_epi32(_mm_set1_epi32(0x5f3759df), _mm_srli_epi32(i, 1));
+  return _mm_castsi128_ps(i);
+}
+
+#elif defined(MADGWICK_BATCH_NEON)
+#include <arm_neon.h>
+#define VF_WIDTH    4
+typedef float32x4_t   vf;
+typedef uint32x4_t    vm;
+
+static inline vf vf_set1(float x) {
+  return vdupq_n_f32(x);
+}
+static inline vf vf_load(const float *p) {
+  return vld1q_f32(p);
+}
+static inline void vf_store(float *p, vf a) {
+  vst1q_f32(p, a);
+}
+static inline vf vf_add(vf a, vf b) {
+  return vaddq_f32(a, b);
+}
+static inline vf vf_sub(vf a, vf b) {
+  return vsubq_f32(a, b);
+}
+static inline vf vf_mul(vf a, vf b) {
+  return vmulq_f32(a, b);
+}
+static inline vf vf_sqrt(vf a) {
+  return vsqrtq_f32(a);
+}
+static inline vm vf_eqz(vf a) {
+  return vceqq_f32(a, vdupq_n_f32(0.0f));
+}
+static inline vm vm_and(vm a, vm b) {
+  return vandq_u32(a, b);
+}
+static inline vm vm_andnot(vm a, vm b) {
+  return vbicq_u32(b, a);
+}
+static inline bool vm_any(vm a) {
+  return vmaxvq_u32(a) != 0;
+}
+static inline vf vf_select(vm m, vf a, vf b) {
+  return vbslq_f32(m, a, b);
+}
+static inline vf vf_invsqrt_bits(vf a) {
+  uint32x4_t i = vreinterpretq_u32_f32(a);
+
+  i = vsubq_u32(vdupq_n_u32(0x5f3759df), vshrq_n_u32(i, 1));
+  return vreinterpretq_f32_u32(i);
+}
+
+#else
+#define VF_WIDTH    1
+typedef float   vf;
+typedef bool    vm;
+
+static inline vf vf_set1(float x) {
+  return x;
+}
+static inline vf vf_load(const float *p) {
+  return *p;
+}
+static inline void vf_store(float *p, vf a) {
+  *p = a;
+}
+static inline vf vf_add(vf a, vf b) {
+  return a + b;
+}
+static inline vf vf_sub(vf a, vf b) {
+  return a - b;
+}
+static inline vf vf_mul(vf a, vf b) {
+  return a * b;
+}
+static inline vf vf_sqrt(vf a) {
+  return sqrtf(a);
+}
+static inline vm vf_eqz(vf a) {
+  return a == 0.0f;
+}
+static inline vm vm_and(vm a, vm b) {
+  return a && b;
+}
+static inline vm vm_andnot(vm a, vm b) {
+  return !a && b;
+}
+static inline bool vm_any(vm a) {
+  return a;
+}
+static inline vf vf_select(vm m, vf a, vf b) {
+  return m ? a : b;
+}
+static inline vf vf_invsqrt_bits(vf a) {
+  union {
+    float    f;
+    uint32_t i;
+  } conv;
+
+  conv.f = a;
+  conv.i = 0x5f3759df - (conv.i >> 1);
+  return conv.f;
+}
+#endif
+
+// Fast inverse square-root, same steps as invSqrt() in madgwick.c
+static inline vf vf_invsqrt(vf x) {
+  vf x2 = vf_mul(x, vf_set1(0.5F));
+  vf y  = vf_invsqrt_bits(x);
+
+  return vf_mul(y, vf_sub(vf_set1(1.5F), vf_mul(vf_mul(x2, y), y)));
+}
+
+#define ADD(a, b)    vf_add((a), (b))
+#define SUB(a, b)    vf_sub((a), (b))
+#define MUL(a, b)    vf_mul((a), (b))
+
+//-------------------------------------------------------------------------------------------
+// Batch management
+
+struct mgos_imu_madgwick_batch *mgos_imu_madgwick_batch_create(size_t n) {
+  struct mgos_imu_madgwick_batch *batch;
+  size_t stride;
+
+  if (n == 0) {
+    return NULL;
+  }
+  batch = calloc(1, sizeof(struct mgos_imu_madgwick_batch));
+  if (!batch) {
+    return NULL;
+  }
+  stride                 = (n + VF_WIDTH - 1) / VF_WIDTH * VF_WIDTH;
+  batch->n               = n;
+  batch->stride          = stride;
+  batch->beta            = calloc(stride, sizeof(float));
+  batch->beta_init       = calloc(stride, sizeof(float));
+  batch->beta_init_count = calloc(stride, sizeof(uint32_t));
+  batch->q0              = calloc(stride, sizeof(float));
+  batch->q1              = calloc(stride, sizeof(float));
+  batch->q2              = calloc(stride, sizeof(float));
+  batch->q3              = calloc(stride, sizeof(float));
+  batch->inv_freq        = calloc(stride, sizeof(float));
+  batch->counter         = calloc(stride, sizeof(uint32_t));
+  if (!batch->beta || !batch->beta_init || !batch->beta_init_count || !batch->q0 || !batch->q1 ||
+      !batch->q2 || !batch->q3 || !batch->inv_freq || !batch->counter) {
+    mgos_imu_madgwick_batch_destroy(&batch);
+    return NULL;
+  }
+
+  // Same defaults as mgos_imu_madgwick_create(), also for the padding lanes.
+  for (size_t i = 0; i < stride; i++) {
+    batch->beta[i]     = 0.1f;
+    batch->inv_freq[i] = 1.0f / 100.0f;
+    batch->q0[i]       = 1.0f;
+  }
+  return batch;
+}
+
+bool mgos_imu_madgwick_batch_destroy(struct mgos_imu_madgwick_batch **batch) {
+  if (!*batch) {
+    return false;
+  }
+  free((*batch)->beta);
+  free((*batch)->beta_init);
+  free((*batch)->beta_init_count);
+  free((*batch)->q0);
+  free((*batch)->q1);
+  free((*batch)->q2);
+  free((*batch)->q3);
+  free((*batch)->inv_freq);
+  free((*batch)->counter);
+  free(*batch);
+  *batch = NULL;
+  return true;
+}
+
+bool mgos_imu_madgwick_batch_set(struct mgos_imu_madgwick_batch *batch, size_t i, const struct mgos_imu_madgwick *filter) {
+  if (!batch || !filter || i >= batch->n) {
+    return false;
+  }
+  batch->beta[i]            = filter->beta;
+  batch->beta_init[i]       = filter->beta_init;
+  batch->beta_init_count[i] = filter->beta_init_count;
+  batch->q0[i]              = filter->q0;
+  batch->q1[i]              = filter->q1;
+  batch->q2[i]              = filter->q2;
+  batch->q3[i]              = filter->q3;
+  batch->inv_freq[i]        = filter->inv_freq;
+  batch->counter[i]         = filter->counter;
+  return true;
+}
+
+bool mgos_imu_madgwick_batch_get(struct mgos_imu_madgwick_batch *batch, size_t i, struct mgos_imu_madgwick *filter) {
+  if (!batch || !filter || i >= batch->n) {
+    return false;
+  }
+  filter->beta            = batch->beta[i];
+  filter->beta_init       = batch->beta_init[i];
+  filter->beta_init_count = batch->beta_init_count[i];
+  filter->q0              = batch->q0[i];
+  filter->q1              = batch->q1[i];
+  filter->q2              = batch->q2[i];
+  filter->q3              = batch->q3[i];
+  filter->inv_freq        = batch->inv_freq[i];
+  filter->freq            = 1.0f / batch->inv_freq[i];
+  filter->counter         = batch->counter[i];
+  return true;
+}
+
+size_t mgos_imu_madgwick_batch_width(void) {
+  return VF_WIDTH;
+}
+
+//-------------------------------------------------------------------------------------------
+// Update
+
+// Normalise a 4-vector in place.
+static inline void vf_normalise4(vf *a, vf *b, vf *c, vf *d) {
+  vf recipNorm = vf_invsqrt(ADD(ADD(ADD(MUL(*a, *a), MUL(*b, *b)), MUL(*c, *c)), MUL(*d, *d)));
+
+  *a = MUL(*a, recipNorm);
+  *b = MUL(*b, recipNorm);
+  *c = MUL(*c, recipNorm);
+  *d = MUL(*d, recipNorm);
+}
+
+// Update VF_WIDTH filters starting at `base`. Inputs point at VF_WIDTH floats.
+static void mgos_imu_madgwick_batch_step(struct mgos_imu_madgwick_batch *batch, size_t base, const float *in[9], const float *beta_now) {
+  vf q0 = vf_load(batch->q0 + base), q1 = vf_load(batch->q1 + base);
+  vf q2 = vf_load(batch->q2 + base), q3 = vf_load(batch->q3 + base);
+  vf gx = vf_load(in[0]), gy = vf_load(in[1]), gz = vf_load(in[2]);
+  vf ax = vf_load(in[3]), ay = vf_load(in[4]), az = vf_load(in[5]);
+  vf mx = vf_load(in[6]), my = vf_load(in[7]), mz = vf_load(in[8]);
+  vf beta = vf_load(beta_now), inv_freq = vf_load(batch->inv_freq + base);
+  vf half = vf_set1(0.5f), two = vf_set1(2.0f), four = vf_set1(4.0f), eight = vf_set1(8.0f);
+  vf qDot1, qDot2, qDot3, qDot4;
+  vf s0, s1, s2, s3, i0, i1, i2, i3;
+  vf recipNorm;
+  vf _2q0, _2q1, _2q2, _2q3, q0q0, q1q1, q2q2, q3q3;
+  vm acc_zero, mag_zero, marg;
+
+  acc_zero = vm_and(vm_and(vf_eqz(ax), vf_eqz(ay)), vf_eqz(az));
+  mag_zero = vm_and(vm_and(vf_eqz(mx), vf_eqz(my)), vf_eqz(mz));
+  // All lanes set, then clear those missing either sensor.
+  marg     = vm_andnot(mag_zero, vm_andnot(acc_zero, vf_eqz(vf_set1(0.0f))));
+
+  // Rate of change of quaternion from gyroscope
+  qDot1 = MUL(half, SUB(SUB(MUL(SUB(vf_set1(0.0f), q1), gx), MUL(q2, gy)), MUL(q3, gz)));
+  qDot2 = MUL(half, SUB(ADD(MUL(q0, gx), MUL(q2, gz)), MUL(q3, gy)));
+  qDot3 = MUL(half, ADD(SUB(MUL(q0, gy), MUL(q1, gz)), MUL(q3, gx)));
+  qDot4 = MUL(half, SUB(ADD(MUL(q0, gz), MUL(q1, gy)), MUL(q2, gx)));
+
+  // Normalise accelerometer measurement
+  recipNorm = vf_invsqrt(ADD(ADD(MUL(ax, ax), MUL(ay, ay)), MUL(az, az)));
+  ax        = MUL(ax, recipNorm);
+  ay        = MUL(ay, recipNorm);
+  az        = MUL(az, recipNorm);
+
+  // Auxiliary variables to avoid repeated arithmetic
+  _2q0 = MUL(two, q0);
+  _2q1 = MUL(two, q1);
+  _2q2 = MUL(two, q2);
+  _2q3 = MUL(two, q3);
+  q0q0 = MUL(q0, q0);
+  q1q1 = MUL(q1, q1);
+  q2q2 = MUL(q2, q2);
+  q3q3 = MUL(q3, q3);
+
+  // IMU gradient decent algorithm corrective step, as in updateIMU()
+  {
+    vf _4q0 = MUL(four, q0), _4q1 = MUL(four, q1), _4q2 = MUL(four, q2);
+    vf _8q1 = MUL(eight, q1), _8q2 = MUL(eight, q2);
+
+    i0 = SUB(ADD(ADD(MUL(_4q0, q2q2), MUL(_2q2, ax)), MUL(_4q0, q1q1)), MUL(_2q1, ay));
+    i1 = ADD(ADD(ADD(SUB(SUB(ADD(SUB(MUL(_4q1, q3q3), MUL(_2q3, ax)), MUL(MUL(four, q0q0), q1)), MUL(_2q0, ay)), _4q1), MUL(_8q1, q1q1)), MUL(_8q1, q2q2)), MUL(_4q1, az));
+    i2 = ADD(ADD(ADD(SUB(SUB(ADD(ADD(MUL(MUL(four, q0q0), q2), MUL(_2q0, ax)), MUL(_4q2, q3q3)), MUL(_2q3, ay)), _4q2), MUL(_8q2, q1q1)), MUL(_8q2, q2q2)), MUL(_4q2, az));
+    i3 = SUB(ADD(SUB(MUL(MUL(four, q1q1), q3), MUL(_2q1, ax)), MUL(MUL(four, q2q2), q3)), MUL(_2q2, ay));
+    vf_normalise4(&i0, &i1, &i2, &i3);
+  }
+
+  // MARG gradient decent algorithm corrective step, as in update(). Skipped
+  // if no lane has both accelerometer and magnetometer data.
+  s0 = i0;
+  s1 = i1;
+  s2 = i2;
+  s3 = i3;
+  if (vm_any(marg)) {
+    vf _2q0mx, _2q0my, _2q0mz, _2q1mx, _2q0q2, _2q2q3, q0q1, q0q2, q0q3, q1q2, q1q3, q2q3;
+    vf hx, hy, _2bx, _2bz, _4bx, _4bz, ex, ey, ez, fx, fy, fz;
+    vf m0, m1, m2, m3;
+
+    // Normalise magnetometer measurement
+    recipNorm = vf_invsqrt(ADD(ADD(MUL(mx, mx), MUL(my, my)), MUL(mz, mz)));
+    mx        = MUL(mx, recipNorm);
+    my        = MUL(my, recipNorm);
+    mz        = MUL(mz, recipNorm);
+
+    _2q0mx = MUL(MUL(two, q0), mx);
+    _2q0my = MUL(MUL(two, q0), my);
+    _2q0mz = MUL(MUL(two, q0), mz);
+    _2q1mx = MUL(MUL(two, q1), mx);
+    _2q0q2 = MUL(MUL(two, q0), q2);
+    _2q2q3 = MUL(MUL(two, q2), q3);
+    q0q1   = MUL(q0, q1);
+    q0q2   = MUL(q0, q2);
+    q0q3   = MUL(q0, q3);
+    q1q2   = MUL(q1, q2);
+    q1q3   = MUL(q1, q3);
+    q2q3   = MUL(q2, q3);
+
+    // Reference direction of Earth's magnetic field
+    hx = SUB(SUB(ADD(ADD(ADD(ADD(SUB(MUL(mx, q0q0), MUL(_2q0my, q3)), MUL(_2q0mz, q2)), MUL(mx, q1q1)), MUL(MUL(_2q1, my), q2)), MUL(MUL(_2q1, mz), q3)), MUL(mx, q2q2)), MUL(mx, q3q3));
+    hy = SUB(ADD(ADD(SUB(ADD(SUB(ADD(MUL(_2q0mx, q3), MUL(my, q0q0)), MUL(_2q0mz, q1)), MUL(_2q1mx, q2)), MUL(my, q1q1)), MUL(my, q2q2)), MUL(MUL(_2q2, mz), q3)), MUL(my, q3q3));
+    _2bx = vf_sqrt(ADD(MUL(hx, hx), MUL(hy, hy)));
+    _2bz = ADD(SUB(ADD(SUB(ADD(ADD(ADD(MUL(SUB(vf_set1(0.0f), _2q0mx), q2), MUL(_2q0my, q1)), MUL(mz, q0q0)), MUL(_2q1mx, q3)), MUL(mz, q1q1)), MUL(MUL(_2q2, my), q3)), MUL(mz, q2q2)), MUL(mz, q3q3));
+    _4bx = MUL(two, _2bx);
+    _4bz = MUL(two, _2bz);
+
+    // Objective function terms
+    ex = SUB(SUB(MUL(two, q1q3), _2q0q2), ax);
+    ey = SUB(ADD(MUL(two, q0q1), _2q2q3), ay);
+    ez = SUB(SUB(SUB(vf_set1(1.0f), MUL(two, q1q1)), MUL(two, q2q2)), az);
+    fx = SUB(ADD(MUL(_2bx, SUB(SUB(half, q2q2), q3q3)), MUL(_2bz, SUB(q1q3, q0q2))), mx);
+    fy = SUB(ADD(MUL(_2bx, SUB(q1q2, q0q3)), MUL(_2bz, ADD(q0q1, q2q3))), my);
+    fz = SUB(ADD(MUL(_2bx, ADD(q0q2, q1q3)), MUL(_2bz, SUB(SUB(half, q1q1), q2q2))), mz);
+
+    m0 = ADD(ADD(SUB(ADD(MUL(SUB(vf_set1(0.0f), _2q2), ex), MUL(_2q1, ey)), MUL(MUL(_2bz, q2), fx)),
+                 MUL(ADD(MUL(SUB(vf_set1(0.0f), _2bx), q3), MUL(_2bz, q1)), fy)),
+             MUL(MUL(_2bx, q2), fz));
+    m1 = ADD(ADD(ADD(SUB(ADD(MUL(_2q3, ex), MUL(_2q0, ey)), MUL(MUL(four, q1), ez)), MUL(MUL(_2bz, q3), fx)),
+                 MUL(ADD(MUL(_2bx, q2), MUL(_2bz, q0)), fy)),
+             MUL(SUB(MUL(_2bx, q3), MUL(_4bz, q1)), fz));
+    m2 = ADD(ADD(ADD(SUB(ADD(MUL(SUB(vf_set1(0.0f), _2q0), ex), MUL(_2q3, ey)), MUL(MUL(four, q2), ez)),
+                     MUL(SUB(MUL(SUB(vf_set1(0.0f), _4bx), q2), MUL(_2bz, q0)), fx)),
+                 MUL(ADD(MUL(_2bx, q1), MUL(_2bz, q3)), fy)),
+             MUL(SUB(MUL(_2bx, q0), MUL(_4bz, q2)), fz));
+    m3 = ADD(ADD(ADD(ADD(MUL(_2q1, ex), MUL(_2q2, ey)), MUL(ADD(MUL(SUB(vf_set1(0.0f), _4bx), q3), MUL(_2bz, q1)), fx)),
+                 MUL(ADD(MUL(SUB(vf_set1(0.0f), _2bx), q0), MUL(_2bz, q2)), fy)),
+             MUL(MUL(_2bx, q1), fz));
+    vf_normalise4(&m0, &m1, &m2, &m3);
+
+    s0 = vf_select(marg, m0, i0);
+    s1 = vf_select(marg, m1, i1);
+    s2 = vf_select(marg, m2, i2);
+    s3 = vf_select(marg, m3, i3);
+  }
+
+  // Apply feedback step, only if accelerometer measurement valid
+  s0    = vf_select(acc_zero, vf_set1(0.0f), MUL(beta, s0));
+  s1    = vf_select(acc_zero, vf_set1(0.0f), MUL(beta, s1));
+  s2    = vf_select(acc_zero, vf_set1(0.0f), MUL(beta, s2));
+  s3    = vf_select(acc_zero, vf_set1(0.0f), MUL(beta, s3));
+  qDot1 = SUB(qDot1, s0);
+  qDot2 = SUB(qDot2, s1);
+  qDot3 = SUB(qDot3, s2);
+  qDot4 = SUB(qDot4, s3);
+
+  // Integrate rate of change of quaternion to yield quaternion
+  q0 = ADD(q0, MUL(qDot1, inv_freq));
+  q1 = ADD(q1, MUL(qDot2, inv_freq));
+  q2 = ADD(q2, MUL(qDot3, inv_freq));
+  q3 = ADD(q3, MUL(qDot4, inv_freq));
+
+  // Normalise quaternion
+  vf_normalise4(&q0, &q1, &q2, &q3);
+  vf_store(batch->q0 + base, q0);
+  vf_store(batch->q1 + base, q1);
+  vf_store(batch->q2 + base, q2);
+  vf_store(batch->q3 + base, q3);
+}
+
+bool mgos_imu_madgwick_batch_update(struct mgos_imu_madgwick_batch *batch, const struct mgos_imu_madgwick_batch_input *in) {
+  const float *src[9];
+  const float *ptr[9];
+  float        tail[9][VF_WIDTH];
+  float        beta_now[VF_WIDTH];
+  size_t       base, lanes;
+
+  if (!batch || !in) {
+    return false;
+  }
+  src[0] = in->gx;
+  src[1] = in->gy;
+  src[2] = in->gz;
+  src[3] = in->ax;
+  src[4] = in->ay;
+  src[5] = in->az;
+  src[6] = in->mx;
+  src[7] = in->my;
+  src[8] = in->mz;
+  for (int k = 0; k < 9; k++) {
+    if (!src[k]) {
+      return false;
+    }
+  }
+
+  for (base = 0; base < batch->n; base += VF_WIDTH) {
+    lanes = batch->n - base;
+    if (lanes >= VF_WIDTH) {
+      lanes = VF_WIDTH;
+      for (int k = 0; k < 9; k++) {
+        ptr[k] = src[k] + base;
+      }
+    } else {
+      // Pad the last, partial step with zeros (gyroscope-only, no rotation).
+      memset(tail, 0, sizeof(tail));
+      for (int k = 0; k < 9; k++) {
+        memcpy(tail[k], src[k] + base, lanes * sizeof(float));
+        ptr[k] = tail[k];
+      }
+    }
+    for (size_t l = 0; l < VF_WIDTH; l++) {
+      size_t i = base + l;
+      beta_now[l] = (batch->counter[i] < batch->beta_init_count[i]) ? batch->beta_init[i] : batch->beta[i];
+    }
+    mgos_imu_madgwick_batch_step(batch, base, ptr, beta_now);
+    for (size_t l = 0; l < lanes; l++) {
+      batch->counter[base + l]++;
+    }
+  }
+  return true;
+}
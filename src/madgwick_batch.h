@@ -0,0 +1,68 @@
+//=============================================================================================
+// madgwick_batch.h
+//=============================================================================================
+//
+// Structure-of-arrays variant of madgwick.c, which updates many independent
+// filters per call using SIMD (AVX2, SSE2 or NEON on AArch64), with a scalar
+// fallback everywhere else. Intended for host side re-fusion of many streams.
+//
+//=============================================================================================
+#pragma once
+#include "mgos.h"
+#include "madgwick.h"
+
+/* Batch of independent Madgwick filters, stored as structure-of-arrays. Each
+ * array holds `stride` elements, which is `n` rounded up to the SIMD width.
+ */
+struct mgos_imu_madgwick_batch {
+  size_t    n;
+  size_t    stride;
+  float *   beta;
+  float *   beta_init;
+  uint32_t *beta_init_count;
+  float *   q0;
+  float *   q1;
+  float *   q2;
+  float *   q3;
+  float *   inv_freq;
+  uint32_t *counter;
+};
+
+/* Inputs for one update step of all filters in a batch. Each array holds `n`
+ * elements, one per filter, in the same units as `mgos_imu_madgwick_update()`.
+ * Filters whose mx/my/mz are all 0.0 run the IMU algorithm, as in the scalar
+ * filter.
+ */
+struct mgos_imu_madgwick_batch_input {
+  const float *gx, *gy, *gz;
+  const float *ax, *ay, *az;
+  const float *mx, *my, *mz;
+};
+
+/* Create a batch of `n` filters, each initialized as by `mgos_imu_madgwick_create()`.
+ * Returns a pointer to a `struct mgos_imu_madgwick_batch`, or NULL otherwise.
+ */
+struct mgos_imu_madgwick_batch *mgos_imu_madgwick_batch_create(size_t n);
+
+/* Clean up and return memory for the batch
+ */
+bool mgos_imu_madgwick_batch_destroy(struct mgos_imu_madgwick_batch **batch);
+
+/* Copy the state of filter `i` in or out of the batch, to or from a scalar
+ * filter. Gating settings of the scalar filter are not used by the batch.
+ * Returns true on success, false if `i` is out of range.
+ */
+bool mgos_imu_madgwick_batch_set(struct mgos_imu_madgwick_batch *batch, size_t i, const struct mgos_imu_madgwick *filter);
+bool mgos_imu_madgwick_batch_get(struct mgos_imu_madgwick_batch *batch, size_t i, struct mgos_imu_madgwick *filter);
+
+/* Run an update cycle on all filters in the batch. The result for each filter
+ * matches `mgos_imu_madgwick_update()` on the same inputs, to within float
+ * rounding.
+ * Returns true on success, false on failure.
+ */
+bool mgos_imu_madgwick_batch_update(struct mgos_imu_madgwick_batch *batch, const struct mgos_imu_madgwick_batch_input *in);
+
+/* Returns the number of filters updated per SIMD step, eg 8 for AVX2 or 1 for
+ * the scalar fallback.
+ */
+size_t mgos_imu_madgwick_batch_width(void);
@@ -37,6 +37,8 @@ void mgos_imu_destroy(struct mgos_imu **imu) {
   if (!*imu) {
     return;
   }
+  mgos_imu_clear_motion_wakeup(*imu);
+  mgos_imu_clear_odr_ctrl(*imu);
   mgos_imu_gyroscope_destroy(*imu);
   mgos_imu_accelerometer_destroy(*imu);
   mgos_imu_magnetometer_destroy(*imu);
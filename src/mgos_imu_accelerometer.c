@@ -25,6 +25,7 @@
 #include "mgos_imu_mpu60x0.h"
 #include "mgos_imu_mpu6886.h"
 #include "mgos_imu_icm20948.h"
+#include "mgos_imu_replay.h"
 
 static struct mgos_imu_acc *mgos_imu_acc_create(void) {
   struct mgos_imu_acc *acc;
@@ -43,12 +44,14 @@ static bool mgos_imu_acc_destroy(struct mgos_imu_acc **acc, void *imu_user_data)
   if (!*acc) {
     return false;
   }
+  mgos_imu_create_cancel((*acc)->pending);
   if ((*acc)->destroy) {
     (*acc)->destroy(*acc, imu_user_data);
   }
   if ((*acc)->user_data) {
     free((*acc)->user_data);
   }
+  free((*acc)->stats);
   free(*acc);
   *acc = NULL;
   return true;
@@ -60,6 +63,7 @@ bool mgos_imu_accelerometer_destroy(struct mgos_imu *imu) {
   if (!imu || !imu->acc) {
     return false;
   }
+  mgos_imu_clear_motion_wakeup(imu);
   ret      = mgos_imu_acc_destroy(&(imu->acc), imu->user_data);
   imu->acc = NULL;
   return ret;
@@ -97,34 +101,104 @@ const char *mgos_imu_accelerometer_get_name(struct mgos_imu *imu) {
 
   case ACC_ICM20948: return "ICM20948";
 
+  case ACC_REPLAY: return "REPLAY";
+
   default: return "UNKNOWN";
   }
 }
 
+// Called after the current sample was converted, so that a range switch only
+// applies to samples read after it.
+static void mgos_imu_acc_autorange(struct mgos_imu *imu) {
+  struct mgos_imu_acc *acc = imu->acc;
+  float scale, prev, odr = 0;
+  int   step;
+
+  step = mgos_imu_autorange_check(&acc->autorange, acc->ax, acc->ay, acc->az);
+  if (step == 0 || !acc->set_scale) {
+    return;
+  }
+  scale = acc->opts.scale;
+  if (acc->get_scale) {
+    acc->get_scale(acc, imu->user_data, &scale);
+  }
+  prev = acc->scale;
+  if (scale <= 0 || !acc->set_scale(acc, imu->user_data, step > 0 ? scale * 2 : scale / 2) || acc->scale == prev) {
+    return;
+  }
+  if (!acc->get_odr || !acc->get_odr(acc, imu->user_data, &odr)) {
+    odr = acc->opts.odr;
+  }
+  mgos_imu_autorange_switched(&acc->autorange, odr);
+  LOG(LL_DEBUG, ("Accelerometer range %.0fG -> %.0fG", scale, acc->opts.scale));
+}
+
 bool mgos_imu_accelerometer_get(struct mgos_imu *imu, float *x, float *y, float *z) {
-  if (!imu->acc || !imu->acc->read) {
+  struct mgos_imu_autorange *ar;
+  int64_t start;
+  bool    ok;
+
+  if (!imu->acc || !imu->acc->read || imu->acc->pending) {
     return false;
   }
 
-  if (!imu->acc->read(imu->acc, imu->user_data)) {
+  imu->acc->stale = false;
+  start          = mgos_imu_stats_start(imu->acc->stats);
+  ok             = imu->acc->read(imu->acc, imu->user_data);
+  mgos_imu_stats_read(imu->acc->stats, start, ok);
+  if (!ok) {
     LOG(LL_ERROR, ("Could not read from accelerometer"));
     return false;
   }
   // LOG(LL_DEBUG, ("Raw: ax=%d ay=%d az=%d", imu->acc->ax, imu->acc->ay, imu->acc->az));
+  if (!imu->acc->stale) {
+    imu->acc->clipped = mgos_imu_autorange_clipped(imu->acc->ax, imu->acc->ay, imu->acc->az);
+    if (imu->acc->clipped) {
+      mgos_imu_stats_clipped(imu->acc->stats);
+    }
+  }
+
+  // While the chip switches range, the sample may be at either one. Such
+  // samples, and ones the driver already returned, are not processed again,
+  // and the previous output is returned.
+  ar = &imu->acc->autorange;
+  if (mgos_imu_autorange_settling(ar)) {
+    imu->acc->stale = true;
+  }
+  if (!imu->acc->stale) {
+    ar->out[0] = (imu->acc->scale * imu->acc->ax) + imu->acc->offset_ax;
+    ar->out[1] = (imu->acc->scale * imu->acc->ay) + imu->acc->offset_ay;
+    ar->out[2] = (imu->acc->scale * imu->acc->az) + imu->acc->offset_az;
+    if (imu->acc->filter) {
+      mgos_imu_filter_process(imu->acc->filter, ar->out, 1);
+    }
+    if (imu->acc->aggregator) {
+      mgos_imu_aggregator_add(imu->acc->aggregator, ar->out, 1);
+    }
+    if (imu->motion) {
+      mgos_imu_motion_acc(imu);
+    }
+    if (imu->odr_ctrl) {
+      mgos_imu_odr_ctrl_acc(imu);
+    }
+    if (ar->enabled) {
+      mgos_imu_acc_autorange(imu);
+    }
+  }
   if (x) {
-    *x = (imu->acc->scale * imu->acc->ax) + imu->acc->offset_ax;
+    *x = ar->out[0];
   }
   if (y) {
-    *y = (imu->acc->scale * imu->acc->ay) + imu->acc->offset_ay;
+    *y = ar->out[1];
   }
   if (z) {
-    *z = (imu->acc->scale * imu->acc->az) + imu->acc->offset_az;
+    *z = ar->out[2];
   }
   return true;
 }
 
-bool mgos_imu_accelerometer_create_i2c(struct mgos_imu *imu, struct mgos_i2c *i2c, uint8_t i2caddr, const struct mgos_imu_acc_opts *opts) {
-  if (!imu || !i2c || !opts) {
+static bool mgos_imu_acc_setup(struct mgos_imu *imu, struct mgos_i2c *i2c, uint8_t i2caddr, const struct mgos_imu_acc_opts *opts) {
+  if (!imu || !opts || (!i2c && opts->type != ACC_REPLAY)) {
     return false;
   }
   if (imu->acc) {
@@ -132,7 +206,7 @@ bool mgos_imu_accelerometer_create_i2c(struct mgos_imu *imu, struct mgos_i2c *i2
   }
   imu->acc = mgos_imu_acc_create();
   if (!imu->acc) {
-    false;
+    return false;
   }
   imu->acc->i2c     = i2c;
   imu->acc->i2caddr = i2caddr;
@@ -140,44 +214,54 @@ bool mgos_imu_accelerometer_create_i2c(struct mgos_imu *imu, struct mgos_i2c *i2
   switch (opts->type) {
   case ACC_MPU6000:
   case ACC_MPU6050:
-    imu->acc->detect    = mgos_imu_mpu60x0_acc_detect;
-    imu->acc->create    = mgos_imu_mpu60x0_acc_create;
-    imu->acc->read      = mgos_imu_mpu60x0_acc_read;
-    imu->acc->get_scale = mgos_imu_mpu60x0_acc_get_scale;
-    imu->acc->set_scale = mgos_imu_mpu60x0_acc_set_scale;
+    imu->acc->detect        = mgos_imu_mpu60x0_acc_detect;
+    imu->acc->create_step   = mgos_imu_mpu60x0_acc_create_step;
+    imu->acc->read          = mgos_imu_mpu60x0_acc_read;
+    imu->acc->get_scale     = mgos_imu_mpu60x0_acc_get_scale;
+    imu->acc->set_scale     = mgos_imu_mpu60x0_acc_set_scale;
+    imu->acc->set_hw_offset = mgos_imu_mpu60x0_acc_set_hw_offset;
     if (!imu->user_data) {
       imu->user_data = mgos_imu_mpu60x0_userdata_create();
     }
     break;
 
   case ACC_MPU6886:
-    imu->acc->detect    = mgos_imu_mpu6886_acc_detect;
-    imu->acc->create    = mgos_imu_mpu60x0_acc_create;
-    imu->acc->read      = mgos_imu_mpu60x0_acc_read;
-    imu->acc->get_scale = mgos_imu_mpu60x0_acc_get_scale;
-    imu->acc->set_scale = mgos_imu_mpu60x0_acc_set_scale;
+    imu->acc->detect      = mgos_imu_mpu6886_acc_detect;
+    imu->acc->create_step = mgos_imu_mpu60x0_acc_create_step;
+    imu->acc->read        = mgos_imu_mpu60x0_acc_read;
+    imu->acc->get_scale   = mgos_imu_mpu60x0_acc_get_scale;
+    imu->acc->set_scale   = mgos_imu_mpu60x0_acc_set_scale;
     if (!imu->user_data) {
       imu->user_data = mgos_imu_mpu60x0_userdata_create();
     }
     break;
 
   case ACC_LSM6DSL:
-    imu->acc->detect    = mgos_imu_lsm6dsl_acc_detect;
-    imu->acc->create    = mgos_imu_lsm6dsl_acc_create;
-    imu->acc->read      = mgos_imu_lsm6dsl_acc_read;
-    imu->acc->get_odr   = mgos_imu_lsm6dsl_acc_get_odr;
-    imu->acc->set_odr   = mgos_imu_lsm6dsl_acc_set_odr;
-    imu->acc->get_scale = mgos_imu_lsm6dsl_acc_get_scale;
-    imu->acc->set_scale = mgos_imu_lsm6dsl_acc_set_scale;
+    imu->acc->detect        = mgos_imu_lsm6dsl_acc_detect;
+    imu->acc->create_step   = mgos_imu_lsm6dsl_acc_create_step;
+    imu->acc->read          = mgos_imu_lsm6dsl_acc_read;
+    imu->acc->get_odr       = mgos_imu_lsm6dsl_acc_get_odr;
+    imu->acc->set_odr       = mgos_imu_lsm6dsl_acc_set_odr;
+    imu->acc->get_scale     = mgos_imu_lsm6dsl_acc_get_scale;
+    imu->acc->set_scale     = mgos_imu_lsm6dsl_acc_set_scale;
+    imu->acc->set_hw_offset = mgos_imu_lsm6dsl_acc_set_hw_offset;
+    imu->acc->get_bandwidth = mgos_imu_lsm6dsl_acc_get_bandwidth;
+    imu->acc->set_bandwidth = mgos_imu_lsm6dsl_acc_set_bandwidth;
+    imu->acc->set_wakeup    = mgos_imu_lsm6dsl_acc_set_wakeup;
+    imu->acc->get_wakeup    = mgos_imu_lsm6dsl_acc_get_wakeup;
     if (!imu->user_data) {
       imu->user_data = mgos_imu_lsm6dsl_userdata_create();
     }
     break;
 
   case ACC_LSM9DS1:
-    imu->acc->detect = mgos_imu_lsm9ds1_acc_detect;
-    imu->acc->create = mgos_imu_lsm9ds1_acc_create;
-    imu->acc->read   = mgos_imu_lsm9ds1_acc_read;
+    imu->acc->detect        = mgos_imu_lsm9ds1_acc_detect;
+    imu->acc->create        = mgos_imu_lsm9ds1_acc_create;
+    imu->acc->read          = mgos_imu_lsm9ds1_acc_read;
+    imu->acc->get_bandwidth = mgos_imu_lsm9ds1_acc_get_bandwidth;
+    imu->acc->set_bandwidth = mgos_imu_lsm9ds1_acc_set_bandwidth;
+    imu->acc->set_wakeup    = mgos_imu_lsm9ds1_acc_set_wakeup;
+    imu->acc->get_wakeup    = mgos_imu_lsm9ds1_acc_get_wakeup;
     if (!imu->user_data) {
       imu->user_data = mgos_imu_lsm9ds1_userdata_create();
     }
@@ -201,11 +285,16 @@ bool mgos_imu_accelerometer_create_i2c(struct mgos_imu *imu, struct mgos_i2c *i2
 
   case ACC_MPU9250:
   case ACC_MPU9255:
-    imu->acc->detect    = mgos_imu_mpu925x_acc_detect;
-    imu->acc->create    = mgos_imu_mpu925x_acc_create;
-    imu->acc->read      = mgos_imu_mpu925x_acc_read;
-    imu->acc->get_scale = mgos_imu_mpu925x_acc_get_scale;
-    imu->acc->set_scale = mgos_imu_mpu925x_acc_set_scale;
+    imu->acc->detect        = mgos_imu_mpu925x_acc_detect;
+    imu->acc->create_step   = mgos_imu_mpu925x_acc_create_step;
+    imu->acc->read          = mgos_imu_mpu925x_acc_read;
+    imu->acc->get_scale     = mgos_imu_mpu925x_acc_get_scale;
+    imu->acc->set_scale     = mgos_imu_mpu925x_acc_set_scale;
+    imu->acc->set_hw_offset = mgos_imu_mpu925x_acc_set_hw_offset;
+    imu->acc->get_bandwidth = mgos_imu_mpu925x_acc_get_bandwidth;
+    imu->acc->set_bandwidth = mgos_imu_mpu925x_acc_set_bandwidth;
+    imu->acc->set_wakeup    = mgos_imu_mpu925x_acc_set_wakeup;
+    imu->acc->get_wakeup    = mgos_imu_mpu925x_acc_get_wakeup;
     if (!imu->user_data) {
       imu->user_data = mgos_imu_mpu925x_userdata_create();
     }
@@ -218,18 +307,30 @@ bool mgos_imu_accelerometer_create_i2c(struct mgos_imu *imu, struct mgos_i2c *i2
     break;
 
   case ACC_ICM20948:
-    imu->acc->detect    = mgos_imu_icm20948_acc_detect;
-    imu->acc->create    = mgos_imu_icm20948_acc_create;
-    imu->acc->read      = mgos_imu_icm20948_acc_read;
-    imu->acc->get_odr   = mgos_imu_icm20948_acc_get_odr;
-    imu->acc->set_odr   = mgos_imu_icm20948_acc_set_odr;
-    imu->acc->get_scale = mgos_imu_icm20948_acc_get_scale;
-    imu->acc->set_scale = mgos_imu_icm20948_acc_set_scale;
+    imu->acc->detect        = mgos_imu_icm20948_acc_detect;
+    imu->acc->create_step   = mgos_imu_icm20948_acc_create_step;
+    imu->acc->read          = mgos_imu_icm20948_acc_read;
+    imu->acc->get_odr       = mgos_imu_icm20948_acc_get_odr;
+    imu->acc->set_odr       = mgos_imu_icm20948_acc_set_odr;
+    imu->acc->get_scale     = mgos_imu_icm20948_acc_get_scale;
+    imu->acc->set_scale     = mgos_imu_icm20948_acc_set_scale;
+    imu->acc->get_bandwidth = mgos_imu_icm20948_acc_get_bandwidth;
+    imu->acc->set_bandwidth = mgos_imu_icm20948_acc_set_bandwidth;
+    imu->acc->set_wakeup    = mgos_imu_icm20948_acc_set_wakeup;
+    imu->acc->get_wakeup    = mgos_imu_icm20948_acc_get_wakeup;
     if (!imu->user_data) {
       imu->user_data = mgos_imu_icm20948_userdata_create();
     }
     break;
 
+  case ACC_REPLAY:
+    imu->acc->detect  = mgos_imu_replay_acc_detect;
+    imu->acc->create  = mgos_imu_replay_acc_create;
+    imu->acc->destroy = mgos_imu_replay_acc_destroy;
+    imu->acc->read    = mgos_imu_replay_acc_read;
+    imu->acc->get_odr = mgos_imu_replay_acc_get_odr;
+    break;
+
   default:
     LOG(LL_ERROR, ("Unknown accelerometer type %d", opts->type));
     mgos_imu_accelerometer_destroy(imu);
@@ -246,26 +347,61 @@ bool mgos_imu_accelerometer_create_i2c(struct mgos_imu *imu, struct mgos_i2c *i2
                      opts->type, mgos_imu_accelerometer_get_name(imu), i2caddr));
     }
   }
+  return true;
+}
 
-  if (imu->acc->create) {
-    if (!imu->acc->create(imu->acc, imu->user_data)) {
-      LOG(LL_ERROR, ("Could not create accelerometer type %d (%s) at I2C 0x%02x",
-                     opts->type, mgos_imu_accelerometer_get_name(imu), i2caddr));
-      mgos_imu_accelerometer_destroy(imu);
-      return false;
-    } else {
-      LOG(LL_DEBUG, ("Successfully created accelerometer type %d (%s) at I2C 0x%02x",
-                     opts->type, mgos_imu_accelerometer_get_name(imu), i2caddr));
-    }
+static int32_t mgos_imu_acc_create_step(struct mgos_imu *imu, uint8_t step) {
+  struct mgos_imu_acc *acc = imu->acc;
+
+  if (acc->create_step) {
+    return acc->create_step(acc, imu->user_data, step);
+  }
+  if (acc->create && !acc->create(acc, imu->user_data)) {
+    return -1;
   }
-  if (imu->acc->set_scale) {
-    imu->acc->set_scale(imu->acc, imu->user_data, opts->scale);
+  return 0;
+}
+
+static bool mgos_imu_acc_create_done(struct mgos_imu *imu, bool ok) {
+  struct mgos_imu_acc *acc = imu->acc;
+
+  acc->pending = NULL;
+  if (!ok) {
+    LOG(LL_ERROR, ("Could not create accelerometer type %d (%s) at I2C 0x%02x",
+                   acc->opts.type, mgos_imu_accelerometer_get_name(imu), acc->i2caddr));
+    mgos_imu_accelerometer_destroy(imu);
+    return false;
   }
+  LOG(LL_DEBUG, ("Successfully created accelerometer type %d (%s) at I2C 0x%02x",
+                 acc->opts.type, mgos_imu_accelerometer_get_name(imu), acc->i2caddr));
+
+  if (acc->set_scale) {
+    acc->set_scale(acc, imu->user_data, acc->opts.scale);
+  }
+
+  if (acc->set_odr) {
+    acc->set_odr(acc, imu->user_data, acc->opts.odr);
+  }
+
+  return true;
+}
 
-  if (imu->acc->set_odr) {
-    imu->acc->set_odr(imu->acc, imu->user_data, opts->odr);
+bool mgos_imu_accelerometer_create_i2c(struct mgos_imu *imu, struct mgos_i2c *i2c, uint8_t i2caddr, const struct mgos_imu_acc_opts *opts) {
+  if (!mgos_imu_acc_setup(imu, i2c, i2caddr, opts)) {
+    return false;
   }
+  return mgos_imu_acc_create_done(imu, mgos_imu_create_run(imu, mgos_imu_acc_create_step));
+}
 
+bool mgos_imu_accelerometer_create_i2c_async(struct mgos_imu *imu, struct mgos_i2c *i2c, uint8_t i2caddr, const struct mgos_imu_acc_opts *opts, mgos_imu_create_cb cb, void *cb_arg) {
+  if (!mgos_imu_acc_setup(imu, i2c, i2caddr, opts)) {
+    return false;
+  }
+  imu->acc->pending = mgos_imu_create_start(imu, mgos_imu_acc_create_step, mgos_imu_acc_create_done, cb, cb_arg);
+  if (!imu->acc->pending) {
+    mgos_imu_accelerometer_destroy(imu);
+    return false;
+  }
   return true;
 }
 
@@ -279,6 +415,13 @@ bool mgos_imu_accelerometer_set_offset(struct mgos_imu *imu, float x, float y, f
   return true;
 }
 
+bool mgos_imu_accelerometer_set_hw_offset(struct mgos_imu *imu, float x, float y, float z) {
+  if (!imu || !imu->acc || !imu->acc->set_hw_offset) {
+    return false;
+  }
+  return imu->acc->set_hw_offset(imu->acc, imu->user_data, x, y, z);
+}
+
 bool mgos_imu_accelerometer_get_offset(struct mgos_imu *imu, float *x, float *y, float *z) {
   if (!imu || !imu->acc) {
     return false;
@@ -322,3 +465,51 @@ bool mgos_imu_accelerometer_set_odr(struct mgos_imu *imu, float hertz) {
   }
   return imu->acc->set_odr(imu->acc, imu->user_data, hertz);
 }
+
+bool mgos_imu_accelerometer_get_bandwidth(struct mgos_imu *imu, float *hertz) {
+  if (!imu || !imu->acc || !imu->acc->get_bandwidth || !hertz) {
+    return false;
+  }
+  return imu->acc->get_bandwidth(imu->acc, imu->user_data, hertz);
+}
+
+bool mgos_imu_accelerometer_set_bandwidth(struct mgos_imu *imu, float hertz) {
+  if (!imu || !imu->acc || !imu->acc->set_bandwidth || hertz <= 0) {
+    return false;
+  }
+  return imu->acc->set_bandwidth(imu->acc, imu->user_data, hertz);
+}
+
+bool mgos_imu_accelerometer_set_autorange(struct mgos_imu *imu, bool enable, uint32_t hold_ms) {
+  if (!imu || !imu->acc || !imu->acc->set_scale) {
+    return false;
+  }
+  memset(&imu->acc->autorange, 0, sizeof(imu->acc->autorange));
+  imu->acc->autorange.enabled = enable;
+  imu->acc->autorange.hold_ms = hold_ms;
+  return true;
+}
+
+bool mgos_imu_accelerometer_get_clipped(struct mgos_imu *imu, bool *clipped) {
+  if (!imu || !imu->acc || !clipped) {
+    return false;
+  }
+  *clipped = imu->acc->clipped;
+  return true;
+}
+
+bool mgos_imu_accelerometer_set_filter(struct mgos_imu *imu, struct mgos_imu_filter *filter) {
+  if (!imu || !imu->acc) {
+    return false;
+  }
+  imu->acc->filter = filter;
+  return true;
+}
+
+bool mgos_imu_accelerometer_set_aggregator(struct mgos_imu *imu, struct mgos_imu_aggregator *agg) {
+  if (!imu || !imu->acc) {
+    return false;
+  }
+  imu->acc->aggregator = agg;
+  return true;
+}
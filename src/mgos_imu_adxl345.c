@@ -62,6 +62,7 @@ bool mgos_imu_adxl345_read(struct mgos_imu_acc *dev, void *imu_user_data) {
   if (!mgos_i2c_read_reg_n(dev->i2c, dev->i2caddr, MGOS_ADXL345_REG_DATA_OUT, 6, data)) {
     return false;
   }
+  mgos_imu_stats_i2c(dev->stats, 6);
   dev->ax = (data[0]) | (data[1] << 8);
   dev->ay = (data[2]) | (data[3] << 8);
   dev->az = (data[4]) | (data[5] << 8);
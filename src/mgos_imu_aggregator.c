@@ -0,0 +1,158 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mgos.h"
+#include "mgos_imu_internal.h"
+#include <math.h>
+
+// Running mean and sum of squared deviations (Welford), so that the variance
+// stays accurate on a large offset such as gravity, and the RMS follows from
+// mean^2 + variance without a sum of squares.
+struct mgos_imu_aggregator {
+  struct mgos_imu_aggregator_opts opts;
+  mgos_imu_aggregator_cb          cb;
+  void *                          cb_arg;
+
+  uint32_t                        window;
+  uint32_t                        count;
+  int64_t                         start_us;
+  float                           min[3];
+  float                           max[3];
+  float                           mean[3];
+  float                           m2[3];
+
+  bool                            have_aggregate;
+  struct mgos_imu_aggregate       aggregate;
+};
+
+// Private functions follow
+static void mgos_imu_aggregator_close(struct mgos_imu_aggregator *agg) {
+  struct mgos_imu_aggregate *a = &agg->aggregate;
+  float var;
+
+  a->window   = agg->window++;
+  a->count    = agg->count;
+  a->start_us = agg->start_us;
+  for (int axis = 0; axis < 3; axis++) {
+    var             = agg->m2[axis] / agg->count;
+    a->min[axis]    = agg->min[axis];
+    a->max[axis]    = agg->max[axis];
+    a->mean[axis]   = agg->mean[axis];
+    a->rms[axis]    = sqrtf(agg->mean[axis] * agg->mean[axis] + var);
+    a->stddev[axis] = sqrtf(var);
+    a->p2p[axis]    = agg->max[axis] - agg->min[axis];
+  }
+  agg->count          = 0;
+  agg->have_aggregate = true;
+  if (agg->cb) {
+    agg->cb(agg, a, agg->cb_arg);
+  }
+}
+
+static void mgos_imu_aggregator_sample(struct mgos_imu_aggregator *agg, const float v[3], int64_t now) {
+  float d;
+
+  if (agg->count > 0 && agg->opts.window_ms > 0 && now - agg->start_us >= (int64_t)agg->opts.window_ms * 1000) {
+    mgos_imu_aggregator_close(agg);
+  }
+  if (agg->count == 0) {
+    agg->start_us = now;
+    for (int axis = 0; axis < 3; axis++) {
+      agg->min[axis]  = v[axis];
+      agg->max[axis]  = v[axis];
+      agg->mean[axis] = 0;
+      agg->m2[axis]   = 0;
+    }
+  }
+  agg->count++;
+  for (int axis = 0; axis < 3; axis++) {
+    if (v[axis] < agg->min[axis]) {
+      agg->min[axis] = v[axis];
+    }
+    if (v[axis] > agg->max[axis]) {
+      agg->max[axis] = v[axis];
+    }
+    d                = v[axis] - agg->mean[axis];
+    agg->mean[axis] += d / agg->count;
+    agg->m2[axis]   += d * (v[axis] - agg->mean[axis]);
+  }
+  if (agg->opts.window_samples > 0 && agg->count >= agg->opts.window_samples) {
+    mgos_imu_aggregator_close(agg);
+  }
+}
+
+// Private functions end
+
+// Public functions follow
+struct mgos_imu_aggregator *mgos_imu_aggregator_create(const struct mgos_imu_aggregator_opts *opts, mgos_imu_aggregator_cb cb, void *user_data) {
+  struct mgos_imu_aggregator *agg;
+
+  if (!opts || (opts->window_samples == 0 && opts->window_ms == 0)) {
+    return NULL;
+  }
+  agg = calloc(1, sizeof(struct mgos_imu_aggregator));
+  if (!agg) {
+    return NULL;
+  }
+  agg->opts   = *opts;
+  agg->cb     = cb;
+  agg->cb_arg = user_data;
+  return agg;
+}
+
+bool mgos_imu_aggregator_destroy(struct mgos_imu_aggregator **agg) {
+  if (!agg || !*agg) {
+    return false;
+  }
+  free(*agg);
+  *agg = NULL;
+  return true;
+}
+
+bool mgos_imu_aggregator_add(struct mgos_imu_aggregator *agg, const float *xyz, size_t n) {
+  int64_t now;
+
+  if (!agg || (!xyz && n > 0)) {
+    return false;
+  }
+  // A batch is timed on arrival, so time limited windows close on batch
+  // boundaries.
+  now = mgos_uptime_micros();
+  for (size_t i = 0; i < n; i++) {
+    mgos_imu_aggregator_sample(agg, &xyz[i * 3], now);
+  }
+  return true;
+}
+
+bool mgos_imu_aggregator_flush(struct mgos_imu_aggregator *agg) {
+  if (!agg) {
+    return false;
+  }
+  if (agg->count > 0) {
+    mgos_imu_aggregator_close(agg);
+  }
+  return true;
+}
+
+bool mgos_imu_aggregator_get(struct mgos_imu_aggregator *agg, struct mgos_imu_aggregate *aggregate) {
+  if (!agg || !aggregate || !agg->have_aggregate) {
+    return false;
+  }
+  *aggregate = agg->aggregate;
+  return true;
+}
+
+// Public functions end
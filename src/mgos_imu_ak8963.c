@@ -34,40 +34,49 @@ bool mgos_imu_ak8963_detect(struct mgos_imu_mag *dev, void *imu_user_data) {
   (void)imu_user_data;
 }
 
-bool mgos_imu_ak8963_create(struct mgos_imu_mag *dev, void *imu_user_data) {
+int32_t mgos_imu_ak8963_create_step(struct mgos_imu_mag *dev, void *imu_user_data, uint8_t step) {
+  uint8_t data[3];
+
   if (!dev) {
-    return false;
+    return -1;
   }
 
-  // Reset
-  mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_AK8963_REG_CNTL, 0x00);
-  mgos_usleep(10000);
-
-  // Fuse ROM access mode
-  mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_AK8963_REG_CNTL, 0x0F);
-  mgos_usleep(10000);
-
-  uint8_t data[3];
-  if (!mgos_i2c_read_reg_n(dev->i2c, dev->i2caddr, MGOS_AK8963_REG_ASAX, 3, data)) {
-    LOG(LL_ERROR, ("Could not read magnetometer adjustment registers"));
-    return false;
+  switch (step) {
+  case 0:
+    // Reset
+    mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_AK8963_REG_CNTL, 0x00);
+    return 10000;
+
+  case 1:
+    // Fuse ROM access mode
+    mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_AK8963_REG_CNTL, 0x0F);
+    return 10000;
+
+  case 2:
+    if (!mgos_i2c_read_reg_n(dev->i2c, dev->i2caddr, MGOS_AK8963_REG_ASAX, 3, data)) {
+      LOG(LL_ERROR, ("Could not read magnetometer adjustment registers"));
+      return -1;
+    }
+    dev->bias[0] = (float)(data[0] - 128) / 256. + 1.;
+    dev->bias[1] = (float)(data[1] - 128) / 256. + 1.;
+    dev->bias[2] = (float)(data[2] - 128) / 256. + 1.;
+
+    LOG(LL_DEBUG, ("Magnetometer adjustment bias %.2f %.2f %.2f", dev->bias[0], dev->bias[1], dev->bias[2]));
+
+    // Reset
+    mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_AK8963_REG_CNTL, 0x00);
+    return 10000;
+
+  case 3:
+    // Set magnetometer config: 16-bit, continuous measurement mode 2 (100Hz)
+    mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_AK8963_REG_CNTL, 0x16);
+    dev->scale = 4192.0 / 32768.0;
+    return 10000;
+
+  case 4:
+    return 0;
   }
-  dev->bias[0] = (float)(data[0] - 128) / 256. + 1.;
-  dev->bias[1] = (float)(data[1] - 128) / 256. + 1.;
-  dev->bias[2] = (float)(data[2] - 128) / 256. + 1.;
-
-  LOG(LL_DEBUG, ("Magnetometer adjustment bias %.2f %.2f %.2f", dev->bias[0], dev->bias[1], dev->bias[2]));
-
-  // Reset
-  mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_AK8963_REG_CNTL, 0x00);
-  mgos_usleep(10000);
-
-  // Set magnetometer config: 16-bit, continuous measurement mode 2 (100Hz)
-  mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_AK8963_REG_CNTL, 0x16);
-  mgos_usleep(10000);
-  dev->scale = 4192.0 / 32768.0;
-
-  return true;
+  return -1;
 
   (void)imu_user_data;
 }
@@ -81,6 +90,7 @@ bool mgos_imu_ak8963_read(struct mgos_imu_mag *dev, void *imu_user_data) {
   if (!mgos_i2c_read_reg_n(dev->i2c, dev->i2caddr, MGOS_AK8963_REG_XOUT_L, 7, data)) {
     return false;
   }
+  mgos_imu_stats_i2c(dev->stats, 7);
   if (data[6] & 0x08) {
     return false;
   }
@@ -32,5 +32,5 @@
 #define MGOS_AK8963_REG_ASAZ           (0x12)
 
 bool mgos_imu_ak8963_detect(struct mgos_imu_mag *dev, void *imu_user_data);
-bool mgos_imu_ak8963_create(struct mgos_imu_mag *dev, void *imu_user_data);
+int32_t mgos_imu_ak8963_create_step(struct mgos_imu_mag *dev, void *imu_user_data, uint8_t step);
 bool mgos_imu_ak8963_read(struct mgos_imu_mag *dev, void *imu_user_data);
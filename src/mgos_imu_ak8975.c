@@ -34,67 +34,114 @@ bool mgos_imu_ak8975_detect(struct mgos_imu_mag *dev, void *imu_user_data) {
   (void)imu_user_data;
 }
 
-bool mgos_imu_ak8975_create(struct mgos_imu_mag *dev, void *imu_user_data) {
-  if (!dev) {
+// Start a single measurement, its result is picked up by the next read.
+static bool mgos_imu_ak8975_start(struct mgos_imu_mag *dev, struct mgos_imu_ak8975_userdata *ud) {
+  if (!mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_AK8975_REG_CNTL, 0x01)) {
+    ud->measuring = false;
     return false;
   }
+  ud->measuring = true;
+  ud->started   = mgos_uptime_micros();
+  return true;
+}
 
-  // Reset
-  mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_AK8975_REG_CNTL, 0x00);
-  mgos_usleep(10000);
-
-  // Fuse ROM access mode
-  mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_AK8975_REG_CNTL, 0x0F);
-  mgos_usleep(10000);
-
+int32_t mgos_imu_ak8975_create_step(struct mgos_imu_mag *dev, void *imu_user_data, uint8_t step) {
+  struct mgos_imu_ak8975_userdata *ud;
   uint8_t data[3];
-  if (!mgos_i2c_read_reg_n(dev->i2c, dev->i2caddr, MGOS_AK8975_REG_ASAX, 3, data)) {
-    LOG(LL_ERROR, ("Could not read magnetometer adjustment registers"));
-    return false;
-  }
-  dev->bias[0] = (float)(data[0] - 128) / 256. + 1.;
-  dev->bias[1] = (float)(data[1] - 128) / 256. + 1.;
-  dev->bias[2] = (float)(data[2] - 128) / 256. + 1.;
-
-  LOG(LL_DEBUG, ("Magnetometer adjustment bias %.2f %.2f %.2f", dev->bias[0], dev->bias[1], dev->bias[2]));
 
-  // Reset
-  mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_AK8975_REG_CNTL, 0x00);
-  mgos_usleep(10000);
-
-  dev->scale = 1229.0 / 4096.0;
+  if (!dev) {
+    return -1;
+  }
 
-  return true;
+  switch (step) {
+  case 0:
+    if (!dev->user_data) {
+      dev->user_data = calloc(1, sizeof(struct mgos_imu_ak8975_userdata));
+      if (!dev->user_data) {
+        return -1;
+      }
+    }
+
+    // Reset
+    mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_AK8975_REG_CNTL, 0x00);
+    return 10000;
+
+  case 1:
+    // Fuse ROM access mode
+    mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_AK8975_REG_CNTL, 0x0F);
+    return 10000;
+
+  case 2:
+    if (!mgos_i2c_read_reg_n(dev->i2c, dev->i2caddr, MGOS_AK8975_REG_ASAX, 3, data)) {
+      LOG(LL_ERROR, ("Could not read magnetometer adjustment registers"));
+      return -1;
+    }
+    dev->bias[0] = (float)(data[0] - 128) / 256. + 1.;
+    dev->bias[1] = (float)(data[1] - 128) / 256. + 1.;
+    dev->bias[2] = (float)(data[2] - 128) / 256. + 1.;
+
+    LOG(LL_DEBUG, ("Magnetometer adjustment bias %.2f %.2f %.2f", dev->bias[0], dev->bias[1], dev->bias[2]));
+
+    // Reset
+    mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_AK8975_REG_CNTL, 0x00);
+    return 10000;
+
+  case 3:
+    dev->scale = 1229.0 / 4096.0;
+
+    // Wait for the first measurement, so that the first read has a sample.
+    ud = (struct mgos_imu_ak8975_userdata *)dev->user_data;
+    if (!mgos_imu_ak8975_start(dev, ud)) {
+      return -1;
+    }
+    return MGOS_AK8975_MEASURE_US;
+
+  case 4:
+    return 0;
+  }
+  return -1;
 
   (void)imu_user_data;
 }
 
 bool mgos_imu_ak8975_read(struct mgos_imu_mag *dev, void *imu_user_data) {
-  uint8_t data[6];
-  int     drdy;
+  struct mgos_imu_ak8975_userdata *ud;
+  uint8_t data[8];
 
-  if (!dev) {
+  if (!dev || !dev->user_data) {
     return false;
   }
-
-  // Set single shot measurement
-  mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_AK8975_REG_CNTL, 0x01);
-  mgos_usleep(9500);
-
-  // Check Data Ready
-  drdy = mgos_i2c_read_reg_b(dev->i2c, dev->i2caddr, MGOS_AK8975_REG_ST1);
-  if (drdy != 0x01) {
-    return false;
+  ud         = (struct mgos_imu_ak8975_userdata *)dev->user_data;
+  dev->stale = true;
+
+  if (ud->measuring) {
+    // ST1, HXL..HZH and ST2 in one go; the data is only used if DRDY is set.
+    if (!mgos_i2c_read_reg_n(dev->i2c, dev->i2caddr, MGOS_AK8975_REG_ST1, 8, data)) {
+      return false;
+    }
+    mgos_imu_stats_i2c(dev->stats, 8);
+    if (!(data[0] & 0x01)) {
+      // Not converted yet, return the previous sample.
+      if (mgos_uptime_micros() - ud->started < MGOS_AK8975_TIMEOUT_US) {
+        return ud->have_sample;
+      }
+      LOG(LL_WARN, ("Magnetometer measurement timed out, restarting"));
+    } else if (!(data[7] & 0x0C)) {
+      // ST2 DERR and HOFL clear
+      dev->mx         = (data[2] << 8) | (data[1]);
+      dev->my         = (data[4] << 8) | (data[3]);
+      dev->mz         = (data[6] << 8) | (data[5]);
+      ud->have_sample = true;
+      dev->stale      = false;
+    }
   }
 
-  if (!mgos_i2c_read_reg_n(dev->i2c, dev->i2caddr, MGOS_AK8975_REG_XOUT_L, 6, data)) {
+  // Start the next measurement, which converts while the caller does other work.
+  if (!mgos_imu_ak8975_start(dev, ud)) {
     return false;
   }
-
-  dev->mx = (data[1] << 8) | (data[0]);
-  dev->my = (data[3] << 8) | (data[2]);
-  dev->mz = (data[5] << 8) | (data[4]);
-  return true;
+  mgos_imu_stats_i2c(dev->stats, 1);
+  return ud->have_sample;
 
   (void)imu_user_data;
 }
@@ -33,6 +33,20 @@
 #define MGOS_AK8975_REG_ASAY           (0x11)
 #define MGOS_AK8975_REG_ASAZ           (0x12)
 
+// Single measurement takes 7.3ms max. If ST1 DRDY is not set well after that,
+// the measurement was lost (eg to a chip reset) and is started again.
+#define MGOS_AK8975_MEASURE_US         (9000)
+#define MGOS_AK8975_TIMEOUT_US         (20000)
+
+// The chip only has a single measurement mode. A measurement is started at
+// the end of create and after every read, so that it converts in between
+// reads; a read before it is done returns the previous sample.
+struct mgos_imu_ak8975_userdata {
+  bool    measuring;      // A measurement was started and not yet read
+  bool    have_sample;    // mx, my and mz hold a measurement
+  int64_t started;        // mgos_uptime_micros() when measuring was set
+};
+
 bool mgos_imu_ak8975_detect(struct mgos_imu_mag *dev, void *imu_user_data);
-bool mgos_imu_ak8975_create(struct mgos_imu_mag *dev, void *imu_user_data);
+int32_t mgos_imu_ak8975_create_step(struct mgos_imu_mag *dev, void *imu_user_data, uint8_t step);
 bool mgos_imu_ak8975_read(struct mgos_imu_mag *dev, void *imu_user_data);
@@ -0,0 +1,411 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mgos.h"
+#include "mgos_i2c.h"
+#include "mgos_imu_internal.h"
+#include "mgos_imu_adxl345.h"
+#include "mgos_imu_ak8963.h"
+#include "mgos_imu_bmm150.h"
+#include "mgos_imu_hmc5883l.h"
+#include "mgos_imu_icm20948.h"
+#include "mgos_imu_itg3205.h"
+#include "mgos_imu_l3gd20.h"
+#include "mgos_imu_lsm303d.h"
+#include "mgos_imu_lsm6dsl.h"
+#include "mgos_imu_lsm9ds1.h"
+#include "mgos_imu_mag3110.h"
+#include "mgos_imu_mma8451.h"
+#include "mgos_imu_mpu60x0.h"
+#include "mgos_imu_mpu6886.h"
+#include "mgos_imu_mpu925x.h"
+#include <stdio.h>
+
+#define MGOS_IMU_AUTODETECT_MAGIC      (0x44554d49) /* "IMUD" */
+#define MGOS_IMU_AUTODETECT_VERSION    (1)
+
+// Registers read from one address, so that rules sharing a register cost one
+// transaction.
+#define MGOS_IMU_AUTODETECT_READS      (4)
+
+// A chip is identified by `value` in register `reg` at `i2caddr`. Rules for
+// the same address are kept together, most likely chip first.
+struct mgos_imu_autodetect_rule {
+  uint8_t                 i2caddr;
+  uint8_t                 reg;
+  uint8_t                 value;
+  enum mgos_imu_acc_type  acc;
+  enum mgos_imu_gyro_type gyro;
+  enum mgos_imu_mag_type  mag;
+};
+
+static const struct mgos_imu_autodetect_rule s_rules[] = {
+  { 0x68, MGOS_MPU9250_REG_WHO_AM_I,     MGOS_MPU9250_DEVID_9250,  ACC_MPU9250,   GYRO_MPU9250,  MAG_NONE      },
+  { 0x68, MGOS_MPU9250_REG_WHO_AM_I,     MGOS_MPU9250_DEVID_9255,  ACC_MPU9255,   GYRO_MPU9255,  MAG_NONE      },
+  { 0x68, MGOS_MPU60X0_REG_WHO_AM_I,     MGOS_MPU60X0_DEVID,       ACC_MPU6050,   GYRO_MPU6050,  MAG_NONE      },
+  { 0x68, MGOS_MPU60X0_REG_WHO_AM_I,     MGOS_MPU6886_DEVID,       ACC_MPU6886,   GYRO_MPU6886,  MAG_NONE      },
+  { 0x68, MGOS_ICM20948_REG0_WHO_AM_I,   MGOS_ICM20948_DEVID,      ACC_ICM20948,  GYRO_ICM20948, MAG_NONE      },
+  { 0x68, MGOS_ITG3205_REG_WHO_AM_I,     MGOS_ITG3205_DEVID,       ACC_NONE,      GYRO_ITG3205,  MAG_NONE      },
+  { 0x69, MGOS_MPU9250_REG_WHO_AM_I,     MGOS_MPU9250_DEVID_9250,  ACC_MPU9250,   GYRO_MPU9250,  MAG_NONE      },
+  { 0x69, MGOS_MPU9250_REG_WHO_AM_I,     MGOS_MPU9250_DEVID_9255,  ACC_MPU9255,   GYRO_MPU9255,  MAG_NONE      },
+  { 0x69, MGOS_MPU60X0_REG_WHO_AM_I,     MGOS_MPU60X0_DEVID,       ACC_MPU6050,   GYRO_MPU6050,  MAG_NONE      },
+  { 0x69, MGOS_MPU60X0_REG_WHO_AM_I,     MGOS_MPU6886_DEVID,       ACC_MPU6886,   GYRO_MPU6886,  MAG_NONE      },
+  { 0x69, MGOS_ICM20948_REG0_WHO_AM_I,   MGOS_ICM20948_DEVID,      ACC_ICM20948,  GYRO_ICM20948, MAG_NONE      },
+  { 0x69, MGOS_ITG3205_REG_WHO_AM_I,     MGOS_ITG3205_DEVID,       ACC_NONE,      GYRO_ITG3205,  MAG_NONE      },
+  { 0x6A, MGOS_LSM6DSL_REG_WHO_AM_I,     MGOS_LSM6DSL_DEVID,       ACC_LSM6DSL,   GYRO_LSM6DSL,  MAG_NONE      },
+  { 0x6A, MGOS_LSM9DS1_REG_WHO_AM_I,     MGOS_LSM9DS1_DEVID,       ACC_LSM9DS1,   GYRO_LSM9DS1,  MAG_NONE      },
+  { 0x6A, MGOS_L3GD20_REG_WHO_AM_I,      MGOS_L3GD20_DEVID,        ACC_NONE,      GYRO_L3GD20,   MAG_NONE      },
+  { 0x6A, MGOS_L3GD20_REG_WHO_AM_I,      MGOS_L3GD20H_DEVID,       ACC_NONE,      GYRO_L3GD20H,  MAG_NONE      },
+  { 0x6B, MGOS_LSM6DSL_REG_WHO_AM_I,     MGOS_LSM6DSL_DEVID,       ACC_LSM6DSL,   GYRO_LSM6DSL,  MAG_NONE      },
+  { 0x6B, MGOS_LSM9DS1_REG_WHO_AM_I,     MGOS_LSM9DS1_DEVID,       ACC_LSM9DS1,   GYRO_LSM9DS1,  MAG_NONE      },
+  { 0x6B, MGOS_L3GD20_REG_WHO_AM_I,      MGOS_L3GD20_DEVID,        ACC_NONE,      GYRO_L3GD20,   MAG_NONE      },
+  { 0x6B, MGOS_L3GD20_REG_WHO_AM_I,      MGOS_L3GD20H_DEVID,       ACC_NONE,      GYRO_L3GD20H,  MAG_NONE      },
+  { 0x1C, MGOS_LSM9DS1_REG_WHO_AM_I_M,   MGOS_LSM9DS1_DEVID_M,     ACC_NONE,      GYRO_NONE,     MAG_LSM9DS1   },
+  { 0x1C, MGOS_LSM303D_REG_WHO_AM_I,     MGOS_LSM303D_DEVID,       ACC_LSM303D,   GYRO_NONE,     MAG_LSM303D   },
+  { 0x1C, MGOS_LSM303D_REG_WHO_AM_I,     MGOS_LSM303DLM_DEVID,     ACC_LSM303DLM, GYRO_NONE,     MAG_LSM303DLM },
+  { 0x1C, MGOS_MMA8451_REG_WHO_AM_I,     MGOS_MMA8451_DEVID,       ACC_MMA8451,   GYRO_NONE,     MAG_NONE      },
+  { 0x1D, MGOS_LSM303D_REG_WHO_AM_I,     MGOS_LSM303D_DEVID,       ACC_LSM303D,   GYRO_NONE,     MAG_LSM303D   },
+  { 0x1D, MGOS_LSM303D_REG_WHO_AM_I,     MGOS_LSM303DLM_DEVID,     ACC_LSM303DLM, GYRO_NONE,     MAG_LSM303DLM },
+  { 0x1D, MGOS_MMA8451_REG_WHO_AM_I,     MGOS_MMA8451_DEVID,       ACC_MMA8451,   GYRO_NONE,     MAG_NONE      },
+  { 0x1D, MGOS_ADXL345_REG_WHO_AM_I,     MGOS_ADXL345_DEVID,       ACC_ADXL345,   GYRO_NONE,     MAG_NONE      },
+  { 0x53, MGOS_ADXL345_REG_WHO_AM_I,     MGOS_ADXL345_DEVID,       ACC_ADXL345,   GYRO_NONE,     MAG_NONE      },
+  { 0x1E, MGOS_LSM9DS1_REG_WHO_AM_I_M,   MGOS_LSM9DS1_DEVID_M,     ACC_NONE,      GYRO_NONE,     MAG_LSM9DS1   },
+  { 0x1E, MGOS_HMC5883L_REG_ID_A,        'H',                      ACC_NONE,      GYRO_NONE,     MAG_HMC5883L  },
+  { 0x0C, MGOS_AK8963_REG_WHO_AM_I,      MGOS_AK8963_DEVID,        ACC_NONE,      GYRO_NONE,     MAG_AK8963    },
+  { 0x0D, MGOS_AK8963_REG_WHO_AM_I,      MGOS_AK8963_DEVID,        ACC_NONE,      GYRO_NONE,     MAG_AK8963    },
+  { 0x0E, MGOS_AK8963_REG_WHO_AM_I,      MGOS_AK8963_DEVID,        ACC_NONE,      GYRO_NONE,     MAG_AK8963    },
+  { 0x0E, MGOS_MAG3110_REG_WHO_AM_I,     MGOS_MAG3110_DEVID,       ACC_NONE,      GYRO_NONE,     MAG_MAG3110   },
+  { 0x0E, MGOS_HMC5883L_REG_ID_A,        'H',                      ACC_NONE,      GYRO_NONE,     MAG_HMC5883L  },
+  { 0x0F, MGOS_AK8963_REG_WHO_AM_I,      MGOS_AK8963_DEVID,        ACC_NONE,      GYRO_NONE,     MAG_AK8963    },
+  { 0x10, MGOS_BMM150_REG_CHIPID,        MGOS_BMM150_DEVID,        ACC_NONE,      GYRO_NONE,     MAG_BMM150    },
+  { 0x11, MGOS_BMM150_REG_CHIPID,        MGOS_BMM150_DEVID,        ACC_NONE,      GYRO_NONE,     MAG_BMM150    },
+  { 0x12, MGOS_BMM150_REG_CHIPID,        MGOS_BMM150_DEVID,        ACC_NONE,      GYRO_NONE,     MAG_BMM150    },
+  { 0x13, MGOS_BMM150_REG_CHIPID,        MGOS_BMM150_DEVID,        ACC_NONE,      GYRO_NONE,     MAG_BMM150    },
+};
+
+#define MGOS_IMU_AUTODETECT_RULES      (sizeof(s_rules) / sizeof(s_rules[0]))
+
+// All members are 4 bytes wide, so there is no padding to worry about.
+struct mgos_imu_autodetect_blob {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t acc_type;
+  uint32_t acc_addr;
+  uint32_t gyro_type;
+  uint32_t gyro_addr;
+  uint32_t mag_type;
+  uint32_t mag_addr;
+  uint32_t checksum;
+};
+
+// Registers already read from the address being probed.
+struct mgos_imu_autodetect_reads {
+  uint8_t i2caddr;
+  uint8_t n;
+  uint8_t reg[MGOS_IMU_AUTODETECT_READS];
+  int     value[MGOS_IMU_AUTODETECT_READS];
+};
+
+// Private functions follow
+// FNV-1a over everything but the trailing checksum.
+static uint32_t mgos_imu_autodetect_checksum(const struct mgos_imu_autodetect_blob *blob) {
+  const uint8_t *p   = (const uint8_t *)blob;
+  uint32_t       sum = 2166136261u;
+
+  for (size_t i = 0; i < offsetof(struct mgos_imu_autodetect_blob, checksum); i++) {
+    sum ^= p[i];
+    sum *= 16777619u;
+  }
+  return sum;
+}
+
+// Returns the identification register of `rule`, or -1 if the address did not
+// answer. A BMM150 in suspend mode reads its chip ID as 0, so it is woken up
+// and read again (3 ms start-up time).
+static int mgos_imu_autodetect_read(struct mgos_i2c *i2c, const struct mgos_imu_autodetect_rule *rule, struct mgos_imu_autodetect_reads *reads) {
+  int value;
+
+  if (reads->i2caddr != rule->i2caddr) {
+    reads->i2caddr = rule->i2caddr;
+    reads->n       = 0;
+  }
+  for (int i = 0; i < reads->n; i++) {
+    if (reads->reg[i] == rule->reg) {
+      return reads->value[i];
+    }
+  }
+  value = mgos_i2c_read_reg_b(i2c, rule->i2caddr, rule->reg);
+  if (value == 0 && rule->mag == MAG_BMM150) {
+    mgos_i2c_write_reg_b(i2c, rule->i2caddr, MGOS_BMM150_REG_POWMODE, 0x01);
+    mgos_usleep(3000);
+    value = mgos_i2c_read_reg_b(i2c, rule->i2caddr, rule->reg);
+  }
+  if (reads->n < MGOS_IMU_AUTODETECT_READS) {
+    reads->reg[reads->n]   = rule->reg;
+    reads->value[reads->n] = value;
+    reads->n++;
+  }
+  return value;
+}
+
+// Rules whose sensors have all been found are skipped.
+static bool mgos_imu_autodetect_wanted(const struct mgos_imu_autodetect_rule *rule, const struct mgos_imu_autodetect *found) {
+  return (rule->acc != ACC_NONE && found->acc_type == ACC_NONE) ||
+         (rule->gyro != GYRO_NONE && found->gyro_type == GYRO_NONE) ||
+         (rule->mag != MAG_NONE && found->mag_type == MAG_NONE);
+}
+
+static void mgos_imu_autodetect_take(const struct mgos_imu_autodetect_rule *rule, struct mgos_imu_autodetect *found) {
+  if (rule->acc != ACC_NONE && found->acc_type == ACC_NONE) {
+    found->acc_type = rule->acc;
+    found->acc_addr = rule->i2caddr;
+  }
+  if (rule->gyro != GYRO_NONE && found->gyro_type == GYRO_NONE) {
+    found->gyro_type = rule->gyro;
+    found->gyro_addr = rule->i2caddr;
+  }
+  if (rule->mag != MAG_NONE && found->mag_type == MAG_NONE) {
+    found->mag_type = rule->mag;
+    found->mag_addr = rule->i2caddr;
+  }
+}
+
+// Probe the rules for `only_mag` or all sensors, reading each register of
+// each address once, and giving up on an address as soon as it fails to
+// answer or one of its rules matches.
+static void mgos_imu_autodetect_probe(struct mgos_i2c *i2c, struct mgos_imu_autodetect *found, bool only_mag) {
+  struct mgos_imu_autodetect_reads reads;
+  int skip_addr = -1;
+  int value;
+
+  memset(&reads, 0, sizeof(reads));
+  reads.i2caddr = 0xff;
+  for (size_t i = 0; i < MGOS_IMU_AUTODETECT_RULES; i++) {
+    const struct mgos_imu_autodetect_rule *rule = &s_rules[i];
+
+    if (rule->i2caddr == skip_addr || (only_mag && rule->mag == MAG_NONE)) {
+      continue;
+    }
+    if (!mgos_imu_autodetect_wanted(rule, found)) {
+      continue;
+    }
+    value = mgos_imu_autodetect_read(i2c, rule, &reads);
+    if (value < 0 || value == rule->value) {
+      skip_addr = rule->i2caddr;
+    }
+    if (value == rule->value) {
+      LOG(LL_DEBUG, ("Autodetect found 0x%02x at I2C 0x%02x", value, rule->i2caddr));
+      mgos_imu_autodetect_take(rule, found);
+    }
+  }
+}
+
+// The magnetometer of an MPU9250 or ICM20948 is only visible on the bus with
+// the I2C bypass of its host chip enabled.
+static void mgos_imu_autodetect_bypass(struct mgos_i2c *i2c, const struct mgos_imu_autodetect *found) {
+  switch (found->acc_type) {
+  case ACC_MPU9250:
+  case ACC_MPU9255:
+  case ACC_MPU6000:
+  case ACC_MPU6050:
+    mgos_i2c_setbits_reg_b(i2c, found->acc_addr, MGOS_MPU9250_REG_INT_PIN_CFG, 1, 1, 1);
+    break;
+
+  case ACC_ICM20948:
+    // Also wakes the chip up, so that the bypass takes effect.
+    mgos_i2c_write_reg_b(i2c, found->acc_addr, MGOS_ICM20948_REG0_PWR_MGMT_1, 0x01);
+    mgos_i2c_write_reg_b(i2c, found->acc_addr, MGOS_ICM20948_REG0_INT_PIN_CFG, 0x02);
+    break;
+
+  default:
+    break;
+  }
+}
+
+// AK8963, AK8975 and the AK09916 in the ICM20948 share a WHO_AM_I, so tell
+// them apart by the chip that hosts them.
+static void mgos_imu_autodetect_pair(struct mgos_imu_autodetect *found) {
+  if (found->mag_type != MAG_AK8963) {
+    return;
+  }
+  switch (found->acc_type) {
+  case ACC_ICM20948:
+    found->mag_type = MAG_ICM20948;
+    break;
+
+  case ACC_MPU6000:
+  case ACC_MPU6050:
+    // MPU9150
+    found->mag_type = MAG_AK8975;
+    break;
+
+  default:
+    break;
+  }
+}
+
+static void mgos_imu_autodetect_scan(struct mgos_i2c *i2c, struct mgos_imu_autodetect *found) {
+  memset(found, 0, sizeof(*found));
+  mgos_imu_autodetect_probe(i2c, found, false);
+  if (found->mag_type == MAG_NONE && found->acc_type != ACC_NONE) {
+    mgos_imu_autodetect_bypass(i2c, found);
+    mgos_imu_autodetect_probe(i2c, found, true);
+  }
+  mgos_imu_autodetect_pair(found);
+}
+
+// Returns the first rule identifying a sensor of this type at `i2caddr`.
+static const struct mgos_imu_autodetect_rule *mgos_imu_autodetect_find_rule(uint8_t i2caddr, int acc, int gyro, int mag) {
+  for (size_t i = 0; i < MGOS_IMU_AUTODETECT_RULES; i++) {
+    const struct mgos_imu_autodetect_rule *rule = &s_rules[i];
+
+    if (rule->i2caddr != i2caddr) {
+      continue;
+    }
+    if ((acc != ACC_NONE && (int)rule->acc == acc) ||
+        (gyro != GYRO_NONE && (int)rule->gyro == gyro) ||
+        (mag != MAG_NONE && (int)rule->mag == mag)) {
+      return rule;
+    }
+  }
+  return NULL;
+}
+
+// Check a cached result with one identification read per chip.
+static bool mgos_imu_autodetect_verify(struct mgos_i2c *i2c, const struct mgos_imu_autodetect *found) {
+  struct mgos_imu_autodetect_reads       reads;
+  const struct mgos_imu_autodetect_rule *rule;
+  int mag                                      = found->mag_type;
+
+  memset(&reads, 0, sizeof(reads));
+  reads.i2caddr = 0xff;
+  if (found->acc_type != ACC_NONE) {
+    rule = mgos_imu_autodetect_find_rule(found->acc_addr, found->acc_type, GYRO_NONE, MAG_NONE);
+    if (!rule || mgos_imu_autodetect_read(i2c, rule, &reads) != rule->value) {
+      return false;
+    }
+  }
+  if (found->gyro_type != GYRO_NONE) {
+    rule = mgos_imu_autodetect_find_rule(found->gyro_addr, ACC_NONE, found->gyro_type, MAG_NONE);
+    if (!rule || mgos_imu_autodetect_read(i2c, rule, &reads) != rule->value) {
+      return false;
+    }
+  }
+  if (mag != MAG_NONE) {
+    if (mag == MAG_ICM20948 || mag == MAG_AK8975) {
+      mag = MAG_AK8963;
+    }
+    rule = mgos_imu_autodetect_find_rule(found->mag_addr, ACC_NONE, GYRO_NONE, mag);
+    if (!rule) {
+      return false;
+    }
+    if (mgos_imu_autodetect_read(i2c, rule, &reads) != rule->value) {
+      // Behind a host chip that was reset since.
+      mgos_imu_autodetect_bypass(i2c, found);
+      reads.n = 0;
+      if (mgos_imu_autodetect_read(i2c, rule, &reads) != rule->value) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+static bool mgos_imu_autodetect_load(const char *filename, struct mgos_imu_autodetect *found) {
+  struct mgos_imu_autodetect_blob blob;
+  FILE *fp;
+  size_t len;
+
+  if (!(fp = fopen(filename, "rb"))) {
+    return false;
+  }
+  len = fread(&blob, 1, sizeof(blob), fp);
+  fclose(fp);
+  if (len != sizeof(blob) || blob.magic != MGOS_IMU_AUTODETECT_MAGIC || blob.version != MGOS_IMU_AUTODETECT_VERSION) {
+    return false;
+  }
+  if (blob.checksum != mgos_imu_autodetect_checksum(&blob)) {
+    LOG(LL_WARN, ("IMU autodetect cache has bad checksum, ignoring"));
+    return false;
+  }
+  found->acc_type  = blob.acc_type;
+  found->acc_addr  = blob.acc_addr;
+  found->gyro_type = blob.gyro_type;
+  found->gyro_addr = blob.gyro_addr;
+  found->mag_type  = blob.mag_type;
+  found->mag_addr  = blob.mag_addr;
+  return true;
+}
+
+static bool mgos_imu_autodetect_save(const char *filename, const struct mgos_imu_autodetect *found) {
+  struct mgos_imu_autodetect_blob blob;
+  FILE *fp;
+  bool  ret;
+
+  memset(&blob, 0, sizeof(blob));
+  blob.magic     = MGOS_IMU_AUTODETECT_MAGIC;
+  blob.version   = MGOS_IMU_AUTODETECT_VERSION;
+  blob.acc_type  = found->acc_type;
+  blob.acc_addr  = found->acc_addr;
+  blob.gyro_type = found->gyro_type;
+  blob.gyro_addr = found->gyro_addr;
+  blob.mag_type  = found->mag_type;
+  blob.mag_addr  = found->mag_addr;
+  blob.checksum  = mgos_imu_autodetect_checksum(&blob);
+  if (!(fp = fopen(filename, "wb"))) {
+    LOG(LL_ERROR, ("Could not open %s for writing", filename));
+    return false;
+  }
+  ret = (fwrite(&blob, 1, sizeof(blob), fp) == sizeof(blob));
+  if (fclose(fp) != 0) {
+    ret = false;
+  }
+  if (!ret) {
+    LOG(LL_ERROR, ("Could not write IMU autodetect cache to %s", filename));
+  }
+  return ret;
+}
+
+// Private functions end
+
+// Public functions follow
+bool mgos_imu_autodetect(struct mgos_i2c *i2c, const char *filename, struct mgos_imu_autodetect *found) {
+  if (!i2c || !found) {
+    return false;
+  }
+  memset(found, 0, sizeof(*found));
+  if (filename && mgos_imu_autodetect_load(filename, found)) {
+    if (mgos_imu_autodetect_verify(i2c, found)) {
+      LOG(LL_DEBUG, ("IMU autodetect cache in %s verified", filename));
+      return found->acc_type != ACC_NONE || found->gyro_type != GYRO_NONE || found->mag_type != MAG_NONE;
+    }
+    LOG(LL_INFO, ("IMU autodetect cache in %s is stale, rescanning", filename));
+  }
+
+  mgos_imu_autodetect_scan(i2c, found);
+  if (found->acc_type == ACC_NONE && found->gyro_type == GYRO_NONE && found->mag_type == MAG_NONE) {
+    LOG(LL_ERROR, ("No IMU found"));
+    return false;
+  }
+  LOG(LL_INFO, ("Autodetected accelerometer type %d at I2C 0x%02x, gyroscope type %d at I2C 0x%02x, magnetometer type %d at I2C 0x%02x",
+                found->acc_type, found->acc_addr, found->gyro_type, found->gyro_addr, found->mag_type, found->mag_addr));
+  if (filename) {
+    mgos_imu_autodetect_save(filename, found);
+  }
+  return true;
+}
+
+// Public functions end
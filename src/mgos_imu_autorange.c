@@ -0,0 +1,106 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mgos.h"
+#include "mgos_imu_internal.h"
+
+// Samples at or over MGOS_IMU_AUTORANGE_HIGH step the range up, and the range
+// steps down once samples stay under MGOS_IMU_AUTORANGE_LOW, which is 80% of
+// the next range down.
+#define MGOS_IMU_AUTORANGE_CLIP      (32760)
+#define MGOS_IMU_AUTORANGE_HIGH      (32112)    // 98%
+#define MGOS_IMU_AUTORANGE_LOW       (13107)    // 40%
+
+// Used when the sensor's data rate is not known.
+#define MGOS_IMU_AUTORANGE_SETTLE_US (20000)
+
+// Private functions follow
+static int32_t mgos_imu_autorange_peak(int16_t x, int16_t y, int16_t z) {
+  int32_t v[3] = { x, y, z };
+  int32_t peak = 0;
+
+  for (int i = 0; i < 3; i++) {
+    if (v[i] < 0) {
+      v[i] = -v[i];
+    }
+    if (v[i] > peak) {
+      peak = v[i];
+    }
+  }
+  return peak;
+}
+
+// Private functions end
+
+// Public functions follow
+bool mgos_imu_autorange_clipped(int16_t x, int16_t y, int16_t z) {
+  return mgos_imu_autorange_peak(x, y, z) >= MGOS_IMU_AUTORANGE_CLIP;
+}
+
+int mgos_imu_autorange_check(struct mgos_imu_autorange *ar, int16_t x, int16_t y, int16_t z) {
+  int32_t peak = mgos_imu_autorange_peak(x, y, z);
+  int64_t now;
+
+  if (!ar || !ar->enabled) {
+    return 0;
+  }
+  if (peak >= MGOS_IMU_AUTORANGE_HIGH) {
+    ar->low_since = 0;
+    return 1;
+  }
+  if (peak >= MGOS_IMU_AUTORANGE_LOW) {
+    ar->low_since = 0;
+    return 0;
+  }
+  now = mgos_uptime_micros();
+  if (ar->low_since == 0) {
+    ar->low_since = now;
+    return 0;
+  }
+  if (now - ar->low_since < (int64_t)ar->hold_ms * 1000) {
+    return 0;
+  }
+  ar->low_since = 0;
+  return -1;
+}
+
+void mgos_imu_autorange_switched(struct mgos_imu_autorange *ar, float odr) {
+  int64_t settle_us = MGOS_IMU_AUTORANGE_SETTLE_US;
+
+  if (!ar) {
+    return;
+  }
+  // The output registers hold a sample at the old range until the next one is
+  // taken; wait out two sample periods to be sure.
+  if (odr > 0) {
+    settle_us = (int64_t)(2e6f / odr);
+  }
+  ar->low_since    = 0;
+  ar->settle_until = mgos_uptime_micros() + settle_us;
+}
+
+bool mgos_imu_autorange_settling(struct mgos_imu_autorange *ar) {
+  if (!ar || ar->settle_until == 0) {
+    return false;
+  }
+  if (mgos_uptime_micros() < ar->settle_until) {
+    return true;
+  }
+  ar->settle_until = 0;
+  return false;
+}
+
+// Public functions end
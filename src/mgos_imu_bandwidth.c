@@ -0,0 +1,41 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mgos.h"
+#include "mgos_imu_internal.h"
+
+// Private functions follow
+// Private functions end
+
+// Driver helpers follow
+int mgos_imu_bandwidth_pick(const float *cutoffs, int n, float hertz) {
+  int best = -1, lowest = -1;
+
+  for (int i = 0; i < n; i++) {
+    if (cutoffs[i] <= 0) {
+      continue;
+    }
+    if (cutoffs[i] <= hertz && (best < 0 || cutoffs[i] > cutoffs[best])) {
+      best = i;
+    }
+    if (lowest < 0 || cutoffs[i] < cutoffs[lowest]) {
+      lowest = i;
+    }
+  }
+  return best >= 0 ? best : lowest;
+}
+
+// Driver helpers end
@@ -42,42 +42,49 @@ bool mgos_imu_bmm150_detect(struct mgos_imu_mag *dev, void *imu_user_data) {
   (void)imu_user_data;
 }
 
-bool mgos_imu_bmm150_create(struct mgos_imu_mag *dev, void *imu_user_data) {
+int32_t mgos_imu_bmm150_create_step(struct mgos_imu_mag *dev, void *imu_user_data, uint8_t step) {
   struct mgos_imu_bmm150_trim_registers *imud;
 
   if (!dev) {
-    return false;
+    return -1;
   }
 
-  imud = calloc(1, sizeof(struct mgos_imu_bmm150_trim_registers));
-  if (!imud) {
-    return false;
+  switch (step) {
+  case 0:
+    imud = calloc(1, sizeof(struct mgos_imu_bmm150_trim_registers));
+    if (!imud) {
+      return -1;
+    }
+    dev->user_data = imud;
+
+    // Exit from Suspend mode
+    mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_BMM150_REG_POWMODE, 0x01);
+    return 5000;
+
+  case 1:
+    // Soft Reset
+    mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_BMM150_REG_POWMODE, 0x83);
+    return 5000;
+
+  case 2:
+    // Regular repetition rate, active mode 10 Hz ODR, noise 0.6 uT RMS
+    mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_BMM150_REG_OPMODE, 0x00);
+    // datasheet page 31, table 3 in page 13. Bosch API sets as if 1+2REPZ (?)
+    mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_BMM150_REG_REPXY,
+                         4); //  9; 1+2REPXY
+    mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_BMM150_REG_REPZ,
+                         14); // 15; 1+REPZ
+    return 5000;
+
+  case 3:
+    dev->scale = 0.3;
+    dev->bias[0] = 1.0;
+    dev->bias[1] = 1.0;
+    dev->bias[2] = 1.0;
+
+    return read_trim_registers(dev) ? 0 : -1;
   }
-  dev->user_data = imud;
-
-  // Exit from Suspend mode
-  mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_BMM150_REG_POWMODE, 0x01);
-  mgos_usleep(5000);
-
-  // Soft Reset
-  mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_BMM150_REG_POWMODE, 0x83);
-  mgos_usleep(5000);
-
-  // Regular repetition rate, active mode 10 Hz ODR, noise 0.6 uT RMS
-  mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_BMM150_REG_OPMODE, 0x00);
-  // datasheet page 31, table 3 in page 13. Bosch API sets as if 1+2REPZ (?)
-  mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_BMM150_REG_REPXY,
-                       4); //  9; 1+2REPXY
-  mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_BMM150_REG_REPZ,
-                       14); // 15; 1+REPZ
-  mgos_usleep(5000);
-
-  dev->scale = 0.3;
-  dev->bias[0] = 1.0;
-  dev->bias[1] = 1.0;
-  dev->bias[2] = 1.0;
-
-  return read_trim_registers(dev);
+  return -1;
 
   (void)imu_user_data;
 }
@@ -96,6 +103,7 @@ bool mgos_imu_bmm150_read(struct mgos_imu_mag *dev, void *imu_user_data) {
                            reg_data)) {
     return false;
   }
+  mgos_imu_stats_i2c(dev->stats, 8);
 
   raw_datax = (((int8_t)reg_data[1]) << 5) |
               (((uint8_t)(reg_data[0] & 0xF8) >> 3)); // 13-bits LSB first
@@ -66,5 +66,5 @@
 
 
 bool mgos_imu_bmm150_detect(struct mgos_imu_mag *dev, void *imu_user_data);
-bool mgos_imu_bmm150_create(struct mgos_imu_mag *dev, void *imu_user_data);
+int32_t mgos_imu_bmm150_create_step(struct mgos_imu_mag *dev, void *imu_user_data, uint8_t step);
 bool mgos_imu_bmm150_read(struct mgos_imu_mag *dev, void *imu_user_data);
@@ -0,0 +1,115 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mgos.h"
+#include "mgos_imu_internal.h"
+
+struct mgos_imu_create_ctx {
+  struct mgos_imu *       imu;
+  mgos_imu_create_step_fn step_fn;
+  mgos_imu_create_done_fn done_fn;
+  mgos_imu_create_cb      cb;
+  void *                  cb_arg;
+  uint8_t                 step;
+  mgos_timer_id           timer_id;
+};
+
+// Private functions follow
+static void mgos_imu_create_timer_cb(void *arg) {
+  struct mgos_imu_create_ctx *ctx = (struct mgos_imu_create_ctx *)arg;
+  struct mgos_imu *           imu;
+  mgos_imu_create_cb          cb;
+  void *                      cb_arg;
+  int32_t                     delay_us;
+  bool                        ok;
+
+  ctx->timer_id = MGOS_INVALID_TIMER_ID;
+  delay_us      = ctx->step_fn(ctx->imu, ctx->step++);
+  if (delay_us > 0 && ctx->step < MGOS_IMU_CREATE_MAX_STEPS) {
+    // Timers have millisecond resolution, never wait less than asked for.
+    ctx->timer_id = mgos_set_timer((delay_us + 999) / 1000, 0, mgos_imu_create_timer_cb, ctx);
+    if (ctx->timer_id != MGOS_INVALID_TIMER_ID) {
+      return;
+    }
+    LOG(LL_ERROR, ("Could not schedule sensor create step %u", ctx->step));
+  }
+
+  // done() clears the sensor's pointer to ctx, and may destroy the sensor.
+  imu    = ctx->imu;
+  cb     = ctx->cb;
+  cb_arg = ctx->cb_arg;
+  ok     = ctx->done_fn(imu, delay_us == 0);
+  free(ctx);
+  if (cb) {
+    cb(imu, ok, cb_arg);
+  }
+}
+
+// Private functions end
+
+// Public functions follow
+bool mgos_imu_create_run(struct mgos_imu *imu, mgos_imu_create_step_fn step) {
+  int32_t delay_us;
+
+  if (!imu || !step) {
+    return false;
+  }
+  for (uint8_t i = 0; i < MGOS_IMU_CREATE_MAX_STEPS; i++) {
+    delay_us = step(imu, i);
+    if (delay_us <= 0) {
+      return delay_us == 0;
+    }
+    mgos_usleep(delay_us);
+  }
+  return false;
+}
+
+struct mgos_imu_create_ctx *mgos_imu_create_start(struct mgos_imu *imu, mgos_imu_create_step_fn step, mgos_imu_create_done_fn done, mgos_imu_create_cb cb, void *cb_arg) {
+  struct mgos_imu_create_ctx *ctx;
+
+  if (!imu || !step || !done) {
+    return NULL;
+  }
+  ctx = calloc(1, sizeof(struct mgos_imu_create_ctx));
+  if (!ctx) {
+    return NULL;
+  }
+  ctx->imu     = imu;
+  ctx->step_fn = step;
+  ctx->done_fn = done;
+  ctx->cb      = cb;
+  ctx->cb_arg  = cb_arg;
+  // Also the first step runs from a timer, so that `cb` is never called
+  // before the caller has seen the return value.
+  ctx->timer_id = mgos_set_timer(0, 0, mgos_imu_create_timer_cb, ctx);
+  if (ctx->timer_id == MGOS_INVALID_TIMER_ID) {
+    free(ctx);
+    return NULL;
+  }
+  return ctx;
+}
+
+void mgos_imu_create_cancel(struct mgos_imu_create_ctx *ctx) {
+  if (!ctx) {
+    return;
+  }
+  if (ctx->timer_id != MGOS_INVALID_TIMER_ID) {
+    mgos_clear_timer(ctx->timer_id);
+  }
+  free(ctx);
+}
+
+// Public functions end
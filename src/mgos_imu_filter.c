@@ -0,0 +1,280 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mgos.h"
+#include "mgos_imu_internal.h"
+#include <math.h>
+
+#define MGOS_IMU_FILTER_DEFAULT_Q    (0.7071f)
+
+// One stage of the chain. The per axis state lives in the chain's `buf`,
+// starting at `offset`, for the axes in `opts.axes` only: two floats per axis
+// for the biquads (transposed direct form II), the running sum followed by the
+// window for moving averages, and the window for medians.
+struct mgos_imu_filter_state {
+  struct mgos_imu_filter_stage opts;
+  float                        b0, b1, b2, a1, a2;
+  bool                         bypass;  // Frequency at or above odr/2
+  bool                         primed;  // State set up from a first sample
+  uint8_t                      pos;     // Next window slot
+  uint8_t                      count;   // Filled window slots
+  uint16_t                     offset;
+};
+
+struct mgos_imu_filter {
+  float                        odr;
+  uint8_t                      num_stages;
+  struct mgos_imu_filter_state stages[MGOS_IMU_FILTER_MAX_STAGES];
+  float                        buf[];
+};
+
+// Private functions follow
+static uint8_t mgos_imu_filter_num_axes(uint8_t axes) {
+  return ((axes & MGOS_IMU_FILTER_AXIS_X) ? 1 : 0) + ((axes & MGOS_IMU_FILTER_AXIS_Y) ? 1 : 0) + ((axes & MGOS_IMU_FILTER_AXIS_Z) ? 1 : 0);
+}
+
+// Floats of state per axis.
+static uint16_t mgos_imu_filter_state_len(const struct mgos_imu_filter_stage *stage) {
+  switch (stage->type) {
+  case MGOS_IMU_FILTER_LOWPASS:
+  case MGOS_IMU_FILTER_NOTCH: return 2;
+
+  case MGOS_IMU_FILTER_MOVING_AVG: return stage->len + 1;
+
+  case MGOS_IMU_FILTER_MEDIAN: return stage->len;
+  }
+  return 0;
+}
+
+static bool mgos_imu_filter_stage_valid(const struct mgos_imu_filter_stage *stage) {
+  if (stage->axes & ~MGOS_IMU_FILTER_AXIS_ALL) {
+    return false;
+  }
+  switch (stage->type) {
+  case MGOS_IMU_FILTER_LOWPASS:
+  case MGOS_IMU_FILTER_NOTCH: return stage->freq > 0 && stage->q >= 0;
+
+  case MGOS_IMU_FILTER_MOVING_AVG: return stage->len > 0 && stage->len <= MGOS_IMU_FILTER_MAX_WINDOW;
+
+  case MGOS_IMU_FILTER_MEDIAN: return stage->len > 0 && stage->len <= MGOS_IMU_FILTER_MAX_MEDIAN && (stage->len & 1);
+  }
+  return false;
+}
+
+// Biquad coefficients from the Audio EQ Cookbook (R. Bristow-Johnson).
+static void mgos_imu_filter_biquad(struct mgos_imu_filter_state *st, float odr) {
+  float w0, cs, alpha, a0;
+
+  if (st->opts.freq >= odr / 2) {
+    st->bypass = true;
+    return;
+  }
+  // Coming out of bypass, the state is stale.
+  if (st->bypass) {
+    st->bypass = false;
+    st->primed = false;
+  }
+  w0    = 2.f * (float)M_PI * st->opts.freq / odr;
+  cs    = cosf(w0);
+  alpha = sinf(w0) / (2.f * st->opts.q);
+  a0    = 1.f + alpha;
+  if (st->opts.type == MGOS_IMU_FILTER_LOWPASS) {
+    st->b0 = (1.f - cs) / 2.f / a0;
+    st->b1 = (1.f - cs) / a0;
+    st->b2 = st->b0;
+  } else {
+    st->b0 = 1.f / a0;
+    st->b1 = -2.f * cs / a0;
+    st->b2 = st->b0;
+  }
+  st->a1 = -2.f * cs / a0;
+  st->a2 = (1.f - alpha) / a0;
+}
+
+static float mgos_imu_filter_median(const float *win, uint8_t n) {
+  float sorted[MGOS_IMU_FILTER_MAX_MEDIAN], v;
+  int   j;
+
+  for (uint8_t i = 0; i < n; i++) {
+    v = win[i];
+    for (j = i - 1; j >= 0 && sorted[j] > v; j--) {
+      sorted[j + 1] = sorted[j];
+    }
+    sorted[j + 1] = v;
+  }
+  return sorted[n / 2];
+}
+
+static void mgos_imu_filter_stage_run(struct mgos_imu_filter_state *st, float *state, float v[3]) {
+  float   *s, *win, y;
+  uint16_t len = mgos_imu_filter_state_len(&st->opts);
+  uint8_t  n;
+
+  for (int axis = 0; axis < 3; axis++) {
+    if (!(st->opts.axes & (1 << axis))) {
+      continue;
+    }
+    s      = state;
+    state += len;
+    switch (st->opts.type) {
+    case MGOS_IMU_FILTER_LOWPASS:
+    case MGOS_IMU_FILTER_NOTCH:
+      if (st->bypass) {
+        break;
+      }
+      // Both filters have unity gain at DC, so priming with the first sample
+      // as the steady state starts them without a step.
+      if (!st->primed) {
+        s[1] = (st->b2 - st->a2) * v[axis];
+        s[0] = (st->b1 + st->b2 - st->a1 - st->a2) * v[axis];
+      }
+      y       = st->b0 * v[axis] + s[0];
+      s[0]    = st->b1 * v[axis] - st->a1 * y + s[1];
+      s[1]    = st->b2 * v[axis] - st->a2 * y;
+      v[axis] = y;
+      break;
+
+    case MGOS_IMU_FILTER_MOVING_AVG:
+      win = &s[1];
+      if (st->count == 0) {
+        s[0] = 0;
+      } else if (st->count == st->opts.len) {
+        s[0] -= win[st->pos];
+      }
+      win[st->pos] = v[axis];
+      s[0]        += v[axis];
+      // Start the sum over once per window, so that rounding errors do not pile up.
+      if (st->pos == st->opts.len - 1) {
+        s[0] = 0;
+        for (uint8_t i = 0; i < st->opts.len; i++) {
+          s[0] += win[i];
+        }
+      }
+      n       = st->count < st->opts.len ? st->count + 1 : st->opts.len;
+      v[axis] = s[0] / n;
+      break;
+
+    case MGOS_IMU_FILTER_MEDIAN:
+      s[st->pos] = v[axis];
+      n          = st->count < st->opts.len ? st->count + 1 : st->opts.len;
+      // Windows fill up from slot 0, so the first `n` slots are the ones in use.
+      v[axis] = mgos_imu_filter_median(s, n);
+      break;
+    }
+  }
+  st->primed = true;
+  if (st->opts.type == MGOS_IMU_FILTER_MOVING_AVG || st->opts.type == MGOS_IMU_FILTER_MEDIAN) {
+    st->pos = (st->pos + 1) % st->opts.len;
+    if (st->count < st->opts.len) {
+      st->count++;
+    }
+  }
+}
+
+// Private functions end
+
+// Public functions follow
+struct mgos_imu_filter *mgos_imu_filter_create(const struct mgos_imu_filter_stage *stages, uint8_t num_stages, float odr) {
+  struct mgos_imu_filter *f;
+  size_t floats = 0;
+
+  if (!stages || num_stages < 1 || num_stages > MGOS_IMU_FILTER_MAX_STAGES || odr <= 0) {
+    return NULL;
+  }
+  for (uint8_t i = 0; i < num_stages; i++) {
+    if (!mgos_imu_filter_stage_valid(&stages[i])) {
+      return NULL;
+    }
+    if ((stages[i].type == MGOS_IMU_FILTER_LOWPASS || stages[i].type == MGOS_IMU_FILTER_NOTCH) && stages[i].freq >= odr / 2) {
+      return NULL;
+    }
+    floats += mgos_imu_filter_state_len(&stages[i]) * mgos_imu_filter_num_axes(stages[i].axes ? stages[i].axes : MGOS_IMU_FILTER_AXIS_ALL);
+  }
+
+  f = calloc(1, sizeof(struct mgos_imu_filter) + floats * sizeof(float));
+  if (!f) {
+    return NULL;
+  }
+  f->num_stages = num_stages;
+  floats        = 0;
+  for (uint8_t i = 0; i < num_stages; i++) {
+    struct mgos_imu_filter_state *st = &f->stages[i];
+
+    st->opts = stages[i];
+    if (st->opts.axes == 0) {
+      st->opts.axes = MGOS_IMU_FILTER_AXIS_ALL;
+    }
+    if (st->opts.q == 0) {
+      st->opts.q = MGOS_IMU_FILTER_DEFAULT_Q;
+    }
+    st->offset = floats;
+    floats    += mgos_imu_filter_state_len(&st->opts) * mgos_imu_filter_num_axes(st->opts.axes);
+  }
+  mgos_imu_filter_set_odr(f, odr);
+  return f;
+}
+
+bool mgos_imu_filter_destroy(struct mgos_imu_filter **filter) {
+  if (!filter || !*filter) {
+    return false;
+  }
+  free(*filter);
+  *filter = NULL;
+  return true;
+}
+
+bool mgos_imu_filter_set_odr(struct mgos_imu_filter *filter, float odr) {
+  struct mgos_imu_filter_state *st;
+
+  if (!filter || odr <= 0) {
+    return false;
+  }
+  filter->odr = odr;
+  for (uint8_t i = 0; i < filter->num_stages; i++) {
+    st = &filter->stages[i];
+    if (st->opts.type == MGOS_IMU_FILTER_LOWPASS || st->opts.type == MGOS_IMU_FILTER_NOTCH) {
+      mgos_imu_filter_biquad(st, odr);
+    }
+  }
+  return true;
+}
+
+bool mgos_imu_filter_reset(struct mgos_imu_filter *filter) {
+  if (!filter) {
+    return false;
+  }
+  for (uint8_t i = 0; i < filter->num_stages; i++) {
+    filter->stages[i].pos    = 0;
+    filter->stages[i].count  = 0;
+    filter->stages[i].primed = false;
+  }
+  return true;
+}
+
+bool mgos_imu_filter_process(struct mgos_imu_filter *filter, float *xyz, size_t n) {
+  if (!filter || (!xyz && n > 0)) {
+    return false;
+  }
+  for (size_t i = 0; i < n; i++) {
+    for (uint8_t j = 0; j < filter->num_stages; j++) {
+      struct mgos_imu_filter_state *st = &filter->stages[j];
+      mgos_imu_filter_stage_run(st, &filter->buf[st->offset], &xyz[i * 3]);
+    }
+  }
+  return true;
+}
+
+// Public functions end
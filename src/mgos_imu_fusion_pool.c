@@ -0,0 +1,406 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef __linux__
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "mgos.h"
+#include "mgos_imu_fusion_pool.h"
+#include "madgwick.h"
+
+// Samples per read/update/write round trip.
+#define MGOS_IMU_FUSION_CHUNK    (256)
+
+// Per worker double ended queue of stream indices. The owner pushes and pops
+// at the bottom, thieves take from the top, so that a worker keeps working on
+// its own shard while idle workers drain the others.
+struct mgos_imu_fusion_deque {
+  pthread_mutex_t lock;
+  size_t *        items;
+  size_t          top, bottom;
+};
+
+struct mgos_imu_fusion_pool;
+
+struct mgos_imu_fusion_worker {
+  struct mgos_imu_fusion_pool *  pool;
+  struct mgos_imu_fusion_deque   deque;
+  pthread_t                      thread;
+  int                            id;
+  struct mgos_imu_fusion_sample *in;   // Chunk buffers, allocated before the thread starts
+  struct mgos_imu_fusion_output *out;
+  uint64_t                       samples;
+  uint32_t                       streams;
+  uint32_t                       streams_failed;
+  uint32_t                       steals;
+};
+
+struct mgos_imu_fusion_pool {
+  const struct mgos_imu_fusion_engine *engine;
+  const void *                         engine_cfg;
+  struct mgos_imu_fusion_stream *      streams;
+  struct mgos_imu_fusion_worker *      workers;
+  int                                  n_workers;
+};
+
+// Private functions follow
+static bool mgos_imu_fusion_deque_pop(struct mgos_imu_fusion_deque *dq, size_t *item) {
+  bool ret = false;
+
+  pthread_mutex_lock(&dq->lock);
+  if (dq->bottom > dq->top) {
+    *item = dq->items[--dq->bottom];
+    ret   = true;
+  }
+  pthread_mutex_unlock(&dq->lock);
+  return ret;
+}
+
+static bool mgos_imu_fusion_deque_steal(struct mgos_imu_fusion_deque *dq, size_t *item) {
+  bool ret = false;
+
+  pthread_mutex_lock(&dq->lock);
+  if (dq->bottom > dq->top) {
+    *item = dq->items[dq->top++];
+    ret   = true;
+  }
+  pthread_mutex_unlock(&dq->lock);
+  return ret;
+}
+
+// Streams are never added once the pool runs, so a worker that finds its own
+// deque and all others empty is done.
+static bool mgos_imu_fusion_next(struct mgos_imu_fusion_worker *w, size_t *item) {
+  struct mgos_imu_fusion_pool *pool = w->pool;
+
+  if (mgos_imu_fusion_deque_pop(&w->deque, item)) {
+    return true;
+  }
+  for (int i = 1; i < pool->n_workers; i++) {
+    struct mgos_imu_fusion_worker *victim = &pool->workers[(w->id + i) % pool->n_workers];
+    if (mgos_imu_fusion_deque_steal(&victim->deque, item)) {
+      w->steals++;
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool mgos_imu_fusion_process(struct mgos_imu_fusion_worker *w, struct mgos_imu_fusion_stream *stream,
+                                    struct mgos_imu_fusion_sample *in, struct mgos_imu_fusion_output *out) {
+  const struct mgos_imu_fusion_engine *engine = w->pool->engine;
+  void *state;
+  int   n;
+  bool  ret = true;
+
+  if (!stream->read || !stream->write) {
+    return false;
+  }
+  // Created on the worker thread, so the state is allocated close to its core.
+  state = engine->create(w->pool->engine_cfg);
+  if (!state) {
+    return false;
+  }
+  while ((n = stream->read(stream->ctx, in, MGOS_IMU_FUSION_CHUNK)) > 0) {
+    if (!engine->update(state, in, out, (size_t)n) || !stream->write(stream->ctx, out, (size_t)n)) {
+      ret = false;
+      break;
+    }
+    w->samples += (uint64_t)n;
+  }
+  if (n < 0) {
+    ret = false;
+  }
+  engine->destroy(state);
+  return ret;
+}
+
+static void *mgos_imu_fusion_worker_main(void *arg) {
+  struct mgos_imu_fusion_worker *w = (struct mgos_imu_fusion_worker *)arg;
+  size_t item;
+
+  while (mgos_imu_fusion_next(w, &item)) {
+    struct mgos_imu_fusion_stream *stream = &w->pool->streams[item];
+
+    stream->failed = !mgos_imu_fusion_process(w, stream, w->in, w->out);
+    if (stream->failed) {
+      w->streams_failed++;
+    }
+    w->streams++;
+  }
+  return NULL;
+}
+
+// Returns the `n`th CPU in `set`, counting from 0, or -1 if there is none.
+static int mgos_imu_fusion_nth_cpu(const cpu_set_t *set, int n) {
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (CPU_ISSET(cpu, set) && n-- == 0) {
+      return cpu;
+    }
+  }
+  return -1;
+}
+
+// Madgwick engine
+struct mgos_imu_fusion_madgwick {
+  struct mgos_imu_madgwick *filter;
+  bool                      seed;
+};
+
+static void *mgos_imu_fusion_madgwick_create(const void *cfg) {
+  const struct mgos_imu_fusion_madgwick_cfg *c = (const struct mgos_imu_fusion_madgwick_cfg *)cfg;
+  struct mgos_imu_fusion_madgwick *          st;
+
+  st = calloc(1, sizeof(*st));
+  if (!st) {
+    return NULL;
+  }
+  st->filter = mgos_imu_madgwick_create();
+  if (!st->filter) {
+    free(st);
+    return NULL;
+  }
+  if (c) {
+    mgos_imu_madgwick_set_params(st->filter, c->freq, c->beta);
+    st->seed = c->seed;
+  }
+  return st;
+}
+
+static void mgos_imu_fusion_madgwick_destroy(void *state) {
+  struct mgos_imu_fusion_madgwick *st = (struct mgos_imu_fusion_madgwick *)state;
+
+  mgos_imu_madgwick_destroy(&st->filter);
+  free(st);
+}
+
+static bool mgos_imu_fusion_madgwick_update(void *state, const struct mgos_imu_fusion_sample *in, struct mgos_imu_fusion_output *out, size_t n) {
+  struct mgos_imu_fusion_madgwick *st = (struct mgos_imu_fusion_madgwick *)state;
+
+  for (size_t i = 0; i < n; i++) {
+    const struct mgos_imu_fusion_sample *s = &in[i];
+
+    if (st->seed) {
+      st->seed = !mgos_imu_madgwick_init(st->filter, s->ax, s->ay, s->az, s->mx, s->my, s->mz);
+    }
+    mgos_imu_madgwick_update(st->filter, s->gx, s->gy, s->gz, s->ax, s->ay, s->az, s->mx, s->my, s->mz);
+    out[i].ts_us = s->ts_us;
+    mgos_imu_madgwick_get_quaternion(st->filter, &out[i].q0, &out[i].q1, &out[i].q2, &out[i].q3);
+  }
+  return true;
+}
+
+// File backed streams
+struct mgos_imu_fusion_files {
+  FILE *in;
+  FILE *out;
+};
+
+static int mgos_imu_fusion_files_read(void *ctx, struct mgos_imu_fusion_sample *buf, size_t max) {
+  struct mgos_imu_fusion_files *f = (struct mgos_imu_fusion_files *)ctx;
+  size_t n;
+
+  n = fread(buf, sizeof(*buf), max, f->in);
+  if (n == 0 && ferror(f->in)) {
+    return -1;
+  }
+  return (int)n;
+}
+
+static bool mgos_imu_fusion_files_write(void *ctx, const struct mgos_imu_fusion_output *buf, size_t n) {
+  struct mgos_imu_fusion_files *f = (struct mgos_imu_fusion_files *)ctx;
+
+  return fwrite(buf, sizeof(*buf), n, f->out) == n;
+}
+// Private functions end
+
+// Public functions follow
+const struct mgos_imu_fusion_engine mgos_imu_fusion_engine_madgwick = {
+  .name    = "madgwick",
+  .create  = mgos_imu_fusion_madgwick_create,
+  .destroy = mgos_imu_fusion_madgwick_destroy,
+  .update  = mgos_imu_fusion_madgwick_update,
+};
+
+bool mgos_imu_fusion_stream_open_files(struct mgos_imu_fusion_stream *stream, const char *in_path, const char *out_path) {
+  struct mgos_imu_fusion_files *f;
+
+  if (!stream || !in_path || !out_path) {
+    return false;
+  }
+  f = calloc(1, sizeof(*f));
+  if (!f) {
+    return false;
+  }
+  f->in  = fopen(in_path, "rb");
+  f->out = fopen(out_path, "wb");
+  if (!f->in || !f->out) {
+    LOG(LL_ERROR, ("Could not open %s or %s", in_path, out_path));
+    if (f->in) {
+      fclose(f->in);
+    }
+    if (f->out) {
+      fclose(f->out);
+    }
+    free(f);
+    return false;
+  }
+  memset(stream, 0, sizeof(*stream));
+  stream->ctx   = f;
+  stream->read  = mgos_imu_fusion_files_read;
+  stream->write = mgos_imu_fusion_files_write;
+  return true;
+}
+
+bool mgos_imu_fusion_stream_close_files(struct mgos_imu_fusion_stream *stream) {
+  struct mgos_imu_fusion_files *f;
+  bool ret = true;
+
+  if (!stream || !stream->ctx) {
+    return false;
+  }
+  f = (struct mgos_imu_fusion_files *)stream->ctx;
+  fclose(f->in);
+  if (fclose(f->out) != 0) {
+    ret = false;
+  }
+  free(f);
+  stream->ctx = NULL;
+  return ret;
+}
+
+bool mgos_imu_fusion_pool_run(const struct mgos_imu_fusion_engine *engine, const void *engine_cfg,
+                              struct mgos_imu_fusion_stream *streams, size_t n_streams,
+                              int n_threads, struct mgos_imu_fusion_pool_stats *stats) {
+  struct mgos_imu_fusion_pool pool;
+  cpu_set_t                   cpus;
+  long ncpu    = sysconf(_SC_NPROCESSORS_ONLN);
+  int  started = 0;
+  int  cpu;
+  bool pin     = false;
+  bool ret     = true;
+
+  if (!streams && n_streams > 0) {
+    return false;
+  }
+  // The CPUs this thread may run on, which need not be numbered from 0.
+  if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0) {
+    ncpu = CPU_COUNT(&cpus);
+    pin  = true;
+  } else {
+    LOG(LL_WARN, ("Could not get the CPU affinity, running fusion workers unpinned"));
+  }
+  if (n_threads <= 0) {
+    n_threads = (ncpu > 0) ? (int)ncpu : 1;
+  }
+  if ((size_t)n_threads > n_streams && n_streams > 0) {
+    n_threads = (int)n_streams;
+  }
+
+  memset(&pool, 0, sizeof(pool));
+  pool.engine     = engine ? engine : &mgos_imu_fusion_engine_madgwick;
+  pool.engine_cfg = engine_cfg;
+  pool.streams    = streams;
+  pool.n_workers  = n_threads;
+  pool.workers    = calloc((size_t)n_threads, sizeof(struct mgos_imu_fusion_worker));
+  if (!pool.workers) {
+    return false;
+  }
+
+  // Shard streams round robin; each deque can hold at most its own shard.
+  for (int i = 0; i < n_threads; i++) {
+    struct mgos_imu_fusion_worker *w = &pool.workers[i];
+
+    w->pool = &pool;
+    w->id   = i;
+    pthread_mutex_init(&w->deque.lock, NULL);
+    w->deque.items = calloc(n_streams / (size_t)n_threads + 1, sizeof(size_t));
+    w->in          = malloc(MGOS_IMU_FUSION_CHUNK * sizeof(*w->in));
+    w->out         = malloc(MGOS_IMU_FUSION_CHUNK * sizeof(*w->out));
+    if (!w->deque.items || !w->in || !w->out) {
+      LOG(LL_ERROR, ("Could not allocate fusion worker %d", i));
+      ret = false;
+    }
+  }
+  for (size_t s = 0; ret && s < n_streams; s++) {
+    struct mgos_imu_fusion_deque *dq = &pool.workers[s % (size_t)n_threads].deque;
+
+    streams[s].failed        = false;
+    dq->items[dq->bottom++] = s;
+  }
+
+  for (int i = 0; ret && i < n_threads; i++) {
+    struct mgos_imu_fusion_worker *w = &pool.workers[i];
+
+    if (pthread_create(&w->thread, NULL, mgos_imu_fusion_worker_main, w) != 0) {
+      LOG(LL_ERROR, ("Could not start fusion worker %d", i));
+      ret = false;
+      break;
+    }
+    // Pin workers to cores, so per-stream state stays in that core's cache.
+    cpu = pin ? mgos_imu_fusion_nth_cpu(&cpus, i) : -1;
+    if (ncpu > 1 && n_threads <= ncpu && cpu >= 0) {
+      cpu_set_t set;
+      int       err;
+
+      CPU_ZERO(&set);
+      CPU_SET(cpu, &set);
+      err = pthread_setaffinity_np(w->thread, sizeof(set), &set);
+      if (err != 0) {
+        LOG(LL_WARN, ("Could not pin fusion worker %d to CPU %d (%d), running it unpinned", i, cpu, err));
+      }
+    }
+    started++;
+  }
+  // Workers that did start will also drain the shards of those that didn't.
+  for (int i = 0; i < started; i++) {
+    pthread_join(pool.workers[i].thread, NULL);
+  }
+
+  if (stats) {
+    memset(stats, 0, sizeof(*stats));
+  }
+  for (int i = 0; i < n_threads; i++) {
+    struct mgos_imu_fusion_worker *w = &pool.workers[i];
+
+    if (stats) {
+      stats->samples        += w->samples;
+      stats->streams        += w->streams;
+      stats->streams_failed += w->streams_failed;
+      stats->steals         += w->steals;
+    }
+    if (w->streams_failed > 0) {
+      ret = false;
+    }
+    pthread_mutex_destroy(&w->deque.lock);
+    free(w->deque.items);
+    free(w->in);
+    free(w->out);
+  }
+  free(pool.workers);
+  return ret && started > 0;
+}
+
+// Public functions end
+
+#endif // __linux__
@@ -0,0 +1,105 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host side batch processor, which re-fuses many recorded device streams on a
+// work-stealing thread pool. Each stream is processed start to end by a single
+// worker, so its filter state stays local to that worker and its output is
+// written in order. Only available on Linux.
+
+#pragma once
+
+#ifdef __linux__
+
+#include "mgos.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// One 9DOF input sample: gyroscope in Rads/sec, accelerometer and magnetometer
+// in any calibrated unit. A magnetometer sample of all zeros is treated as absent.
+struct mgos_imu_fusion_sample {
+  uint32_t ts_us;
+  float    gx, gy, gz;
+  float    ax, ay, az;
+  float    mx, my, mz;
+};
+
+// One output sample: the attitude Quaternion after fusing the input sample
+// with the same timestamp.
+struct mgos_imu_fusion_output {
+  uint32_t ts_us;
+  float    q0, q1, q2, q3;
+};
+
+// Fusion engine. `create` is called on the worker thread that processes the
+// stream, with the `cfg` passed to mgos_imu_fusion_pool_run(). `update` fuses
+// `n` samples into `n` outputs.
+struct mgos_imu_fusion_engine {
+  const char *name;
+  void *(*create)(const void *cfg);
+  void (*destroy)(void *state);
+  bool (*update)(void *state, const struct mgos_imu_fusion_sample *in, struct mgos_imu_fusion_output *out, size_t n);
+};
+
+// Madgwick engine, the default. `cfg` is a `struct mgos_imu_fusion_madgwick_cfg`,
+// or NULL for the defaults of mgos_imu_madgwick_create(). If `seed` is set,
+// the filter attitude is initialized from the first sample of each stream.
+struct mgos_imu_fusion_madgwick_cfg {
+  float freq;
+  float beta;
+  bool  seed;
+};
+
+extern const struct mgos_imu_fusion_engine mgos_imu_fusion_engine_madgwick;
+
+// Stream I/O. `read` fills up to `max` samples and returns the number read,
+// 0 at the end of the stream or -1 on error. `write` is called with outputs in
+// stream order, and returns false on error, which aborts the stream.
+struct mgos_imu_fusion_stream {
+  void *ctx;
+  int   (*read)(void *ctx, struct mgos_imu_fusion_sample *buf, size_t max);
+  bool  (*write)(void *ctx, const struct mgos_imu_fusion_output *buf, size_t n);
+  bool  failed;     // Set by the pool if the stream was aborted.
+};
+
+// File backed stream, reading an array of `struct mgos_imu_fusion_sample` from
+// `in_path` and writing an array of `struct mgos_imu_fusion_output` to `out_path`.
+// Returns true on success, in which case mgos_imu_fusion_stream_close_files()
+// must be called once the pool is done.
+bool mgos_imu_fusion_stream_open_files(struct mgos_imu_fusion_stream *stream, const char *in_path, const char *out_path);
+bool mgos_imu_fusion_stream_close_files(struct mgos_imu_fusion_stream *stream);
+
+struct mgos_imu_fusion_pool_stats {
+  uint64_t samples;
+  uint32_t streams;
+  uint32_t streams_failed;
+  uint32_t steals;
+};
+
+// Process all `n_streams` streams with `n_threads` workers (0 for one per
+// online CPU), using `engine` (NULL for Madgwick) configured by `engine_cfg`.
+// Blocks until all streams are done. `stats` may be NULL.
+// Returns true if all streams were processed without error.
+bool mgos_imu_fusion_pool_run(const struct mgos_imu_fusion_engine *engine, const void *engine_cfg,
+                              struct mgos_imu_fusion_stream *streams, size_t n_streams,
+                              int n_threads, struct mgos_imu_fusion_pool_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __linux__
@@ -24,6 +24,7 @@
 #include "mgos_imu_mpu60x0.h"
 #include "mgos_imu_mpu6886.h"
 #include "mgos_imu_icm20948.h"
+#include "mgos_imu_replay.h"
 
 static struct mgos_imu_gyro *mgos_imu_gyro_create(void) {
   struct mgos_imu_gyro *gyro;
@@ -51,12 +52,14 @@ static bool mgos_imu_gyro_destroy(struct mgos_imu_gyro **gyro, void *imu_user_da
   if (!*gyro) {
     return false;
   }
+  mgos_imu_create_cancel((*gyro)->pending);
   if ((*gyro)->destroy) {
     (*gyro)->destroy(*gyro, imu_user_data);
   }
   if ((*gyro)->user_data) {
     free((*gyro)->user_data);
   }
+  free((*gyro)->stats);
   free(*gyro);
   *gyro = NULL;
   return true;
@@ -103,40 +106,107 @@ const char *mgos_imu_gyroscope_get_name(struct mgos_imu *imu) {
 
   case GYRO_ICM20948: return "ICM20948";
 
+  case GYRO_REPLAY: return "REPLAY";
+
   default: return "UNKNOWN";
   }
 }
 
+// Called after the current sample was converted, so that a range switch only
+// applies to samples read after it.
+static void mgos_imu_gyro_autorange(struct mgos_imu *imu) {
+  struct mgos_imu_gyro *gyro = imu->gyro;
+  float scale, prev, odr = 0;
+  int   step;
+
+  step = mgos_imu_autorange_check(&gyro->autorange, gyro->gx, gyro->gy, gyro->gz);
+  if (step == 0 || !gyro->set_scale) {
+    return;
+  }
+  scale = gyro->opts.scale;
+  if (gyro->get_scale) {
+    gyro->get_scale(gyro, imu->user_data, &scale);
+  }
+  prev = gyro->scale;
+  if (scale <= 0 || !gyro->set_scale(gyro, imu->user_data, step > 0 ? scale * 2 : scale / 2) || gyro->scale == prev) {
+    return;
+  }
+  if (!gyro->get_odr || !gyro->get_odr(gyro, imu->user_data, &odr)) {
+    odr = gyro->opts.odr;
+  }
+  mgos_imu_autorange_switched(&gyro->autorange, odr);
+  LOG(LL_DEBUG, ("Gyroscope range %.0fdps -> %.0fdps", scale, gyro->opts.scale));
+}
+
 bool mgos_imu_gyroscope_get(struct mgos_imu *imu, float *x, float *y, float *z) {
-  if (!imu->gyro || !imu->gyro->read) {
+  struct mgos_imu_autorange *ar;
+  int64_t start;
+  bool    ok;
+
+  if (!imu->gyro || !imu->gyro->read || imu->gyro->pending) {
     return false;
   }
 
-  if (!imu->gyro->read(imu->gyro, imu->user_data)) {
+  imu->gyro->stale = false;
+  start           = mgos_imu_stats_start(imu->gyro->stats);
+  ok              = imu->gyro->read(imu->gyro, imu->user_data);
+  mgos_imu_stats_read(imu->gyro->stats, start, ok);
+  if (!ok) {
     LOG(LL_ERROR, ("Could not read from gyroscope"));
     return false;
   }
   // LOG(LL_DEBUG, ("Raw: gx=%d gy=%d gz=%d", imu->gyro->gx, imu->gyro->gy, imu->gyro->gz));
+  if (!imu->gyro->stale) {
+    imu->gyro->clipped = mgos_imu_autorange_clipped(imu->gyro->gx, imu->gyro->gy, imu->gyro->gz);
+    if (imu->gyro->clipped) {
+      mgos_imu_stats_clipped(imu->gyro->stats);
+    }
+  }
+
+  // While the chip switches range, the sample may be at either one. Such
+  // samples, and ones the driver already returned, are not processed again,
+  // and the previous output is returned.
+  ar = &imu->gyro->autorange;
+  if (mgos_imu_autorange_settling(ar)) {
+    imu->gyro->stale = true;
+  }
+  if (!imu->gyro->stale) {
+    ar->out[0] = (imu->gyro->scale *
+                  (imu->gyro->gx * imu->gyro->orientation[0] + imu->gyro->gy * imu->gyro->orientation[1] + imu->gyro->gz * imu->gyro->orientation[2])
+                  ) + imu->gyro->offset_gx;
+    ar->out[1] = (imu->gyro->scale *
+                  (imu->gyro->gx * imu->gyro->orientation[3] + imu->gyro->gy * imu->gyro->orientation[4] + imu->gyro->gz * imu->gyro->orientation[5])
+                  ) + imu->gyro->offset_gy;
+    ar->out[2] = (imu->gyro->scale *
+                  (imu->gyro->gx * imu->gyro->orientation[6] + imu->gyro->gy * imu->gyro->orientation[7] + imu->gyro->gz * imu->gyro->orientation[8])
+                  ) + imu->gyro->offset_gz;
+    if (imu->gyro->filter) {
+      mgos_imu_filter_process(imu->gyro->filter, ar->out, 1);
+    }
+    if (imu->gyro->aggregator) {
+      mgos_imu_aggregator_add(imu->gyro->aggregator, ar->out, 1);
+    }
+    if (imu->odr_ctrl) {
+      mgos_imu_odr_ctrl_gyro(imu);
+    }
+    if (ar->enabled) {
+      mgos_imu_gyro_autorange(imu);
+    }
+  }
   if (x) {
-    *x = (imu->gyro->scale *
-          (imu->gyro->gx * imu->gyro->orientation[0] + imu->gyro->gy * imu->gyro->orientation[1] + imu->gyro->gz * imu->gyro->orientation[2])
-          ) + imu->gyro->offset_gx;
+    *x = ar->out[0];
   }
   if (y) {
-    *y = (imu->gyro->scale *
-          (imu->gyro->gx * imu->gyro->orientation[3] + imu->gyro->gy * imu->gyro->orientation[4] + imu->gyro->gz * imu->gyro->orientation[5])
-          ) + imu->gyro->offset_gy;
+    *y = ar->out[1];
   }
   if (z) {
-    *z = (imu->gyro->scale *
-          (imu->gyro->gx * imu->gyro->orientation[6] + imu->gyro->gy * imu->gyro->orientation[7] + imu->gyro->gz * imu->gyro->orientation[8])
-          ) + imu->gyro->offset_gz;
+    *z = ar->out[2];
   }
   return true;
 }
 
-bool mgos_imu_gyroscope_create_i2c(struct mgos_imu *imu, struct mgos_i2c *i2c, uint8_t i2caddr, const struct mgos_imu_gyro_opts *opts) {
-  if (!imu || !i2c || !opts) {
+static bool mgos_imu_gyro_setup(struct mgos_imu *imu, struct mgos_i2c *i2c, uint8_t i2caddr, const struct mgos_imu_gyro_opts *opts) {
+  if (!imu || !opts || (!i2c && opts->type != GYRO_REPLAY)) {
     return false;
   }
   if (imu->gyro) {
@@ -144,7 +214,7 @@ bool mgos_imu_gyroscope_create_i2c(struct mgos_imu *imu, struct mgos_i2c *i2c, u
   }
   imu->gyro = mgos_imu_gyro_create();
   if (!imu->gyro) {
-    false;
+    return false;
   }
   imu->gyro->i2c     = i2c;
   imu->gyro->i2caddr = i2caddr;
@@ -152,31 +222,35 @@ bool mgos_imu_gyroscope_create_i2c(struct mgos_imu *imu, struct mgos_i2c *i2c, u
   switch (opts->type) {
   case GYRO_MPU6000:
   case GYRO_MPU6050:
-    imu->gyro->detect    = mgos_imu_mpu60x0_gyro_detect;
-    imu->gyro->create    = mgos_imu_mpu60x0_gyro_create;
-    imu->gyro->read      = mgos_imu_mpu60x0_gyro_read;
-    imu->gyro->get_scale = mgos_imu_mpu60x0_gyro_get_scale;
-    imu->gyro->set_scale = mgos_imu_mpu60x0_gyro_set_scale;
+    imu->gyro->detect        = mgos_imu_mpu60x0_gyro_detect;
+    imu->gyro->create_step   = mgos_imu_mpu60x0_gyro_create_step;
+    imu->gyro->read          = mgos_imu_mpu60x0_gyro_read;
+    imu->gyro->get_scale     = mgos_imu_mpu60x0_gyro_get_scale;
+    imu->gyro->set_scale     = mgos_imu_mpu60x0_gyro_set_scale;
+    imu->gyro->set_hw_offset = mgos_imu_mpu60x0_gyro_set_hw_offset;
     if (!imu->user_data) {
       imu->user_data = mgos_imu_mpu60x0_userdata_create();
     }
     break;
 
   case GYRO_MPU6886:
-    imu->gyro->detect    = mgos_imu_mpu6886_gyro_detect;
-    imu->gyro->create    = mgos_imu_mpu60x0_gyro_create;
-    imu->gyro->read      = mgos_imu_mpu60x0_gyro_read;
-    imu->gyro->get_scale = mgos_imu_mpu60x0_gyro_get_scale;
-    imu->gyro->set_scale = mgos_imu_mpu60x0_gyro_set_scale;
+    imu->gyro->detect        = mgos_imu_mpu6886_gyro_detect;
+    imu->gyro->create_step   = mgos_imu_mpu60x0_gyro_create_step;
+    imu->gyro->read          = mgos_imu_mpu60x0_gyro_read;
+    imu->gyro->get_scale     = mgos_imu_mpu60x0_gyro_get_scale;
+    imu->gyro->set_scale     = mgos_imu_mpu60x0_gyro_set_scale;
+    imu->gyro->set_hw_offset = mgos_imu_mpu60x0_gyro_set_hw_offset;
     if (!imu->user_data) {
       imu->user_data = mgos_imu_mpu60x0_userdata_create();
     }
     break;
 
   case GYRO_LSM6DSL:
-    imu->gyro->detect = mgos_imu_lsm6dsl_gyro_detect;
-    imu->gyro->create = mgos_imu_lsm6dsl_gyro_create;
-    imu->gyro->read   = mgos_imu_lsm6dsl_gyro_read;
+    imu->gyro->detect      = mgos_imu_lsm6dsl_gyro_detect;
+    imu->gyro->create_step = mgos_imu_lsm6dsl_gyro_create_step;
+    imu->gyro->read        = mgos_imu_lsm6dsl_gyro_read;
+    imu->gyro->get_odr     = mgos_imu_lsm6dsl_gyro_get_odr;
+    imu->gyro->set_odr     = mgos_imu_lsm6dsl_gyro_set_odr;
     if (!imu->user_data) {
       imu->user_data = mgos_imu_lsm6dsl_userdata_create();
     }
@@ -192,43 +266,62 @@ bool mgos_imu_gyroscope_create_i2c(struct mgos_imu *imu, struct mgos_i2c *i2c, u
     break;
 
   case GYRO_ITG3205:
-    imu->gyro->detect = mgos_imu_itg3205_detect;
-    imu->gyro->create = mgos_imu_itg3205_create;
-    imu->gyro->read   = mgos_imu_itg3205_read;
+    imu->gyro->detect        = mgos_imu_itg3205_detect;
+    imu->gyro->create        = mgos_imu_itg3205_create;
+    imu->gyro->read          = mgos_imu_itg3205_read;
+    imu->gyro->get_bandwidth = mgos_imu_itg3205_get_bandwidth;
+    imu->gyro->set_bandwidth = mgos_imu_itg3205_set_bandwidth;
     break;
 
   case GYRO_L3GD20:
   case GYRO_L3GD20H:
-    imu->gyro->detect = mgos_imu_l3gd20_detect;
-    imu->gyro->create = mgos_imu_l3gd20_create;
-    imu->gyro->read   = mgos_imu_l3gd20_read;
+    imu->gyro->detect        = mgos_imu_l3gd20_detect;
+    imu->gyro->create_step   = mgos_imu_l3gd20_create_step;
+    imu->gyro->read          = mgos_imu_l3gd20_read;
+    imu->gyro->get_odr       = mgos_imu_l3gd20_get_odr;
+    imu->gyro->set_odr       = mgos_imu_l3gd20_set_odr;
+    imu->gyro->get_bandwidth = mgos_imu_l3gd20_gyro_get_bandwidth;
+    imu->gyro->set_bandwidth = mgos_imu_l3gd20_gyro_set_bandwidth;
     break;
 
   case GYRO_MPU9250:
   case GYRO_MPU9255:
-    imu->gyro->detect    = mgos_imu_mpu925x_gyro_detect;
-    imu->gyro->create    = mgos_imu_mpu925x_gyro_create;
-    imu->gyro->read      = mgos_imu_mpu925x_gyro_read;
-    imu->gyro->get_scale = mgos_imu_mpu925x_gyro_get_scale;
-    imu->gyro->set_scale = mgos_imu_mpu925x_gyro_set_scale;
+    imu->gyro->detect        = mgos_imu_mpu925x_gyro_detect;
+    imu->gyro->create_step   = mgos_imu_mpu925x_gyro_create_step;
+    imu->gyro->read          = mgos_imu_mpu925x_gyro_read;
+    imu->gyro->get_scale     = mgos_imu_mpu925x_gyro_get_scale;
+    imu->gyro->set_scale     = mgos_imu_mpu925x_gyro_set_scale;
+    imu->gyro->set_hw_offset = mgos_imu_mpu925x_gyro_set_hw_offset;
+    imu->gyro->get_bandwidth = mgos_imu_mpu925x_gyro_get_bandwidth;
+    imu->gyro->set_bandwidth = mgos_imu_mpu925x_gyro_set_bandwidth;
     if (!imu->user_data) {
       imu->user_data = mgos_imu_mpu925x_userdata_create();
     }
     break;
 
   case GYRO_ICM20948:
-    imu->gyro->detect    = mgos_imu_icm20948_gyro_detect;
-    imu->gyro->create    = mgos_imu_icm20948_gyro_create;
-    imu->gyro->read      = mgos_imu_icm20948_gyro_read;
-    imu->gyro->get_odr   = mgos_imu_icm20948_gyro_get_odr;
-    imu->gyro->set_odr   = mgos_imu_icm20948_gyro_set_odr;
-    imu->gyro->get_scale = mgos_imu_icm20948_gyro_get_scale;
-    imu->gyro->set_scale = mgos_imu_icm20948_gyro_set_scale;
+    imu->gyro->detect        = mgos_imu_icm20948_gyro_detect;
+    imu->gyro->create_step   = mgos_imu_icm20948_gyro_create_step;
+    imu->gyro->read          = mgos_imu_icm20948_gyro_read;
+    imu->gyro->get_odr       = mgos_imu_icm20948_gyro_get_odr;
+    imu->gyro->set_odr       = mgos_imu_icm20948_gyro_set_odr;
+    imu->gyro->get_scale     = mgos_imu_icm20948_gyro_get_scale;
+    imu->gyro->set_scale     = mgos_imu_icm20948_gyro_set_scale;
+    imu->gyro->get_bandwidth = mgos_imu_icm20948_gyro_get_bandwidth;
+    imu->gyro->set_bandwidth = mgos_imu_icm20948_gyro_set_bandwidth;
     if (!imu->user_data) {
       imu->user_data = mgos_imu_icm20948_userdata_create();
     }
     break;
 
+  case GYRO_REPLAY:
+    imu->gyro->detect  = mgos_imu_replay_gyro_detect;
+    imu->gyro->create  = mgos_imu_replay_gyro_create;
+    imu->gyro->destroy = mgos_imu_replay_gyro_destroy;
+    imu->gyro->read    = mgos_imu_replay_gyro_read;
+    imu->gyro->get_odr = mgos_imu_replay_gyro_get_odr;
+    break;
+
   default:
     LOG(LL_ERROR, ("Unknown gyroscope type %d", opts->type));
     mgos_imu_gyroscope_destroy(imu);
@@ -245,30 +338,64 @@ bool mgos_imu_gyroscope_create_i2c(struct mgos_imu *imu, struct mgos_i2c *i2c, u
                      opts->type, mgos_imu_gyroscope_get_name(imu), i2caddr));
     }
   }
+  return true;
+}
 
-  if (imu->gyro->create) {
-    if (!imu->gyro->create(imu->gyro, imu->user_data)) {
-      LOG(LL_ERROR, ("Could not create gyroscope type %d (%s) at I2C 0x%02x",
-                     opts->type, mgos_imu_gyroscope_get_name(imu), i2caddr));
-      mgos_imu_gyroscope_destroy(imu);
-      return false;
-    } else {
-      LOG(LL_DEBUG, ("Successfully created gyroscope type %d (%s) at I2C 0x%02x",
-                     opts->type, mgos_imu_gyroscope_get_name(imu), i2caddr));
-    }
+static int32_t mgos_imu_gyro_create_step(struct mgos_imu *imu, uint8_t step) {
+  struct mgos_imu_gyro *gyro = imu->gyro;
+
+  if (gyro->create_step) {
+    return gyro->create_step(gyro, imu->user_data, step);
   }
-  if (imu->gyro->set_scale) {
-    imu->gyro->set_scale(imu->gyro, imu->user_data, opts->scale);
+  if (gyro->create && !gyro->create(gyro, imu->user_data)) {
+    return -1;
+  }
+  return 0;
+}
+
+static bool mgos_imu_gyro_create_done(struct mgos_imu *imu, bool ok) {
+  struct mgos_imu_gyro *gyro = imu->gyro;
+
+  gyro->pending = NULL;
+  if (!ok) {
+    LOG(LL_ERROR, ("Could not create gyroscope type %d (%s) at I2C 0x%02x",
+                   gyro->opts.type, mgos_imu_gyroscope_get_name(imu), gyro->i2caddr));
+    mgos_imu_gyroscope_destroy(imu);
+    return false;
   }
+  LOG(LL_DEBUG, ("Successfully created gyroscope type %d (%s) at I2C 0x%02x",
+                 gyro->opts.type, mgos_imu_gyroscope_get_name(imu), gyro->i2caddr));
 
-  if (imu->gyro->set_odr) {
-    imu->gyro->set_odr(imu->gyro, imu->user_data, opts->odr);
+  if (gyro->set_scale) {
+    gyro->set_scale(gyro, imu->user_data, gyro->opts.scale);
   }
 
+  if (gyro->set_odr) {
+    gyro->set_odr(gyro, imu->user_data, gyro->opts.odr);
+  }
 
   return true;
 }
 
+bool mgos_imu_gyroscope_create_i2c(struct mgos_imu *imu, struct mgos_i2c *i2c, uint8_t i2caddr, const struct mgos_imu_gyro_opts *opts) {
+  if (!mgos_imu_gyro_setup(imu, i2c, i2caddr, opts)) {
+    return false;
+  }
+  return mgos_imu_gyro_create_done(imu, mgos_imu_create_run(imu, mgos_imu_gyro_create_step));
+}
+
+bool mgos_imu_gyroscope_create_i2c_async(struct mgos_imu *imu, struct mgos_i2c *i2c, uint8_t i2caddr, const struct mgos_imu_gyro_opts *opts, mgos_imu_create_cb cb, void *cb_arg) {
+  if (!mgos_imu_gyro_setup(imu, i2c, i2caddr, opts)) {
+    return false;
+  }
+  imu->gyro->pending = mgos_imu_create_start(imu, mgos_imu_gyro_create_step, mgos_imu_gyro_create_done, cb, cb_arg);
+  if (!imu->gyro->pending) {
+    mgos_imu_gyroscope_destroy(imu);
+    return false;
+  }
+  return true;
+}
+
 bool mgos_imu_gyroscope_set_offset(struct mgos_imu *imu, float x, float y, float z) {
   if (!imu || !imu->gyro) {
     return false;
@@ -279,6 +406,21 @@ bool mgos_imu_gyroscope_set_offset(struct mgos_imu *imu, float x, float y, float
   return true;
 }
 
+bool mgos_imu_gyroscope_set_hw_offset(struct mgos_imu *imu, float x, float y, float z) {
+  float *o;
+
+  if (!imu || !imu->gyro || !imu->gyro->set_hw_offset) {
+    return false;
+  }
+  // Offset registers work on sensor axes, so undo the orientation first. It is
+  // a rotation, so its inverse is its transpose.
+  o = imu->gyro->orientation;
+  return imu->gyro->set_hw_offset(imu->gyro, imu->user_data,
+                                  o[0] * x + o[3] * y + o[6] * z,
+                                  o[1] * x + o[4] * y + o[7] * z,
+                                  o[2] * x + o[5] * y + o[8] * z);
+}
+
 bool mgos_imu_gyroscope_get_offset(struct mgos_imu *imu, float *x, float *y, float *z) {
   if (!imu || !imu->gyro) {
     return false;
@@ -338,3 +480,51 @@ bool mgos_imu_gyroscope_set_odr(struct mgos_imu *imu, float hertz) {
   }
   return imu->gyro->set_odr(imu->gyro, imu->user_data, hertz);
 }
+
+bool mgos_imu_gyroscope_get_bandwidth(struct mgos_imu *imu, float *hertz) {
+  if (!imu || !imu->gyro || !imu->gyro->get_bandwidth || !hertz) {
+    return false;
+  }
+  return imu->gyro->get_bandwidth(imu->gyro, imu->user_data, hertz);
+}
+
+bool mgos_imu_gyroscope_set_bandwidth(struct mgos_imu *imu, float hertz) {
+  if (!imu || !imu->gyro || !imu->gyro->set_bandwidth || hertz <= 0) {
+    return false;
+  }
+  return imu->gyro->set_bandwidth(imu->gyro, imu->user_data, hertz);
+}
+
+bool mgos_imu_gyroscope_set_autorange(struct mgos_imu *imu, bool enable, uint32_t hold_ms) {
+  if (!imu || !imu->gyro || !imu->gyro->set_scale) {
+    return false;
+  }
+  memset(&imu->gyro->autorange, 0, sizeof(imu->gyro->autorange));
+  imu->gyro->autorange.enabled = enable;
+  imu->gyro->autorange.hold_ms = hold_ms;
+  return true;
+}
+
+bool mgos_imu_gyroscope_get_clipped(struct mgos_imu *imu, bool *clipped) {
+  if (!imu || !imu->gyro || !clipped) {
+    return false;
+  }
+  *clipped = imu->gyro->clipped;
+  return true;
+}
+
+bool mgos_imu_gyroscope_set_filter(struct mgos_imu *imu, struct mgos_imu_filter *filter) {
+  if (!imu || !imu->gyro) {
+    return false;
+  }
+  imu->gyro->filter = filter;
+  return true;
+}
+
+bool mgos_imu_gyroscope_set_aggregator(struct mgos_imu *imu, struct mgos_imu_aggregator *agg) {
+  if (!imu || !imu->gyro) {
+    return false;
+  }
+  imu->gyro->aggregator = agg;
+  return true;
+}
@@ -75,6 +75,7 @@ bool mgos_imu_hmc5883l_read(struct mgos_imu_mag *dev, void *imu_user_data) {
   if (!mgos_i2c_read_reg_n(dev->i2c, dev->i2caddr, MGOS_HMC5883L_REG_OUT_X_MSB, 6, data)) {
     return false;
   }
+  mgos_imu_stats_i2c(dev->stats, 6);
 
   dev->mx = (data[0] << 8) | (data[1]);
   dev->my = (data[2] << 8) | (data[3]);
@@ -0,0 +1,971 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef MGOS_IMU_I2C_SIM
+
+#include "mgos_imu_i2c_sim.h"
+#include <math.h>
+
+// The chip models are written from the datasheets rather than from the
+// drivers, so that a driver that gets a register wrong fails here too.
+
+#define SIM_BANKS           (4)
+#define SIM_FIFO_MAX        (4096)
+
+// Output register formats
+#define SIM_FMT_BE16        (0)   // 3x int16, MSB first
+#define SIM_FMT_LE16        (1)   // 3x int16, LSB first
+#define SIM_FMT_BE14        (2)   // 3x 14 bit, left justified, MSB first (MMA8451)
+#define SIM_FMT_BMM150      (3)   // 13/13/15 bit X/Y/Z and 14 bit RHALL, LSB first
+
+#define SIM_FIFO_NONE       (0)
+#define SIM_FIFO_MPU        (1)
+#define SIM_FIFO_LSM6DSL    (2)
+#define SIM_FIFO_L3GD20     (3)
+
+#define SIM_NO_BANK_REG     (-1)
+
+struct sim_reg {
+  uint8_t bank, reg, val;
+};
+
+struct sim_block {
+  int8_t  sensor;     // enum mgos_imu_i2c_sim_sensor, or -1 for none
+  uint8_t bank, reg;
+  uint8_t fmt;
+  uint8_t drdy_reg, drdy_mask;
+  uint8_t dor_mask;   // Set in drdy_reg when a sample lands on an unread one
+};
+
+struct sim_chip {
+  const char *          name;
+  int16_t               bank_reg;     // Bank select register, value in bits 5:4
+  uint8_t               auto_inc;     // Sub address bit that enables auto increment
+  uint8_t               reset_reg, reset_mask;  // Reloads all registers
+  uint8_t               clear_reg, clear_mask;  // Other self-clearing bits
+  uint8_t               fifo;
+  uint16_t              fifo_size;
+  uint8_t               shot_reg;     // Single measurement control, or 0
+  struct sim_block      blocks[2];
+  const struct sim_reg *defaults;
+};
+
+struct sim_fifo {
+  uint8_t  buf[SIM_FIFO_MAX];
+  uint16_t head, len;
+};
+
+struct sim_dev {
+  const struct sim_chip *       chip;
+  uint8_t                       i2caddr;
+  float                         odr;
+  uint8_t                       regs[SIM_BANKS][256];
+  uint8_t                       bank;
+  uint8_t                       ptr;          // Register pointer, for raw reads
+  uint64_t                      sample;       // Samples produced so far
+  uint64_t                      shot_due_ns;  // 0 if no measurement pending
+  uint32_t                      rnd;
+  struct mgos_imu_i2c_sim_wave  wave[3];
+  struct sim_fifo               fifo;
+  struct mgos_imu_i2c_sim_stats stats;
+};
+
+struct mgos_i2c {
+  uint32_t                      freq;
+  uint64_t                      now_ns;
+  struct sim_dev                devs[MGOS_IMU_I2C_SIM_MAX_DEVICES];
+  int                           n_devs;
+  struct mgos_imu_i2c_sim_stats stats;
+};
+
+static struct mgos_i2c *s_global_i2c = NULL;
+
+// Register defaults, terminated by a zero entry at bank 0xff.
+static const struct sim_reg s_mpu9250_defaults[] = {
+  { 0, 0x75, 0x71 },                                       // WHO_AM_I
+  { 0, 0x6B, 0x01 },                                       // PWR_MGMT_1
+  { 0, 0x77, 0x1A }, { 0, 0x78, 0x52 },                    // XA_OFFSET, factory trim
+  { 0, 0x7A, 0xE5 }, { 0, 0x7B, 0x1C },
+  { 0, 0x7D, 0x21 }, { 0, 0x7E, 0x0E },
+  { 0xff, 0, 0 }
+};
+
+static const struct sim_reg s_mpu6050_defaults[] = {
+  { 0, 0x75, 0x68 },                                       // WHO_AM_I
+  { 0, 0x6B, 0x40 },                                       // PWR_MGMT_1, asleep
+  { 0, 0x06, 0xF4 }, { 0, 0x07, 0x3B },                    // XA_OFFS_USR, factory trim
+  { 0, 0x08, 0x06 }, { 0, 0x09, 0xA2 },
+  { 0, 0x0A, 0x08 }, { 0, 0x0B, 0x5D },
+  { 0xff, 0, 0 }
+};
+
+static const struct sim_reg s_ak8963_defaults[] = {
+  { 0, 0x00, 0x48 },                                       // WIA
+  { 0, 0x10, 0xB0 }, { 0, 0x11, 0xB2 }, { 0, 0x12, 0xA8 }, // ASA, fuse ROM
+  { 0xff, 0, 0 }
+};
+
+static const struct sim_reg s_lsm6dsl_defaults[] = {
+  { 0, 0x0F, 0x6A },                                       // WHO_AM_I
+  { 0, 0x12, 0x04 },                                       // CTRL3_C, IF_INC
+  { 0xff, 0, 0 }
+};
+
+static const struct sim_reg s_icm20948_defaults[] = {
+  { 0, 0x00, 0xEA },                                       // WHO_AM_I
+  { 0, 0x06, 0x41 },                                       // PWR_MGMT_1
+  { 0xff, 0, 0 }
+};
+
+static const struct sim_reg s_ak09916_defaults[] = {
+  { 0, 0x00, 0x48 },                                       // WIA1
+  { 0, 0x01, 0x09 },                                       // WIA2
+  { 0xff, 0, 0 }
+};
+
+static const struct sim_reg s_lsm9ds1_ag_defaults[] = {
+  { 0, 0x0F, 0x68 },                                       // WHO_AM_I
+  { 0, 0x22, 0x04 },                                       // CTRL_REG8, IF_ADD_INC
+  { 0xff, 0, 0 }
+};
+
+static const struct sim_reg s_lsm9ds1_m_defaults[] = {
+  { 0, 0x0F, 0x3D },                                       // WHO_AM_I_M
+  { 0xff, 0, 0 }
+};
+
+// Trim values of a typical part.
+static const struct sim_reg s_bmm150_defaults[] = {
+  { 0, 0x40, 0x32 },                                       // CHIPID
+  { 0, 0x5D, 0x00 }, { 0, 0x5E, 0x00 },                    // DIG_X1, DIG_Y1
+  { 0, 0x62, 0x00 }, { 0, 0x63, 0x00 },                    // DIG_Z4
+  { 0, 0x64, 0x1A }, { 0, 0x65, 0x1A },                    // DIG_X2, DIG_Y2
+  { 0, 0x68, 0xFB }, { 0, 0x69, 0x02 },                    // DIG_Z2
+  { 0, 0x6A, 0xAB }, { 0, 0x6B, 0x60 },                    // DIG_Z1
+  { 0, 0x6C, 0x8D }, { 0, 0x6D, 0x1B },                    // DIG_XYZ1
+  { 0, 0x6E, 0x00 }, { 0, 0x6F, 0x00 },                    // DIG_Z3
+  { 0, 0x70, 0xFD }, { 0, 0x71, 0x1D },                    // DIG_XY2, DIG_XY1
+  { 0xff, 0, 0 }
+};
+
+static const struct sim_reg s_adxl345_defaults[] = {
+  { 0, 0x00, 0xE5 },                                       // DEVID
+  { 0xff, 0, 0 }
+};
+
+static const struct sim_reg s_mma8451_defaults[] = {
+  { 0, 0x0D, 0x1A },                                       // WHO_AM_I
+  { 0xff, 0, 0 }
+};
+
+static const struct sim_reg s_lsm303d_defaults[] = {
+  { 0, 0x0F, 0x49 },                                       // WHO_AM_I
+  { 0xff, 0, 0 }
+};
+
+static const struct sim_reg s_l3gd20_defaults[] = {
+  { 0, 0x0F, 0xD4 },                                       // WHO_AM_I
+  { 0xff, 0, 0 }
+};
+
+static const struct sim_reg s_itg3205_defaults[] = {
+  { 0, 0x00, 0x68 },                                       // WHO_AM_I
+  { 0xff, 0, 0 }
+};
+
+static const struct sim_reg s_mag3110_defaults[] = {
+  { 0, 0x07, 0xC4 },                                       // WHO_AM_I
+  { 0xff, 0, 0 }
+};
+
+static const struct sim_chip s_chips[MGOS_IMU_I2C_SIM_CHIP_MAX] = {
+  [MGOS_IMU_I2C_SIM_MPU9250] = {
+    .name      = "MPU9250", .bank_reg = SIM_NO_BANK_REG,
+    .reset_reg = 0x6B, .reset_mask = 0x80,                 // PWR_MGMT_1 H_RESET
+    .clear_reg = 0x6A, .clear_mask = 0x07,                 // USER_CTRL *_RST
+    .fifo      = SIM_FIFO_MPU, .fifo_size = 512,
+    .blocks    = { { MGOS_IMU_I2C_SIM_ACC,  0, 0x3B, SIM_FMT_BE16, 0x3A, 0x01 },
+                   { MGOS_IMU_I2C_SIM_GYRO, 0, 0x43, SIM_FMT_BE16, 0x3A, 0x01 } },
+    .defaults  = s_mpu9250_defaults,
+  },
+  [MGOS_IMU_I2C_SIM_MPU6050] = {
+    .name      = "MPU6050", .bank_reg = SIM_NO_BANK_REG,
+    .reset_reg = 0x6B, .reset_mask = 0x80,
+    .clear_reg = 0x6A, .clear_mask = 0x07,
+    .fifo      = SIM_FIFO_MPU, .fifo_size = 1024,
+    .blocks    = { { MGOS_IMU_I2C_SIM_ACC,  0, 0x3B, SIM_FMT_BE16, 0x3A, 0x01 },
+                   { MGOS_IMU_I2C_SIM_GYRO, 0, 0x43, SIM_FMT_BE16, 0x3A, 0x01 } },
+    .defaults  = s_mpu6050_defaults,
+  },
+  [MGOS_IMU_I2C_SIM_AK8963] = {
+    .name      = "AK8963", .bank_reg = SIM_NO_BANK_REG,
+    .reset_reg = 0x0B, .reset_mask = 0x01,                 // CNTL2 SRST
+    .blocks    = { { MGOS_IMU_I2C_SIM_MAG, 0, 0x03, SIM_FMT_LE16, 0x02, 0x01 },
+                   { -1 } },
+    .defaults  = s_ak8963_defaults,
+  },
+  [MGOS_IMU_I2C_SIM_AK8975] = {
+    .name      = "AK8975", .bank_reg = SIM_NO_BANK_REG,
+    .shot_reg  = 0x0A,                                     // CNTL, single measurement
+    .blocks    = { { MGOS_IMU_I2C_SIM_MAG, 0, 0x03, SIM_FMT_LE16, 0x02, 0x01 },
+                   { -1 } },
+    .defaults  = s_ak8963_defaults,
+  },
+  [MGOS_IMU_I2C_SIM_LSM6DSL] = {
+    .name      = "LSM6DSL", .bank_reg = SIM_NO_BANK_REG,
+    .reset_reg = 0x12, .reset_mask = 0x01,                 // CTRL3_C SW_RESET
+    .clear_reg = 0x12, .clear_mask = 0x80,                 // CTRL3_C BOOT
+    .fifo      = SIM_FIFO_LSM6DSL, .fifo_size = 4096,
+    .blocks    = { { MGOS_IMU_I2C_SIM_GYRO, 0, 0x22, SIM_FMT_LE16, 0x1E, 0x02 },
+                   { MGOS_IMU_I2C_SIM_ACC,  0, 0x28, SIM_FMT_LE16, 0x1E, 0x01 } },
+    .defaults  = s_lsm6dsl_defaults,
+  },
+  [MGOS_IMU_I2C_SIM_ICM20948] = {
+    .name      = "ICM20948", .bank_reg = 0x7F,
+    .reset_reg = 0x06, .reset_mask = 0x80,                 // PWR_MGMT_1 DEVICE_RESET
+    .blocks    = { { MGOS_IMU_I2C_SIM_ACC,  0, 0x2D, SIM_FMT_BE16, 0x1A, 0x01 },
+                   { MGOS_IMU_I2C_SIM_GYRO, 0, 0x33, SIM_FMT_BE16, 0x1A, 0x01 } },
+    .defaults  = s_icm20948_defaults,
+  },
+  [MGOS_IMU_I2C_SIM_AK09916] = {
+    .name      = "AK09916", .bank_reg = SIM_NO_BANK_REG,
+    .reset_reg = 0x32, .reset_mask = 0x01,                 // CNTL3 SRST
+    .blocks    = { { MGOS_IMU_I2C_SIM_MAG, 0, 0x11, SIM_FMT_LE16, 0x10, 0x01, 0x02 },
+                   { -1 } },
+    .defaults  = s_ak09916_defaults,
+  },
+  [MGOS_IMU_I2C_SIM_LSM9DS1_AG] = {
+    .name      = "LSM9DS1", .bank_reg = SIM_NO_BANK_REG,
+    .reset_reg = 0x22, .reset_mask = 0x01,                 // CTRL_REG8 SW_RESET
+    .clear_reg = 0x22, .clear_mask = 0x80,                 // CTRL_REG8 BOOT
+    .blocks    = { { MGOS_IMU_I2C_SIM_GYRO, 0, 0x18, SIM_FMT_LE16, 0x17, 0x02 },
+                   { MGOS_IMU_I2C_SIM_ACC,  0, 0x28, SIM_FMT_LE16, 0x27, 0x01 } },
+    .defaults  = s_lsm9ds1_ag_defaults,
+  },
+  [MGOS_IMU_I2C_SIM_LSM9DS1_M] = {
+    .name      = "LSM9DS1_M", .bank_reg = SIM_NO_BANK_REG,
+    .reset_reg = 0x21, .reset_mask = 0x04,                 // CTRL_REG2_M SOFT_RST
+    .clear_reg = 0x21, .clear_mask = 0x08,                 // CTRL_REG2_M REBOOT
+    .blocks    = { { MGOS_IMU_I2C_SIM_MAG, 0, 0x28, SIM_FMT_LE16, 0x27, 0x08 },
+                   { -1 } },
+    .defaults  = s_lsm9ds1_m_defaults,
+  },
+  [MGOS_IMU_I2C_SIM_BMM150] = {
+    .name      = "BMM150", .bank_reg = SIM_NO_BANK_REG,
+    .clear_reg = 0x4B, .clear_mask = 0x82,                 // POWMODE soft reset
+    .blocks    = { { MGOS_IMU_I2C_SIM_MAG, 0, 0x42, SIM_FMT_BMM150, 0x48, 0x01 },
+                   { -1 } },
+    .defaults  = s_bmm150_defaults,
+  },
+  [MGOS_IMU_I2C_SIM_ADXL345] = {
+    .name      = "ADXL345", .bank_reg = SIM_NO_BANK_REG,
+    .blocks    = { { MGOS_IMU_I2C_SIM_ACC, 0, 0x32, SIM_FMT_LE16, 0x30, 0x80 },
+                   { -1 } },
+    .defaults  = s_adxl345_defaults,
+  },
+  [MGOS_IMU_I2C_SIM_MMA8451] = {
+    .name      = "MMA8451", .bank_reg = SIM_NO_BANK_REG,
+    .reset_reg = 0x2B, .reset_mask = 0x40,                 // CTRL_REG2 RST
+    .blocks    = { { MGOS_IMU_I2C_SIM_ACC, 0, 0x01, SIM_FMT_BE14, 0x00, 0x08 },
+                   { -1 } },
+    .defaults  = s_mma8451_defaults,
+  },
+  [MGOS_IMU_I2C_SIM_LSM303D] = {
+    .name      = "LSM303D", .bank_reg = SIM_NO_BANK_REG, .auto_inc = 0x80,
+    .clear_reg = 0x1F, .clear_mask = 0x80,                 // CTRL0 BOOT
+    .blocks    = { { MGOS_IMU_I2C_SIM_ACC, 0, 0x28, SIM_FMT_LE16, 0x27, 0x08 },
+                   { MGOS_IMU_I2C_SIM_MAG, 0, 0x08, SIM_FMT_LE16, 0x07, 0x08 } },
+    .defaults  = s_lsm303d_defaults,
+  },
+  [MGOS_IMU_I2C_SIM_L3GD20] = {
+    .name      = "L3GD20", .bank_reg = SIM_NO_BANK_REG, .auto_inc = 0x80,
+    .clear_reg = 0x24, .clear_mask = 0x80,                 // CTRL_REG5 BOOT
+    .fifo      = SIM_FIFO_L3GD20, .fifo_size = 32 * 6,
+    .blocks    = { { MGOS_IMU_I2C_SIM_GYRO, 0, 0x28, SIM_FMT_LE16, 0x27, 0x08 },
+                   { -1 } },
+    .defaults  = s_l3gd20_defaults,
+  },
+  [MGOS_IMU_I2C_SIM_ITG3205] = {
+    .name      = "ITG3205", .bank_reg = SIM_NO_BANK_REG,
+    .reset_reg = 0x3E, .reset_mask = 0x80,                 // PWR_MGM H_RESET
+    .blocks    = { { MGOS_IMU_I2C_SIM_GYRO, 0, 0x1D, SIM_FMT_BE16, 0x1A, 0x01 },
+                   { -1 } },
+    .defaults  = s_itg3205_defaults,
+  },
+  [MGOS_IMU_I2C_SIM_MAG3110] = {
+    .name      = "MAG3110", .bank_reg = SIM_NO_BANK_REG,
+    .clear_reg = 0x11, .clear_mask = 0x10,                 // CTRL_REG2 Mag_RST
+    .blocks    = { { MGOS_IMU_I2C_SIM_MAG, 0, 0x01, SIM_FMT_BE16, 0x00, 0x08 },
+                   { -1 } },
+    .defaults  = s_mag3110_defaults,
+  },
+};
+
+// Private functions follow
+static struct sim_dev *sim_find(struct mgos_i2c *i2c, uint16_t addr) {
+  if (!i2c) {
+    return NULL;
+  }
+  for (int i = 0; i < i2c->n_devs; i++) {
+    if (i2c->devs[i].i2caddr == addr) {
+      return &i2c->devs[i];
+    }
+  }
+  return NULL;
+}
+
+static void sim_load_defaults(struct sim_dev *dev) {
+  memset(dev->regs, 0, sizeof(dev->regs));
+  for (const struct sim_reg *r = dev->chip->defaults; r && r->bank != 0xff; r++) {
+    dev->regs[r->bank][r->reg] = r->val;
+  }
+  dev->bank        = 0;
+  dev->shot_due_ns = 0;
+  dev->fifo.head   = 0;
+  dev->fifo.len    = 0;
+}
+
+static uint32_t sim_rand(struct sim_dev *dev) {
+  dev->rnd = dev->rnd * 1664525u + 1013904223u;
+  return dev->rnd >> 8;
+}
+
+static int16_t sim_wave_value(struct sim_dev *dev, int sensor, int axis, double t) {
+  struct mgos_imu_i2c_sim_wave *w = &dev->wave[sensor];
+  double v;
+
+  v = w->offset[axis] + w->amplitude[axis] * sin(2 * M_PI * w->freq * t + axis * 2 * M_PI / 3);
+  if (w->noise) {
+    v += (double)(sim_rand(dev) % (2u * w->noise + 1)) - w->noise;
+  }
+  if (v > 32767) {
+    v = 32767;
+  } else if (v < -32768) {
+    v = -32768;
+  }
+  return (int16_t)lround(v);
+}
+
+static int16_t sim_clamp(int16_t v, int16_t lim) {
+  return v > lim ? lim : (v < -lim - 1 ? -lim - 1 : v);
+}
+
+// Encode a sample into `out` (up to 8 bytes), returns its length.
+static int sim_encode(const struct sim_block *b, const int16_t v[3], uint8_t *out) {
+  uint16_t u;
+
+  switch (b->fmt) {
+  case SIM_FMT_LE16:
+    for (int i = 0; i < 3; i++) {
+      out[i * 2]     = (uint8_t)v[i];
+      out[i * 2 + 1] = (uint8_t)((uint16_t)v[i] >> 8);
+    }
+    return 6;
+
+  case SIM_FMT_BE14:
+    for (int i = 0; i < 3; i++) {
+      u              = (uint16_t)(sim_clamp(v[i], 8191) * 4);
+      out[i * 2]     = (uint8_t)(u >> 8);
+      out[i * 2 + 1] = (uint8_t)u;
+    }
+    return 6;
+
+  case SIM_FMT_BMM150:
+    for (int i = 0; i < 2; i++) {
+      u              = (uint16_t)(sim_clamp(v[i], 4095) * 8);
+      out[i * 2]     = (uint8_t)u;
+      out[i * 2 + 1] = (uint8_t)(u >> 8);
+    }
+    u      = (uint16_t)(sim_clamp(v[2], 16383) * 2);
+    out[4] = (uint8_t)u;
+    out[5] = (uint8_t)(u >> 8);
+    u      = (uint16_t)(0x1b8d << 2);   // RHALL at DIG_XYZ1, which compensates to unity
+    out[6] = (uint8_t)u;
+    out[7] = (uint8_t)(u >> 8);
+    return 8;
+
+  default:
+    for (int i = 0; i < 3; i++) {
+      out[i * 2]     = (uint8_t)((uint16_t)v[i] >> 8);
+      out[i * 2 + 1] = (uint8_t)v[i];
+    }
+    return 6;
+  }
+}
+
+static void sim_fifo_push(struct mgos_i2c *i2c, struct sim_dev *dev, const uint8_t *data, int len, bool overwrite) {
+  struct sim_fifo *f = &dev->fifo;
+
+  for (int i = 0; i < len; i++) {
+    if (f->len >= dev->chip->fifo_size) {
+      dev->stats.fifo_overruns++;
+      i2c->stats.fifo_overruns++;
+      if (!overwrite) {
+        return;
+      }
+      f->head = (f->head + 1) % dev->chip->fifo_size;
+      f->len--;
+    }
+    f->buf[(f->head + f->len) % dev->chip->fifo_size] = data[i];
+    f->len++;
+  }
+}
+
+// CTRL_REG5 FIFO_EN and FIFO_CTRL_REG FM other than bypass.
+static bool sim_l3gd20_fifo_on(struct sim_dev *dev) {
+  return (dev->regs[0][0x24] & 0x40) && (dev->regs[0][0x2E] & 0xE0);
+}
+
+static uint8_t sim_fifo_pop(struct sim_dev *dev) {
+  struct sim_fifo *f = &dev->fifo;
+  uint8_t v;
+
+  if (f->len == 0) {
+    return 0;
+  }
+  v       = f->buf[f->head];
+  f->head = (f->head + 1) % dev->chip->fifo_size;
+  f->len--;
+  return v;
+}
+
+// Push a sample into the FIFO, in the order and with the enables of the chip.
+static void sim_fifo_sample(struct mgos_i2c *i2c, struct sim_dev *dev, uint8_t enc[2][8]) {
+  uint8_t en;
+
+  switch (dev->chip->fifo) {
+  case SIM_FIFO_MPU:
+    // USER_CTRL FIFO_EN, then FIFO_EN: ACCEL, TEMP, XG, YG, ZG in register order.
+    if (!(dev->regs[0][0x6A] & 0x40)) {
+      return;
+    }
+    en = dev->regs[0][0x23];
+    if (en & 0x08) {
+      sim_fifo_push(i2c, dev, enc[0], 6, !(dev->regs[0][0x1A] & 0x40));
+    }
+    if (en & 0x80) {
+      sim_fifo_push(i2c, dev, &dev->regs[0][0x41], 2, !(dev->regs[0][0x1A] & 0x40));
+    }
+    for (int i = 0; i < 3; i++) {
+      if (en & (0x40 >> i)) {
+        sim_fifo_push(i2c, dev, &enc[1][i * 2], 2, !(dev->regs[0][0x1A] & 0x40));
+      }
+    }
+    if (dev->fifo.len >= dev->chip->fifo_size) {
+      dev->regs[0][0x3A] |= 0x10;   // INT_STATUS FIFO_OFLOW_INT
+    }
+    break;
+
+  case SIM_FIFO_LSM6DSL:
+    // FIFO_CTRL5 FIFO_MODE and ODR_FIFO, FIFO_CTRL3 decimation for gyro and XL.
+    if (!(dev->regs[0][0x0A] & 0x07) || !(dev->regs[0][0x0A] & 0x78)) {
+      return;
+    }
+    en = dev->regs[0][0x08];
+    if (en & 0x38) {
+      sim_fifo_push(i2c, dev, enc[0], 6, (dev->regs[0][0x0A] & 0x07) != 1);
+    }
+    if (en & 0x07) {
+      sim_fifo_push(i2c, dev, enc[1], 6, (dev->regs[0][0x0A] & 0x07) != 1);
+    }
+    break;
+
+  case SIM_FIFO_L3GD20:
+    // FM=001 (FIFO) stops when full, the stream modes overwrite.
+    if (sim_l3gd20_fifo_on(dev)) {
+      sim_fifo_push(i2c, dev, enc[0], 6, (dev->regs[0][0x2E] & 0xE0) != 0x20);
+    }
+    break;
+  }
+}
+
+static void sim_produce(struct mgos_i2c *i2c, struct sim_dev *dev, uint64_t sample) {
+  uint8_t enc[2][8];
+  int16_t v[3];
+  double  t = (double)sample / dev->odr;
+
+  for (int b = 0; b < 2; b++) {
+    const struct sim_block *blk = &dev->chip->blocks[b];
+    int len;
+
+    if (blk->sensor < 0) {
+      continue;
+    }
+    for (int axis = 0; axis < 3; axis++) {
+      v[axis] = sim_wave_value(dev, blk->sensor, axis, t);
+    }
+    len = sim_encode(blk, v, enc[b]);
+    memcpy(&dev->regs[blk->bank][blk->reg], enc[b], len);
+    if (dev->regs[0][blk->drdy_reg] & blk->drdy_mask) {
+      dev->regs[0][blk->drdy_reg] |= blk->dor_mask;
+    }
+    dev->regs[0][blk->drdy_reg] |= blk->drdy_mask;
+  }
+  sim_fifo_sample(i2c, dev, enc);
+}
+
+// Bring a device up to the current bus time.
+static void sim_update(struct mgos_i2c *i2c, struct sim_dev *dev) {
+  uint64_t due;
+
+  if (dev->chip->shot_reg) {
+    if (dev->shot_due_ns && i2c->now_ns >= dev->shot_due_ns) {
+      dev->shot_due_ns = 0;
+      dev->regs[0][dev->chip->shot_reg] = 0;   // Back to power down
+      sim_produce(i2c, dev, dev->sample++);
+    }
+    return;
+  }
+  due = (uint64_t)((double)i2c->now_ns * dev->odr / 1e9);
+  if (due <= dev->sample) {
+    return;
+  }
+  // Only the most recent FIFO depth worth of samples can matter.
+  if (due - dev->sample > SIM_FIFO_MAX) {
+    dev->sample = due - SIM_FIFO_MAX;
+  }
+  while (dev->sample < due) {
+    sim_produce(i2c, dev, dev->sample++);
+  }
+}
+
+static uint8_t sim_reg_read(struct sim_dev *dev, uint8_t reg) {
+  uint8_t *regs = dev->regs[dev->bank];
+  uint16_t words;
+
+  switch (dev->chip->fifo) {
+  case SIM_FIFO_MPU:
+    if (reg == 0x72) {
+      return (uint8_t)(dev->fifo.len >> 8);
+    }
+    if (reg == 0x73) {
+      return (uint8_t)dev->fifo.len;
+    }
+    if (reg == 0x74) {
+      return sim_fifo_pop(dev);
+    }
+    if (reg == 0x3A) {
+      uint8_t v = regs[reg];
+      regs[reg] = 0;   // INT_STATUS clears on read
+      return v;
+    }
+    break;
+
+  case SIM_FIFO_LSM6DSL:
+    words = dev->fifo.len / 2;
+    if (reg == 0x3A) {
+      return (uint8_t)words;
+    }
+    if (reg == 0x3B) {
+      return (uint8_t)(((words >> 8) & 0x07) | (words == 0 ? 0x10 : 0) |
+                       (dev->fifo.len >= dev->chip->fifo_size ? 0x60 : 0));
+    }
+    if (reg == 0x3E || reg == 0x3F) {
+      return sim_fifo_pop(dev);
+    }
+    break;
+
+  case SIM_FIFO_L3GD20:
+    words = dev->fifo.len / 6;
+    if (reg == 0x2F) {
+      // FIFO_SRC_REG: WTM OVRN EMPTY FSS[4:0], a full FIFO reads 31.
+      return (uint8_t)(((dev->regs[0][0x2E] & 0x1F) && words >= (dev->regs[0][0x2E] & 0x1F) ? 0x80 : 0) |
+                       (dev->fifo.len >= dev->chip->fifo_size ? 0x40 : 0) | (words == 0 ? 0x20 : 0) |
+                       (words > 31 ? 31 : words));
+    }
+    if (reg >= 0x28 && reg <= 0x2D && sim_l3gd20_fifo_on(dev) && dev->fifo.len > 0) {
+      return sim_fifo_pop(dev);
+    }
+    break;
+  }
+  if (dev->chip->bank_reg >= 0 && reg == dev->chip->bank_reg) {
+    return (uint8_t)(dev->bank << 4);
+  }
+  for (int b = 0; b < 2; b++) {
+    const struct sim_block *blk = &dev->chip->blocks[b];
+    if (blk->sensor >= 0 && blk->bank == dev->bank && reg >= blk->reg && reg < blk->reg + 6) {
+      dev->regs[0][blk->drdy_reg] &= ~(blk->drdy_mask | blk->dor_mask);
+    }
+  }
+  return regs[reg];
+}
+
+static void sim_reg_write(struct mgos_i2c *i2c, struct sim_dev *dev, uint8_t reg, uint8_t value) {
+  const struct sim_chip *chip = dev->chip;
+
+  if (chip->bank_reg >= 0 && reg == chip->bank_reg) {
+    dev->bank = (value >> 4) & (SIM_BANKS - 1);
+    return;
+  }
+  if (dev->bank == 0 && chip->reset_mask && reg == chip->reset_reg && (value & chip->reset_mask)) {
+    sim_load_defaults(dev);
+    return;
+  }
+  if (dev->bank == 0 && chip->fifo == SIM_FIFO_MPU && reg == 0x6A && (value & 0x04)) {
+    dev->fifo.head = dev->fifo.len = 0;   // USER_CTRL FIFO_RST
+  }
+  if (chip->fifo == SIM_FIFO_L3GD20 && reg == 0x2E && !(value & 0xE0)) {
+    dev->fifo.head = dev->fifo.len = 0;   // FIFO_CTRL_REG FM=000, bypass
+  }
+  if (dev->bank == 0 && chip->shot_reg && reg == chip->shot_reg && (value & 0x0F) == 0x01) {
+    dev->shot_due_ns = i2c->now_ns + 7300000;   // Single measurement, 7.3ms max
+  }
+  if (dev->bank == 0 && chip->clear_mask && reg == chip->clear_reg) {
+    value &= ~chip->clear_mask;
+  }
+  dev->regs[dev->bank][reg] = value;
+}
+
+// Register address after reading or writing `reg`.
+static uint8_t sim_next_reg(struct sim_dev *dev, uint8_t reg, bool inc) {
+  if (!inc) {
+    return reg;
+  }
+  if (dev->chip->fifo == SIM_FIFO_MPU && reg == 0x74) {
+    return reg;
+  }
+  if (dev->chip->fifo == SIM_FIFO_LSM6DSL && reg == 0x3F) {
+    return 0x3E;
+  }
+  if (dev->chip->fifo == SIM_FIFO_L3GD20 && reg == 0x2D && sim_l3gd20_fifo_on(dev)) {
+    return 0x28;
+  }
+  return (uint8_t)(reg + 1);
+}
+
+static bool sim_auto_inc(struct sim_dev *dev, uint8_t *reg) {
+  if (!dev->chip->auto_inc) {
+    return true;
+  }
+  if (*reg & dev->chip->auto_inc) {
+    *reg &= ~dev->chip->auto_inc;
+    return true;
+  }
+  return false;
+}
+
+// Count a transaction of `wire` bytes on the bus, including address and
+// register bytes, of which `payload` were read or written.
+static void sim_account(struct mgos_i2c *i2c, struct sim_dev *dev, int wire, int restarts, size_t payload, bool read) {
+  uint64_t bits = 2 + (uint64_t)wire * 9 + (uint64_t)restarts;
+  uint64_t ns   = bits * 1000000000ull / i2c->freq;
+
+  i2c->now_ns       += ns;
+  i2c->stats.bus_ns += ns;
+  i2c->stats.transactions++;
+  if (!dev) {
+    i2c->stats.naks++;
+    return;
+  }
+  dev->stats.bus_ns += ns;
+  dev->stats.transactions++;
+  if (read) {
+    i2c->stats.bytes_read += payload;
+    dev->stats.bytes_read += payload;
+  } else {
+    i2c->stats.bytes_written += payload;
+    dev->stats.bytes_written += payload;
+  }
+}
+
+static bool sim_read_regs(struct mgos_i2c *i2c, uint16_t addr, uint8_t reg, size_t n, uint8_t *buf) {
+  struct sim_dev *dev = sim_find(i2c, addr);
+  bool            inc;
+
+  if (!dev) {
+    if (i2c) {
+      sim_account(i2c, NULL, 1, 0, 0, true);
+    }
+    return false;
+  }
+  sim_update(i2c, dev);
+  inc = sim_auto_inc(dev, &reg);
+  for (size_t i = 0; i < n; i++) {
+    buf[i] = sim_reg_read(dev, reg);
+    reg    = sim_next_reg(dev, reg, inc);
+  }
+  dev->ptr = reg;
+  sim_account(i2c, dev, 3 + (int)n, 1, n, true);
+  return true;
+}
+
+static bool sim_write_regs(struct mgos_i2c *i2c, uint16_t addr, uint8_t reg, size_t n, const uint8_t *buf) {
+  struct sim_dev *dev = sim_find(i2c, addr);
+  bool            inc;
+
+  if (!dev) {
+    if (i2c) {
+      sim_account(i2c, NULL, 1, 0, 0, false);
+    }
+    return false;
+  }
+  sim_update(i2c, dev);
+  inc = sim_auto_inc(dev, &reg);
+  for (size_t i = 0; i < n; i++) {
+    sim_reg_write(i2c, dev, reg, buf[i]);
+    reg = sim_next_reg(dev, reg, inc);
+  }
+  dev->ptr = reg;
+  sim_account(i2c, dev, 2 + (int)n, 0, n, false);
+  return true;
+}
+// Private functions end
+
+// Public functions follow
+struct mgos_i2c *mgos_imu_i2c_sim_create(uint32_t freq) {
+  struct mgos_i2c *i2c;
+
+  i2c = calloc(1, sizeof(struct mgos_i2c));
+  if (!i2c) {
+    return NULL;
+  }
+  i2c->freq    = freq ? freq : MGOS_IMU_I2C_SIM_FREQ;
+  s_global_i2c = i2c;
+  return i2c;
+}
+
+bool mgos_imu_i2c_sim_destroy(struct mgos_i2c **i2c) {
+  if (!*i2c) {
+    return false;
+  }
+  if (s_global_i2c == *i2c) {
+    s_global_i2c = NULL;
+  }
+  free(*i2c);
+  *i2c = NULL;
+  return true;
+}
+
+bool mgos_imu_i2c_sim_add(struct mgos_i2c *i2c, enum mgos_imu_i2c_sim_chip chip, uint8_t i2caddr, float odr) {
+  struct sim_dev *dev;
+
+  if (!i2c || chip >= MGOS_IMU_I2C_SIM_CHIP_MAX || sim_find(i2c, i2caddr) ||
+      i2c->n_devs >= MGOS_IMU_I2C_SIM_MAX_DEVICES) {
+    return false;
+  }
+  dev = &i2c->devs[i2c->n_devs++];
+  memset(dev, 0, sizeof(*dev));
+  dev->chip    = &s_chips[chip];
+  dev->i2caddr = i2caddr;
+  dev->odr     = odr > 0 ? odr : 1000.f;
+  dev->rnd     = 0x1234567u ^ i2caddr;
+  dev->sample  = (uint64_t)((double)i2c->now_ns * dev->odr / 1e9);
+
+  dev->wave[MGOS_IMU_I2C_SIM_ACC].offset[2]    = 4096.f;   // 1G at 8G full scale
+  dev->wave[MGOS_IMU_I2C_SIM_ACC].noise        = 8;
+  for (int i = 0; i < 3; i++) {
+    dev->wave[MGOS_IMU_I2C_SIM_GYRO].amplitude[i] = 300.f;
+    dev->wave[MGOS_IMU_I2C_SIM_MAG].offset[i]     = 200.f;
+  }
+  dev->wave[MGOS_IMU_I2C_SIM_GYRO].freq        = 0.5f;
+  dev->wave[MGOS_IMU_I2C_SIM_GYRO].noise       = 4;
+  dev->wave[MGOS_IMU_I2C_SIM_MAG].offset[2]    = -400.f;
+  dev->wave[MGOS_IMU_I2C_SIM_MAG].noise        = 2;
+  sim_load_defaults(dev);
+  return true;
+}
+
+bool mgos_imu_i2c_sim_set_wave(struct mgos_i2c *i2c, uint8_t i2caddr, enum mgos_imu_i2c_sim_sensor sensor, const struct mgos_imu_i2c_sim_wave *wave) {
+  struct sim_dev *dev = sim_find(i2c, i2caddr);
+
+  if (!dev || !wave || sensor > MGOS_IMU_I2C_SIM_MAG) {
+    return false;
+  }
+  dev->wave[sensor] = *wave;
+  return true;
+}
+
+bool mgos_imu_i2c_sim_peek(struct mgos_i2c *i2c, uint8_t i2caddr, uint8_t bank, uint8_t reg, uint8_t *value) {
+  struct sim_dev *dev = sim_find(i2c, i2caddr);
+
+  if (!dev || bank >= SIM_BANKS || !value) {
+    return false;
+  }
+  *value = dev->regs[bank][reg];
+  return true;
+}
+
+bool mgos_imu_i2c_sim_poke(struct mgos_i2c *i2c, uint8_t i2caddr, uint8_t bank, uint8_t reg, uint8_t value) {
+  struct sim_dev *dev = sim_find(i2c, i2caddr);
+
+  if (!dev || bank >= SIM_BANKS) {
+    return false;
+  }
+  dev->regs[bank][reg] = value;
+  return true;
+}
+
+uint64_t mgos_imu_i2c_sim_get_time_us(struct mgos_i2c *i2c) {
+  return i2c ? i2c->now_ns / 1000 : 0;
+}
+
+void mgos_imu_i2c_sim_advance(struct mgos_i2c *i2c, uint32_t us) {
+  if (!i2c) {
+    return;
+  }
+  i2c->now_ns += (uint64_t)us * 1000;
+  for (int i = 0; i < i2c->n_devs; i++) {
+    sim_update(i2c, &i2c->devs[i]);
+  }
+}
+
+bool mgos_imu_i2c_sim_get_stats(struct mgos_i2c *i2c, uint8_t i2caddr, struct mgos_imu_i2c_sim_stats *stats) {
+  struct sim_dev *dev;
+
+  if (!i2c || !stats) {
+    return false;
+  }
+  if (i2caddr == 0) {
+    *stats = i2c->stats;
+    return true;
+  }
+  dev = sim_find(i2c, i2caddr);
+  if (!dev) {
+    return false;
+  }
+  *stats = dev->stats;
+  return true;
+}
+
+void mgos_imu_i2c_sim_reset_stats(struct mgos_i2c *i2c) {
+  if (!i2c) {
+    return;
+  }
+  memset(&i2c->stats, 0, sizeof(i2c->stats));
+  for (int i = 0; i < i2c->n_devs; i++) {
+    memset(&i2c->devs[i].stats, 0, sizeof(i2c->devs[i].stats));
+  }
+}
+
+// The mgos_i2c API, as used by the drivers.
+struct mgos_i2c *mgos_i2c_get_global(void) {
+  return s_global_i2c;
+}
+
+bool mgos_i2c_read(struct mgos_i2c *i2c, uint16_t addr, void *data, size_t len, bool stop) {
+  struct sim_dev *dev = sim_find(i2c, addr);
+  uint8_t *       buf = (uint8_t *)data;
+
+  if (!dev) {
+    if (i2c) {
+      sim_account(i2c, NULL, 1, 0, 0, true);
+    }
+    return false;
+  }
+  sim_update(i2c, dev);
+  for (size_t i = 0; i < len; i++) {
+    buf[i]   = sim_reg_read(dev, dev->ptr);
+    dev->ptr = sim_next_reg(dev, dev->ptr, true);
+  }
+  sim_account(i2c, dev, 1 + (int)len, 0, len, true);
+  (void)stop;
+  return true;
+}
+
+bool mgos_i2c_write(struct mgos_i2c *i2c, uint16_t addr, const void *data, size_t len, bool stop) {
+  const uint8_t *buf = (const uint8_t *)data;
+  struct sim_dev *dev;
+
+  if (len == 0) {
+    dev = sim_find(i2c, addr);
+    if (i2c) {
+      sim_account(i2c, dev, 1, 0, 0, false);
+    }
+    return dev != NULL;
+  }
+  if (!sim_write_regs(i2c, addr, buf[0], len - 1, buf + 1)) {
+    return false;
+  }
+  (void)stop;
+  return true;
+}
+
+void mgos_i2c_stop(struct mgos_i2c *i2c) {
+  (void)i2c;
+}
+
+int mgos_i2c_get_freq(struct mgos_i2c *i2c) {
+  return i2c ? (int)i2c->freq : 0;
+}
+
+bool mgos_i2c_set_freq(struct mgos_i2c *i2c, int freq) {
+  if (!i2c || freq <= 0) {
+    return false;
+  }
+  i2c->freq = (uint32_t)freq;
+  return true;
+}
+
+int mgos_i2c_read_reg_b(struct mgos_i2c *i2c, uint16_t addr, uint8_t reg) {
+  uint8_t value;
+
+  if (!sim_read_regs(i2c, addr, reg, 1, &value)) {
+    return -1;
+  }
+  return value;
+}
+
+int mgos_i2c_read_reg_w(struct mgos_i2c *i2c, uint16_t addr, uint8_t reg) {
+  uint8_t data[2];
+
+  if (!sim_read_regs(i2c, addr, reg, 2, data)) {
+    return -1;
+  }
+  return (data[0] << 8) | data[1];
+}
+
+bool mgos_i2c_read_reg_n(struct mgos_i2c *i2c, uint16_t addr, uint8_t reg, size_t n, uint8_t *buf) {
+  return sim_read_regs(i2c, addr, reg, n, buf);
+}
+
+bool mgos_i2c_write_reg_b(struct mgos_i2c *i2c, uint16_t addr, uint8_t reg, uint8_t value) {
+  return sim_write_regs(i2c, addr, reg, 1, &value);
+}
+
+bool mgos_i2c_write_reg_w(struct mgos_i2c *i2c, uint16_t addr, uint8_t reg, uint16_t value) {
+  uint8_t data[2] = { (uint8_t)(value >> 8), (uint8_t)value };
+
+  return sim_write_regs(i2c, addr, reg, 2, data);
+}
+
+bool mgos_i2c_write_reg_n(struct mgos_i2c *i2c, uint16_t addr, uint8_t reg, size_t n, const uint8_t *buf) {
+  return sim_write_regs(i2c, addr, reg, n, buf);
+}
+
+bool mgos_i2c_setbits_reg_b(struct mgos_i2c *i2c, uint16_t addr, uint8_t reg, uint8_t bitoffset, uint8_t bitlen, uint8_t value) {
+  uint8_t old, mask;
+
+  if (bitoffset + bitlen > 8 || !sim_read_regs(i2c, addr, reg, 1, &old)) {
+    return false;
+  }
+  mask = (uint8_t)(((1 << bitlen) - 1) << bitoffset);
+  old  = (uint8_t)((old & ~mask) | ((value << bitoffset) & mask));
+  return sim_write_regs(i2c, addr, reg, 1, &old);
+}
+
+bool mgos_i2c_getbits_reg_b(struct mgos_i2c *i2c, uint16_t addr, uint8_t reg, uint8_t bitoffset, uint8_t bitlen, uint8_t *value) {
+  uint8_t v;
+
+  if (bitoffset + bitlen > 8 || !value || !sim_read_regs(i2c, addr, reg, 1, &v)) {
+    return false;
+  }
+  *value = (uint8_t)((v >> bitoffset) & ((1 << bitlen) - 1));
+  return true;
+}
+
+// Public functions end
+
+#endif // MGOS_IMU_I2C_SIM
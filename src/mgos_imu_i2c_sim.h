@@ -0,0 +1,118 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Simulated I2C bus for running the drivers on a Linux host, without
+// hardware. It provides the mgos_i2c_*() register calls used by the drivers,
+// backed by register-map models of the chips: WHO_AM_I, self-clearing reset
+// bits, register banks, factory trim, output registers fed from a waveform
+// at the chip's ODR, data ready bits and FIFOs. Every transaction is counted
+// and costed in bus time, so that the cost of a mgos_imu_*_get() call can be
+// measured reproducibly, and compared between driver changes.
+//
+// Only built with -DMGOS_IMU_I2C_SIM, in place of the mgos i2c library.
+
+#pragma once
+
+#ifdef MGOS_IMU_I2C_SIM
+
+#include "mgos.h"
+#include "mgos_i2c.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MGOS_IMU_I2C_SIM_FREQ        (400000)
+#define MGOS_IMU_I2C_SIM_MAX_DEVICES (8)
+
+enum mgos_imu_i2c_sim_chip {
+  MGOS_IMU_I2C_SIM_MPU9250 = 0,   // Accel/gyro, FIFO. Add an AK8963 for the magnetometer.
+  MGOS_IMU_I2C_SIM_MPU6050,       // Accel/gyro, FIFO
+  MGOS_IMU_I2C_SIM_AK8963,
+  MGOS_IMU_I2C_SIM_AK8975,
+  MGOS_IMU_I2C_SIM_LSM6DSL,       // Accel/gyro, FIFO
+  MGOS_IMU_I2C_SIM_ICM20948,      // Accel/gyro, register banks
+  MGOS_IMU_I2C_SIM_AK09916,       // ICM20948 magnetometer, in bypass mode
+  MGOS_IMU_I2C_SIM_LSM9DS1_AG,
+  MGOS_IMU_I2C_SIM_LSM9DS1_M,
+  MGOS_IMU_I2C_SIM_BMM150,
+  MGOS_IMU_I2C_SIM_ADXL345,
+  MGOS_IMU_I2C_SIM_MMA8451,
+  MGOS_IMU_I2C_SIM_LSM303D,       // Accel and magnetometer on one address
+  MGOS_IMU_I2C_SIM_L3GD20,        // Gyro, FIFO
+  MGOS_IMU_I2C_SIM_ITG3205,
+  MGOS_IMU_I2C_SIM_MAG3110,
+  MGOS_IMU_I2C_SIM_CHIP_MAX
+};
+
+enum mgos_imu_i2c_sim_sensor {
+  MGOS_IMU_I2C_SIM_ACC = 0,
+  MGOS_IMU_I2C_SIM_GYRO,
+  MGOS_IMU_I2C_SIM_MAG
+};
+
+// Waveform of one sensor's output registers, in raw LSB:
+//   offset + amplitude * sin(2*pi*freq*t + axis*2*pi/3) + noise
+// where noise is deterministic and uniform in [-noise, noise].
+struct mgos_imu_i2c_sim_wave {
+  float    offset[3];
+  float    amplitude[3];
+  float    freq;
+  uint16_t noise;
+};
+
+struct mgos_imu_i2c_sim_stats {
+  uint32_t transactions;
+  uint32_t bytes_read;     // Payload bytes, excluding address and register bytes
+  uint32_t bytes_written;
+  uint32_t naks;           // Transactions to an address without a device
+  uint64_t bus_ns;         // Simulated time on the wire
+  uint32_t fifo_overruns;
+};
+
+// Create a bus clocked at `freq` Hz, 0 for MGOS_IMU_I2C_SIM_FREQ.
+// Returns a bus to pass to mgos_imu_*_create_i2c(), or NULL otherwise.
+struct mgos_i2c *mgos_imu_i2c_sim_create(uint32_t freq);
+bool mgos_imu_i2c_sim_destroy(struct mgos_i2c **i2c);
+
+// Attach a model of `chip` at `i2caddr`, producing samples at `odr` Hz
+// (0 for 1kHz), with a default waveform of 1G on the accelerometer z axis,
+// a slow gyroscope rotation and a constant field on the magnetometer.
+// Returns true on success, false if the address is taken or the bus is full.
+bool mgos_imu_i2c_sim_add(struct mgos_i2c *i2c, enum mgos_imu_i2c_sim_chip chip, uint8_t i2caddr, float odr);
+
+bool mgos_imu_i2c_sim_set_wave(struct mgos_i2c *i2c, uint8_t i2caddr, enum mgos_imu_i2c_sim_sensor sensor, const struct mgos_imu_i2c_sim_wave *wave);
+
+// Direct register access, which is not counted. `bank` is 0 except on
+// chips with register banks.
+bool mgos_imu_i2c_sim_peek(struct mgos_i2c *i2c, uint8_t i2caddr, uint8_t bank, uint8_t reg, uint8_t *value);
+bool mgos_imu_i2c_sim_poke(struct mgos_i2c *i2c, uint8_t i2caddr, uint8_t bank, uint8_t reg, uint8_t value);
+
+// Simulated time, which advances with bus time and by explicit calls, eg to
+// model the sampling interval of a loop. Samples are produced, and FIFOs
+// filled, as time passes.
+uint64_t mgos_imu_i2c_sim_get_time_us(struct mgos_i2c *i2c);
+void mgos_imu_i2c_sim_advance(struct mgos_i2c *i2c, uint32_t us);
+
+// Counters for the whole bus, or if `i2caddr` is not 0, for one device.
+bool mgos_imu_i2c_sim_get_stats(struct mgos_i2c *i2c, uint8_t i2caddr, struct mgos_imu_i2c_sim_stats *stats);
+void mgos_imu_i2c_sim_reset_stats(struct mgos_i2c *i2c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MGOS_IMU_I2C_SIM
@@ -17,10 +17,18 @@
 #include "mgos.h"
 #include "mgos_i2c.h"
 #include "mgos_imu_icm20948.h"
+#include <math.h>
 
 #define MGOS_ICM20948_ACC_BASE_ODR  1125.f
 #define MGOS_ICM20948_GYRO_BASE_ODR 1100.f
 
+// Low pass cutoff in Hz, by ACCEL_DLPFCFG and GYRO_DLPFCFG with the FCHOICE
+// bits set. With FCHOICE cleared the filter is bypassed.
+static const float s_icm20948_acc_bandwidth[8]  = { 246.f, 246.f, 111.4f, 50.4f, 23.9f, 11.5f, 5.7f, 473.f };
+static const float s_icm20948_gyro_bandwidth[8] = { 196.6f, 151.8f, 119.5f, 51.2f, 23.9f, 11.6f, 5.7f, 361.4f };
+#define MGOS_ICM20948_ACC_NO_DLPF_BW   1209.f
+#define MGOS_ICM20948_GYRO_NO_DLPF_BW  12106.f
+
 static bool mgos_imu_icm20948_change_bank(struct mgos_i2c *i2c, uint8_t i2caddr, void *imu_user_data, uint8_t bank_no) {
   struct  mgos_imu_icm20948_userdata *iud = (struct mgos_imu_icm20948_userdata *)imu_user_data;
   uint8_t bank_addr = 0x00;
@@ -69,49 +77,59 @@ static bool mgos_imu_icm20948_detect(struct mgos_i2c *i2c, uint8_t i2caddr, void
   return false;
 }
 
-static bool mgos_imu_icm20948_accgyro_create(struct mgos_i2c *i2c, uint8_t i2caddr, void *imu_user_data) {
+// Chip create steps, see mgos_imu_acc_create_step_fn.
+static int32_t mgos_imu_icm20948_accgyro_create_step(struct mgos_i2c *i2c, uint8_t i2caddr, void *imu_user_data, bool no_rst, uint8_t step) {
   if (!i2c) {
-    return false;
+    return -1;
   }
 
-  if(!mgos_imu_icm20948_change_bank(i2c, i2caddr, imu_user_data, 0)) {
-    return false;
-  }
-
-  // PWR_MGMNT_1: DEVICE_RESET=1; SLEEP=0; LP_EN=0; TEMP_DIS=0; CLKSEL=000;
-  mgos_i2c_write_reg_b(i2c, i2caddr, MGOS_ICM20948_REG0_PWR_MGMT_1, 0x80);
-  mgos_usleep(11000);
+  switch (step) {
+  case 0:
+    if(!mgos_imu_icm20948_change_bank(i2c, i2caddr, imu_user_data, 0)) {
+      return -1;
+    }
 
-  // PWR_MGMNT_1: DEVICE_RESET=0; SLEEP=0; LP_EN=0; TEMP_DIS=0; CLKSEL=001(auto clock source);
-  mgos_i2c_write_reg_b(i2c, i2caddr, MGOS_ICM20948_REG0_PWR_MGMT_1, 0x01);
+    // PWR_MGMNT_1: DEVICE_RESET=1; SLEEP=0; LP_EN=0; TEMP_DIS=0; CLKSEL=000;
+    if (!no_rst) {
+      mgos_i2c_write_reg_b(i2c, i2caddr, MGOS_ICM20948_REG0_PWR_MGMT_1, 0x80);
+      return 11000;
+    }
+  // fallthrough
 
-  // INT_PIN_CFG: BYPASS_EN=1(enable slave bypass mode);
-  mgos_i2c_write_reg_b(i2c, i2caddr, MGOS_ICM20948_REG0_INT_PIN_CFG, 0x02);
+  case 1:
+    // PWR_MGMNT_1: DEVICE_RESET=0; SLEEP=0; LP_EN=0; TEMP_DIS=0; CLKSEL=001(auto clock source);
+    mgos_i2c_write_reg_b(i2c, i2caddr, MGOS_ICM20948_REG0_PWR_MGMT_1, 0x01);
 
-  return true;
+    // INT_PIN_CFG: BYPASS_EN=1(enable slave bypass mode);
+    mgos_i2c_write_reg_b(i2c, i2caddr, MGOS_ICM20948_REG0_INT_PIN_CFG, 0x02);
+    return 0;
+  }
+  return -1;
 }
 
 bool mgos_imu_icm20948_acc_detect(struct mgos_imu_acc *dev, void *imu_user_data) {
   return mgos_imu_icm20948_detect(dev->i2c, dev->i2caddr, imu_user_data);
 }
 
-bool mgos_imu_icm20948_acc_create(struct mgos_imu_acc *dev, void *imu_user_data) {
+int32_t mgos_imu_icm20948_acc_create_step(struct mgos_imu_acc *dev, void *imu_user_data, uint8_t step) {
   struct mgos_imu_icm20948_userdata *iud = (struct mgos_imu_icm20948_userdata *)imu_user_data;
+  int32_t ret;
 
   if (!dev) {
-    return false;
+    return -1;
   }
 
   // Only initialize the ICM20948 if gyro hasn't done so yet
   if (!iud->accgyro_initialized) {
-    if (!mgos_imu_icm20948_accgyro_create(dev->i2c, dev->i2caddr, imu_user_data)) {
-      return false;
+    ret = mgos_imu_icm20948_accgyro_create_step(dev->i2c, dev->i2caddr, imu_user_data, dev->opts.no_rst, step);
+    if (ret != 0) {
+      return ret;
     }
     iud->accgyro_initialized = true;
   }
 
   if(!mgos_imu_icm20948_change_bank(dev->i2c, dev->i2caddr, imu_user_data, 2)) {
-    return false;
+    return -1;
   }
 
   // REG2_ACCEL_CONFIG: ACCEL_DLPFCFG=101(12Hz); ACCEL_FS_SEL=10(8g); ACCEL_FCHOICE=1(Enable accel DLPF);
@@ -122,7 +140,7 @@ bool mgos_imu_icm20948_acc_create(struct mgos_imu_acc *dev, void *imu_user_data)
   mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_ICM20948_REG2_ACCEL_SMPLRT_DIV_2, 0x0a);
 
   dev->scale = 8.f / 32767.0f;
-  return true;
+  return 0;
 }
 
 bool mgos_imu_icm20948_acc_read(struct mgos_imu_acc *dev, void *imu_user_data) {
@@ -138,6 +156,7 @@ bool mgos_imu_icm20948_acc_read(struct mgos_imu_acc *dev, void *imu_user_data) {
   if (!mgos_i2c_read_reg_n(dev->i2c, dev->i2caddr, MGOS_ICM20948_REG0_ACCEL_XOUT_H, 6, data)) {
     return false;
   }
+  mgos_imu_stats_i2c(dev->stats, 6);
 
   dev->ax = (data[0] << 8) | (data[1]);
   dev->ay = (data[2] << 8) | (data[3]);
@@ -247,27 +266,153 @@ bool mgos_imu_icm20948_acc_set_odr(struct mgos_imu_acc *dev, void *imu_user_data
   return true;
 }
 
+bool mgos_imu_icm20948_acc_get_bandwidth(struct mgos_imu_acc *dev, void *imu_user_data, float *hertz) {
+  int config;
+
+  if(!mgos_imu_icm20948_change_bank(dev->i2c, dev->i2caddr, imu_user_data, 2)) {
+    return false;
+  }
+  if ((config = mgos_i2c_read_reg_b(dev->i2c, dev->i2caddr, MGOS_ICM20948_REG2_ACCEL_CONFIG)) < 0) {
+    return false;
+  }
+  *hertz = (config & 0x01) ? s_icm20948_acc_bandwidth[(config >> 3) & 0x07] : MGOS_ICM20948_ACC_NO_DLPF_BW;
+  return true;
+}
+
+bool mgos_imu_icm20948_acc_set_bandwidth(struct mgos_imu_acc *dev, void *imu_user_data, float hertz) {
+  // ACCEL_DLPFCFG 0 has the same cutoff as 1.
+  uint8_t dlpf = mgos_imu_bandwidth_pick(&s_icm20948_acc_bandwidth[1], 7, hertz) + 1;
+
+  if(!mgos_imu_icm20948_change_bank(dev->i2c, dev->i2caddr, imu_user_data, 2)) {
+    return false;
+  }
+  // ACCEL_CONFIG: ACCEL_DLPFCFG=dlpf; ACCEL_FCHOICE=1(Enable accel DLPF);
+  return mgos_i2c_setbits_reg_b(dev->i2c, dev->i2caddr, MGOS_ICM20948_REG2_ACCEL_CONFIG, 3, 3, dlpf) &&
+         mgos_i2c_setbits_reg_b(dev->i2c, dev->i2caddr, MGOS_ICM20948_REG2_ACCEL_CONFIG, 0, 1, 1);
+}
+
+// Wake on motion: gyro disabled, accelerometer duty cycled at its current
+// sample rate in low power mode, and WOM on INT1 comparing every sample to the
+// previous one. There is no duration counter, so `duration_ms` is not used.
+bool mgos_imu_icm20948_acc_set_wakeup(struct mgos_imu_acc *dev, void *imu_user_data, float threshold, uint32_t duration_ms) {
+  struct mgos_imu_icm20948_userdata *iud = (struct mgos_imu_icm20948_userdata *)imu_user_data;
+  int val, thr;
+
+  if (!dev || !iud) {
+    return false;
+  }
+
+  if (threshold <= 0) {
+    if (!iud->wake_enabled) {
+      return true;
+    }
+    iud->wake_enabled = false;
+    if (!mgos_imu_icm20948_change_bank(dev->i2c, dev->i2caddr, imu_user_data, 0) ||
+        !mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_ICM20948_REG0_PWR_MGMT_1, iud->wake_pwr_mgmt_1) ||
+        !mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_ICM20948_REG0_LP_CONFIG, iud->wake_lp_config) ||
+        !mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_ICM20948_REG0_INT_ENABLE, iud->wake_int_enable) ||
+        !mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_ICM20948_REG0_PWR_MGMT_2, iud->wake_pwr_mgmt_2)) {
+      return false;
+    }
+    if (!mgos_imu_icm20948_change_bank(dev->i2c, dev->i2caddr, imu_user_data, 2)) {
+      return false;
+    }
+    return mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_ICM20948_REG2_ACCEL_INTEL_CTRL, 0x00);
+  }
+
+  if (!mgos_imu_icm20948_change_bank(dev->i2c, dev->i2caddr, imu_user_data, 0)) {
+    return false;
+  }
+  if (!iud->wake_enabled) {
+    if ((val = mgos_i2c_read_reg_b(dev->i2c, dev->i2caddr, MGOS_ICM20948_REG0_LP_CONFIG)) < 0) {
+      return false;
+    }
+    iud->wake_lp_config = (uint8_t)val;
+    if ((val = mgos_i2c_read_reg_b(dev->i2c, dev->i2caddr, MGOS_ICM20948_REG0_PWR_MGMT_1)) < 0) {
+      return false;
+    }
+    iud->wake_pwr_mgmt_1 = (uint8_t)val;
+    if ((val = mgos_i2c_read_reg_b(dev->i2c, dev->i2caddr, MGOS_ICM20948_REG0_PWR_MGMT_2)) < 0) {
+      return false;
+    }
+    iud->wake_pwr_mgmt_2 = (uint8_t)val;
+    if ((val = mgos_i2c_read_reg_b(dev->i2c, dev->i2caddr, MGOS_ICM20948_REG0_INT_ENABLE)) < 0) {
+      return false;
+    }
+    iud->wake_int_enable = (uint8_t)val;
+  }
+
+  // ACCEL_WOM_THR is in units of 4mg.
+  thr = (int)roundf(threshold * 250.f);
+  if (thr < 1) {
+    thr = 1;
+  } else if (thr > 255) {
+    thr = 255;
+  }
+  // PWR_MGMT_2: DISABLE_ACCEL=000; DISABLE_GYRO=111;
+  if (!mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_ICM20948_REG0_PWR_MGMT_2, 0x07)) {
+    return false;
+  }
+  // ACCEL_INTEL_CTRL: ACCEL_INTEL_EN=1; ACCEL_INTEL_MODE_INT=1 (compare to previous sample);
+  if (!mgos_imu_icm20948_change_bank(dev->i2c, dev->i2caddr, imu_user_data, 2) ||
+      !mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_ICM20948_REG2_ACCEL_WOM_THR, (uint8_t)thr) ||
+      !mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_ICM20948_REG2_ACCEL_INTEL_CTRL, 0x03)) {
+    return false;
+  }
+  // INT_ENABLE: WOM_INT_EN=1; LP_CONFIG: ACCEL_CYCLE=1; PWR_MGMT_1: LP_EN=1;
+  if (!mgos_imu_icm20948_change_bank(dev->i2c, dev->i2caddr, imu_user_data, 0) ||
+      !mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_ICM20948_REG0_INT_ENABLE, iud->wake_int_enable | 0x08) ||
+      !mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_ICM20948_REG0_LP_CONFIG, iud->wake_lp_config | 0x20) ||
+      !mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_ICM20948_REG0_PWR_MGMT_1, (iud->wake_pwr_mgmt_1 & ~0x40) | 0x20)) {
+    return false;
+  }
+  iud->wake_enabled = true;
+  return true;
+
+  (void)duration_ms;
+}
+
+bool mgos_imu_icm20948_acc_get_wakeup(struct mgos_imu_acc *dev, void *imu_user_data, bool *woken) {
+  int status;
+
+  if (!dev || !woken) {
+    return false;
+  }
+  if (!mgos_imu_icm20948_change_bank(dev->i2c, dev->i2caddr, imu_user_data, 0)) {
+    return false;
+  }
+  // Reading INT_STATUS clears it.
+  status = mgos_i2c_read_reg_b(dev->i2c, dev->i2caddr, MGOS_ICM20948_REG0_INT_STATUS);
+  if (status < 0) {
+    return false;
+  }
+  *woken = (status & 0x08);
+  return true;
+}
+
 bool mgos_imu_icm20948_gyro_detect(struct mgos_imu_gyro *dev, void *imu_user_data) {
   return mgos_imu_icm20948_detect(dev->i2c, dev->i2caddr, imu_user_data);
 }
 
-bool mgos_imu_icm20948_gyro_create(struct mgos_imu_gyro *dev, void *imu_user_data) {
+int32_t mgos_imu_icm20948_gyro_create_step(struct mgos_imu_gyro *dev, void *imu_user_data, uint8_t step) {
   struct mgos_imu_icm20948_userdata *iud = (struct mgos_imu_icm20948_userdata *)imu_user_data;
+  int32_t ret;
 
   if (!dev) {
-    return false;
+    return -1;
   }
 
   // Only initialize the ICM20948 if acc hasn't done so yet
   if (!iud->accgyro_initialized) {
-    if (!mgos_imu_icm20948_accgyro_create(dev->i2c, dev->i2caddr, imu_user_data)) {
-      return false;
+    ret = mgos_imu_icm20948_accgyro_create_step(dev->i2c, dev->i2caddr, imu_user_data, dev->opts.no_rst, step);
+    if (ret != 0) {
+      return ret;
     }
     iud->accgyro_initialized = true;
   }
 
   if(!mgos_imu_icm20948_change_bank(dev->i2c, dev->i2caddr, imu_user_data, 2)) {
-    return false;
+    return -1;
   }
 
   // GYRO_CONFIG_1: GYRO_DLPFCFG=101(12Hz); GYRO_FS_SEL=11(2000dps); GYRO_FCHOICE=1(Enable gyro DLPF);
@@ -276,7 +421,7 @@ bool mgos_imu_icm20948_gyro_create(struct mgos_imu_gyro *dev, void *imu_user_dat
   mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_ICM20948_REG2_GYRO_SMPLRT_DIV, 0x0a);
 
   dev->scale = 2000 / 32767.0f;
-  return true;
+  return 0;
 }
 
 bool mgos_imu_icm20948_gyro_read(struct mgos_imu_gyro *dev, void *imu_user_data) {
@@ -292,6 +437,7 @@ bool mgos_imu_icm20948_gyro_read(struct mgos_imu_gyro *dev, void *imu_user_data)
   if (!mgos_i2c_read_reg_n(dev->i2c, dev->i2caddr, MGOS_ICM20948_REG0_GYRO_XOUT_H, 6, data)) {
     return false;
   }
+  mgos_imu_stats_i2c(dev->stats, 6);
   dev->gx = (data[0] << 8) | (data[1]);
   dev->gy = (data[2] << 8) | (data[3]);
   dev->gz = (data[4] << 8) | (data[5]);
@@ -390,6 +536,30 @@ bool mgos_imu_icm20948_gyro_set_odr(struct mgos_imu_gyro *dev, void *imu_user_da
   return true;
 }
 
+bool mgos_imu_icm20948_gyro_get_bandwidth(struct mgos_imu_gyro *dev, void *imu_user_data, float *hertz) {
+  int config;
+
+  if(!mgos_imu_icm20948_change_bank(dev->i2c, dev->i2caddr, imu_user_data, 2)) {
+    return false;
+  }
+  if ((config = mgos_i2c_read_reg_b(dev->i2c, dev->i2caddr, MGOS_ICM20948_REG2_GYRO_CONFIG_1)) < 0) {
+    return false;
+  }
+  *hertz = (config & 0x01) ? s_icm20948_gyro_bandwidth[(config >> 3) & 0x07] : MGOS_ICM20948_GYRO_NO_DLPF_BW;
+  return true;
+}
+
+bool mgos_imu_icm20948_gyro_set_bandwidth(struct mgos_imu_gyro *dev, void *imu_user_data, float hertz) {
+  uint8_t dlpf = mgos_imu_bandwidth_pick(s_icm20948_gyro_bandwidth, 8, hertz);
+
+  if(!mgos_imu_icm20948_change_bank(dev->i2c, dev->i2caddr, imu_user_data, 2)) {
+    return false;
+  }
+  // GYRO_CONFIG_1: GYRO_DLPFCFG=dlpf; GYRO_FCHOICE=1(Enable gyro DLPF);
+  return mgos_i2c_setbits_reg_b(dev->i2c, dev->i2caddr, MGOS_ICM20948_REG2_GYRO_CONFIG_1, 3, 3, dlpf) &&
+         mgos_i2c_setbits_reg_b(dev->i2c, dev->i2caddr, MGOS_ICM20948_REG2_GYRO_CONFIG_1, 0, 1, 1);
+}
+
 bool mgos_imu_icm20948_mag_detect(struct mgos_imu_mag *dev, void *imu_user_data) {
   int device_id;
 
@@ -427,22 +597,37 @@ bool mgos_imu_icm20948_mag_create(struct mgos_imu_mag *dev, void *imu_user_data)
 }
 
 bool mgos_imu_icm20948_mag_read(struct mgos_imu_mag *dev, void *imu_user_data) {
-  uint8_t data[6];
+  uint8_t data[9];
 
   if (!dev) {
     return false;
   }
 
-  if (!mgos_i2c_read_reg_n(dev->i2c, dev->i2caddr, MGOS_ICM20948_HXL_M, 6, data)) {
+  // ST1, HXL..HZH, TMPS and ST2 in one go. Reading ST2 releases the data
+  // latch, so it has to be part of the same burst as the data.
+  if (!mgos_i2c_read_reg_n(dev->i2c, dev->i2caddr, MGOS_ICM20948_ST1_M, 9, data)) {
     return false;
   }
+  mgos_imu_stats_i2c(dev->stats, 9);
+  dev->stale = true;
 
-  // It is required to read ST2 register after data reading.
-  mgos_i2c_read_reg_b(dev->i2c, dev->i2caddr, MGOS_ICM20948_ST2_M);
+  // ST1 DRDY=0: no new sample since the last read, keep the previous one.
+  if (!(data[0] & 0x01)) {
+    return true;
+  }
+  // ST1 DOR=1: a sample was skipped.
+  if (data[0] & 0x02) {
+    mgos_imu_stats_overrun(dev->stats);
+  }
+  // ST2 HOFL=1: magnetic sensor overflow, the sample is invalid.
+  if (data[8] & 0x08) {
+    return true;
+  }
 
-  dev->mx = (data[1] << 8) | (data[0]);
-  dev->my = (data[3] << 8) | (data[2]);
-  dev->mz = (data[5] << 8) | (data[4]);
+  dev->mx    = (data[2] << 8) | (data[1]);
+  dev->my    = (data[4] << 8) | (data[3]);
+  dev->mz    = (data[6] << 8) | (data[5]);
+  dev->stale = false;
   return true;
 
   (void)imu_user_data;
@@ -490,7 +675,8 @@ bool mgos_imu_icm20948_mag_set_odr(struct mgos_imu_mag *dev, void *imu_user_data
     return false;
   }
 
-  return false;
+  dev->opts.odr = odr;
+  return true;
   (void)imu_user_data;
 }
 
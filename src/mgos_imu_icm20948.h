@@ -31,6 +31,8 @@
 #define MGOS_ICM20948_REG0_PWR_MGMT_1           (0x06)
 #define MGOS_ICM20948_REG0_PWR_MGMT_2           (0x07)
 #define MGOS_ICM20948_REG0_INT_PIN_CFG          (0x0f)
+#define MGOS_ICM20948_REG0_INT_ENABLE           (0x10)
+#define MGOS_ICM20948_REG0_INT_STATUS           (0x19)
 #define MGOS_ICM20948_REG0_ACCEL_XOUT_H         (0x2d)
 #define MGOS_ICM20948_REG0_GYRO_XOUT_H          (0x33)
 #define MGOS_ICM20948_REG0_EXT_SLV_SENS_DATA_00 (0x3b)
@@ -39,6 +41,8 @@
 #define MGOS_ICM20948_REG2_GYRO_CONFIG_1        (0x01)
 #define MGOS_ICM20948_REG2_ACCEL_SMPLRT_DIV_1   (0x10)
 #define MGOS_ICM20948_REG2_ACCEL_SMPLRT_DIV_2   (0x11)
+#define MGOS_ICM20948_REG2_ACCEL_INTEL_CTRL     (0x12)
+#define MGOS_ICM20948_REG2_ACCEL_WOM_THR        (0x13)
 #define MGOS_ICM20948_REG2_ACCEL_CONFIG         (0x14)
 #define MGOS_ICM20948_REG3_I2C_MST_CTRL         (0x01)
 #define MGOS_ICM20948_REG3_I2C_SLV0_ADDR        (0x03)
@@ -48,6 +52,7 @@
 
 // ICM20948 -- Registers (Mag)
 #define MGOS_ICM20948_WHO_AM_I_M                (0x01)
+#define MGOS_ICM20948_ST1_M                     (0x10)
 #define MGOS_ICM20948_HXL_M                     (0x11)
 #define MGOS_ICM20948_ST2_M                     (0x18)
 #define MGOS_ICM20948_CNTL2_M                   (0x31)
@@ -56,25 +61,38 @@
 struct mgos_imu_icm20948_userdata {
   bool    accgyro_initialized;
   int8_t  current_bank_no;
+
+  // Wake on motion, with the registers it changes as they were before.
+  bool    wake_enabled;
+  uint8_t wake_lp_config;
+  uint8_t wake_pwr_mgmt_1;
+  uint8_t wake_pwr_mgmt_2;
+  uint8_t wake_int_enable;
 };
 
 struct mgos_imu_icm20948_userdata *mgos_imu_icm20948_userdata_create(void);
 
 bool mgos_imu_icm20948_acc_detect(struct mgos_imu_acc *dev, void *imu_user_data);
-bool mgos_imu_icm20948_acc_create(struct mgos_imu_acc *dev, void *imu_user_data);
+int32_t mgos_imu_icm20948_acc_create_step(struct mgos_imu_acc *dev, void *imu_user_data, uint8_t step);
 bool mgos_imu_icm20948_acc_read(struct mgos_imu_acc *dev, void *imu_user_data);
 bool mgos_imu_icm20948_acc_get_scale(struct mgos_imu_acc *dev, void *imu_user_data, float *scale);
 bool mgos_imu_icm20948_acc_set_scale(struct mgos_imu_acc *dev, void *imu_user_data, float scale);
 bool mgos_imu_icm20948_acc_get_odr(struct mgos_imu_acc *dev, void *imu_user_data, float *odr);
 bool mgos_imu_icm20948_acc_set_odr(struct mgos_imu_acc *dev, void *imu_user_data, float odr);
+bool mgos_imu_icm20948_acc_get_bandwidth(struct mgos_imu_acc *dev, void *imu_user_data, float *hertz);
+bool mgos_imu_icm20948_acc_set_bandwidth(struct mgos_imu_acc *dev, void *imu_user_data, float hertz);
+bool mgos_imu_icm20948_acc_set_wakeup(struct mgos_imu_acc *dev, void *imu_user_data, float threshold, uint32_t duration_ms);
+bool mgos_imu_icm20948_acc_get_wakeup(struct mgos_imu_acc *dev, void *imu_user_data, bool *woken);
 
 bool mgos_imu_icm20948_gyro_detect(struct mgos_imu_gyro *dev, void *imu_user_data);
-bool mgos_imu_icm20948_gyro_create(struct mgos_imu_gyro *dev, void *imu_user_data);
+int32_t mgos_imu_icm20948_gyro_create_step(struct mgos_imu_gyro *dev, void *imu_user_data, uint8_t step);
 bool mgos_imu_icm20948_gyro_read(struct mgos_imu_gyro *dev, void *imu_user_data);
 bool mgos_imu_icm20948_gyro_get_scale(struct mgos_imu_gyro *dev, void *imu_user_data, float *scale);
 bool mgos_imu_icm20948_gyro_set_scale(struct mgos_imu_gyro *dev, void *imu_user_data, float scale);
 bool mgos_imu_icm20948_gyro_get_odr(struct mgos_imu_gyro *dev, void *imu_user_data, float *odr);
 bool mgos_imu_icm20948_gyro_set_odr(struct mgos_imu_gyro *dev, void *imu_user_data, float odr);
+bool mgos_imu_icm20948_gyro_get_bandwidth(struct mgos_imu_gyro *dev, void *imu_user_data, float *hertz);
+bool mgos_imu_icm20948_gyro_set_bandwidth(struct mgos_imu_gyro *dev, void *imu_user_data, float hertz);
 
 bool mgos_imu_icm20948_mag_detect(struct mgos_imu_mag *dev, void *imu_user_data);
 bool mgos_imu_icm20948_mag_create(struct mgos_imu_mag *dev, void *imu_user_data);
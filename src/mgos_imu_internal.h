@@ -27,108 +27,241 @@ struct mgos_imu_mag;
 struct mgos_imu_acc;
 struct mgos_imu_gyro;
 
+// Per sensor counters, allocated by mgos_imu_stats_enable(), NULL otherwise.
+struct mgos_imu_counters {
+  uint32_t reads;
+  uint32_t read_errors;
+  uint32_t i2c_bytes;
+  uint32_t overruns;
+  uint32_t clipped;
+  uint32_t latency_min_us;
+  uint32_t latency_max_us;
+  uint64_t latency_sum_us;
+  uint32_t latency_hist[MGOS_IMU_STATS_BUCKETS];
+};
+
 struct mgos_imu {
-  struct mgos_imu_mag * mag;
-  struct mgos_imu_acc * acc;
-  struct mgos_imu_gyro *gyro;
-  void *                user_data;
+  struct mgos_imu_mag *     mag;
+  struct mgos_imu_acc *     acc;
+  struct mgos_imu_gyro *    gyro;
+  void *                    user_data;
+  struct mgos_imu_motion *  motion;   // Motion wakeup state, see mgos_imu_motion.c
+  struct mgos_imu_odr_ctrl *odr_ctrl; // Adaptive data rate state, see mgos_imu_odr.c
 };
 
+// Staged sensor creation. Drivers whose chips need time after a reset or mode
+// change implement create_step() instead of create(): it is called with step
+// 0, 1, 2.. and returns the time in microseconds to wait before the next step,
+// 0 when the sensor is created, or -1 on error. The waits are done with
+// mgos_usleep() by mgos_imu_*_create_i2c(), and on timers by
+// mgos_imu_*_create_i2c_async().
+#define MGOS_IMU_CREATE_MAX_STEPS    (16)
+
+typedef int32_t (*mgos_imu_create_step_fn)(struct mgos_imu *imu, uint8_t step);
+typedef bool (*mgos_imu_create_done_fn)(struct mgos_imu *imu, bool ok);
+
+struct mgos_imu_create_ctx;
+
 // Magnetometer
 typedef bool (*mgos_imu_mag_detect_fn)(struct mgos_imu_mag *dev, void *imu_user_data);
 typedef bool (*mgos_imu_mag_create_fn)(struct mgos_imu_mag *dev, void *imu_user_data);
+typedef int32_t (*mgos_imu_mag_create_step_fn)(struct mgos_imu_mag *dev, void *imu_user_data, uint8_t step);
 typedef bool (*mgos_imu_mag_destroy_fn)(struct mgos_imu_mag *dev, void *imu_user_data);
 typedef bool (*mgos_imu_mag_read_fn)(struct mgos_imu_mag *dev, void *imu_user_data);
 typedef bool (*mgos_imu_mag_get_odr_fn)(struct mgos_imu_mag *dev, void *imu_user_data, float *odr);
 typedef bool (*mgos_imu_mag_set_odr_fn)(struct mgos_imu_mag *dev, void *imu_user_data, float odr);
 typedef bool (*mgos_imu_mag_get_scale_fn)(struct mgos_imu_mag *dev, void *imu_user_data, float *scale);
 typedef bool (*mgos_imu_mag_set_scale_fn)(struct mgos_imu_mag *dev, void *imu_user_data, float scale);
+typedef bool (*mgos_imu_mag_set_hw_offset_fn)(struct mgos_imu_mag *dev, void *imu_user_data, float x, float y, float z);
 
 struct mgos_imu_mag {
-  mgos_imu_mag_detect_fn    detect;
-  mgos_imu_mag_create_fn    create;
-  mgos_imu_mag_destroy_fn   destroy;
-  mgos_imu_mag_read_fn      read;
-  mgos_imu_mag_get_odr_fn   get_odr;
-  mgos_imu_mag_set_odr_fn   set_odr;
-  mgos_imu_mag_get_scale_fn get_scale;
-  mgos_imu_mag_set_scale_fn set_scale;
-
-  struct mgos_i2c *         i2c;
-  uint8_t                   i2caddr;
-  struct mgos_imu_mag_opts  opts;
+  mgos_imu_mag_detect_fn        detect;
+  mgos_imu_mag_create_fn        create;
+  mgos_imu_mag_create_step_fn   create_step;
+  mgos_imu_mag_destroy_fn       destroy;
+  mgos_imu_mag_read_fn          read;
+  mgos_imu_mag_get_odr_fn       get_odr;
+  mgos_imu_mag_set_odr_fn       set_odr;
+  mgos_imu_mag_get_scale_fn     get_scale;
+  mgos_imu_mag_set_scale_fn     set_scale;
+  mgos_imu_mag_set_hw_offset_fn set_hw_offset;
 
-  void *                    user_data;
+  struct mgos_i2c *             i2c;
+  uint8_t                       i2caddr;
+  struct mgos_imu_mag_opts      opts;
+
+  void *                        user_data;
+  struct mgos_imu_counters *    stats;
+  struct mgos_imu_create_ctx *  pending;
+  struct mgos_imu_filter *      filter;
+  struct mgos_imu_aggregator *  aggregator;
 
-  float                     scale;
-  float                     bias[3];
-  float                     orientation[9];
-  int16_t                   mx, my, mz;
+  float                         scale;
+  float                         bias[3];
+  float                         orientation[9];
+  int16_t                       mx, my, mz;
+  bool                          stale;  // read() had no new sample, and kept the previous one
+  float                         out[3]; // Last output, returned again for stale samples
+};
+
+// Auto-range state of an accelerometer or gyroscope, see mgos_imu_autorange.c.
+struct mgos_imu_autorange {
+  bool     enabled;
+  uint32_t hold_ms;
+  int64_t  low_since;    // When all axes went under the step down level, 0 if they are not
+  int64_t  settle_until; // Until when the chip is switching range, 0 if it is not
+  float    out[3];       // Last output, held while the chip is switching range
 };
 
 // Accelerometer
 typedef bool (*mgos_imu_acc_detect_fn)(struct mgos_imu_acc *dev, void *imu_user_data);
 typedef bool (*mgos_imu_acc_create_fn)(struct mgos_imu_acc *dev, void *imu_user_data);
+typedef int32_t (*mgos_imu_acc_create_step_fn)(struct mgos_imu_acc *dev, void *imu_user_data, uint8_t step);
 typedef bool (*mgos_imu_acc_destroy_fn)(struct mgos_imu_acc *dev, void *imu_user_data);
 typedef bool (*mgos_imu_acc_read_fn)(struct mgos_imu_acc *dev, void *imu_user_data);
 typedef bool (*mgos_imu_acc_get_odr_fn)(struct mgos_imu_acc *dev, void *imu_user_data, float *odr);
 typedef bool (*mgos_imu_acc_set_odr_fn)(struct mgos_imu_acc *dev, void *imu_user_data, float odr);
 typedef bool (*mgos_imu_acc_get_scale_fn)(struct mgos_imu_acc *dev, void *imu_user_data, float *scale);
 typedef bool (*mgos_imu_acc_set_scale_fn)(struct mgos_imu_acc *dev, void *imu_user_data, float scale);
+typedef bool (*mgos_imu_acc_set_hw_offset_fn)(struct mgos_imu_acc *dev, void *imu_user_data, float x, float y, float z);
+typedef bool (*mgos_imu_acc_get_bandwidth_fn)(struct mgos_imu_acc *dev, void *imu_user_data, float *hertz);
+typedef bool (*mgos_imu_acc_set_bandwidth_fn)(struct mgos_imu_acc *dev, void *imu_user_data, float hertz);
+// Wake on motion. set_wakeup() with a `threshold` in G puts the chip into its
+// low power, accelerometer only mode, with a wake interrupt on motion routed to
+// an INT pin. A `threshold` of 0 returns the chip to the configuration it had
+// before. get_wakeup() reads and clears the wake status.
+typedef bool (*mgos_imu_acc_set_wakeup_fn)(struct mgos_imu_acc *dev, void *imu_user_data, float threshold, uint32_t duration_ms);
+typedef bool (*mgos_imu_acc_get_wakeup_fn)(struct mgos_imu_acc *dev, void *imu_user_data, bool *woken);
 
 struct mgos_imu_acc {
-  mgos_imu_acc_detect_fn    detect;
-  mgos_imu_acc_create_fn    create;
-  mgos_imu_acc_destroy_fn   destroy;
-  mgos_imu_acc_read_fn      read;
-  mgos_imu_acc_get_odr_fn   get_odr;
-  mgos_imu_acc_set_odr_fn   set_odr;
-  mgos_imu_acc_get_scale_fn get_scale;
-  mgos_imu_acc_set_scale_fn set_scale;
-
-  struct mgos_i2c *         i2c;
-  uint8_t                   i2caddr;
-  struct mgos_imu_acc_opts  opts;
+  mgos_imu_acc_detect_fn        detect;
+  mgos_imu_acc_create_fn        create;
+  mgos_imu_acc_create_step_fn   create_step;
+  mgos_imu_acc_destroy_fn       destroy;
+  mgos_imu_acc_read_fn          read;
+  mgos_imu_acc_get_odr_fn       get_odr;
+  mgos_imu_acc_set_odr_fn       set_odr;
+  mgos_imu_acc_get_scale_fn     get_scale;
+  mgos_imu_acc_set_scale_fn     set_scale;
+  mgos_imu_acc_set_hw_offset_fn set_hw_offset;
+  mgos_imu_acc_get_bandwidth_fn get_bandwidth;
+  mgos_imu_acc_set_bandwidth_fn set_bandwidth;
+  mgos_imu_acc_set_wakeup_fn    set_wakeup;
+  mgos_imu_acc_get_wakeup_fn    get_wakeup;
 
-  void *                    user_data;
+  struct mgos_i2c *             i2c;
+  uint8_t                       i2caddr;
+  struct mgos_imu_acc_opts      opts;
 
-  float                     scale;
-  float                     offset_ax, offset_ay, offset_az;
-  int16_t                   ax, ay, az;
+  void *                        user_data;
+  struct mgos_imu_counters *    stats;
+  struct mgos_imu_create_ctx *  pending;
+  struct mgos_imu_filter *      filter;
+  struct mgos_imu_aggregator *  aggregator;
+
+  float                         scale;
+  float                         offset_ax, offset_ay, offset_az;
+  int16_t                       ax, ay, az;
+  bool                          clipped;
+  bool                          stale;  // read() had no new sample, or the range is switching
+  struct mgos_imu_autorange     autorange;
 };
 
 // Gyroscope
 typedef bool (*mgos_imu_gyro_detect_fn)(struct mgos_imu_gyro *dev, void *imu_user_data);
 typedef bool (*mgos_imu_gyro_create_fn)(struct mgos_imu_gyro *dev, void *imu_user_data);
+typedef int32_t (*mgos_imu_gyro_create_step_fn)(struct mgos_imu_gyro *dev, void *imu_user_data, uint8_t step);
 typedef bool (*mgos_imu_gyro_destroy_fn)(struct mgos_imu_gyro *dev, void *imu_user_data);
 typedef bool (*mgos_imu_gyro_read_fn)(struct mgos_imu_gyro *dev, void *imu_user_data);
 typedef bool (*mgos_imu_gyro_get_odr_fn)(struct mgos_imu_gyro *dev, void *imu_user_data, float *odr);
 typedef bool (*mgos_imu_gyro_set_odr_fn)(struct mgos_imu_gyro *dev, void *imu_user_data, float odr);
 typedef bool (*mgos_imu_gyro_get_scale_fn)(struct mgos_imu_gyro *dev, void *imu_user_data, float *scale);
 typedef bool (*mgos_imu_gyro_set_scale_fn)(struct mgos_imu_gyro *dev, void *imu_user_data, float scale);
+typedef bool (*mgos_imu_gyro_set_hw_offset_fn)(struct mgos_imu_gyro *dev, void *imu_user_data, float x, float y, float z);
+typedef bool (*mgos_imu_gyro_get_bandwidth_fn)(struct mgos_imu_gyro *dev, void *imu_user_data, float *hertz);
+typedef bool (*mgos_imu_gyro_set_bandwidth_fn)(struct mgos_imu_gyro *dev, void *imu_user_data, float hertz);
 
 struct mgos_imu_gyro {
-  mgos_imu_gyro_detect_fn    detect;
-  mgos_imu_gyro_create_fn    create;
-  mgos_imu_gyro_destroy_fn   destroy;
-  mgos_imu_gyro_read_fn      read;
-  mgos_imu_gyro_get_odr_fn   get_odr;
-  mgos_imu_gyro_set_odr_fn   set_odr;
-  mgos_imu_gyro_get_scale_fn get_scale;
-  mgos_imu_gyro_set_scale_fn set_scale;
-
-  struct mgos_i2c *          i2c;
-  uint8_t                    i2caddr;
-  struct mgos_imu_gyro_opts  opts;
-
-  void *                     user_data;
-
-  float                      scale;
-  float                      offset_gx, offset_gy, offset_gz;
-  float                      orientation[9];
-  int16_t                    gx, gy, gz;
+  mgos_imu_gyro_detect_fn        detect;
+  mgos_imu_gyro_create_fn        create;
+  mgos_imu_gyro_create_step_fn   create_step;
+  mgos_imu_gyro_destroy_fn       destroy;
+  mgos_imu_gyro_read_fn          read;
+  mgos_imu_gyro_get_odr_fn       get_odr;
+  mgos_imu_gyro_set_odr_fn       set_odr;
+  mgos_imu_gyro_get_scale_fn     get_scale;
+  mgos_imu_gyro_set_scale_fn     set_scale;
+  mgos_imu_gyro_set_hw_offset_fn set_hw_offset;
+  mgos_imu_gyro_get_bandwidth_fn get_bandwidth;
+  mgos_imu_gyro_set_bandwidth_fn set_bandwidth;
+
+  struct mgos_i2c *              i2c;
+  uint8_t                        i2caddr;
+  struct mgos_imu_gyro_opts      opts;
+
+  void *                         user_data;
+  struct mgos_imu_counters *     stats;
+  struct mgos_imu_create_ctx *   pending;
+  struct mgos_imu_filter *       filter;
+  struct mgos_imu_aggregator *   aggregator;
+
+  float                          scale;
+  float                          offset_gx, offset_gy, offset_gz;
+  float                          orientation[9];
+  int16_t                        gx, gy, gz;
+  bool                           clipped;
+  bool                           stale;  // read() had no new sample, or the range is switching
+  struct mgos_imu_autorange      autorange;
 };
 
+// Stats helpers, see mgos_imu_stats.c. All of them are a noop on NULL stats.
+int64_t mgos_imu_stats_start(struct mgos_imu_counters *stats);
+void mgos_imu_stats_read(struct mgos_imu_counters *stats, int64_t start, bool ok);
+// Called by the driver read() functions with the number of register bytes
+// they moved over I2C.
+void mgos_imu_stats_i2c(struct mgos_imu_counters *stats, uint32_t bytes);
+// Called by the driver read() functions when the chip flags that a sample was
+// overwritten before it was read.
+void mgos_imu_stats_overrun(struct mgos_imu_counters *stats);
+// Called by the mgos_imu_*_get() functions for samples that hit the end of
+// the range on any axis.
+void mgos_imu_stats_clipped(struct mgos_imu_counters *stats);
+
+// Bandwidth helper, see mgos_imu_bandwidth.c. Drivers keep their low pass cutoffs in
+// tables indexed by register value, with 0 for values they do not use. Returns
+// the index of the highest cutoff that is at most `hertz`, or of the lowest
+// cutoff if there is none.
+int mgos_imu_bandwidth_pick(const float *cutoffs, int n, float hertz);
+
+// Staged create helpers, see mgos_imu_create.c.
+// Run all steps now, sleeping in between. Returns true if the sensor was created.
+bool mgos_imu_create_run(struct mgos_imu *imu, mgos_imu_create_step_fn step);
+// Run the steps on timers, then call done() and `cb`. Returns NULL on failure.
+struct mgos_imu_create_ctx *mgos_imu_create_start(struct mgos_imu *imu, mgos_imu_create_step_fn step, mgos_imu_create_done_fn done, mgos_imu_create_cb cb, void *cb_arg);
+// Stop a pending create without calling done() or `cb`, for sensor destroy.
+void mgos_imu_create_cancel(struct mgos_imu_create_ctx *ctx);
+
+// Motion wakeup helpers, see mgos_imu_motion.c.
+// Called by mgos_imu_accelerometer_get() after every successful read.
+void mgos_imu_motion_acc(struct mgos_imu *imu);
+
+// Auto-range helpers, see mgos_imu_autorange.c.
+// Returns true if any axis is at the end of the int16 range.
+bool mgos_imu_autorange_clipped(int16_t x, int16_t y, int16_t z);
+// Returns 1 to step the range up, -1 to step it down, 0 to keep it.
+int mgos_imu_autorange_check(struct mgos_imu_autorange *ar, int16_t x, int16_t y, int16_t z);
+// Called after the range was switched, with the data rate of the sensor, or 0
+// if it is not known. Until the chip has produced a sample at the new range,
+// mgos_imu_autorange_settling() returns true.
+void mgos_imu_autorange_switched(struct mgos_imu_autorange *ar, float odr);
+bool mgos_imu_autorange_settling(struct mgos_imu_autorange *ar);
+
+// Adaptive data rate helpers, see mgos_imu_odr.c.
+// Called by mgos_imu_accelerometer_get() and mgos_imu_gyroscope_get() after
+// every successful read.
+void mgos_imu_odr_ctrl_acc(struct mgos_imu *imu);
+void mgos_imu_odr_ctrl_gyro(struct mgos_imu *imu);
+
 #ifdef __cplusplus
 }
 #endif
@@ -18,6 +18,10 @@
 #include "mgos_i2c.h"
 #include "mgos_imu_itg3205.h"
 
+// Low pass cutoff in Hz, by DLPF_CFG. Value 0 runs the chip at 8kHz instead of
+// 1kHz, which would change the data rate, so it is not set by the driver.
+static const float s_itg3205_bandwidth[7] = { 256.f, 188.f, 98.f, 42.f, 20.f, 10.f, 5.f };
+
 bool mgos_imu_itg3205_detect(struct mgos_imu_gyro *dev, void *imu_user_data) {
   int device_id;
 
@@ -75,6 +79,7 @@ bool mgos_imu_itg3205_read(struct mgos_imu_gyro *dev, void *imu_user_data) {
   if (!mgos_i2c_read_reg_n(dev->i2c, dev->i2caddr, MGOS_ITG3205_REG_GYRO_XOUT_H, 6, data)) {
     return false;
   }
+  mgos_imu_stats_i2c(dev->stats, 6);
   dev->gx = (int16_t)((data[0] << 8) | data[1]);
   dev->gy = (int16_t)((data[2] << 8) | data[3]);
   dev->gz = (int16_t)((data[4] << 8) | data[5]);
@@ -83,3 +88,29 @@ bool mgos_imu_itg3205_read(struct mgos_imu_gyro *dev, void *imu_user_data) {
 
   (void)imu_user_data;
 }
+
+bool mgos_imu_itg3205_get_bandwidth(struct mgos_imu_gyro *dev, void *imu_user_data, float *hertz) {
+  uint8_t dlpf;
+
+  if (!dev || !mgos_i2c_getbits_reg_b(dev->i2c, dev->i2caddr, MGOS_ITG3205_REG_DLPF_FS, 0, 3, &dlpf)) {
+    return false;
+  }
+  if (dlpf > 6) {
+    return false;
+  }
+  *hertz = s_itg3205_bandwidth[dlpf];
+  return true;
+
+  (void)imu_user_data;
+}
+
+bool mgos_imu_itg3205_set_bandwidth(struct mgos_imu_gyro *dev, void *imu_user_data, float hertz) {
+  uint8_t dlpf = mgos_imu_bandwidth_pick(&s_itg3205_bandwidth[1], 6, hertz) + 1;
+
+  if (!dev) {
+    return false;
+  }
+  return mgos_i2c_setbits_reg_b(dev->i2c, dev->i2caddr, MGOS_ITG3205_REG_DLPF_FS, 0, 3, dlpf);
+
+  (void)imu_user_data;
+}
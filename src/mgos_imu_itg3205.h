@@ -41,3 +41,5 @@
 bool mgos_imu_itg3205_detect(struct mgos_imu_gyro *dev, void *imu_user_data);
 bool mgos_imu_itg3205_create(struct mgos_imu_gyro *dev, void *imu_user_data);
 bool mgos_imu_itg3205_read(struct mgos_imu_gyro *dev, void *imu_user_data);
+bool mgos_imu_itg3205_get_bandwidth(struct mgos_imu_gyro *dev, void *imu_user_data, float *hertz);
+bool mgos_imu_itg3205_set_bandwidth(struct mgos_imu_gyro *dev, void *imu_user_data, float hertz);
@@ -18,6 +18,46 @@
 #include "mgos_i2c.h"
 #include "mgos_imu_l3gd20.h"
 
+// Low pass cutoff in Hz, by CTRL_REG1 DR (rows) and BW (columns).
+static const float s_l3gd20_bandwidth[4][4] = {
+  { 12.5f, 25.f, 25.f,  25.f  },
+  { 12.5f, 25.f, 50.f,  70.f  },
+  { 20.f,  25.f, 50.f,  100.f },
+  { 30.f,  35.f, 50.f,  100.f },
+};
+
+// As above for the L3GD20H, with LOW_ODR clear. 0 marks the combinations the
+// datasheet leaves out.
+static const float s_l3gd20h_bandwidth[4][4] = {
+  { 12.5f, 25.f, 25.f,  25.f  },
+  { 12.5f, 0.f,  0.f,   70.f  },
+  { 20.f,  25.f, 50.f,  110.f },
+  { 30.f,  35.f, 0.f,   100.f },
+};
+
+// Cutoffs of the part, at CTRL_REG1 DR `dr`.
+static const float *mgos_imu_l3gd20_bandwidth(struct mgos_imu_gyro *dev, uint8_t dr) {
+  return dev->opts.type == GYRO_L3GD20H ? s_l3gd20h_bandwidth[dr & 0x03] : s_l3gd20_bandwidth[dr & 0x03];
+}
+
+// Data rate in Hz of CTRL_REG1 DR. The L3GD20H runs slightly faster.
+static float mgos_imu_l3gd20_dr_to_hz(struct mgos_imu_gyro *dev, uint8_t dr) {
+  static const float l3gd20[4]  = { 95.f, 190.f, 380.f, 760.f };
+  static const float l3gd20h[4] = { 100.f, 200.f, 400.f, 800.f };
+
+  return dev->opts.type == GYRO_L3GD20H ? l3gd20h[dr & 0x03] : l3gd20[dr & 0x03];
+}
+
+static struct mgos_imu_gyro *mgos_imu_l3gd20_get_gyro(struct mgos_imu *imu) {
+  if (!imu || !imu->gyro || imu->gyro->pending) {
+    return NULL;
+  }
+  if (imu->gyro->opts.type != GYRO_L3GD20 && imu->gyro->opts.type != GYRO_L3GD20H) {
+    return NULL;
+  }
+  return imu->gyro;
+}
+
 bool mgos_imu_l3gd20_detect(struct mgos_imu_gyro *dev, void *imu_user_data) {
   int device_id;
 
@@ -39,31 +79,37 @@ bool mgos_imu_l3gd20_detect(struct mgos_imu_gyro *dev, void *imu_user_data) {
   (void)imu_user_data;
 }
 
-bool mgos_imu_l3gd20_create(struct mgos_imu_gyro *dev, void *imu_user_data) {
+int32_t mgos_imu_l3gd20_create_step(struct mgos_imu_gyro *dev, void *imu_user_data, uint8_t step) {
   if (!dev) {
-    return false;
+    return -1;
   }
 
-  // Reset
-  if (!mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_L3GD20_REG_CTRL_REG1, 0x00)) {
-    return false;
+  switch (step) {
+  case 0:
+    // Reset
+    if (!mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_L3GD20_REG_CTRL_REG1, 0x00)) {
+      return -1;
+    }
+    return 5000;
+
+  default:
+    break;
   }
-  mgos_usleep(5000);
 
   // Enable sensors: DR=01 (190Hz) BW=10 (50Hz) PD=1 [XYZ]EN=1
   if (!mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_L3GD20_REG_CTRL_REG1, 0x6F)) {
-    return false;
+    return -1;
   }
 
   // Set 2000DPS
   if (!mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_L3GD20_REG_CTRL_REG4, 0x20)) {
-    return false;
+    return -1;
   }
 
   // Datasheet says 2000dps is 0.07 deg per LSB.
   dev->scale = (2000.f * 1.1468625f) / 32767.5f;
 
-  return true;
+  return 0;
 
   (void)imu_user_data;
 }
@@ -74,13 +120,11 @@ bool mgos_imu_l3gd20_read(struct mgos_imu_gyro *dev, void *imu_user_data) {
   if (!dev) {
     return false;
   }
-  // Device cannot read multiple registers at once.
-  data[0] = mgos_i2c_read_reg_b(dev->i2c, dev->i2caddr, MGOS_L3GD20_REG_OUT_X_L);
-  data[1] = mgos_i2c_read_reg_b(dev->i2c, dev->i2caddr, MGOS_L3GD20_REG_OUT_X_H);
-  data[2] = mgos_i2c_read_reg_b(dev->i2c, dev->i2caddr, MGOS_L3GD20_REG_OUT_Y_L);
-  data[3] = mgos_i2c_read_reg_b(dev->i2c, dev->i2caddr, MGOS_L3GD20_REG_OUT_Y_H);
-  data[4] = mgos_i2c_read_reg_b(dev->i2c, dev->i2caddr, MGOS_L3GD20_REG_OUT_Z_L);
-  data[5] = mgos_i2c_read_reg_b(dev->i2c, dev->i2caddr, MGOS_L3GD20_REG_OUT_Z_H);
+  // Multi byte reads need the sub address MSB set, or the chip sends OUT_X_L six times.
+  if (!mgos_i2c_read_reg_n(dev->i2c, dev->i2caddr, MGOS_L3GD20_REG_OUT_X_L | MGOS_L3GD20_AUTO_INC, 6, data)) {
+    return false;
+  }
+  mgos_imu_stats_i2c(dev->stats, 6);
   dev->gx = (int16_t)((data[1] << 8) | data[0]);
   dev->gy = (int16_t)((data[3] << 8) | data[2]);
   dev->gz = (int16_t)((data[5] << 8) | data[4]);
@@ -89,3 +133,179 @@ bool mgos_imu_l3gd20_read(struct mgos_imu_gyro *dev, void *imu_user_data) {
 
   (void)imu_user_data;
 }
+
+bool mgos_imu_l3gd20_get_odr(struct mgos_imu_gyro *dev, void *imu_user_data, float *odr) {
+  uint8_t dr;
+
+  if (!dev || !odr) {
+    return false;
+  }
+  if (!mgos_i2c_getbits_reg_b(dev->i2c, dev->i2caddr, MGOS_L3GD20_REG_CTRL_REG1, 6, 2, &dr)) {
+    return false;
+  }
+  *odr = mgos_imu_l3gd20_dr_to_hz(dev, dr);
+  return true;
+
+  (void)imu_user_data;
+}
+
+bool mgos_imu_l3gd20_set_odr(struct mgos_imu_gyro *dev, void *imu_user_data, float odr) {
+  uint8_t dr;
+
+  if (!dev || odr <= 0) {
+    return false;
+  }
+  for (dr = 0; dr < 4; dr++) {
+    if (odr <= mgos_imu_l3gd20_dr_to_hz(dev, dr)) {
+      break;
+    }
+  }
+  if (dr == 4) {
+    return false;
+  }
+  // BW is left as is, its cutoff scales with the data rate.
+  if (!mgos_i2c_setbits_reg_b(dev->i2c, dev->i2caddr, MGOS_L3GD20_REG_CTRL_REG1, 6, 2, dr)) {
+    return false;
+  }
+  dev->opts.odr = odr;
+  return true;
+
+  (void)imu_user_data;
+}
+
+bool mgos_imu_l3gd20_gyro_get_bandwidth(struct mgos_imu_gyro *dev, void *imu_user_data, float *hertz) {
+  int ctrl1;
+
+  if (!dev || !hertz) {
+    return false;
+  }
+  ctrl1 = mgos_i2c_read_reg_b(dev->i2c, dev->i2caddr, MGOS_L3GD20_REG_CTRL_REG1);
+  if (ctrl1 < 0) {
+    return false;
+  }
+  *hertz = mgos_imu_l3gd20_bandwidth(dev, ctrl1 >> 6)[(ctrl1 >> 4) & 0x03];
+  return *hertz > 0;
+
+  (void)imu_user_data;
+}
+
+bool mgos_imu_l3gd20_gyro_set_bandwidth(struct mgos_imu_gyro *dev, void *imu_user_data, float hertz) {
+  uint8_t dr, bw;
+
+  if (!dev || hertz <= 0) {
+    return false;
+  }
+  if (!mgos_i2c_getbits_reg_b(dev->i2c, dev->i2caddr, MGOS_L3GD20_REG_CTRL_REG1, 6, 2, &dr)) {
+    return false;
+  }
+  bw = mgos_imu_bandwidth_pick(mgos_imu_l3gd20_bandwidth(dev, dr), 4, hertz);
+  return mgos_i2c_setbits_reg_b(dev->i2c, dev->i2caddr, MGOS_L3GD20_REG_CTRL_REG1, 4, 2, bw);
+
+  (void)imu_user_data;
+}
+
+bool mgos_imu_l3gd20_get_bandwidth(struct mgos_imu *imu, float *hertz) {
+  return mgos_imu_l3gd20_gyro_get_bandwidth(mgos_imu_l3gd20_get_gyro(imu), NULL, hertz);
+}
+
+bool mgos_imu_l3gd20_set_bandwidth(struct mgos_imu *imu, float hertz) {
+  return mgos_imu_l3gd20_gyro_set_bandwidth(mgos_imu_l3gd20_get_gyro(imu), NULL, hertz);
+}
+
+bool mgos_imu_l3gd20_fifo_enable(struct mgos_imu *imu, uint8_t watermark) {
+  struct mgos_imu_gyro *dev = mgos_imu_l3gd20_get_gyro(imu);
+
+  if (!dev || watermark == 0 || watermark >= MGOS_L3GD20_FIFO_SIZE) {
+    return false;
+  }
+  // FIFO_CTRL_REG: FM=010 (stream) WTM=watermark
+  if (!mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_L3GD20_REG_FIFO_CTRL_REG, (MGOS_L3GD20_FIFO_MODE_STREAM << 5) | watermark)) {
+    return false;
+  }
+  // CTRL_REG3: I2_WTM=1, CTRL_REG5: FIFO_EN=1
+  return mgos_i2c_setbits_reg_b(dev->i2c, dev->i2caddr, MGOS_L3GD20_REG_CTRL_REG3, 2, 1, 1) &&
+         mgos_i2c_setbits_reg_b(dev->i2c, dev->i2caddr, MGOS_L3GD20_REG_CTRL_REG5, 6, 1, 1);
+}
+
+bool mgos_imu_l3gd20_fifo_disable(struct mgos_imu *imu) {
+  struct mgos_imu_gyro *dev = mgos_imu_l3gd20_get_gyro(imu);
+
+  if (!dev) {
+    return false;
+  }
+  return mgos_i2c_setbits_reg_b(dev->i2c, dev->i2caddr, MGOS_L3GD20_REG_CTRL_REG5, 6, 1, 0) &&
+         mgos_i2c_setbits_reg_b(dev->i2c, dev->i2caddr, MGOS_L3GD20_REG_CTRL_REG3, 2, 1, 0) &&
+         mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_L3GD20_REG_FIFO_CTRL_REG, MGOS_L3GD20_FIFO_MODE_BYPASS << 5);
+}
+
+bool mgos_imu_l3gd20_fifo_get_level(struct mgos_imu *imu, uint8_t *samples, bool *overrun) {
+  struct mgos_imu_gyro *dev = mgos_imu_l3gd20_get_gyro(imu);
+  int src;
+
+  if (!dev) {
+    return false;
+  }
+  // FIFO_SRC_REG: WTM OVRN EMPTY FSS[4:0]. A full FIFO reads FSS=31 and OVRN=1.
+  src = mgos_i2c_read_reg_b(dev->i2c, dev->i2caddr, MGOS_L3GD20_REG_FIFO_SRC_REG);
+  if (src < 0) {
+    return false;
+  }
+  if (samples) {
+    *samples = (src & 0x40) ? MGOS_L3GD20_FIFO_SIZE : (src & 0x20) ? 0 : (src & 0x1F);
+  }
+  if (overrun) {
+    *overrun = (src & 0x40);
+  }
+  return true;
+}
+
+bool mgos_imu_l3gd20_fifo_drain(struct mgos_imu *imu, float *xyz, uint8_t max, uint8_t *count) {
+  struct mgos_imu_gyro *dev = mgos_imu_l3gd20_get_gyro(imu);
+  uint8_t data[MGOS_L3GD20_FIFO_SIZE * 6];
+  uint8_t n;
+  bool    overrun;
+
+  if (!dev || !xyz || !count) {
+    return false;
+  }
+  *count = 0;
+  if (!mgos_imu_l3gd20_fifo_get_level(imu, &n, &overrun)) {
+    return false;
+  }
+  if (overrun) {
+    mgos_imu_stats_overrun(dev->stats);
+  }
+  if (n > max) {
+    n = max;
+  }
+  if (n == 0) {
+    return true;
+  }
+  // With the FIFO enabled, the sub address rolls over from OUT_Z_H back to
+  // OUT_X_L, so that the whole FIFO can be read in a single burst.
+  if (!mgos_i2c_read_reg_n(dev->i2c, dev->i2caddr, MGOS_L3GD20_REG_OUT_X_L | MGOS_L3GD20_AUTO_INC, n * 6, data)) {
+    return false;
+  }
+  mgos_imu_stats_i2c(dev->stats, 1 + n * 6);
+  for (uint8_t i = 0; i < n; i++) {
+    uint8_t *d = &data[i * 6];
+    dev->gx = (int16_t)((d[1] << 8) | d[0]);
+    dev->gy = (int16_t)((d[3] << 8) | d[2]);
+    dev->gz = (int16_t)((d[5] << 8) | d[4]);
+    for (int axis = 0; axis < 3; axis++) {
+      const float *o = &dev->orientation[axis * 3];
+      xyz[i * 3 + axis] = dev->scale * (dev->gx * o[0] + dev->gy * o[1] + dev->gz * o[2]);
+    }
+    xyz[i * 3]     += dev->offset_gx;
+    xyz[i * 3 + 1] += dev->offset_gy;
+    xyz[i * 3 + 2] += dev->offset_gz;
+  }
+  if (dev->filter) {
+    mgos_imu_filter_process(dev->filter, xyz, n);
+  }
+  if (dev->aggregator) {
+    mgos_imu_aggregator_add(dev->aggregator, xyz, n);
+  }
+  *count = n;
+  return true;
+}
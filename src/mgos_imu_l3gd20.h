@@ -51,6 +51,40 @@
 #define MGOS_L3GD20_REG_INT1_THS_ZL      (0x37)
 #define MGOS_L3GD20_REG_INT1_DURATION    (0x38)
 
+// Sub address bit that enables auto increment on multi byte transfers
+#define MGOS_L3GD20_AUTO_INC             (0x80)
+
+#define MGOS_L3GD20_FIFO_SIZE            (32)
+#define MGOS_L3GD20_FIFO_MODE_BYPASS     (0x00)
+#define MGOS_L3GD20_FIFO_MODE_STREAM     (0x02)
+
 bool mgos_imu_l3gd20_detect(struct mgos_imu_gyro *dev, void *imu_user_data);
-bool mgos_imu_l3gd20_create(struct mgos_imu_gyro *dev, void *imu_user_data);
+int32_t mgos_imu_l3gd20_create_step(struct mgos_imu_gyro *dev, void *imu_user_data, uint8_t step);
 bool mgos_imu_l3gd20_read(struct mgos_imu_gyro *dev, void *imu_user_data);
+bool mgos_imu_l3gd20_get_odr(struct mgos_imu_gyro *dev, void *imu_user_data, float *odr);
+bool mgos_imu_l3gd20_set_odr(struct mgos_imu_gyro *dev, void *imu_user_data, float odr);
+bool mgos_imu_l3gd20_gyro_get_bandwidth(struct mgos_imu_gyro *dev, void *imu_user_data, float *hertz);
+bool mgos_imu_l3gd20_gyro_set_bandwidth(struct mgos_imu_gyro *dev, void *imu_user_data, float hertz);
+
+// Get/set the low pass filter cutoff in Hz. The available cutoffs depend on
+// the data rate, so set the data rate first. The driver will pick the highest
+// cutoff that is at most `hertz`, or the lowest one if there is none.
+// Same as mgos_imu_gyroscope_get/set_bandwidth(), kept for existing callers.
+bool mgos_imu_l3gd20_get_bandwidth(struct mgos_imu *imu, float *hertz);
+bool mgos_imu_l3gd20_set_bandwidth(struct mgos_imu *imu, float hertz);
+
+// Run the 32 sample FIFO in stream mode, and raise the watermark flag (and the
+// DRDY/INT2 pin) once `watermark` samples (1..31) are stored. While the FIFO
+// is enabled, mgos_imu_gyroscope_get() returns the oldest stored sample, so
+// use mgos_imu_l3gd20_fifo_drain() to read it instead.
+bool mgos_imu_l3gd20_fifo_enable(struct mgos_imu *imu, uint8_t watermark);
+bool mgos_imu_l3gd20_fifo_disable(struct mgos_imu *imu);
+
+// Number of stored samples, and whether the FIFO is full and older samples
+// are being overwritten. Either pointer may be NULL.
+bool mgos_imu_l3gd20_fifo_get_level(struct mgos_imu *imu, uint8_t *samples, bool *overrun);
+
+// Read up to `max` stored samples, oldest first, into `xyz` as x,y,z triplets
+// in units of degrees/sec, with the gyroscope orientation and offset applied
+// as in mgos_imu_gyroscope_get(). *count is set to the number of samples read.
+bool mgos_imu_l3gd20_fifo_drain(struct mgos_imu *imu, float *xyz, uint8_t max, uint8_t *count);
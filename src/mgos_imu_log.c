@@ -0,0 +1,557 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mgos_imu_log.h"
+#include "mgos_imu_internal.h"
+
+#define MGOS_IMU_LOG_MAGIC          "IMUL"
+#define MGOS_IMU_LOG_CHANNELS       (10)   /* ts + 9 raw */
+#define MGOS_IMU_LOG_SENSOR_SIZE    (MGOS_IMU_LOG_NAME_LEN + 4 + 4)
+#define MGOS_IMU_LOG_HEADER_V1_SIZE (4 + 1 + 1 + 3 * MGOS_IMU_LOG_SENSOR_SIZE)
+#define MGOS_IMU_LOG_HEADER_SIZE    (MGOS_IMU_LOG_HEADER_V1_SIZE + 3 * 4)
+#define MGOS_IMU_LOG_FRAME_SIZE     (4 + 9 * 2)
+#define MGOS_IMU_LOG_BLOCK_FIXED    (1 + MGOS_IMU_LOG_FRAME_SIZE + 4 + MGOS_IMU_LOG_CHANNELS)
+/* Raw deltas span 17 bits after zigzag, timestamp deltas up to 32. */
+#define MGOS_IMU_LOG_DELTA_BITS     (32 + 9 * 17)
+
+struct mgos_imu_log_encoder {
+  struct mgos_imu_log_config config;
+  mgos_imu_log_write_fn      write;
+  void *                     ctx;
+  bool                       header_written;
+
+  uint8_t                    block_frames;
+  uint8_t                    n;
+  struct mgos_imu_log_frame *frames;
+  uint8_t *                  buf;
+  size_t                     buf_len;
+
+  uint32_t                   stat_frames;
+  uint32_t                   stat_frames_dropped;
+  uint32_t                   stat_bytes;
+};
+
+struct mgos_imu_log_decoder {
+  struct mgos_imu_log_config config;
+  mgos_imu_log_read_fn       read;
+  void *                     ctx;
+
+  uint8_t                    block_frames;
+  uint8_t                    n;
+  uint8_t                    pos;
+  struct mgos_imu_log_frame *frames;
+  uint8_t *                  buf;
+  size_t                     buf_len;
+};
+
+// Private functions follow
+static void put_u16(uint8_t *p, uint16_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+  p[2] = (uint8_t)(v >> 16);
+  p[3] = (uint8_t)(v >> 24);
+}
+
+static void put_f32(uint8_t *p, float f) {
+  uint32_t v;
+
+  memcpy(&v, &f, sizeof(v));
+  put_u32(p, v);
+}
+
+static uint16_t get_u16(const uint8_t *p) {
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static float get_f32(const uint8_t *p) {
+  uint32_t v = get_u32(p);
+  float    f;
+
+  memcpy(&f, &v, sizeof(f));
+  return f;
+}
+
+static uint32_t zigzag(int32_t v) {
+  return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static int32_t unzigzag(uint32_t v) {
+  return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static uint8_t bit_width(uint32_t v) {
+  uint8_t w = 0;
+
+  while (v) {
+    w++;
+    v >>= 1;
+  }
+  return w;
+}
+
+static size_t block_max_size(uint8_t block_frames) {
+  return MGOS_IMU_LOG_BLOCK_FIXED + ((size_t)(block_frames - 1) * MGOS_IMU_LOG_DELTA_BITS + 7) / 8;
+}
+
+static void frame_put(uint8_t *p, const struct mgos_imu_log_frame *f) {
+  put_u32(p, f->ts_us);
+  put_u16(p + 4, (uint16_t)f->ax);
+  put_u16(p + 6, (uint16_t)f->ay);
+  put_u16(p + 8, (uint16_t)f->az);
+  put_u16(p + 10, (uint16_t)f->gx);
+  put_u16(p + 12, (uint16_t)f->gy);
+  put_u16(p + 14, (uint16_t)f->gz);
+  put_u16(p + 16, (uint16_t)f->mx);
+  put_u16(p + 18, (uint16_t)f->my);
+  put_u16(p + 20, (uint16_t)f->mz);
+}
+
+static void frame_get(struct mgos_imu_log_frame *f, const uint8_t *p) {
+  f->ts_us = get_u32(p);
+  f->ax    = (int16_t)get_u16(p + 4);
+  f->ay    = (int16_t)get_u16(p + 6);
+  f->az    = (int16_t)get_u16(p + 8);
+  f->gx    = (int16_t)get_u16(p + 10);
+  f->gy    = (int16_t)get_u16(p + 12);
+  f->gz    = (int16_t)get_u16(p + 14);
+  f->mx    = (int16_t)get_u16(p + 16);
+  f->my    = (int16_t)get_u16(p + 18);
+  f->mz    = (int16_t)get_u16(p + 20);
+}
+
+// Raw channel `c` (1..9) of a frame, in the order ax..mz.
+static int16_t *frame_raw(struct mgos_imu_log_frame *f, int c) {
+  return &f->ax + (c - 1);
+}
+
+// Zigzag encoded delta of channel `c` between frames i-1 and i.
+static uint32_t block_delta(struct mgos_imu_log_frame *frames, uint32_t ts_step, int c, int i) {
+  if (c == 0) {
+    return zigzag((int32_t)(frames[i].ts_us - frames[i - 1].ts_us - ts_step));
+  }
+  return zigzag((int32_t)*frame_raw(&frames[i], c) - (int32_t)*frame_raw(&frames[i - 1], c));
+}
+
+static void sensor_put(uint8_t *p, const struct mgos_imu_log_sensor *s) {
+  memset(p, 0, MGOS_IMU_LOG_NAME_LEN);
+  memcpy(p, s->name, strnlen(s->name, MGOS_IMU_LOG_NAME_LEN - 1));
+  put_f32(p + MGOS_IMU_LOG_NAME_LEN, s->scale);
+  put_f32(p + MGOS_IMU_LOG_NAME_LEN + 4, s->odr);
+}
+
+static void sensor_get(struct mgos_imu_log_sensor *s, const uint8_t *p) {
+  memcpy(s->name, p, MGOS_IMU_LOG_NAME_LEN);
+  s->name[MGOS_IMU_LOG_NAME_LEN - 1] = 0;
+  s->scale = get_f32(p + MGOS_IMU_LOG_NAME_LEN);
+  s->odr   = get_f32(p + MGOS_IMU_LOG_NAME_LEN + 4);
+}
+
+static bool encoder_write_header(struct mgos_imu_log_encoder *enc) {
+  uint8_t hdr[MGOS_IMU_LOG_HEADER_SIZE];
+
+  memcpy(hdr, MGOS_IMU_LOG_MAGIC, 4);
+  hdr[4] = MGOS_IMU_LOG_VERSION;
+  hdr[5] = enc->block_frames;
+  sensor_put(hdr + 6, &enc->config.acc);
+  sensor_put(hdr + 6 + MGOS_IMU_LOG_SENSOR_SIZE, &enc->config.gyro);
+  sensor_put(hdr + 6 + 2 * MGOS_IMU_LOG_SENSOR_SIZE, &enc->config.mag);
+  for (int axis = 0; axis < 3; axis++) {
+    put_f32(hdr + MGOS_IMU_LOG_HEADER_V1_SIZE + 4 * axis, enc->config.mag_sensitivity[axis]);
+  }
+  if (!enc->write(enc->ctx, hdr, sizeof(hdr))) {
+    return false;
+  }
+  enc->stat_bytes    += sizeof(hdr);
+  enc->header_written = true;
+  return true;
+}
+
+static size_t encoder_pack_block(struct mgos_imu_log_encoder *enc) {
+  uint8_t *p        = enc->buf;
+  uint8_t  width[MGOS_IMU_LOG_CHANNELS];
+  uint32_t ts_step  = 0;
+  uint64_t acc      = 0;
+  int      acc_bits = 0;
+  int      n        = enc->n;
+
+  *p++ = (uint8_t)n;
+  frame_put(p, &enc->frames[0]);
+  p += MGOS_IMU_LOG_FRAME_SIZE;
+  if (n > 1) {
+    ts_step = enc->frames[1].ts_us - enc->frames[0].ts_us;
+  }
+  put_u32(p, ts_step);
+  p += 4;
+
+  for (int c = 0; c < MGOS_IMU_LOG_CHANNELS; c++) {
+    uint32_t all = 0;
+    for (int i = 1; i < n; i++) {
+      all |= block_delta(enc->frames, ts_step, c, i);
+    }
+    width[c] = bit_width(all);
+    *p++     = width[c];
+  }
+
+  for (int c = 0; c < MGOS_IMU_LOG_CHANNELS; c++) {
+    if (width[c] == 0) {
+      continue;
+    }
+    for (int i = 1; i < n; i++) {
+      acc      |= (uint64_t)block_delta(enc->frames, ts_step, c, i) << acc_bits;
+      acc_bits += width[c];
+      while (acc_bits >= 8) {
+        *p++      = (uint8_t)acc;
+        acc     >>= 8;
+        acc_bits -= 8;
+      }
+    }
+  }
+  if (acc_bits > 0) {
+    *p++ = (uint8_t)acc;
+  }
+  return (size_t)(p - enc->buf);
+}
+
+static bool decoder_read_exact(struct mgos_imu_log_decoder *dec, uint8_t *buf, size_t len) {
+  size_t got = 0;
+
+  while (got < len) {
+    int ret = dec->read(dec->ctx, buf + got, len - got);
+    if (ret <= 0) {
+      return false;
+    }
+    got += (size_t)ret;
+  }
+  return true;
+}
+
+static bool decoder_read_block(struct mgos_imu_log_decoder *dec) {
+  uint8_t  width[MGOS_IMU_LOG_CHANNELS];
+  uint8_t  fixed[MGOS_IMU_LOG_BLOCK_FIXED];
+  uint32_t ts_step;
+  size_t   bits     = 0, len;
+  uint64_t acc      = 0;
+  int      acc_bits = 0;
+  uint8_t *p;
+  int      n;
+
+  if (!decoder_read_exact(dec, fixed, sizeof(fixed))) {
+    return false;
+  }
+  n = fixed[0];
+  if (n == 0 || n > dec->block_frames) {
+    LOG(LL_ERROR, ("Corrupt block, %d frames", n));
+    return false;
+  }
+  frame_get(&dec->frames[0], fixed + 1);
+  ts_step = get_u32(fixed + 1 + MGOS_IMU_LOG_FRAME_SIZE);
+  for (int c = 0; c < MGOS_IMU_LOG_CHANNELS; c++) {
+    width[c] = fixed[1 + MGOS_IMU_LOG_FRAME_SIZE + 4 + c];
+    if (width[c] > (c == 0 ? 32 : 17)) {
+      LOG(LL_ERROR, ("Corrupt block, channel %d width %d", c, width[c]));
+      return false;
+    }
+    bits += (size_t)width[c] * (n - 1);
+  }
+  len = (bits + 7) / 8;
+  if (!decoder_read_exact(dec, dec->buf, len)) {
+    return false;
+  }
+
+  // Deltas are channel major, so seed all frames from the first and rebuild
+  // each channel in frame order.
+  for (int i = 1; i < n; i++) {
+    dec->frames[i] = dec->frames[0];
+  }
+  p = dec->buf;
+  for (int c = 0; c < MGOS_IMU_LOG_CHANNELS; c++) {
+    uint64_t mask = ((uint64_t)1 << width[c]) - 1;
+    for (int i = 1; i < n; i++) {
+      int32_t delta = 0;
+      if (width[c] > 0) {
+        while (acc_bits < width[c]) {
+          acc      |= (uint64_t)*p++ << acc_bits;
+          acc_bits += 8;
+        }
+        delta     = unzigzag((uint32_t)(acc & mask));
+        acc     >>= width[c];
+        acc_bits -= width[c];
+      }
+      if (c == 0) {
+        dec->frames[i].ts_us = dec->frames[i - 1].ts_us + ts_step + (uint32_t)delta;
+      } else {
+        *frame_raw(&dec->frames[i], c) = (int16_t)(*frame_raw(&dec->frames[i - 1], c) + delta);
+      }
+    }
+  }
+  dec->n   = (uint8_t)n;
+  dec->pos = 0;
+  return true;
+}
+
+static void log_sensor_name(struct mgos_imu_log_sensor *s, const char *name) {
+  memset(s->name, 0, sizeof(s->name));
+  if (name) {
+    strncpy(s->name, name, sizeof(s->name) - 1);
+  }
+}
+// Private functions end
+
+// Public functions follow
+bool mgos_imu_log_config_from_imu(struct mgos_imu *imu, struct mgos_imu_log_config *cfg) {
+  if (!imu || !cfg) {
+    return false;
+  }
+  memset(cfg, 0, sizeof(*cfg));
+  if (imu->acc) {
+    log_sensor_name(&cfg->acc, mgos_imu_accelerometer_get_name(imu));
+    cfg->acc.scale = imu->acc->scale;
+    mgos_imu_accelerometer_get_odr(imu, &cfg->acc.odr);
+  }
+  if (imu->gyro) {
+    log_sensor_name(&cfg->gyro, mgos_imu_gyroscope_get_name(imu));
+    cfg->gyro.scale = imu->gyro->scale;
+    mgos_imu_gyroscope_get_odr(imu, &cfg->gyro.odr);
+  }
+  if (imu->mag) {
+    log_sensor_name(&cfg->mag, mgos_imu_magnetometer_get_name(imu));
+    cfg->mag.scale = imu->mag->scale;
+    mgos_imu_magnetometer_get_odr(imu, &cfg->mag.odr);
+    for (int axis = 0; axis < 3; axis++) {
+      cfg->mag_sensitivity[axis] = imu->mag->bias[axis];
+    }
+  }
+  return true;
+}
+
+bool mgos_imu_log_read_frame(struct mgos_imu *imu, struct mgos_imu_log_frame *frame) {
+  int64_t start;
+  bool    ok;
+
+  if (!imu || !frame) {
+    return false;
+  }
+  memset(frame, 0, sizeof(*frame));
+  frame->ts_us = (uint32_t)mgos_uptime_micros();
+  if (imu->acc && imu->acc->read) {
+    start = mgos_imu_stats_start(imu->acc->stats);
+    ok    = imu->acc->read(imu->acc, imu->user_data);
+    mgos_imu_stats_read(imu->acc->stats, start, ok);
+    if (!ok) {
+      return false;
+    }
+    frame->ax = imu->acc->ax;
+    frame->ay = imu->acc->ay;
+    frame->az = imu->acc->az;
+  }
+  if (imu->gyro && imu->gyro->read) {
+    start = mgos_imu_stats_start(imu->gyro->stats);
+    ok    = imu->gyro->read(imu->gyro, imu->user_data);
+    mgos_imu_stats_read(imu->gyro->stats, start, ok);
+    if (!ok) {
+      return false;
+    }
+    frame->gx = imu->gyro->gx;
+    frame->gy = imu->gyro->gy;
+    frame->gz = imu->gyro->gz;
+  }
+  if (imu->mag && imu->mag->read) {
+    start = mgos_imu_stats_start(imu->mag->stats);
+    ok    = imu->mag->read(imu->mag, imu->user_data);
+    mgos_imu_stats_read(imu->mag->stats, start, ok);
+    if (!ok) {
+      return false;
+    }
+    frame->mx = imu->mag->mx;
+    frame->my = imu->mag->my;
+    frame->mz = imu->mag->mz;
+  }
+  return true;
+}
+
+struct mgos_imu_log_encoder *mgos_imu_log_encoder_create(const struct mgos_imu_log_config *cfg, uint8_t block_frames, mgos_imu_log_write_fn write, void *ctx) {
+  struct mgos_imu_log_encoder *enc;
+
+  if (!cfg || !write) {
+    return NULL;
+  }
+  if (block_frames == 0) {
+    block_frames = MGOS_IMU_LOG_BLOCK_FRAMES;
+  }
+  enc = calloc(1, sizeof(struct mgos_imu_log_encoder));
+  if (!enc) {
+    return NULL;
+  }
+  enc->config       = *cfg;
+  enc->write        = write;
+  enc->ctx          = ctx;
+  enc->block_frames = block_frames;
+  enc->buf_len      = block_max_size(block_frames);
+  enc->frames       = calloc(block_frames, sizeof(struct mgos_imu_log_frame));
+  enc->buf          = calloc(1, enc->buf_len);
+  if (!enc->frames || !enc->buf) {
+    mgos_imu_log_encoder_destroy(&enc);
+    return NULL;
+  }
+  return enc;
+}
+
+bool mgos_imu_log_encoder_destroy(struct mgos_imu_log_encoder **enc) {
+  if (!*enc) {
+    return false;
+  }
+  free((*enc)->frames);
+  free((*enc)->buf);
+  free(*enc);
+  *enc = NULL;
+  return true;
+}
+
+bool mgos_imu_log_encoder_flush(struct mgos_imu_log_encoder *enc) {
+  size_t len;
+  bool   ret = false;
+
+  if (!enc) {
+    return false;
+  }
+  if (enc->n == 0) {
+    return true;
+  }
+  len = encoder_pack_block(enc);
+  if ((enc->header_written || encoder_write_header(enc)) && enc->write(enc->ctx, enc->buf, len)) {
+    enc->stat_bytes += len;
+    ret              = true;
+  } else {
+    enc->stat_frames_dropped += enc->n;
+  }
+  enc->n = 0;
+  return ret;
+}
+
+bool mgos_imu_log_encoder_add(struct mgos_imu_log_encoder *enc, const struct mgos_imu_log_frame *frame) {
+  if (!enc || !frame) {
+    return false;
+  }
+  enc->frames[enc->n++] = *frame;
+  enc->stat_frames++;
+  if (enc->n == enc->block_frames) {
+    return mgos_imu_log_encoder_flush(enc);
+  }
+  return true;
+}
+
+bool mgos_imu_log_encoder_get_stats(struct mgos_imu_log_encoder *enc, uint32_t *frames, uint32_t *frames_dropped, uint32_t *bytes) {
+  if (!enc) {
+    return false;
+  }
+  if (frames) {
+    *frames = enc->stat_frames;
+  }
+  if (frames_dropped) {
+    *frames_dropped = enc->stat_frames_dropped;
+  }
+  if (bytes) {
+    *bytes = enc->stat_bytes;
+  }
+  return true;
+}
+
+struct mgos_imu_log_decoder *mgos_imu_log_decoder_create(mgos_imu_log_read_fn read, void *ctx) {
+  struct mgos_imu_log_decoder *dec;
+  uint8_t hdr[MGOS_IMU_LOG_HEADER_SIZE];
+
+  if (!read) {
+    return NULL;
+  }
+  dec = calloc(1, sizeof(struct mgos_imu_log_decoder));
+  if (!dec) {
+    return NULL;
+  }
+  dec->read = read;
+  dec->ctx  = ctx;
+  if (!decoder_read_exact(dec, hdr, MGOS_IMU_LOG_HEADER_V1_SIZE)) {
+    LOG(LL_ERROR, ("Could not read log header"));
+    goto err;
+  }
+  if (memcmp(hdr, MGOS_IMU_LOG_MAGIC, 4) || hdr[4] < 1 || hdr[4] > MGOS_IMU_LOG_VERSION || hdr[5] == 0) {
+    LOG(LL_ERROR, ("Not an IMU log, or unknown version %d", hdr[4]));
+    goto err;
+  }
+  if (hdr[4] >= 2 && !decoder_read_exact(dec, hdr + MGOS_IMU_LOG_HEADER_V1_SIZE, MGOS_IMU_LOG_HEADER_SIZE - MGOS_IMU_LOG_HEADER_V1_SIZE)) {
+    LOG(LL_ERROR, ("Could not read log header"));
+    goto err;
+  }
+  dec->block_frames = hdr[5];
+  sensor_get(&dec->config.acc, hdr + 6);
+  sensor_get(&dec->config.gyro, hdr + 6 + MGOS_IMU_LOG_SENSOR_SIZE);
+  sensor_get(&dec->config.mag, hdr + 6 + 2 * MGOS_IMU_LOG_SENSOR_SIZE);
+  for (int axis = 0; axis < 3; axis++) {
+    dec->config.mag_sensitivity[axis] = (hdr[4] >= 2) ? get_f32(hdr + MGOS_IMU_LOG_HEADER_V1_SIZE + 4 * axis) : 1.0f;
+  }
+
+  dec->buf_len = block_max_size(dec->block_frames);
+  dec->frames  = calloc(dec->block_frames, sizeof(struct mgos_imu_log_frame));
+  dec->buf     = calloc(1, dec->buf_len);
+  if (!dec->frames || !dec->buf) {
+    goto err;
+  }
+  return dec;
+
+err:
+  mgos_imu_log_decoder_destroy(&dec);
+  return NULL;
+}
+
+bool mgos_imu_log_decoder_destroy(struct mgos_imu_log_decoder **dec) {
+  if (!*dec) {
+    return false;
+  }
+  free((*dec)->frames);
+  free((*dec)->buf);
+  free(*dec);
+  *dec = NULL;
+  return true;
+}
+
+bool mgos_imu_log_decoder_get_config(struct mgos_imu_log_decoder *dec, struct mgos_imu_log_config *cfg) {
+  if (!dec || !cfg) {
+    return false;
+  }
+  *cfg = dec->config;
+  return true;
+}
+
+bool mgos_imu_log_decoder_next(struct mgos_imu_log_decoder *dec, struct mgos_imu_log_frame *frame) {
+  if (!dec || !frame) {
+    return false;
+  }
+  if (dec->pos >= dec->n && !decoder_read_block(dec)) {
+    return false;
+  }
+  *frame = dec->frames[dec->pos++];
+  return true;
+}
+
+// Public functions end
@@ -0,0 +1,119 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Compact binary log of raw IMU frames. All values are little endian.
+//
+// Header:
+//   "IMUL", u8 version, u8 block_frames,
+//   3x (acc, gyro, mag): char name[11] (NUL padded), f32 scale (units/LSB), f32 odr (Hz)
+//   3x f32 mag_sensitivity    -- version 2 and up
+// Followed by blocks of up to block_frames frames:
+//   u8 n                      -- frames in this block, 1..block_frames
+//   u32 ts, 9x i16 raw        -- first frame, verbatim
+//   u32 ts_step               -- ts[1]-ts[0], or 0 if n == 1
+//   10x u8 width              -- bits per delta, for ts and each raw channel
+//   bit packed deltas         -- channel major, n-1 per channel, LSB first,
+//                                padded to a byte at the end of the block
+// Raw channel deltas are frame[i]-frame[i-1]; timestamp deltas are
+// (ts[i]-ts[i-1])-ts_step, which is 0 at a steady rate. All deltas are zigzag
+// encoded, and each channel uses the smallest width that fits its deltas.
+
+#pragma once
+
+#include "mgos.h"
+#include "mgos_imu.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MGOS_IMU_LOG_VERSION          (2)
+#define MGOS_IMU_LOG_NAME_LEN         (11)
+#define MGOS_IMU_LOG_BLOCK_FRAMES     (32)
+
+// Raw sensor frame, as read from the chips before scaling.
+struct mgos_imu_log_frame {
+  uint32_t ts_us;
+  int16_t  ax, ay, az;
+  int16_t  gx, gy, gz;
+  int16_t  mx, my, mz;
+};
+
+struct mgos_imu_log_sensor {
+  char  name[MGOS_IMU_LOG_NAME_LEN];
+  float scale;  // Units per LSB: G, degrees/sec or Gauss.
+  float odr;    // Hz, or 0 if unknown.
+};
+
+struct mgos_imu_log_config {
+  struct mgos_imu_log_sensor acc;
+  struct mgos_imu_log_sensor gyro;
+  struct mgos_imu_log_sensor mag;
+  float                      mag_sensitivity[3];  // Per axis factory trim (ASA), 1.0 if none.
+};
+
+// Write `len` bytes, return true on success.
+typedef bool (*mgos_imu_log_write_fn)(void *ctx, const void *buf, size_t len);
+
+// Read up to `len` bytes, return the number of bytes read, 0 at end of file or
+// -1 on error.
+typedef int (*mgos_imu_log_read_fn)(void *ctx, void *buf, size_t len);
+
+// Fill in the log configuration for the sensors attached to `imu`.
+// Returns true on success, false otherwise.
+bool mgos_imu_log_config_from_imu(struct mgos_imu *imu, struct mgos_imu_log_config *cfg);
+
+// Read all attached sensors of `imu` and fill in a raw frame, timestamped with
+// mgos_uptime_micros(). Channels of absent sensors are 0.
+// Returns true on success, false if any attached sensor could not be read.
+bool mgos_imu_log_read_frame(struct mgos_imu *imu, struct mgos_imu_log_frame *frame);
+
+// Streaming encoder. Frames are buffered until a block is full, at which point
+// the block is encoded and handed to `write`. The header is written on the
+// first block. If `write` fails, the frames of that block are counted as
+// dropped and encoding continues with the next block.
+struct mgos_imu_log_encoder;
+
+// `block_frames` of 0 selects MGOS_IMU_LOG_BLOCK_FRAMES; at most 255.
+// Returns an encoder, or NULL otherwise.
+struct mgos_imu_log_encoder *mgos_imu_log_encoder_create(const struct mgos_imu_log_config *cfg, uint8_t block_frames, mgos_imu_log_write_fn write, void *ctx);
+bool mgos_imu_log_encoder_destroy(struct mgos_imu_log_encoder **enc);
+
+// Add a frame. Returns false if a full block was written and failed.
+bool mgos_imu_log_encoder_add(struct mgos_imu_log_encoder *enc, const struct mgos_imu_log_frame *frame);
+
+// Write out a partial block, if any. Returns false if writing failed.
+bool mgos_imu_log_encoder_flush(struct mgos_imu_log_encoder *enc);
+
+// Encoder statistics. Each pointer may be NULL.
+bool mgos_imu_log_encoder_get_stats(struct mgos_imu_log_encoder *enc, uint32_t *frames, uint32_t *frames_dropped, uint32_t *bytes);
+
+// Pull decoder, reading through `read`.
+struct mgos_imu_log_decoder;
+
+// Reads and checks the header. Returns a decoder, or NULL if the stream is not
+// a log of a known version. Version 1 logs read with a mag_sensitivity of 1.0.
+struct mgos_imu_log_decoder *mgos_imu_log_decoder_create(mgos_imu_log_read_fn read, void *ctx);
+bool mgos_imu_log_decoder_destroy(struct mgos_imu_log_decoder **dec);
+bool mgos_imu_log_decoder_get_config(struct mgos_imu_log_decoder *dec, struct mgos_imu_log_config *cfg);
+
+// Returns the next frame. Returns false at the end of the log, or on a
+// truncated or corrupt block.
+bool mgos_imu_log_decoder_next(struct mgos_imu_log_decoder *dec, struct mgos_imu_log_frame *frame);
+
+#ifdef __cplusplus
+}
+#endif
@@ -41,14 +41,16 @@ static bool mgos_imu_lsm303d_detect(struct mgos_i2c *i2c, uint8_t i2caddr, uint8
   return false;
 }
 
-static bool mgos_imu_lsm303d_create(struct mgos_i2c *i2c, uint8_t i2caddr) {
+static bool mgos_imu_lsm303d_create(struct mgos_i2c *i2c, uint8_t i2caddr, bool no_rst) {
   if (!i2c) {
     return false;
   }
 
   // Reset
-  mgos_i2c_write_reg_b(i2c, i2caddr, MGOS_LSM303D_REG_CTRL0, 0x80);
-  mgos_usleep(5000);
+  if (!no_rst) {
+    mgos_i2c_write_reg_b(i2c, i2caddr, MGOS_LSM303D_REG_CTRL0, 0x80);
+    mgos_usleep(5000);
+  }
 
   // Enable
   mgos_i2c_write_reg_b(i2c, i2caddr, MGOS_LSM303D_REG_CTRL0, 0x00);
@@ -81,7 +83,7 @@ bool mgos_imu_lsm303d_acc_create(struct mgos_imu_acc *dev, void *imu_user_data)
 
   // Only initialize the LSM303D if mag hasn't done so yet
   if (!iud->initialized) {
-    if (!mgos_imu_lsm303d_create(dev->i2c, dev->i2caddr)) {
+    if (!mgos_imu_lsm303d_create(dev->i2c, dev->i2caddr, dev->opts.no_rst)) {
       return false;
     }
     iud->initialized = true;
@@ -107,6 +109,7 @@ bool mgos_imu_lsm303d_acc_read(struct mgos_imu_acc *dev, void *imu_user_data) {
   if (!mgos_i2c_read_reg_n(dev->i2c, dev->i2caddr, MGOS_LSM303D_REG_OUT_X_L_A | 0x80, 6, data)) {
     return false;
   }
+  mgos_imu_stats_i2c(dev->stats, 6);
   dev->ax = (data[1] << 8) | (data[0]);
   dev->ay = (data[3] << 8) | (data[2]);
   dev->az = (data[5] << 8) | (data[4]);
@@ -141,7 +144,7 @@ bool mgos_imu_lsm303d_mag_create(struct mgos_imu_mag *dev, void *imu_user_data)
 
   // Only initialize the LSM303D if acc hasn't done so yet
   if (!iud->initialized) {
-    if (!mgos_imu_lsm303d_create(dev->i2c, dev->i2caddr)) {
+    if (!mgos_imu_lsm303d_create(dev->i2c, dev->i2caddr, dev->opts.no_rst)) {
       return false;
     }
     iud->initialized = true;
@@ -174,6 +177,7 @@ bool mgos_imu_lsm303d_mag_read(struct mgos_imu_mag *dev, void *imu_user_data) {
   if (!mgos_i2c_read_reg_n(dev->i2c, dev->i2caddr, MGOS_LSM303D_REG_OUT_X_L_M | 0x80, 6, data)) {
     return false;
   }
+  mgos_imu_stats_i2c(dev->stats, 6);
   dev->mx = (data[1] << 8) | (data[0]);
   dev->my = (data[3] << 8) | (data[2]);
   dev->mz = (data[5] << 8) | (data[4]);
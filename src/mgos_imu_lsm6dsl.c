@@ -17,6 +17,14 @@
 #include "mgos.h"
 #include "mgos_i2c.h"
 #include "mgos_imu_lsm6dsl.h"
+#include <math.h>
+
+// Configuration registers: FIFO_CTRL1..CTRL10_C, TAP_CFG..MD2_CFG and X/Y/Z_OFS_USR.
+static const struct mgos_imu_regcache_range s_lsm6dsl_cached[] = {
+  { MGOS_LSM6DSL_REG_FIFO_CTRL1, MGOS_LSM6DSL_REG_CTRL10_C  },
+  { MGOS_LSM6DSL_REG_TAP_CFG,    MGOS_LSM6DSL_REG_MD2_CFG   },
+  { MGOS_LSM6DSL_REG_X_OFS_USR,  MGOS_LSM6DSL_REG_Z_OFS_USR },
+};
 
 static bool mgos_imu_lsm6dsl_detect(struct mgos_i2c *i2c, uint8_t i2caddr) {
   int device_id;
@@ -32,28 +40,49 @@ static bool mgos_imu_lsm6dsl_detect(struct mgos_i2c *i2c, uint8_t i2caddr) {
   return false;
 }
 
-static bool mgos_imu_lsm6dsl_accgyro_create(struct mgos_i2c *i2c, uint8_t i2caddr, bool no_rst) {
+// Chip create steps, see mgos_imu_acc_create_step_fn.
+static int32_t mgos_imu_lsm6dsl_accgyro_create_step(struct mgos_i2c *i2c, uint8_t i2caddr, bool no_rst, struct mgos_imu_lsm6dsl_userdata *iud, uint8_t step) {
+  int ctrl3_c;
+
   if (!i2c) {
-    return false;
+    return -1;
   }
 
   // Reload trimmming data and reset (procedure as described in AN5040 5.7).
-  if (!no_rst) {
+  switch (step) {
+  case 0:
+    if (no_rst) {
+      break;
+    }
     // Power down gyro and accel
     mgos_i2c_write_reg_b(i2c, i2caddr, MGOS_LSM6DSL_REG_CTRL2_G, 0);
     mgos_i2c_write_reg_b(i2c, i2caddr, MGOS_LSM6DSL_REG_CTRL1_XL, 0);
     // Reload trimming values (takes 15 ms)
     mgos_i2c_write_reg_b(i2c, i2caddr, MGOS_LSM6DSL_REG_CTRL3_C, 0x80);
-    mgos_usleep(15000);
-    // Perform SW reset (bit auto-clears).
+    return 15000;
+
+  case 1:
+    // Perform SW reset (bit auto-clears, after 50 us).
     mgos_i2c_write_reg_b(i2c, i2caddr, MGOS_LSM6DSL_REG_CTRL3_C, 1);
-    while (mgos_i2c_read_reg_b(i2c, i2caddr, MGOS_LSM6DSL_REG_CTRL3_C) & 1) {
-      ;
+    return 50;
+
+  default:
+    // Wait for the reset bit to clear, but give up after a few polls.
+    ctrl3_c = mgos_i2c_read_reg_b(i2c, i2caddr, MGOS_LSM6DSL_REG_CTRL3_C);
+    if (ctrl3_c < 0 || (ctrl3_c & 1)) {
+      return step < 5 ? 1000 : -1;
     }
+    break;
   }
 
   // CTRL3_C: BOOT=0; BDU=1; H_LACTIVE=1; PP_OD=0; SIM=0; IF_INC=1; BLE=0; SW_RESET=0;
-  return mgos_i2c_write_reg_b(i2c, i2caddr, MGOS_LSM6DSL_REG_CTRL3_C, 0x44);
+  if (!mgos_i2c_write_reg_b(i2c, i2caddr, MGOS_LSM6DSL_REG_CTRL3_C, 0x44)) {
+    return -1;
+  }
+  if (!mgos_imu_regcache_init(&iud->regs, i2c, i2caddr, s_lsm6dsl_cached, sizeof(s_lsm6dsl_cached) / sizeof(s_lsm6dsl_cached[0]))) {
+    return -1;
+  }
+  return 0;
 }
 
 bool mgos_imu_lsm6dsl_acc_detect(struct mgos_imu_acc *dev, void *imu_user_data) {
@@ -62,22 +91,24 @@ bool mgos_imu_lsm6dsl_acc_detect(struct mgos_imu_acc *dev, void *imu_user_data)
   (void)imu_user_data;
 }
 
-bool mgos_imu_lsm6dsl_acc_create(struct mgos_imu_acc *dev, void *imu_user_data) {
+int32_t mgos_imu_lsm6dsl_acc_create_step(struct mgos_imu_acc *dev, void *imu_user_data, uint8_t step) {
   struct mgos_imu_lsm6dsl_userdata *iud = (struct mgos_imu_lsm6dsl_userdata *)imu_user_data;
+  int32_t ret;
 
   if (!dev) {
-    return false;
+    return -1;
   }
 
   // Only initialize the LSM6DSL if gyro hasn't done so yet
   if (!iud->initialized) {
-    if (!mgos_imu_lsm6dsl_accgyro_create(dev->i2c, dev->i2caddr, dev->opts.no_rst)) {
-      return false;
+    ret = mgos_imu_lsm6dsl_accgyro_create_step(dev->i2c, dev->i2caddr, dev->opts.no_rst, iud, step);
+    if (ret != 0) {
+      return ret;
     }
     iud->initialized = true;
   }
 
-  return true;
+  return 0;
 }
 
 bool mgos_imu_lsm6dsl_acc_read(struct mgos_imu_acc *dev, void *imu_user_data) {
@@ -89,6 +120,7 @@ bool mgos_imu_lsm6dsl_acc_read(struct mgos_imu_acc *dev, void *imu_user_data) {
   if (!mgos_i2c_read_reg_n(dev->i2c, dev->i2caddr, MGOS_LSM6DSL_REG_OUTX_L_XL, 6, (uint8_t *)data)) {
     return false;
   }
+  mgos_imu_stats_i2c(dev->stats, 6);
   dev->ax = data[0];
   dev->ay = data[1];
   dev->az = data[2];
@@ -98,9 +130,10 @@ bool mgos_imu_lsm6dsl_acc_read(struct mgos_imu_acc *dev, void *imu_user_data) {
 }
 
 bool mgos_imu_lsm6dsl_acc_get_scale(struct mgos_imu_acc *dev, void *imu_user_data, float *scale) {
+  struct mgos_imu_lsm6dsl_userdata *iud = (struct mgos_imu_lsm6dsl_userdata *)imu_user_data;
   uint8_t fs = 0;
 
-  if (!mgos_i2c_getbits_reg_b(dev->i2c, dev->i2caddr, MGOS_LSM6DSL_REG_CTRL1_XL, 2, 2, &fs)) {
+  if (!mgos_imu_regcache_getbits_reg_b(&iud->regs, MGOS_LSM6DSL_REG_CTRL1_XL, 2, 2, &fs)) {
     return false;
   }
   switch (fs) {
@@ -115,10 +148,11 @@ bool mgos_imu_lsm6dsl_acc_get_scale(struct mgos_imu_acc *dev, void *imu_user_dat
 
   return true;
 
-  (void)imu_user_data;
+  (void)dev;
 }
 
 bool mgos_imu_lsm6dsl_acc_set_scale(struct mgos_imu_acc *dev, void *imu_user_data, float scale) {
+  struct mgos_imu_lsm6dsl_userdata *iud = (struct mgos_imu_lsm6dsl_userdata *)imu_user_data;
   uint8_t fs = 0;
 
   if (scale <= 2) {
@@ -136,12 +170,10 @@ bool mgos_imu_lsm6dsl_acc_set_scale(struct mgos_imu_acc *dev, void *imu_user_dat
   } else {
     return false;
   }
-  if (!mgos_i2c_setbits_reg_b(dev->i2c, dev->i2caddr, MGOS_LSM6DSL_REG_CTRL1_XL, 2, 2, fs)) return false;
+  if (!mgos_imu_regcache_setbits_reg_b(&iud->regs, MGOS_LSM6DSL_REG_CTRL1_XL, 2, 2, fs)) return false;
   dev->opts.scale = scale;
   dev->scale = dev->opts.scale / 32767.0f;
   return true;
-
-  (void)imu_user_data;
 }
 
 static float mgos_imu_lsm6dsl_odr_to_hz(uint8_t lsm6_odr) {
@@ -174,15 +206,16 @@ static float mgos_imu_lsm6dsl_odr_to_hz(uint8_t lsm6_odr) {
 }
 
 bool mgos_imu_lsm6dsl_acc_get_odr(struct mgos_imu_acc *dev, void *imu_user_data, float *odr) {
+  struct mgos_imu_lsm6dsl_userdata *iud = (struct mgos_imu_lsm6dsl_userdata *)imu_user_data;
   uint8_t odr_xl = 0;
 
-  if (!mgos_i2c_getbits_reg_b(dev->i2c, dev->i2caddr, MGOS_LSM6DSL_REG_CTRL1_XL, 4, 4, &odr_xl)) {
+  if (!mgos_imu_regcache_getbits_reg_b(&iud->regs, MGOS_LSM6DSL_REG_CTRL1_XL, 4, 4, &odr_xl)) {
     return false;
   }
   *odr = mgos_imu_lsm6dsl_odr_to_hz(odr_xl);
   return *odr >= 0;
 
-  (void)imu_user_data;
+  (void)dev;
 }
 
 static uint8_t mgos_imu_lsm6dsl_hz_to_odr(float odr) {
@@ -226,15 +259,195 @@ static uint8_t mgos_imu_lsm6dsl_hz_to_odr(float odr) {
 }
 
 bool mgos_imu_lsm6dsl_acc_set_odr(struct mgos_imu_acc *dev, void *imu_user_data, float odr) {
+  struct mgos_imu_lsm6dsl_userdata *iud = (struct mgos_imu_lsm6dsl_userdata *)imu_user_data;
   uint8_t lsm6_odr = mgos_imu_lsm6dsl_hz_to_odr(odr);
 
   if (lsm6_odr == 0xff) {
     return false;
   }
 
-  if (!mgos_i2c_setbits_reg_b(dev->i2c, dev->i2caddr, MGOS_LSM6DSL_REG_CTRL1_XL, 4, 4, lsm6_odr)) return false;
+  if (!mgos_imu_regcache_setbits_reg_b(&iud->regs, MGOS_LSM6DSL_REG_CTRL1_XL, 4, 4, lsm6_odr)) return false;
   dev->opts.odr = odr;
   return true;
+}
+
+// Low pass cutoffs as fractions of the data rate: LPF1 alone with
+// LPF1_BW_SEL=0 and 1, then LPF1 followed by LPF2 for each CTRL8_XL HPCF_XL.
+static const float   s_lsm6dsl_lpf_div[6]  = { 2.f, 4.f, 9.f, 50.f, 100.f, 400.f };
+static const uint8_t s_lsm6dsl_lpf_hpcf[6] = { 0, 0, 2, 0, 1, 3 };
+
+bool mgos_imu_lsm6dsl_acc_get_bandwidth(struct mgos_imu_acc *dev, void *imu_user_data, float *hertz) {
+  struct mgos_imu_lsm6dsl_userdata *iud = (struct mgos_imu_lsm6dsl_userdata *)imu_user_data;
+  static const float hpcf_div[4] = { 50.f, 100.f, 9.f, 400.f };
+  int   ctrl1, ctrl8;
+  float odr;
+
+  if (!mgos_imu_lsm6dsl_acc_get_odr(dev, imu_user_data, &odr) || odr <= 0) {
+    return false;
+  }
+  ctrl1 = mgos_imu_regcache_read_reg_b(&iud->regs, MGOS_LSM6DSL_REG_CTRL1_XL);
+  ctrl8 = mgos_imu_regcache_read_reg_b(&iud->regs, MGOS_LSM6DSL_REG_CTRL8_XL);
+  if (ctrl1 < 0 || ctrl8 < 0) {
+    return false;
+  }
+  if (ctrl8 & 0x80) {
+    *hertz = odr / hpcf_div[(ctrl8 >> 5) & 0x03];
+  } else {
+    *hertz = odr / ((ctrl1 & 0x02) ? 4.f : 2.f);
+  }
+  return true;
+}
+
+// The cutoffs follow the data rate, so set_odr() keeps the ratio.
+bool mgos_imu_lsm6dsl_acc_set_bandwidth(struct mgos_imu_acc *dev, void *imu_user_data, float hertz) {
+  struct mgos_imu_lsm6dsl_userdata *iud = (struct mgos_imu_lsm6dsl_userdata *)imu_user_data;
+  float cutoffs[6];
+  float odr;
+  int   ctrl8, i;
+
+  // CTRL1_XL belongs to wake on motion until it is restored.
+  if (!iud || iud->wake_enabled) {
+    return false;
+  }
+  if (!mgos_imu_lsm6dsl_acc_get_odr(dev, imu_user_data, &odr) || odr <= 0) {
+    return false;
+  }
+  for (i = 0; i < 6; i++) {
+    cutoffs[i] = odr / s_lsm6dsl_lpf_div[i];
+  }
+  i = mgos_imu_bandwidth_pick(cutoffs, 6, hertz);
+  if ((ctrl8 = mgos_imu_regcache_read_reg_b(&iud->regs, MGOS_LSM6DSL_REG_CTRL8_XL)) < 0) {
+    return false;
+  }
+  // CTRL8_XL: LPF2_XL_EN; HPCF_XL; HP_SLOPE_XL_EN=0 (LPF2 path on the output)
+  ctrl8 &= ~(0x80 | 0x60 | 0x04);
+  if (i >= 2) {
+    ctrl8 |= 0x80 | (s_lsm6dsl_lpf_hpcf[i] << 5);
+  }
+  // CTRL1_XL: LPF1_BW_SEL
+  return mgos_imu_regcache_setbits_reg_b(&iud->regs, MGOS_LSM6DSL_REG_CTRL1_XL, 1, 1, i == 1) &&
+         mgos_imu_regcache_write_reg_b(&iud->regs, MGOS_LSM6DSL_REG_CTRL8_XL, (uint8_t)ctrl8);
+}
+
+bool mgos_imu_lsm6dsl_acc_set_hw_offset(struct mgos_imu_acc *dev, void *imu_user_data, float x, float y, float z) {
+  struct mgos_imu_lsm6dsl_userdata *iud = (struct mgos_imu_lsm6dsl_userdata *)imu_user_data;
+  float   weight;
+  uint8_t usr_off_w;
+  int     ofs[3];
+  uint8_t data[3];
+
+  // X/Y/Z_OFS_USR are 8 bit two's complement, and are subtracted from the
+  // output. USR_OFF_W in CTRL6_C selects the weight: 2^-10 g/LSB or 2^-6 g/LSB.
+  if (fabsf(x) <= 127.f / 1024.f && fabsf(y) <= 127.f / 1024.f && fabsf(z) <= 127.f / 1024.f) {
+    usr_off_w = 0;
+    weight    = 1.f / 1024.f;
+  } else {
+    usr_off_w = 1;
+    weight    = 1.f / 64.f;
+  }
+  ofs[0] = (int)roundf(-x / weight);
+  ofs[1] = (int)roundf(-y / weight);
+  ofs[2] = (int)roundf(-z / weight);
+  for (int i = 0; i < 3; i++) {
+    if (ofs[i] < -127 || ofs[i] > 127) {
+      return false;
+    }
+    data[i] = (uint8_t)(int8_t)ofs[i];
+  }
+  if (!mgos_imu_regcache_setbits_reg_b(&iud->regs, MGOS_LSM6DSL_REG_CTRL6_C, 3, 1, usr_off_w)) {
+    return false;
+  }
+  return mgos_imu_regcache_write_reg_n(&iud->regs, MGOS_LSM6DSL_REG_X_OFS_USR, 3, data);
+
+  (void)dev;
+}
+
+// Registers changed by wake on motion, in the order they are restored in.
+static const uint8_t s_lsm6dsl_wake_regs[] = {
+  MGOS_LSM6DSL_REG_MD1_CFG,     MGOS_LSM6DSL_REG_TAP_CFG,  MGOS_LSM6DSL_REG_WAKE_UP_THS, MGOS_LSM6DSL_REG_WAKE_UP_DUR,
+  MGOS_LSM6DSL_REG_CTRL6_C,     MGOS_LSM6DSL_REG_CTRL1_XL, MGOS_LSM6DSL_REG_CTRL2_G,
+};
+
+// Wake on motion: accelerometer in low power mode at 26Hz, gyro powered down,
+// and the slope filter wake-up interrupt latched on INT1.
+bool mgos_imu_lsm6dsl_acc_set_wakeup(struct mgos_imu_acc *dev, void *imu_user_data, float threshold, uint32_t duration_ms) {
+  struct mgos_imu_lsm6dsl_userdata *iud = (struct mgos_imu_lsm6dsl_userdata *)imu_user_data;
+  const size_t n = sizeof(s_lsm6dsl_wake_regs);
+  float        fs;
+  int          val, ths, dur;
+
+  if (!dev || !iud) {
+    return false;
+  }
+
+  if (threshold <= 0) {
+    if (!iud->wake_enabled) {
+      return true;
+    }
+    iud->wake_enabled = false;
+    for (size_t i = 0; i < n; i++) {
+      if (!mgos_imu_regcache_write_reg_b(&iud->regs, s_lsm6dsl_wake_regs[i], iud->wake_saved[i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  if (!iud->wake_enabled) {
+    for (size_t i = 0; i < n; i++) {
+      if ((val = mgos_imu_regcache_read_reg_b(&iud->regs, s_lsm6dsl_wake_regs[i])) < 0) {
+        return false;
+      }
+      iud->wake_saved[i] = (uint8_t)val;
+    }
+  }
+
+  // WK_THS is in units of FS/64, WAKE_DUR in units of 1/ODR.
+  switch ((iud->wake_saved[5] >> 2) & 0x03) {
+  case 1: fs = 16; break;
+
+  case 2: fs = 4; break;
+
+  case 3: fs = 8; break;
+
+  default: fs = 2; break;
+  }
+  ths = (int)roundf(threshold * 64.f / fs);
+  if (ths < 1) {
+    ths = 1;
+  } else if (ths > 63) {
+    ths = 63;
+  }
+  dur = (int)(duration_ms * 26 / 1000);
+  if (dur > 3) {
+    dur = 3;
+  }
+  if (!mgos_imu_regcache_setbits_reg_b(&iud->regs, MGOS_LSM6DSL_REG_CTRL2_G, 4, 4, 0) ||
+      !mgos_imu_regcache_setbits_reg_b(&iud->regs, MGOS_LSM6DSL_REG_CTRL1_XL, 4, 4, 0x02) ||
+      !mgos_imu_regcache_setbits_reg_b(&iud->regs, MGOS_LSM6DSL_REG_CTRL6_C, 4, 1, 1) ||
+      !mgos_imu_regcache_setbits_reg_b(&iud->regs, MGOS_LSM6DSL_REG_WAKE_UP_DUR, 5, 2, dur) ||
+      !mgos_imu_regcache_setbits_reg_b(&iud->regs, MGOS_LSM6DSL_REG_WAKE_UP_THS, 0, 6, ths) ||
+      !mgos_imu_regcache_write_reg_b(&iud->regs, MGOS_LSM6DSL_REG_TAP_CFG, (iud->wake_saved[1] & ~0x10) | 0x81) ||
+      !mgos_imu_regcache_setbits_reg_b(&iud->regs, MGOS_LSM6DSL_REG_MD1_CFG, 5, 1, 1)) {
+    return false;
+  }
+  iud->wake_enabled = true;
+  return true;
+}
+
+bool mgos_imu_lsm6dsl_acc_get_wakeup(struct mgos_imu_acc *dev, void *imu_user_data, bool *woken) {
+  int src;
+
+  if (!dev || !woken) {
+    return false;
+  }
+  // Reading WAKE_UP_SRC clears the latched interrupt.
+  src = mgos_i2c_read_reg_b(dev->i2c, dev->i2caddr, MGOS_LSM6DSL_REG_WAKE_UP_SRC);
+  if (src < 0) {
+    return false;
+  }
+  *woken = (src & 0x08);
+  return true;
 
   (void)imu_user_data;
 }
@@ -245,25 +458,58 @@ bool mgos_imu_lsm6dsl_gyro_detect(struct mgos_imu_gyro *dev, void *imu_user_data
   (void)imu_user_data;
 }
 
-bool mgos_imu_lsm6dsl_gyro_create(struct mgos_imu_gyro *dev, void *imu_user_data) {
+int32_t mgos_imu_lsm6dsl_gyro_create_step(struct mgos_imu_gyro *dev, void *imu_user_data, uint8_t step) {
   struct mgos_imu_lsm6dsl_userdata *iud = (struct mgos_imu_lsm6dsl_userdata *)imu_user_data;
+  int32_t ret;
 
   if (!dev) {
-    return false;
+    return -1;
   }
 
   // Only initialize the LSM6DSL if acc hasn't done so yet
   if (!iud->initialized) {
-    if (!mgos_imu_lsm6dsl_accgyro_create(dev->i2c, dev->i2caddr, false /* no_rst */)) {
-      return false;
+    ret = mgos_imu_lsm6dsl_accgyro_create_step(dev->i2c, dev->i2caddr, dev->opts.no_rst, iud, step);
+    if (ret != 0) {
+      return ret;
     }
     iud->initialized = true;
   }
 
   // CTRL2_G: ODR_XL=0100 (104Hz ODR); FS_XL=11 (2000dps); FS_125=0; 0
-  mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_LSM6DSL_REG_CTRL2_G, 0x4c);
+  mgos_imu_regcache_write_reg_b(&iud->regs, MGOS_LSM6DSL_REG_CTRL2_G, 0x4c);
 
   dev->scale = 2000.f * .035 * 1e-3;
+  return 0;
+}
+
+bool mgos_imu_lsm6dsl_gyro_get_odr(struct mgos_imu_gyro *dev, void *imu_user_data, float *odr) {
+  struct mgos_imu_lsm6dsl_userdata *iud = (struct mgos_imu_lsm6dsl_userdata *)imu_user_data;
+  uint8_t odr_g = 0;
+
+  if (!mgos_imu_regcache_getbits_reg_b(&iud->regs, MGOS_LSM6DSL_REG_CTRL2_G, 4, 4, &odr_g)) {
+    return false;
+  }
+  *odr = mgos_imu_lsm6dsl_odr_to_hz(odr_g);
+  return *odr >= 0;
+
+  (void)dev;
+}
+
+bool mgos_imu_lsm6dsl_gyro_set_odr(struct mgos_imu_gyro *dev, void *imu_user_data, float odr) {
+  struct mgos_imu_lsm6dsl_userdata *iud = (struct mgos_imu_lsm6dsl_userdata *)imu_user_data;
+  uint8_t lsm6_odr = mgos_imu_lsm6dsl_hz_to_odr(odr);
+
+  // Keep the gyro running when opts.odr was left at 0.
+  if (lsm6_odr == 0 || lsm6_odr == 0xff) {
+    return false;
+  }
+  // The gyro has no 1.6Hz mode, 12.5Hz is its slowest.
+  if (lsm6_odr == 11) {
+    lsm6_odr = 1;
+  }
+
+  if (!mgos_imu_regcache_setbits_reg_b(&iud->regs, MGOS_LSM6DSL_REG_CTRL2_G, 4, 4, lsm6_odr)) return false;
+  dev->opts.odr = odr;
   return true;
 }
 
@@ -276,6 +522,7 @@ bool mgos_imu_lsm6dsl_gyro_read(struct mgos_imu_gyro *dev, void *imu_user_data)
   if (!mgos_i2c_read_reg_n(dev->i2c, dev->i2caddr, MGOS_LSM6DSL_REG_OUTX_L_G, 6, data)) {
     return false;
   }
+  mgos_imu_stats_i2c(dev->stats, 6);
   dev->gx = (data[1] << 8) | (data[0]);
   dev->gy = (data[3] << 8) | (data[2]);
   dev->gz = (data[5] << 8) | (data[4]);
@@ -410,7 +657,7 @@ bool mgos_imu_lsm6dsl_set_int_handler(struct mgos_imu *imu, int int1_gpio, int i
   }
   if (int2_gpio >= 0) {
     bool int2_on_int1 = (int2_gpio == int1_gpio);
-    mgos_i2c_setbits_reg_b(imu->acc->i2c, imu->acc->i2caddr, MGOS_LSM6DSL_REG_CTRL4_C, 5, 1, int2_on_int1);
+    mgos_imu_regcache_setbits_reg_b(&iud->regs, MGOS_LSM6DSL_REG_CTRL4_C, 5, 1, int2_on_int1);
     if (!int2_on_int1) {
       mgos_gpio_setup_input(int2_gpio, MGOS_GPIO_PULL_DOWN);
       mgos_gpio_set_int_handler(int2_gpio, MGOS_GPIO_INT_EDGE_POS, mgos_imu_lsm6dsl_irq, imu);
@@ -420,14 +667,21 @@ bool mgos_imu_lsm6dsl_set_int_handler(struct mgos_imu *imu, int int1_gpio, int i
   }
 
   // Set latched mode for ints.
-  mgos_i2c_setbits_reg_b(imu->acc->i2c, imu->acc->i2caddr, MGOS_LSM6DSL_REG_TAP_CFG, 0, 1, 1);
+  mgos_imu_regcache_setbits_reg_b(&iud->regs, MGOS_LSM6DSL_REG_TAP_CFG, 0, 1, 1);
 
   return true;
 }
 
 bool mgos_imu_lsm6dsl_int1_enable(struct mgos_imu *imu, uint32_t int1_mask) {
-  int int1_ctrl = mgos_i2c_read_reg_b(imu->acc->i2c, imu->acc->i2caddr, MGOS_LSM6DSL_REG_INT1_CTRL);
-  int md1_cfg   = mgos_i2c_read_reg_b(imu->acc->i2c, imu->acc->i2caddr, MGOS_LSM6DSL_REG_MD1_CFG);
+  struct mgos_imu_lsm6dsl_userdata *iud;
+  int int1_ctrl, md1_cfg;
+
+  if (!imu || !imu->acc || !imu->user_data) {
+    return false;
+  }
+  iud       = (struct mgos_imu_lsm6dsl_userdata *)imu->user_data;
+  int1_ctrl = mgos_imu_regcache_read_reg_b(&iud->regs, MGOS_LSM6DSL_REG_INT1_CTRL);
+  md1_cfg   = mgos_imu_regcache_read_reg_b(&iud->regs, MGOS_LSM6DSL_REG_MD1_CFG);
 
   if (int1_ctrl < 0 || md1_cfg < 0) {
     return false;
@@ -435,30 +689,44 @@ bool mgos_imu_lsm6dsl_int1_enable(struct mgos_imu *imu, uint32_t int1_mask) {
   int1_ctrl |= (uint8_t)int1_mask;
   md1_cfg   |= (uint8_t)(int1_mask >> 8);
   if (md1_cfg != 0) {
-    if (!mgos_i2c_setbits_reg_b(imu->acc->i2c, imu->acc->i2caddr, MGOS_LSM6DSL_REG_TAP_CFG, 7, 1, 1)) {
+    if (!mgos_imu_regcache_setbits_reg_b(&iud->regs, MGOS_LSM6DSL_REG_TAP_CFG, 7, 1, 1)) {
       return false;
     }
   }
-  return mgos_i2c_write_reg_b(imu->acc->i2c, imu->acc->i2caddr, MGOS_LSM6DSL_REG_INT1_CTRL, int1_ctrl) &&
-         mgos_i2c_write_reg_b(imu->acc->i2c, imu->acc->i2caddr, MGOS_LSM6DSL_REG_MD1_CFG, md1_cfg);
+  return mgos_imu_regcache_write_reg_b(&iud->regs, MGOS_LSM6DSL_REG_INT1_CTRL, int1_ctrl) &&
+         mgos_imu_regcache_write_reg_b(&iud->regs, MGOS_LSM6DSL_REG_MD1_CFG, md1_cfg);
 }
 
 bool mgos_imu_lsm6dsl_int1_disable(struct mgos_imu *imu, uint32_t int1_mask) {
-  int int1_ctrl = mgos_i2c_read_reg_b(imu->acc->i2c, imu->acc->i2caddr, MGOS_LSM6DSL_REG_INT1_CTRL);
-  int md1_cfg   = mgos_i2c_read_reg_b(imu->acc->i2c, imu->acc->i2caddr, MGOS_LSM6DSL_REG_MD1_CFG);
+  struct mgos_imu_lsm6dsl_userdata *iud;
+  int int1_ctrl, md1_cfg;
+
+  if (!imu || !imu->acc || !imu->user_data) {
+    return false;
+  }
+  iud       = (struct mgos_imu_lsm6dsl_userdata *)imu->user_data;
+  int1_ctrl = mgos_imu_regcache_read_reg_b(&iud->regs, MGOS_LSM6DSL_REG_INT1_CTRL);
+  md1_cfg   = mgos_imu_regcache_read_reg_b(&iud->regs, MGOS_LSM6DSL_REG_MD1_CFG);
 
   if (int1_ctrl < 0 || md1_cfg < 0) {
     return false;
   }
   int1_ctrl &= ~((uint8_t)int1_mask);
   md1_cfg   &= ~((uint8_t)(int1_mask >> 8));
-  return mgos_i2c_write_reg_b(imu->acc->i2c, imu->acc->i2caddr, MGOS_LSM6DSL_REG_INT1_CTRL, int1_ctrl) &&
-         mgos_i2c_write_reg_b(imu->acc->i2c, imu->acc->i2caddr, MGOS_LSM6DSL_REG_MD1_CFG, md1_cfg);
+  return mgos_imu_regcache_write_reg_b(&iud->regs, MGOS_LSM6DSL_REG_INT1_CTRL, int1_ctrl) &&
+         mgos_imu_regcache_write_reg_b(&iud->regs, MGOS_LSM6DSL_REG_MD1_CFG, md1_cfg);
 }
 
 bool mgos_imu_lsm6dsl_int2_enable(struct mgos_imu *imu, uint32_t int2_mask) {
-  int int2_ctrl = mgos_i2c_read_reg_b(imu->acc->i2c, imu->acc->i2caddr, MGOS_LSM6DSL_REG_INT2_CTRL);
-  int md2_cfg   = mgos_i2c_read_reg_b(imu->acc->i2c, imu->acc->i2caddr, MGOS_LSM6DSL_REG_MD2_CFG);
+  struct mgos_imu_lsm6dsl_userdata *iud;
+  int int2_ctrl, md2_cfg;
+
+  if (!imu || !imu->acc || !imu->user_data) {
+    return false;
+  }
+  iud       = (struct mgos_imu_lsm6dsl_userdata *)imu->user_data;
+  int2_ctrl = mgos_imu_regcache_read_reg_b(&iud->regs, MGOS_LSM6DSL_REG_INT2_CTRL);
+  md2_cfg   = mgos_imu_regcache_read_reg_b(&iud->regs, MGOS_LSM6DSL_REG_MD2_CFG);
 
   if (int2_ctrl < 0 || md2_cfg < 0) {
     return false;
@@ -466,23 +734,30 @@ bool mgos_imu_lsm6dsl_int2_enable(struct mgos_imu *imu, uint32_t int2_mask) {
   int2_ctrl |= (uint8_t)(int2_mask | (int2_mask >> 16));
   md2_cfg   |= (uint8_t)(int2_mask >> 8);
   if (md2_cfg != 0) {
-    if (!mgos_i2c_setbits_reg_b(imu->acc->i2c, imu->acc->i2caddr, MGOS_LSM6DSL_REG_TAP_CFG, 7, 1, 1)) {
+    if (!mgos_imu_regcache_setbits_reg_b(&iud->regs, MGOS_LSM6DSL_REG_TAP_CFG, 7, 1, 1)) {
       return false;
     }
   }
-  return mgos_i2c_write_reg_b(imu->acc->i2c, imu->acc->i2caddr, MGOS_LSM6DSL_REG_INT2_CTRL, int2_ctrl) &&
-         mgos_i2c_write_reg_b(imu->acc->i2c, imu->acc->i2caddr, MGOS_LSM6DSL_REG_MD2_CFG, md2_cfg);
+  return mgos_imu_regcache_write_reg_b(&iud->regs, MGOS_LSM6DSL_REG_INT2_CTRL, int2_ctrl) &&
+         mgos_imu_regcache_write_reg_b(&iud->regs, MGOS_LSM6DSL_REG_MD2_CFG, md2_cfg);
 }
 
 bool mgos_imu_lsm6dsl_int2_disable(struct mgos_imu *imu, uint32_t int2_mask) {
-  int int2_ctrl = mgos_i2c_read_reg_b(imu->acc->i2c, imu->acc->i2caddr, MGOS_LSM6DSL_REG_INT2_CTRL);
-  int md2_cfg   = mgos_i2c_read_reg_b(imu->acc->i2c, imu->acc->i2caddr, MGOS_LSM6DSL_REG_MD2_CFG);
+  struct mgos_imu_lsm6dsl_userdata *iud;
+  int int2_ctrl, md2_cfg;
+
+  if (!imu || !imu->acc || !imu->user_data) {
+    return false;
+  }
+  iud       = (struct mgos_imu_lsm6dsl_userdata *)imu->user_data;
+  int2_ctrl = mgos_imu_regcache_read_reg_b(&iud->regs, MGOS_LSM6DSL_REG_INT2_CTRL);
+  md2_cfg   = mgos_imu_regcache_read_reg_b(&iud->regs, MGOS_LSM6DSL_REG_MD2_CFG);
 
   if (int2_ctrl < 0 || md2_cfg < 0) {
     return false;
   }
   int2_ctrl &= ~((uint8_t)(int2_mask | (int2_mask >> 16)));
   md2_cfg   &= ~((uint8_t)(int2_mask >> 8));
-  return mgos_i2c_write_reg_b(imu->acc->i2c, imu->acc->i2caddr, MGOS_LSM6DSL_REG_INT2_CTRL, int2_ctrl) &&
-         mgos_i2c_write_reg_b(imu->acc->i2c, imu->acc->i2caddr, MGOS_LSM6DSL_REG_MD2_CFG, md2_cfg);
+  return mgos_imu_regcache_write_reg_b(&iud->regs, MGOS_LSM6DSL_REG_INT2_CTRL, int2_ctrl) &&
+         mgos_imu_regcache_write_reg_b(&iud->regs, MGOS_LSM6DSL_REG_MD2_CFG, md2_cfg);
 }
@@ -18,6 +18,7 @@
 
 #include <stdint.h>
 #include "mgos_imu_internal.h"
+#include "mgos_imu_regcache.h"
 
 #define MGOS_LSM6DSL_DEFAULT_I2CADDR    (0x6b)
 #define MGOS_LSM6DSL_DEVID              (0x6A)
@@ -129,25 +130,37 @@ enum mgos_imu_lsm6dsl_fifo_mode {
 typedef void (*mgos_imu_lsm6dsl_int_cb)(struct mgos_imu *imu, uint32_t int_mask, void *user_data);
 
 struct mgos_imu_lsm6dsl_userdata {
-  bool                    initialized;
-  mgos_imu_lsm6dsl_int_cb int_cb;
-  void *                  int_cb_user_data;
-  int                     int_gpio;
+  bool                     initialized;
+  mgos_imu_lsm6dsl_int_cb  int_cb;
+  void *                   int_cb_user_data;
+  int                      int_gpio;
+  struct mgos_imu_regcache regs;      // Configuration register shadow
+
+  // Wake on motion, with the registers it changes as they were before.
+  bool                     wake_enabled;
+  uint8_t                  wake_saved[7];
 };
 
 struct mgos_imu_lsm6dsl_userdata *mgos_imu_lsm6dsl_userdata_create(void);
 
 bool mgos_imu_lsm6dsl_acc_detect(struct mgos_imu_acc *dev, void *imu_user_data);
-bool mgos_imu_lsm6dsl_acc_create(struct mgos_imu_acc *dev, void *imu_user_data);
+int32_t mgos_imu_lsm6dsl_acc_create_step(struct mgos_imu_acc *dev, void *imu_user_data, uint8_t step);
 bool mgos_imu_lsm6dsl_acc_read(struct mgos_imu_acc *dev, void *imu_user_data);
 bool mgos_imu_lsm6dsl_acc_get_scale(struct mgos_imu_acc *dev, void *imu_user_data, float *scale);
 bool mgos_imu_lsm6dsl_acc_set_scale(struct mgos_imu_acc *dev, void *imu_user_data, float scale);
 bool mgos_imu_lsm6dsl_acc_get_odr(struct mgos_imu_acc *dev, void *imu_user_data, float *odr);
 bool mgos_imu_lsm6dsl_acc_set_odr(struct mgos_imu_acc *dev, void *imu_user_data, float odr);
+bool mgos_imu_lsm6dsl_acc_get_bandwidth(struct mgos_imu_acc *dev, void *imu_user_data, float *hertz);
+bool mgos_imu_lsm6dsl_acc_set_bandwidth(struct mgos_imu_acc *dev, void *imu_user_data, float hertz);
+bool mgos_imu_lsm6dsl_acc_set_hw_offset(struct mgos_imu_acc *dev, void *imu_user_data, float x, float y, float z);
+bool mgos_imu_lsm6dsl_acc_set_wakeup(struct mgos_imu_acc *dev, void *imu_user_data, float threshold, uint32_t duration_ms);
+bool mgos_imu_lsm6dsl_acc_get_wakeup(struct mgos_imu_acc *dev, void *imu_user_data, bool *woken);
 
 bool mgos_imu_lsm6dsl_gyro_detect(struct mgos_imu_gyro *dev, void *imu_user_data);
-bool mgos_imu_lsm6dsl_gyro_create(struct mgos_imu_gyro *dev, void *imu_user_data);
+int32_t mgos_imu_lsm6dsl_gyro_create_step(struct mgos_imu_gyro *dev, void *imu_user_data, uint8_t step);
 bool mgos_imu_lsm6dsl_gyro_read(struct mgos_imu_gyro *dev, void *imu_user_data);
+bool mgos_imu_lsm6dsl_gyro_get_odr(struct mgos_imu_gyro *dev, void *imu_user_data, float *odr);
+bool mgos_imu_lsm6dsl_gyro_set_odr(struct mgos_imu_gyro *dev, void *imu_user_data, float odr);
 
 // Interrupts
 #define MGOS_LSM6DSL_INT_DRDY_XL        (1 << 0)
@@ -17,6 +17,7 @@
 #include "mgos.h"
 #include "mgos_i2c.h"
 #include "mgos_imu_lsm9ds1.h"
+#include <math.h>
 
 static bool mgos_imu_lsm9ds1_detect(struct mgos_i2c *i2c, uint8_t i2caddr) {
   int device_id;
@@ -32,14 +33,16 @@ static bool mgos_imu_lsm9ds1_detect(struct mgos_i2c *i2c, uint8_t i2caddr) {
   return false;
 }
 
-static bool mgos_imu_lsm9ds1_accgyro_create(struct mgos_i2c *i2c, uint8_t i2caddr) {
+static bool mgos_imu_lsm9ds1_accgyro_create(struct mgos_i2c *i2c, uint8_t i2caddr, bool no_rst) {
   if (!i2c) {
     return false;
   }
 
   // Reset acc/gyro
-  mgos_i2c_write_reg_b(i2c, i2caddr, MGOS_LSM9DS1_REG_CTRL_REG8, 0x81);
-  mgos_usleep(10000);
+  if (!no_rst) {
+    mgos_i2c_write_reg_b(i2c, i2caddr, MGOS_LSM9DS1_REG_CTRL_REG8, 0x81);
+    mgos_usleep(10000);
+  }
 
   // FIFO_CTRL: FMODE=000 (FIFO off); FTH=00000
   mgos_i2c_write_reg_b(i2c, i2caddr, MGOS_LSM9DS1_REG_FIFO_CTRL, 0x00);
@@ -70,7 +73,7 @@ bool mgos_imu_lsm9ds1_acc_create(struct mgos_imu_acc *dev, void *imu_user_data)
 
   // Only initialize the LSM9DS1 if gyro hasn't done so yet
   if (!iud->accgyro_initialized) {
-    if (!mgos_imu_lsm9ds1_accgyro_create(dev->i2c, dev->i2caddr)) {
+    if (!mgos_imu_lsm9ds1_accgyro_create(dev->i2c, dev->i2caddr, dev->opts.no_rst)) {
       return false;
     }
     iud->accgyro_initialized = true;
@@ -102,6 +105,7 @@ bool mgos_imu_lsm9ds1_acc_read(struct mgos_imu_acc *dev, void *imu_user_data) {
   if (!mgos_i2c_read_reg_n(dev->i2c, dev->i2caddr, MGOS_LSM9DS1_REG_OUT_X_L_XL, 6, data)) {
     return false;
   }
+  mgos_imu_stats_i2c(dev->stats, 6);
   dev->ax = (data[1] << 8) | (data[0]);
   dev->ay = (data[3] << 8) | (data[2]);
   dev->az = (data[5] << 8) | (data[4]);
@@ -110,6 +114,130 @@ bool mgos_imu_lsm9ds1_acc_read(struct mgos_imu_acc *dev, void *imu_user_data) {
   (void)imu_user_data;
 }
 
+// Anti-aliasing filter cutoff in Hz, by CTRL_REG6_XL BW_XL with BW_SCAL_ODR=1.
+// With BW_SCAL_ODR=0 the chip picks the cutoff from the data rate.
+static const float s_lsm9ds1_acc_bandwidth[4] = { 408.f, 211.f, 105.f, 50.f };
+
+bool mgos_imu_lsm9ds1_acc_get_bandwidth(struct mgos_imu_acc *dev, void *imu_user_data, float *hertz) {
+  int ctrl6;
+
+  if (!dev) {
+    return false;
+  }
+  if ((ctrl6 = mgos_i2c_read_reg_b(dev->i2c, dev->i2caddr, MGOS_LSM9DS1_REG_CTRL_REG6_XL)) < 0) {
+    return false;
+  }
+  if (ctrl6 & 0x04) {
+    *hertz = s_lsm9ds1_acc_bandwidth[ctrl6 & 0x03];
+    return true;
+  }
+  // ODR_XL: 952Hz, 476Hz, 238Hz, and 50Hz below that.
+  switch ((ctrl6 >> 5) & 0x07) {
+  case 0: return false;
+
+  case 6: *hertz = 408.f; break;
+
+  case 5: *hertz = 211.f; break;
+
+  case 4: *hertz = 105.f; break;
+
+  default: *hertz = 50.f; break;
+  }
+  return true;
+
+  (void)imu_user_data;
+}
+
+bool mgos_imu_lsm9ds1_acc_set_bandwidth(struct mgos_imu_acc *dev, void *imu_user_data, float hertz) {
+  uint8_t bw = mgos_imu_bandwidth_pick(s_lsm9ds1_acc_bandwidth, 4, hertz);
+
+  if (!dev) {
+    return false;
+  }
+  // CTRL_REG6_XL: BW_SCAL_ODR=1 (bandwidth from BW_XL); BW_XL=bw
+  return mgos_i2c_setbits_reg_b(dev->i2c, dev->i2caddr, MGOS_LSM9DS1_REG_CTRL_REG6_XL, 0, 3, 0x04 | bw);
+
+  (void)imu_user_data;
+}
+
+// The LSM9DS1 has no wake-up interrupt, but its activity/inactivity engine
+// does the power management on its own: while the accelerometer stays under
+// ACT_THS it drops to 10Hz and powers the gyro down, and it returns to the
+// configured rates on activity. INT2 signals inactivity, so waking up is the
+// INACT status going from set to clear. ACT_THS is 7 bits of full scale, and
+// the driver runs the accelerometer at 8G. `duration_ms` is not used, the
+// chip goes inactive as soon as it can.
+bool mgos_imu_lsm9ds1_acc_set_wakeup(struct mgos_imu_acc *dev, void *imu_user_data, float threshold, uint32_t duration_ms) {
+  struct mgos_imu_lsm9ds1_userdata *iud = (struct mgos_imu_lsm9ds1_userdata *)imu_user_data;
+  int val, ths;
+
+  if (!dev || !iud) {
+    return false;
+  }
+
+  if (threshold <= 0) {
+    if (!iud->wake_enabled) {
+      return true;
+    }
+    iud->wake_enabled = false;
+    return mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_LSM9DS1_REG_ACT_THS, 0x00) &&
+           mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_LSM9DS1_REG_INT2_CTRL, iud->wake_int2_ctrl) &&
+           mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_LSM9DS1_REG_CTRL_REG8, iud->wake_ctrl_reg8);
+  }
+
+  if (!iud->wake_enabled) {
+    if ((val = mgos_i2c_read_reg_b(dev->i2c, dev->i2caddr, MGOS_LSM9DS1_REG_INT2_CTRL)) < 0) {
+      return false;
+    }
+    iud->wake_int2_ctrl = (uint8_t)val;
+    if ((val = mgos_i2c_read_reg_b(dev->i2c, dev->i2caddr, MGOS_LSM9DS1_REG_CTRL_REG8)) < 0) {
+      return false;
+    }
+    iud->wake_ctrl_reg8 = (uint8_t)val;
+  }
+
+  ths = (int)roundf(threshold * 128.f / 8.f);
+  if (ths < 1) {
+    ths = 1;
+  } else if (ths > 127) {
+    ths = 127;
+  }
+  // CTRL_REG8: PP_OD=0 (push-pull), so that INT2 can be read without a pull-up.
+  // ACT_THS: SLEEP_ON_INACT_EN=0 (gyro powered down); ACT_THS=ths
+  if (!mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_LSM9DS1_REG_CTRL_REG8, iud->wake_ctrl_reg8 & ~0x10) ||
+      !mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_LSM9DS1_REG_INT2_CTRL, iud->wake_int2_ctrl | 0x80) ||
+      !mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_LSM9DS1_REG_ACT_DUR, 0x00) ||
+      !mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_LSM9DS1_REG_ACT_THS, (uint8_t)ths)) {
+    return false;
+  }
+  iud->wake_enabled  = true;
+  iud->wake_inactive = false;
+  return true;
+
+  (void)duration_ms;
+}
+
+bool mgos_imu_lsm9ds1_acc_get_wakeup(struct mgos_imu_acc *dev, void *imu_user_data, bool *woken) {
+  struct mgos_imu_lsm9ds1_userdata *iud = (struct mgos_imu_lsm9ds1_userdata *)imu_user_data;
+  int status;
+
+  if (!dev || !iud || !woken) {
+    return false;
+  }
+  status = mgos_i2c_read_reg_b(dev->i2c, dev->i2caddr, MGOS_LSM9DS1_REG_STATUS1_REG);
+  if (status < 0) {
+    return false;
+  }
+  *woken = false;
+  if (status & 0x10) {
+    iud->wake_inactive = true;
+  } else if (iud->wake_inactive) {
+    iud->wake_inactive = false;
+    *woken             = true;
+  }
+  return true;
+}
+
 bool mgos_imu_lsm9ds1_gyro_detect(struct mgos_imu_gyro *dev, void *imu_user_data) {
   return mgos_imu_lsm9ds1_detect(dev->i2c, dev->i2caddr);
 
@@ -126,7 +254,7 @@ bool mgos_imu_lsm9ds1_gyro_create(struct mgos_imu_gyro *dev, void *imu_user_data
 
   // Only initialize the LSM9DS1 if acc hasn't done so yet
   if (!iud->accgyro_initialized) {
-    if (!mgos_imu_lsm9ds1_accgyro_create(dev->i2c, dev->i2caddr)) {
+    if (!mgos_imu_lsm9ds1_accgyro_create(dev->i2c, dev->i2caddr, dev->opts.no_rst)) {
       return false;
     }
     iud->accgyro_initialized = true;
@@ -159,6 +287,7 @@ bool mgos_imu_lsm9ds1_gyro_read(struct mgos_imu_gyro *dev, void *imu_user_data)
   if (!mgos_i2c_read_reg_n(dev->i2c, dev->i2caddr, MGOS_LSM9DS1_REG_OUT_X_L_G, 6, data)) {
     return false;
   }
+  mgos_imu_stats_i2c(dev->stats, 6);
   dev->gx = (data[1] << 8) | (data[0]);
   dev->gy = (data[3] << 8) | (data[2]);
   dev->gz = (data[5] << 8) | (data[4]);
@@ -190,8 +319,10 @@ bool mgos_imu_lsm9ds1_mag_create(struct mgos_imu_mag *dev, void *imu_user_data)
   }
 
   // Reset mag
-  mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_LSM9DS1_REG_CTRL_REG2_M, 0x0c);
-  mgos_usleep(10000);
+  if (!dev->opts.no_rst) {
+    mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_LSM9DS1_REG_CTRL_REG2_M, 0x0c);
+    mgos_usleep(10000);
+  }
 
 
   // CTRL_REG1_M: TEMP_COMP=0; OM=10 (high performance); DO=110 (ODR 40Hz); FAST_ODR=0; ST=0
@@ -229,6 +360,7 @@ bool mgos_imu_lsm9ds1_mag_read(struct mgos_imu_mag *dev, void *imu_user_data) {
   if (!mgos_i2c_read_reg_n(dev->i2c, dev->i2caddr, MGOS_LSM9DS1_REG_OUT_X_L_M, 6, data)) {
     return false;
   }
+  mgos_imu_stats_i2c(dev->stats, 6);
   dev->mx = (data[1] << 8) | (data[0]);
   dev->my = (data[3] << 8) | (data[2]);
   dev->mz = (data[5] << 8) | (data[4]);
@@ -237,6 +369,33 @@ bool mgos_imu_lsm9ds1_mag_read(struct mgos_imu_mag *dev, void *imu_user_data) {
   (void)imu_user_data;
 }
 
+bool mgos_imu_lsm9ds1_mag_set_hw_offset(struct mgos_imu_mag *dev, void *imu_user_data, float x, float y, float z) {
+  float   o[3] = { x, y, z };
+  uint8_t data[6];
+  int32_t val;
+
+  if (!dev) {
+    return false;
+  }
+
+  // OFFSET_*_REG_M are in output LSB, little endian, and are subtracted from
+  // the measurement before it is written to OUT_*_M.
+  for (int i = 0; i < 3; i++) {
+    if (dev->scale == 0 || dev->bias[i] == 0) {
+      return false;
+    }
+    val = (int32_t)roundf(-o[i] / (dev->scale * dev->bias[i]));
+    if (val < INT16_MIN || val > INT16_MAX) {
+      return false;
+    }
+    data[i * 2]     = (uint8_t)(val & 0xFF);
+    data[i * 2 + 1] = (uint8_t)((val >> 8) & 0xFF);
+  }
+  return mgos_i2c_write_reg_n(dev->i2c, dev->i2caddr, MGOS_LSM9DS1_REG_OFFSET_X_REG_L_M, 6, data);
+
+  (void)imu_user_data;
+}
+
 struct mgos_imu_lsm9ds1_userdata *mgos_imu_lsm9ds1_userdata_create(void) {
   struct mgos_imu_lsm9ds1_userdata *iud;
 
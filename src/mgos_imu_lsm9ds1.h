@@ -102,7 +102,13 @@
 #define MGOS_LSM9DS1_REG_INT_THS_H_M         (0x33)
 
 struct mgos_imu_lsm9ds1_userdata {
-  bool accgyro_initialized;
+  bool    accgyro_initialized;
+
+  // Wake on motion, with the registers it changes as they were before.
+  bool    wake_enabled;
+  bool    wake_inactive;
+  uint8_t wake_int2_ctrl;
+  uint8_t wake_ctrl_reg8;
 };
 
 struct mgos_imu_lsm9ds1_userdata *mgos_imu_lsm9ds1_userdata_create(void);
@@ -110,6 +116,10 @@ struct mgos_imu_lsm9ds1_userdata *mgos_imu_lsm9ds1_userdata_create(void);
 bool mgos_imu_lsm9ds1_acc_detect(struct mgos_imu_acc *dev, void *imu_user_data);
 bool mgos_imu_lsm9ds1_acc_create(struct mgos_imu_acc *dev, void *imu_user_data);
 bool mgos_imu_lsm9ds1_acc_read(struct mgos_imu_acc *dev, void *imu_user_data);
+bool mgos_imu_lsm9ds1_acc_get_bandwidth(struct mgos_imu_acc *dev, void *imu_user_data, float *hertz);
+bool mgos_imu_lsm9ds1_acc_set_bandwidth(struct mgos_imu_acc *dev, void *imu_user_data, float hertz);
+bool mgos_imu_lsm9ds1_acc_set_wakeup(struct mgos_imu_acc *dev, void *imu_user_data, float threshold, uint32_t duration_ms);
+bool mgos_imu_lsm9ds1_acc_get_wakeup(struct mgos_imu_acc *dev, void *imu_user_data, bool *woken);
 
 bool mgos_imu_lsm9ds1_gyro_detect(struct mgos_imu_gyro *dev, void *imu_user_data);
 bool mgos_imu_lsm9ds1_gyro_create(struct mgos_imu_gyro *dev, void *imu_user_data);
@@ -118,3 +128,4 @@ bool mgos_imu_lsm9ds1_gyro_read(struct mgos_imu_gyro *dev, void *imu_user_data);
 bool mgos_imu_lsm9ds1_mag_detect(struct mgos_imu_mag *dev, void *imu_user_data);
 bool mgos_imu_lsm9ds1_mag_create(struct mgos_imu_mag *dev, void *imu_user_data);
 bool mgos_imu_lsm9ds1_mag_read(struct mgos_imu_mag *dev, void *imu_user_data);
+bool mgos_imu_lsm9ds1_mag_set_hw_offset(struct mgos_imu_mag *dev, void *imu_user_data, float x, float y, float z);
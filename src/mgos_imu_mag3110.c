@@ -70,6 +70,7 @@ bool mgos_imu_mag3110_read(struct mgos_imu_mag *dev, void *imu_user_data) {
   if (!mgos_i2c_read_reg_n(dev->i2c, dev->i2caddr, MGOS_MAG3110_REG_OUT_X_MSB, 6, data)) {
     return false;
   }
+  mgos_imu_stats_i2c(dev->stats, 6);
 
   dev->mx = (data[1] << 8) | (data[0]);
   dev->my = (data[3] << 8) | (data[2]);
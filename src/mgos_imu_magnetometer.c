@@ -24,6 +24,7 @@
 #include "mgos_imu_hmc5883l.h"
 #include "mgos_imu_lsm9ds1.h"
 #include "mgos_imu_icm20948.h"
+#include "mgos_imu_replay.h"
 
 static struct mgos_imu_mag *mgos_imu_mag_create(void) {
   struct mgos_imu_mag *mag;
@@ -51,12 +52,14 @@ static bool mgos_imu_mag_destroy(struct mgos_imu_mag **mag, void *imu_user_data)
   if (!*mag) {
     return false;
   }
+  mgos_imu_create_cancel((*mag)->pending);
   if ((*mag)->destroy) {
     (*mag)->destroy(*mag, imu_user_data);
   }
   if ((*mag)->user_data) {
     free((*mag)->user_data);
   }
+  free((*mag)->stats);
   free(*mag);
   *mag = NULL;
   return true;
@@ -99,39 +102,61 @@ const char *mgos_imu_magnetometer_get_name(struct mgos_imu *imu) {
 
   case MAG_ICM20948: return "ICM20948";
 
+  case MAG_REPLAY: return "REPLAY";
+
   default: return "UNKNOWN";
   }
 }
 
 bool mgos_imu_magnetometer_get(struct mgos_imu *imu, float *x, float *y, float *z) {
-  float mxb, myb, mzb;
+  float * v;
+  float   mxb, myb, mzb;
+  int64_t start;
+  bool    ok;
 
-  if (!imu->mag || !imu->mag->read) {
+  if (!imu->mag || !imu->mag->read || imu->mag->pending) {
     return false;
   }
 
-  if (!imu->mag->read(imu->mag, imu->user_data)) {
+  imu->mag->stale = false;
+  start          = mgos_imu_stats_start(imu->mag->stats);
+  ok             = imu->mag->read(imu->mag, imu->user_data);
+  mgos_imu_stats_read(imu->mag->stats, start, ok);
+  if (!ok) {
     LOG(LL_ERROR, ("Could not read from magnetometer"));
     return false;
   }
   // LOG(LL_DEBUG, ("Raw: mx=%d my=%d mz=%d", imu->mag->mx, imu->mag->my, imu->mag->mz));
-  mxb = imu->mag->bias[0] * imu->mag->mx * imu->mag->scale;
-  myb = imu->mag->bias[1] * imu->mag->my * imu->mag->scale;
-  mzb = imu->mag->bias[2] * imu->mag->mz * imu->mag->scale;
+  // A sample the driver already returned is not processed again.
+  v = imu->mag->out;
+  if (!imu->mag->stale) {
+    mxb  = imu->mag->bias[0] * imu->mag->mx * imu->mag->scale;
+    myb  = imu->mag->bias[1] * imu->mag->my * imu->mag->scale;
+    mzb  = imu->mag->bias[2] * imu->mag->mz * imu->mag->scale;
+    v[0] = (mxb * imu->mag->orientation[0] + myb * imu->mag->orientation[1] + mzb * imu->mag->orientation[2]);
+    v[1] = (mxb * imu->mag->orientation[3] + myb * imu->mag->orientation[4] + mzb * imu->mag->orientation[5]);
+    v[2] = (mxb * imu->mag->orientation[6] + myb * imu->mag->orientation[7] + mzb * imu->mag->orientation[8]);
+    if (imu->mag->filter) {
+      mgos_imu_filter_process(imu->mag->filter, v, 1);
+    }
+    if (imu->mag->aggregator) {
+      mgos_imu_aggregator_add(imu->mag->aggregator, v, 1);
+    }
+  }
   if (x) {
-    *x = (mxb * imu->mag->orientation[0] + myb * imu->mag->orientation[1] + mzb * imu->mag->orientation[2]);
+    *x = v[0];
   }
   if (y) {
-    *y = (mxb * imu->mag->orientation[3] + myb * imu->mag->orientation[4] + mzb * imu->mag->orientation[5]);
+    *y = v[1];
   }
   if (z) {
-    *z = (mxb * imu->mag->orientation[6] + myb * imu->mag->orientation[7] + mzb * imu->mag->orientation[8]);
+    *z = v[2];
   }
   return true;
 }
 
-bool mgos_imu_magnetometer_create_i2c(struct mgos_imu *imu, struct mgos_i2c *i2c, uint8_t i2caddr, const struct mgos_imu_mag_opts *opts) {
-  if (!imu || !i2c || !opts) {
+static bool mgos_imu_mag_setup(struct mgos_imu *imu, struct mgos_i2c *i2c, uint8_t i2caddr, const struct mgos_imu_mag_opts *opts) {
+  if (!imu || !opts || (!i2c && opts->type != MAG_REPLAY)) {
     return false;
   }
   if (imu->mag) {
@@ -146,9 +171,10 @@ bool mgos_imu_magnetometer_create_i2c(struct mgos_imu *imu, struct mgos_i2c *i2c
   imu->mag->opts    = *opts;
   switch (opts->type) {
   case MAG_LSM9DS1:
-    imu->mag->detect = mgos_imu_lsm9ds1_mag_detect;
-    imu->mag->create = mgos_imu_lsm9ds1_mag_create;
-    imu->mag->read   = mgos_imu_lsm9ds1_mag_read;
+    imu->mag->detect        = mgos_imu_lsm9ds1_mag_detect;
+    imu->mag->create        = mgos_imu_lsm9ds1_mag_create;
+    imu->mag->read          = mgos_imu_lsm9ds1_mag_read;
+    imu->mag->set_hw_offset = mgos_imu_lsm9ds1_mag_set_hw_offset;
     if (!imu->user_data) {
       imu->user_data = mgos_imu_lsm9ds1_userdata_create();
     }
@@ -171,21 +197,21 @@ bool mgos_imu_magnetometer_create_i2c(struct mgos_imu *imu, struct mgos_i2c *i2c
     break;
 
   case MAG_AK8963:
-    imu->mag->detect = mgos_imu_ak8963_detect;
-    imu->mag->create = mgos_imu_ak8963_create;
-    imu->mag->read   = mgos_imu_ak8963_read;
+    imu->mag->detect      = mgos_imu_ak8963_detect;
+    imu->mag->create_step = mgos_imu_ak8963_create_step;
+    imu->mag->read        = mgos_imu_ak8963_read;
     break;
 
   case MAG_AK8975:
-    imu->mag->detect = mgos_imu_ak8975_detect;
-    imu->mag->create = mgos_imu_ak8975_create;
-    imu->mag->read   = mgos_imu_ak8975_read;
+    imu->mag->detect      = mgos_imu_ak8975_detect;
+    imu->mag->create_step = mgos_imu_ak8975_create_step;
+    imu->mag->read        = mgos_imu_ak8975_read;
     break;
 
   case MAG_BMM150:
-    imu->mag->detect = mgos_imu_bmm150_detect;
-    imu->mag->create = mgos_imu_bmm150_create;
-    imu->mag->read   = mgos_imu_bmm150_read;
+    imu->mag->detect      = mgos_imu_bmm150_detect;
+    imu->mag->create_step = mgos_imu_bmm150_create_step;
+    imu->mag->read        = mgos_imu_bmm150_read;
     break;
 
   case MAG_MAG3110:
@@ -205,6 +231,14 @@ bool mgos_imu_magnetometer_create_i2c(struct mgos_imu *imu, struct mgos_i2c *i2c
     }
     break;
 
+  case MAG_REPLAY:
+    imu->mag->detect  = mgos_imu_replay_mag_detect;
+    imu->mag->create  = mgos_imu_replay_mag_create;
+    imu->mag->destroy = mgos_imu_replay_mag_destroy;
+    imu->mag->read    = mgos_imu_replay_mag_read;
+    imu->mag->get_odr = mgos_imu_replay_mag_get_odr;
+    break;
+
   default:
     LOG(LL_ERROR, ("Unknown magnetometer type %d", opts->type));
     mgos_imu_magnetometer_destroy(imu);
@@ -222,29 +256,79 @@ bool mgos_imu_magnetometer_create_i2c(struct mgos_imu *imu, struct mgos_i2c *i2c
                      opts->type, mgos_imu_magnetometer_get_name(imu), i2caddr));
     }
   }
+  return true;
+}
 
-  if (imu->mag->create) {
-    if (!imu->mag->create(imu->mag, imu->user_data)) {
-      LOG(LL_ERROR, ("Could not create magnetometer type %d (%s) at I2C 0x%02x",
-                     opts->type, mgos_imu_magnetometer_get_name(imu), i2caddr));
-      mgos_imu_magnetometer_destroy(imu);
-      return false;
-    } else {
-      LOG(LL_DEBUG, ("Successfully created magnetometer type %d (%s) at I2C 0x%02x",
-                     opts->type, mgos_imu_magnetometer_get_name(imu), i2caddr));
-    }
+static int32_t mgos_imu_mag_create_step(struct mgos_imu *imu, uint8_t step) {
+  struct mgos_imu_mag *mag = imu->mag;
+
+  if (mag->create_step) {
+    return mag->create_step(mag, imu->user_data, step);
   }
-  if (imu->mag->set_scale) {
-    imu->mag->set_scale(imu->mag, imu->user_data, opts->scale);
+  if (mag->create && !mag->create(mag, imu->user_data)) {
+    return -1;
   }
+  return 0;
+}
+
+static bool mgos_imu_mag_create_done(struct mgos_imu *imu, bool ok) {
+  struct mgos_imu_mag *mag = imu->mag;
+
+  mag->pending = NULL;
+  if (!ok) {
+    LOG(LL_ERROR, ("Could not create magnetometer type %d (%s) at I2C 0x%02x",
+                   mag->opts.type, mgos_imu_magnetometer_get_name(imu), mag->i2caddr));
+    mgos_imu_magnetometer_destroy(imu);
+    return false;
+  }
+  LOG(LL_DEBUG, ("Successfully created magnetometer type %d (%s) at I2C 0x%02x",
+                 mag->opts.type, mgos_imu_magnetometer_get_name(imu), mag->i2caddr));
+
+  if (mag->set_scale) {
+    mag->set_scale(mag, imu->user_data, mag->opts.scale);
+  }
+
+  if (mag->set_odr) {
+    mag->set_odr(mag, imu->user_data, mag->opts.odr);
+  }
+
+  return true;
+}
 
-  if (imu->mag->set_odr) {
-    imu->mag->set_odr(imu->mag, imu->user_data, opts->odr);
+bool mgos_imu_magnetometer_create_i2c(struct mgos_imu *imu, struct mgos_i2c *i2c, uint8_t i2caddr, const struct mgos_imu_mag_opts *opts) {
+  if (!mgos_imu_mag_setup(imu, i2c, i2caddr, opts)) {
+    return false;
   }
+  return mgos_imu_mag_create_done(imu, mgos_imu_create_run(imu, mgos_imu_mag_create_step));
+}
 
+bool mgos_imu_magnetometer_create_i2c_async(struct mgos_imu *imu, struct mgos_i2c *i2c, uint8_t i2caddr, const struct mgos_imu_mag_opts *opts, mgos_imu_create_cb cb, void *cb_arg) {
+  if (!mgos_imu_mag_setup(imu, i2c, i2caddr, opts)) {
+    return false;
+  }
+  imu->mag->pending = mgos_imu_create_start(imu, mgos_imu_mag_create_step, mgos_imu_mag_create_done, cb, cb_arg);
+  if (!imu->mag->pending) {
+    mgos_imu_magnetometer_destroy(imu);
+    return false;
+  }
   return true;
 }
 
+bool mgos_imu_magnetometer_set_hw_offset(struct mgos_imu *imu, float x, float y, float z) {
+  float *o;
+
+  if (!imu || !imu->mag || !imu->mag->set_hw_offset) {
+    return false;
+  }
+  // Offset registers work on sensor axes, so undo the orientation first. It is
+  // a rotation, so its inverse is its transpose.
+  o = imu->mag->orientation;
+  return imu->mag->set_hw_offset(imu->mag, imu->user_data,
+                                 o[0] * x + o[3] * y + o[6] * z,
+                                 o[1] * x + o[4] * y + o[7] * z,
+                                 o[2] * x + o[5] * y + o[8] * z);
+}
+
 bool mgos_imu_magnetometer_get_orientation(struct mgos_imu *imu, float v[9]) {
   if (!imu || !imu->mag || !v) {
     return false;
@@ -288,3 +372,19 @@ bool mgos_imu_magnetometer_set_odr(struct mgos_imu *imu, float hertz) {
   }
   return imu->mag->set_odr(imu->mag, imu->user_data, hertz);
 }
+
+bool mgos_imu_magnetometer_set_filter(struct mgos_imu *imu, struct mgos_imu_filter *filter) {
+  if (!imu || !imu->mag) {
+    return false;
+  }
+  imu->mag->filter = filter;
+  return true;
+}
+
+bool mgos_imu_magnetometer_set_aggregator(struct mgos_imu *imu, struct mgos_imu_aggregator *agg) {
+  if (!imu || !imu->mag) {
+    return false;
+  }
+  imu->mag->aggregator = agg;
+  return true;
+}
@@ -61,6 +61,7 @@ bool mgos_imu_mma8451_read(struct mgos_imu_acc *dev, void *imu_user_data) {
   if (!mgos_i2c_read_reg_n(dev->i2c, dev->i2caddr, MGOS_MMA8451_REG_OUT_X_MSB, 6, data)) {
     return false;
   }
+  mgos_imu_stats_i2c(dev->stats, 6);
   dev->ax = (data[1]) | (data[0] << 8);
   dev->ay = (data[3]) | (data[2] << 8);
   dev->az = (data[5]) | (data[4] << 8);
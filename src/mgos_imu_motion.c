@@ -0,0 +1,282 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mgos.h"
+#include "mgos_imu_internal.h"
+#include <math.h>
+
+#define MGOS_IMU_MOTION_POLL_MS    (100)
+// Data rate that sensors on other chips are lowered to while asleep.
+#define MGOS_IMU_MOTION_SLEEP_ODR  (1)
+
+struct mgos_imu_motion {
+  float              threshold;
+  uint32_t           duration_ms;
+  uint32_t           quiet_ms;
+  int                int_gpio;
+  mgos_imu_motion_cb cb;
+  void *             cb_arg;
+
+  bool               asleep;
+  bool               have_last;
+  float              last[3];
+  int64_t            last_motion;
+  int64_t            last_sample;
+  mgos_timer_id      timer_id;
+
+  // Data rates of sensors on other chips than the accelerometer, 0 if they
+  // were not lowered.
+  float              gyro_odr;
+  float              mag_odr;
+};
+
+// Private functions follow
+static bool mgos_imu_motion_same_chip(struct mgos_i2c *i2c, uint8_t i2caddr, struct mgos_imu_acc *acc) {
+  return i2c == acc->i2c && i2caddr == acc->i2caddr;
+}
+
+static bool mgos_imu_motion_sleep(struct mgos_imu *imu) {
+  struct mgos_imu_motion *m = imu->motion;
+  bool woken;
+
+  if (!imu->acc->set_wakeup(imu->acc, imu->user_data, m->threshold, m->duration_ms)) {
+    LOG(LL_ERROR, ("Could not enable accelerometer wake on motion"));
+    return false;
+  }
+  // Drop a wake status left over from before the chip went to sleep.
+  imu->acc->get_wakeup(imu->acc, imu->user_data, &woken);
+
+  // Sensors on the accelerometer's chip are handled by set_wakeup(), others
+  // are slowed down as far as they go.
+  m->gyro_odr = 0;
+  if (imu->gyro && !imu->gyro->pending && imu->gyro->get_odr && imu->gyro->set_odr &&
+      !mgos_imu_motion_same_chip(imu->gyro->i2c, imu->gyro->i2caddr, imu->acc)) {
+    if (imu->gyro->get_odr(imu->gyro, imu->user_data, &m->gyro_odr) &&
+        !imu->gyro->set_odr(imu->gyro, imu->user_data, MGOS_IMU_MOTION_SLEEP_ODR)) {
+      m->gyro_odr = 0;
+    }
+  }
+  m->mag_odr = 0;
+  if (imu->mag && !imu->mag->pending && imu->mag->get_odr && imu->mag->set_odr &&
+      !mgos_imu_motion_same_chip(imu->mag->i2c, imu->mag->i2caddr, imu->acc)) {
+    if (imu->mag->get_odr(imu->mag, imu->user_data, &m->mag_odr) &&
+        !imu->mag->set_odr(imu->mag, imu->user_data, MGOS_IMU_MOTION_SLEEP_ODR)) {
+      m->mag_odr = 0;
+    }
+  }
+  m->asleep = true;
+  LOG(LL_DEBUG, ("IMU asleep after %u ms without motion", m->quiet_ms));
+  return true;
+}
+
+static bool mgos_imu_motion_wake(struct mgos_imu *imu) {
+  struct mgos_imu_motion *m = imu->motion;
+  bool ret = true;
+
+  if (!imu->acc->set_wakeup(imu->acc, imu->user_data, 0, 0)) {
+    LOG(LL_ERROR, ("Could not disable accelerometer wake on motion"));
+    ret = false;
+  }
+  if (m->gyro_odr > 0 && imu->gyro && imu->gyro->set_odr) {
+    ret = imu->gyro->set_odr(imu->gyro, imu->user_data, m->gyro_odr) && ret;
+  }
+  if (m->mag_odr > 0 && imu->mag && imu->mag->set_odr) {
+    ret = imu->mag->set_odr(imu->mag, imu->user_data, m->mag_odr) && ret;
+  }
+  m->gyro_odr    = 0;
+  m->mag_odr     = 0;
+  m->asleep      = false;
+  m->have_last   = false;
+  m->last_motion = mgos_uptime_micros();
+  m->last_sample = 0;
+  LOG(LL_DEBUG, ("IMU woken up on motion"));
+  return ret;
+}
+
+static void mgos_imu_motion_woken(struct mgos_imu *imu) {
+  struct mgos_imu_motion *m = imu->motion;
+  bool woken = false;
+
+  if (!m->asleep) {
+    return;
+  }
+  if (!imu->acc->get_wakeup(imu->acc, imu->user_data, &woken) || !woken) {
+    return;
+  }
+  mgos_imu_motion_wake(imu);
+  if (m->cb) {
+    m->cb(imu, true, m->cb_arg);
+  }
+}
+
+static void mgos_imu_motion_irq(int pin, void *arg) {
+  struct mgos_imu *imu = (struct mgos_imu *)arg;
+
+  if (!imu || !imu->acc || !imu->motion) {
+    return;
+  }
+  mgos_imu_motion_woken(imu);
+
+  (void)pin;
+}
+
+static void mgos_imu_motion_timer_cb(void *arg) {
+  struct mgos_imu *       imu = (struct mgos_imu *)arg;
+  struct mgos_imu_motion *m;
+  int64_t now, start;
+  bool    ok;
+
+  if (!imu || !imu->acc || !imu->motion) {
+    return;
+  }
+  m = imu->motion;
+  if (m->asleep) {
+    if (m->int_gpio < 0) {
+      mgos_imu_motion_woken(imu);
+    }
+    return;
+  }
+
+  // Take a sample of our own if the application has not read one lately.
+  // It is read from the driver, not through mgos_imu_accelerometer_get(), so
+  // that filters, aggregators and the other users of the application's
+  // samples never see it.
+  now = mgos_uptime_micros();
+  if (now - m->last_sample >= MGOS_IMU_MOTION_POLL_MS * 1000 && !imu->acc->pending && imu->acc->read) {
+    start = mgos_imu_stats_start(imu->acc->stats);
+    ok    = imu->acc->read(imu->acc, imu->user_data);
+    mgos_imu_stats_read(imu->acc->stats, start, ok);
+    if (ok) {
+      mgos_imu_motion_acc(imu);
+    }
+  }
+  if (now - m->last_motion < (int64_t)m->quiet_ms * 1000) {
+    return;
+  }
+  if (!mgos_imu_motion_sleep(imu)) {
+    // Try again after another quiet period.
+    m->last_motion = now;
+    return;
+  }
+  if (m->cb) {
+    m->cb(imu, false, m->cb_arg);
+  }
+}
+
+// Private functions end
+
+// Public functions follow
+void mgos_imu_motion_acc(struct mgos_imu *imu) {
+  struct mgos_imu_motion *m;
+  float v[3], d = 0;
+
+  if (!imu || !imu->acc || !imu->motion) {
+    return;
+  }
+  m = imu->motion;
+  if (m->asleep) {
+    return;
+  }
+  v[0]           = imu->acc->scale * imu->acc->ax;
+  v[1]           = imu->acc->scale * imu->acc->ay;
+  v[2]           = imu->acc->scale * imu->acc->az;
+  m->last_sample = mgos_uptime_micros();
+  if (m->have_last) {
+    for (int i = 0; i < 3; i++) {
+      d += (v[i] - m->last[i]) * (v[i] - m->last[i]);
+    }
+    if (sqrtf(d) > m->threshold) {
+      m->last_motion = m->last_sample;
+    }
+  }
+  memcpy(m->last, v, sizeof(v));
+  m->have_last = true;
+}
+
+bool mgos_imu_set_motion_wakeup(struct mgos_imu *imu, float threshold, uint32_t duration_ms, uint32_t quiet_ms, int int_gpio, mgos_imu_motion_cb cb, void *user_data) {
+  struct mgos_imu_motion *m;
+
+  if (!imu || !imu->acc || imu->acc->pending || threshold <= 0) {
+    return false;
+  }
+  if (!imu->acc->set_wakeup || !imu->acc->get_wakeup) {
+    LOG(LL_ERROR, ("Accelerometer has no wake on motion mode"));
+    return false;
+  }
+  mgos_imu_clear_motion_wakeup(imu);
+
+  m = calloc(1, sizeof(struct mgos_imu_motion));
+  if (!m) {
+    return false;
+  }
+  m->threshold   = threshold;
+  m->duration_ms = duration_ms;
+  m->quiet_ms    = quiet_ms;
+  m->int_gpio    = int_gpio;
+  m->cb          = cb;
+  m->cb_arg      = user_data;
+  imu->motion    = m;
+
+  if (!mgos_imu_motion_sleep(imu)) {
+    imu->motion = NULL;
+    free(m);
+    return false;
+  }
+  m->timer_id = mgos_set_timer(MGOS_IMU_MOTION_POLL_MS, MGOS_TIMER_REPEAT, mgos_imu_motion_timer_cb, imu);
+  if (m->timer_id == MGOS_INVALID_TIMER_ID) {
+    mgos_imu_clear_motion_wakeup(imu);
+    return false;
+  }
+  if (int_gpio >= 0) {
+    mgos_gpio_setup_input(int_gpio, MGOS_GPIO_PULL_DOWN);
+    mgos_gpio_set_int_handler(int_gpio, MGOS_GPIO_INT_EDGE_ANY, mgos_imu_motion_irq, imu);
+    mgos_gpio_clear_int(int_gpio);
+    mgos_gpio_enable_int(int_gpio);
+  }
+  return true;
+}
+
+bool mgos_imu_clear_motion_wakeup(struct mgos_imu *imu) {
+  struct mgos_imu_motion *m;
+  bool ret = true;
+
+  if (!imu || !imu->motion) {
+    return false;
+  }
+  m = imu->motion;
+  if (m->int_gpio >= 0) {
+    mgos_gpio_disable_int(m->int_gpio);
+    mgos_gpio_remove_int_handler(m->int_gpio, NULL, NULL);
+  }
+  if (m->timer_id != MGOS_INVALID_TIMER_ID) {
+    mgos_clear_timer(m->timer_id);
+  }
+  if (m->asleep && imu->acc) {
+    ret = mgos_imu_motion_wake(imu);
+  }
+  imu->motion = NULL;
+  free(m);
+  return ret;
+}
+
+bool mgos_imu_motion_is_awake(struct mgos_imu *imu) {
+  if (!imu || !imu->motion) {
+    return true;
+  }
+  return !imu->motion->asleep;
+}
+
+// Public functions end
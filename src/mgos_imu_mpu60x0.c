@@ -17,6 +17,15 @@
 #include "mgos_imu_mpu60x0.h"
 #include "mgos.h"
 #include "mgos_i2c.h"
+#include <math.h>
+
+// Configuration registers: SMPLRT_DIV..ACCEL_CONFIG, INT_PIN_CFG..INT_ENABLE
+// and USER_CTRL..PWR_MGMT_2.
+static const struct mgos_imu_regcache_range s_mpu60x0_cached[] = {
+  { MGOS_MPU60X0_REG_SMPLRT_DIV,  MGOS_MPU60X0_REG_ACCEL_CONFIG },
+  { MGOS_MPU60X0_REG_INT_PIN_CFG, MGOS_MPU60X0_REG_INT_ENABLE   },
+  { MGOS_MPU60X0_REG_USER_CTRL,   MGOS_MPU60X0_REG_PWR_MGMT_2   },
+};
 
 static bool mgos_imu_mpu60x0_detect(struct mgos_i2c *i2c, uint8_t i2caddr) {
   if (!i2c) {
@@ -27,25 +36,41 @@ static bool mgos_imu_mpu60x0_detect(struct mgos_i2c *i2c, uint8_t i2caddr) {
          mgos_i2c_read_reg_b(i2c, i2caddr, MGOS_MPU60X0_REG_WHO_AM_I);
 }
 
-static bool mgos_imu_mpu60x0_create(struct mgos_i2c *i2c, uint8_t i2caddr) {
+// Chip create steps, see mgos_imu_acc_create_step_fn.
+static int32_t mgos_imu_mpu60x0_create_step(struct mgos_i2c *i2c,
+                                            uint8_t i2caddr, bool no_rst,
+                                            struct mgos_imu_mpu60x0_userdata *iud,
+                                            uint8_t step) {
   if (!i2c) {
-    return false;
+    return -1;
   }
 
-  // Reset
-  mgos_i2c_write_reg_b(i2c, i2caddr, MGOS_MPU60X0_REG_PWR_MGMT_1, 0x80);
-  mgos_usleep(80000);
+  switch (step) {
+  case 0:
+    // Reset
+    if (!no_rst) {
+      mgos_i2c_write_reg_b(i2c, i2caddr, MGOS_MPU60X0_REG_PWR_MGMT_1, 0x80);
+      return 80000;
+    }
+  // fallthrough
 
-  // Enable IMU sensors
-  mgos_i2c_write_reg_b(i2c, i2caddr, MGOS_MPU60X0_REG_PWR_MGMT_2, 0x00);
+  case 1:
+    // Enable IMU sensors
+    mgos_i2c_write_reg_b(i2c, i2caddr, MGOS_MPU60X0_REG_PWR_MGMT_2, 0x00);
 
-  // Set DPLF: -- EXT_SYNC_SET=000 DLPF_CFG=010 (94Hz accel, 98Hz gyro, Fs=1KHz)
-  mgos_i2c_write_reg_b(i2c, i2caddr, MGOS_MPU60X0_REG_CONFIG, 0x02);
+    // Set DPLF: -- EXT_SYNC_SET=000 DLPF_CFG=010 (94Hz accel, 98Hz gyro, Fs=1KHz)
+    mgos_i2c_write_reg_b(i2c, i2caddr, MGOS_MPU60X0_REG_CONFIG, 0x02);
 
-  // Exit sleep mode
-  mgos_i2c_write_reg_b(i2c, i2caddr, MGOS_MPU60X0_REG_PWR_MGMT_1, 0x00);
+    // Exit sleep mode
+    mgos_i2c_write_reg_b(i2c, i2caddr, MGOS_MPU60X0_REG_PWR_MGMT_1, 0x00);
 
-  return true;
+    if (!mgos_imu_regcache_init(&iud->regs, i2c, i2caddr, s_mpu60x0_cached,
+                                sizeof(s_mpu60x0_cached) / sizeof(s_mpu60x0_cached[0]))) {
+      return -1;
+    }
+    return 0;
+  }
+  return -1;
 }
 
 bool mgos_imu_mpu60x0_acc_detect(struct mgos_imu_acc *dev,
@@ -55,26 +80,29 @@ bool mgos_imu_mpu60x0_acc_detect(struct mgos_imu_acc *dev,
   (void)imu_user_data;
 }
 
-bool mgos_imu_mpu60x0_acc_create(struct mgos_imu_acc *dev,
-                                 void *imu_user_data) {
+int32_t mgos_imu_mpu60x0_acc_create_step(struct mgos_imu_acc *dev,
+                                         void *imu_user_data, uint8_t step) {
   struct mgos_imu_mpu60x0_userdata *iud =
     (struct mgos_imu_mpu60x0_userdata *)imu_user_data;
+  int32_t ret;
 
   if (!dev) {
-    return false;
+    return -1;
   }
 
   // Only initialize the MPU60X0 if gyro hasn't done so yet
   if (!iud->initialized) {
-    if (!mgos_imu_mpu60x0_create(dev->i2c, dev->i2caddr)) {
-      return false;
+    ret = mgos_imu_mpu60x0_create_step(dev->i2c, dev->i2caddr,
+                                       dev->opts.no_rst, iud, step);
+    if (ret != 0) {
+      return ret;
     }
     iud->initialized = true;
   }
   // Accel Config: XA_ST=0 YG_AT=0 ZA_ST=0 FS_SEL=10 (8G) ---
-  mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_MPU60X0_REG_ACCEL_CONFIG, 0x10);
+  mgos_imu_regcache_write_reg_b(&iud->regs, MGOS_MPU60X0_REG_ACCEL_CONFIG, 0x10);
 
-  return true;
+  return 0;
 }
 
 bool mgos_imu_mpu60x0_acc_read(struct mgos_imu_acc *dev, void *imu_user_data) {
@@ -86,6 +114,7 @@ bool mgos_imu_mpu60x0_acc_read(struct mgos_imu_acc *dev, void *imu_user_data) {
   if (!mgos_i2c_read_reg_n(dev->i2c, dev->i2caddr, MGOS_MPU60X0_REG_ACCEL_XOUT_H, 6, data)) {
     return false;
   }
+  mgos_imu_stats_i2c(dev->stats, 6);
   dev->ax = (data[0] << 8) | (data[1]);
   dev->ay = (data[2] << 8) | (data[3]);
   dev->az = (data[4] << 8) | (data[5]);
@@ -102,26 +131,29 @@ bool mgos_imu_mpu60x0_gyro_detect(struct mgos_imu_gyro *dev,
   (void)imu_user_data;
 }
 
-bool mgos_imu_mpu60x0_gyro_create(struct mgos_imu_gyro *dev,
-                                  void *imu_user_data) {
+int32_t mgos_imu_mpu60x0_gyro_create_step(struct mgos_imu_gyro *dev,
+                                          void *imu_user_data, uint8_t step) {
   struct mgos_imu_mpu60x0_userdata *iud =
     (struct mgos_imu_mpu60x0_userdata *)imu_user_data;
+  int32_t ret;
 
   if (!dev) {
-    return false;
+    return -1;
   }
 
   // Only initialize the MPU60X0 if acc hasn't done so yet
   if (!iud->initialized) {
-    if (!mgos_imu_mpu60x0_create(dev->i2c, dev->i2caddr)) {
-      return false;
+    ret = mgos_imu_mpu60x0_create_step(dev->i2c, dev->i2caddr,
+                                       dev->opts.no_rst, iud, step);
+    if (ret != 0) {
+      return ret;
     }
     iud->initialized = true;
   }
   // Gyro Config: XG_ST=0 YG_ST=0 ZG_ST=0 FS_SEL=11 (2000 dps) ---
-  mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_MPU60X0_REG_GYRO_CONFIG, 0x18);
+  mgos_imu_regcache_write_reg_b(&iud->regs, MGOS_MPU60X0_REG_GYRO_CONFIG, 0x18);
 
-  return true;
+  return 0;
 }
 
 bool mgos_imu_mpu60x0_gyro_read(struct mgos_imu_gyro *dev,
@@ -134,6 +166,7 @@ bool mgos_imu_mpu60x0_gyro_read(struct mgos_imu_gyro *dev,
   if (!mgos_i2c_read_reg_n(dev->i2c, dev->i2caddr, MGOS_MPU60X0_REG_GYRO_XOUT_H, 6, data)) {
     return false;
   }
+  mgos_imu_stats_i2c(dev->stats, 6);
   dev->gx = (data[0] << 8) | (data[1]);
   dev->gy = (data[2] << 8) | (data[3]);
   dev->gz = (data[4] << 8) | (data[5]);
@@ -156,9 +189,11 @@ struct mgos_imu_mpu60x0_userdata *mgos_imu_mpu60x0_userdata_create(void) {
 
 bool mgos_imu_mpu60x0_acc_get_scale(struct mgos_imu_acc *dev,
                                     void *imu_user_data, float *scale) {
+  struct mgos_imu_mpu60x0_userdata *iud =
+    (struct mgos_imu_mpu60x0_userdata *)imu_user_data;
   uint8_t sel;
 
-  if (!mgos_i2c_getbits_reg_b(dev->i2c, dev->i2caddr, MGOS_MPU60X0_REG_ACCEL_CONFIG, 3, 2, &sel)) {
+  if (!mgos_imu_regcache_getbits_reg_b(&iud->regs, MGOS_MPU60X0_REG_ACCEL_CONFIG, 3, 2, &sel)) {
     return false;
   }
   switch (sel) {
@@ -173,11 +208,13 @@ bool mgos_imu_mpu60x0_acc_get_scale(struct mgos_imu_acc *dev,
 
   return true;
 
-  (void)imu_user_data;
+  (void)dev;
 }
 
 bool mgos_imu_mpu60x0_acc_set_scale(struct mgos_imu_acc *dev,
                                     void *imu_user_data, float scale) {
+  struct mgos_imu_mpu60x0_userdata *iud =
+    (struct mgos_imu_mpu60x0_userdata *)imu_user_data;
   uint8_t sel;
 
   if (scale > 16) {
@@ -195,22 +232,22 @@ bool mgos_imu_mpu60x0_acc_set_scale(struct mgos_imu_acc *dev,
     sel   = 0; // 2G
     scale = 2.f;
   }
-  if (!mgos_i2c_setbits_reg_b(dev->i2c, dev->i2caddr, MGOS_MPU60X0_REG_ACCEL_CONFIG, 3, 2, sel)) {
+  if (!mgos_imu_regcache_setbits_reg_b(&iud->regs, MGOS_MPU60X0_REG_ACCEL_CONFIG, 3, 2, sel)) {
     return false;
   }
   dev->opts.scale = scale;
   dev->scale      = scale / 32768.0f;
 
   return true;
-
-  (void)imu_user_data;
 }
 
 bool mgos_imu_mpu60x0_gyro_get_scale(struct mgos_imu_gyro *dev,
                                      void *imu_user_data, float *scale) {
+  struct mgos_imu_mpu60x0_userdata *iud =
+    (struct mgos_imu_mpu60x0_userdata *)imu_user_data;
   uint8_t sel;
 
-  if (!mgos_i2c_getbits_reg_b(dev->i2c, dev->i2caddr, MGOS_MPU60X0_REG_GYRO_CONFIG, 3, 2, &sel)) {
+  if (!mgos_imu_regcache_getbits_reg_b(&iud->regs, MGOS_MPU60X0_REG_GYRO_CONFIG, 3, 2, &sel)) {
     return false;
   }
   switch (sel) {
@@ -225,11 +262,13 @@ bool mgos_imu_mpu60x0_gyro_get_scale(struct mgos_imu_gyro *dev,
 
   return true;
 
-  (void)imu_user_data;
+  (void)dev;
 }
 
 bool mgos_imu_mpu60x0_gyro_set_scale(struct mgos_imu_gyro *dev,
                                      void *imu_user_data, float scale) {
+  struct mgos_imu_mpu60x0_userdata *iud =
+    (struct mgos_imu_mpu60x0_userdata *)imu_user_data;
   uint8_t sel;
 
   if (scale > 2000) {
@@ -247,13 +286,76 @@ bool mgos_imu_mpu60x0_gyro_set_scale(struct mgos_imu_gyro *dev,
     sel   = 0; // 250DPS
     scale = 250.f;
   }
-  if (!mgos_i2c_setbits_reg_b(dev->i2c, dev->i2caddr, MGOS_MPU60X0_REG_GYRO_CONFIG, 3, 2, sel)) {
+  if (!mgos_imu_regcache_setbits_reg_b(&iud->regs, MGOS_MPU60X0_REG_GYRO_CONFIG, 3, 2, sel)) {
     return false;
   }
   dev->opts.scale = scale;
   dev->scale      = scale / 32768.0f;
 
   return true;
+}
+
+bool mgos_imu_mpu60x0_acc_set_hw_offset(struct mgos_imu_acc *dev,
+                                        void *imu_user_data,
+                                        float x, float y, float z) {
+  struct mgos_imu_mpu60x0_userdata *iud =
+    (struct mgos_imu_mpu60x0_userdata *)imu_user_data;
+  float   o[3] = { x, y, z };
+  uint8_t data[6];
+  int32_t val;
+
+  if (!dev || !iud) {
+    return false;
+  }
+
+  // The accel offset registers hold a factory trim, which we keep and add to.
+  if (!iud->acc_trim_valid) {
+    if (!mgos_i2c_read_reg_n(dev->i2c, dev->i2caddr,
+                             MGOS_MPU60X0_REG_XA_OFFS_USRH, 6, data)) {
+      return false;
+    }
+    for (int i = 0; i < 3; i++) {
+      iud->acc_trim[i] = (int16_t)((data[i * 2] << 8) | data[i * 2 + 1]);
+    }
+    iud->acc_trim_valid = true;
+  }
+
+  // Offsets are in +-16G format (2048 LSB/g) and bit0 is reserved, so step
+  // in units of 2 LSB and leave bit0 alone.
+  for (int i = 0; i < 3; i++) {
+    val = iud->acc_trim[i] + 2 * (int32_t)roundf(o[i] * 1024.f);
+    if (val < INT16_MIN || val > INT16_MAX) {
+      return false;
+    }
+    data[i * 2]     = (uint8_t)((val >> 8) & 0xFF);
+    data[i * 2 + 1] = (uint8_t)((val & 0xFE) | (iud->acc_trim[i] & 0x01));
+  }
+  return mgos_i2c_write_reg_n(dev->i2c, dev->i2caddr,
+                              MGOS_MPU60X0_REG_XA_OFFS_USRH, 6, data);
+}
+
+bool mgos_imu_mpu60x0_gyro_set_hw_offset(struct mgos_imu_gyro *dev,
+                                         void *imu_user_data,
+                                         float x, float y, float z) {
+  float   o[3] = { x, y, z };
+  uint8_t data[6];
+  int32_t val;
+
+  if (!dev) {
+    return false;
+  }
+
+  // Offsets are in +-1000DPS format (32.8 LSB/dps), and are added to the output.
+  for (int i = 0; i < 3; i++) {
+    val = (int32_t)roundf(o[i] * 32.8f);
+    if (val < INT16_MIN || val > INT16_MAX) {
+      return false;
+    }
+    data[i * 2]     = (uint8_t)((val >> 8) & 0xFF);
+    data[i * 2 + 1] = (uint8_t)(val & 0xFF);
+  }
+  return mgos_i2c_write_reg_n(dev->i2c, dev->i2caddr,
+                              MGOS_MPU60X0_REG_XG_OFFS_USRH, 6, data);
 
   (void)imu_user_data;
 }
@@ -18,15 +18,28 @@
 
 #include "mgos.h"
 #include "mgos_imu_internal.h"
+#include "mgos_imu_regcache.h"
 
 // MPU6000 allows for both I2C and SPI, while MPU6050 has only I2C.
 #define MGOS_MPU60X0_DEFAULT_I2CADDR         (0x68)
 #define MGOS_MPU60X0_DEVID                   (0x68)
 
+#define MGOS_MPU60X0_REG_XA_OFFS_USRH        (0x06)
+#define MGOS_MPU60X0_REG_XA_OFFS_USRL        (0x07)
+#define MGOS_MPU60X0_REG_YA_OFFS_USRH        (0x08)
+#define MGOS_MPU60X0_REG_YA_OFFS_USRL        (0x09)
+#define MGOS_MPU60X0_REG_ZA_OFFS_USRH        (0x0A)
+#define MGOS_MPU60X0_REG_ZA_OFFS_USRL        (0x0B)
 #define MGOS_MPU60X0_REG_SELF_TEST_X         (0x0D)
 #define MGOS_MPU60X0_REG_SELF_TEST_Y         (0x0E)
 #define MGOS_MPU60X0_REG_SELF_TEST_Z         (0x0F)
 #define MGOS_MPU60X0_REG_SELF_TEST_A         (0x10)
+#define MGOS_MPU60X0_REG_XG_OFFS_USRH        (0x13)
+#define MGOS_MPU60X0_REG_XG_OFFS_USRL        (0x14)
+#define MGOS_MPU60X0_REG_YG_OFFS_USRH        (0x15)
+#define MGOS_MPU60X0_REG_YG_OFFS_USRL        (0x16)
+#define MGOS_MPU60X0_REG_ZG_OFFS_USRH        (0x17)
+#define MGOS_MPU60X0_REG_ZG_OFFS_USRL        (0x18)
 #define MGOS_MPU60X0_REG_SMPLRT_DIV          (0x19)
 #define MGOS_MPU60X0_REG_CONFIG              (0x1A)
 #define MGOS_MPU60X0_REG_GYRO_CONFIG         (0x1B)
@@ -79,25 +92,35 @@
 #define MGOS_MPU60X0_REG_WHO_AM_I            (0x75)
 
 struct mgos_imu_mpu60x0_userdata {
-  bool initialized;
+  bool                     initialized;
+  bool                     acc_trim_valid;
+  int16_t                  acc_trim[3];
+  struct mgos_imu_regcache regs;      // Configuration register shadow
 };
 
 struct mgos_imu_mpu60x0_userdata *mgos_imu_mpu60x0_userdata_create(void);
 
 bool mgos_imu_mpu60x0_acc_detect(struct mgos_imu_acc *dev, void *imu_user_data);
-bool mgos_imu_mpu60x0_acc_create(struct mgos_imu_acc *dev, void *imu_user_data);
+int32_t mgos_imu_mpu60x0_acc_create_step(struct mgos_imu_acc *dev,
+                                         void *imu_user_data, uint8_t step);
 bool mgos_imu_mpu60x0_acc_read(struct mgos_imu_acc *dev, void *imu_user_data);
 bool mgos_imu_mpu60x0_acc_get_scale(struct mgos_imu_acc *dev,
                                     void *imu_user_data, float *scale);
 bool mgos_imu_mpu60x0_acc_set_scale(struct mgos_imu_acc *dev,
                                     void *imu_user_data, float scale);
+bool mgos_imu_mpu60x0_acc_set_hw_offset(struct mgos_imu_acc *dev,
+                                        void *imu_user_data,
+                                        float x, float y, float z);
 
 bool mgos_imu_mpu60x0_gyro_detect(struct mgos_imu_gyro *dev,
                                   void *imu_user_data);
-bool mgos_imu_mpu60x0_gyro_create(struct mgos_imu_gyro *dev,
-                                  void *imu_user_data);
+int32_t mgos_imu_mpu60x0_gyro_create_step(struct mgos_imu_gyro *dev,
+                                          void *imu_user_data, uint8_t step);
 bool mgos_imu_mpu60x0_gyro_read(struct mgos_imu_gyro *dev, void *imu_user_data);
 bool mgos_imu_mpu60x0_gyro_get_scale(struct mgos_imu_gyro *dev,
                                      void *imu_user_data, float *scale);
 bool mgos_imu_mpu60x0_gyro_set_scale(struct mgos_imu_gyro *dev,
                                      void *imu_user_data, float scale);
+bool mgos_imu_mpu60x0_gyro_set_hw_offset(struct mgos_imu_gyro *dev,
+                                         void *imu_user_data,
+                                         float x, float y, float z);
@@ -17,6 +17,21 @@
 #include "mgos.h"
 #include "mgos_i2c.h"
 #include "mgos_imu_mpu925x.h"
+#include <math.h>
+
+// Configuration registers: SMPLRT_DIV..ACCEL_CONFIG2, INT_PIN_CFG..INT_ENABLE
+// and PWR_MGMT_1..PWR_MGMT_2.
+static const struct mgos_imu_regcache_range s_mpu925x_cached[] = {
+  { MGOS_MPU9250_REG_SMPLRT_DIV,  MGOS_MPU9250_REG_ACCEL_CONFIG2 },
+  { MGOS_MPU9250_REG_INT_PIN_CFG, MGOS_MPU9250_REG_INT_ENABLE    },
+  { MGOS_MPU9250_REG_PWR_MGMT_1,  MGOS_MPU9250_REG_PWR_MGMT_2    },
+};
+
+// Low pass cutoff in Hz, by ACCEL_CONFIG2 A_DLPFCFG and CONFIG DLPF_CFG, with
+// the FCHOICE bits left at 1 (filter on). Gyro values 0 and 7 run the chip at
+// 8kHz, which SMPLRT_DIV does not apply to, so they are not set by the driver.
+static const float s_mpu925x_acc_bandwidth[8]  = { 218.1f, 218.1f, 99.f, 44.8f, 21.2f, 10.2f, 5.05f, 420.f };
+static const float s_mpu925x_gyro_bandwidth[8] = { 250.f, 184.f, 92.f, 41.f, 20.f, 10.f, 5.f, 3600.f };
 
 static bool mgos_imu_mpu925x_detect(struct mgos_i2c *i2c, uint8_t i2caddr, uint8_t *devid) {
   int device_id;
@@ -40,22 +55,34 @@ static bool mgos_imu_mpu925x_detect(struct mgos_i2c *i2c, uint8_t i2caddr, uint8
   return false;
 }
 
-static bool mgos_imu_mpu925x_create(struct mgos_i2c *i2c, uint8_t i2caddr) {
+// Chip create steps, see mgos_imu_acc_create_step_fn.
+static int32_t mgos_imu_mpu925x_create_step(struct mgos_i2c *i2c, uint8_t i2caddr, bool no_rst, struct mgos_imu_mpu925x_userdata *iud, uint8_t step) {
   if (!i2c) {
-    return false;
+    return -1;
   }
 
-  // Reset
-  mgos_i2c_write_reg_b(i2c, i2caddr, MGOS_MPU9250_REG_PWR_MGMT_1, 0x80);
-  mgos_usleep(80000);
+  switch (step) {
+  case 0:
+    // Reset
+    if (!no_rst) {
+      mgos_i2c_write_reg_b(i2c, i2caddr, MGOS_MPU9250_REG_PWR_MGMT_1, 0x80);
+      return 80000;
+    }
+  // fallthrough
 
-  // Enable IMU sensors
-  mgos_i2c_write_reg_b(i2c, i2caddr, MGOS_MPU9250_REG_PWR_MGMT_2, 0x00);
+  case 1:
+    // Enable IMU sensors
+    mgos_i2c_write_reg_b(i2c, i2caddr, MGOS_MPU9250_REG_PWR_MGMT_2, 0x00);
 
-  // I2C Passthrough enable (exposes magnetometer to I2C bus)
-  mgos_i2c_write_reg_b(i2c, i2caddr, MGOS_MPU9250_REG_INT_PIN_CFG, 0x02);
+    // I2C Passthrough enable (exposes magnetometer to I2C bus)
+    mgos_i2c_write_reg_b(i2c, i2caddr, MGOS_MPU9250_REG_INT_PIN_CFG, 0x02);
 
-  return true;
+    if (!mgos_imu_regcache_init(&iud->regs, i2c, i2caddr, s_mpu925x_cached, sizeof(s_mpu925x_cached) / sizeof(s_mpu925x_cached[0]))) {
+      return -1;
+    }
+    return 0;
+  }
+  return -1;
 }
 
 bool mgos_imu_mpu925x_acc_detect(struct mgos_imu_acc *dev, void *imu_user_data) {
@@ -74,24 +101,26 @@ bool mgos_imu_mpu925x_acc_detect(struct mgos_imu_acc *dev, void *imu_user_data)
   (void)imu_user_data;
 }
 
-bool mgos_imu_mpu925x_acc_create(struct mgos_imu_acc *dev, void *imu_user_data) {
+int32_t mgos_imu_mpu925x_acc_create_step(struct mgos_imu_acc *dev, void *imu_user_data, uint8_t step) {
   struct mgos_imu_mpu925x_userdata *iud = (struct mgos_imu_mpu925x_userdata *)imu_user_data;
+  int32_t ret;
 
   if (!dev) {
-    return false;
+    return -1;
   }
 
   // Only initialize the MPU9250 if gyro hasn't done so yet
   if (!iud->initialized) {
-    if (!mgos_imu_mpu925x_create(dev->i2c, dev->i2caddr)) {
-      return false;
+    ret = mgos_imu_mpu925x_create_step(dev->i2c, dev->i2caddr, dev->opts.no_rst, iud, step);
+    if (ret != 0) {
+      return ret;
     }
     iud->initialized = true;
   }
-  if (!mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_MPU9250_REG_ACCEL_CONFIG2, MGOS_MPU9250_DLPF_41)) {
-    return false;
+  if (!mgos_imu_regcache_write_reg_b(&iud->regs, MGOS_MPU9250_REG_ACCEL_CONFIG2, MGOS_MPU9250_DLPF_41)) {
+    return -1;
   }
-  return true;
+  return 0;
 }
 
 bool mgos_imu_mpu925x_acc_read(struct mgos_imu_acc *dev, void *imu_user_data) {
@@ -103,6 +132,7 @@ bool mgos_imu_mpu925x_acc_read(struct mgos_imu_acc *dev, void *imu_user_data) {
   if (!mgos_i2c_read_reg_n(dev->i2c, dev->i2caddr, MGOS_MPU9250_REG_ACCEL_XOUT_H, 6, data)) {
     return false;
   }
+  mgos_imu_stats_i2c(dev->stats, 6);
   dev->ax = (data[0] << 8) | (data[1]);
   dev->ay = (data[2] << 8) | (data[3]);
   dev->az = (data[4] << 8) | (data[5]);
@@ -127,24 +157,26 @@ bool mgos_imu_mpu925x_gyro_detect(struct mgos_imu_gyro *dev, void *imu_user_data
   (void)imu_user_data;
 }
 
-bool mgos_imu_mpu925x_gyro_create(struct mgos_imu_gyro *dev, void *imu_user_data) {
+int32_t mgos_imu_mpu925x_gyro_create_step(struct mgos_imu_gyro *dev, void *imu_user_data, uint8_t step) {
   struct mgos_imu_mpu925x_userdata *iud = (struct mgos_imu_mpu925x_userdata *)imu_user_data;
+  int32_t ret;
 
   if (!dev) {
-    return false;
+    return -1;
   }
 
   // Only initialize the MPU9250 if acc hasn't done so yet
   if (!iud->initialized) {
-    if (!mgos_imu_mpu925x_create(dev->i2c, dev->i2caddr)) {
-      return false;
+    ret = mgos_imu_mpu925x_create_step(dev->i2c, dev->i2caddr, dev->opts.no_rst, iud, step);
+    if (ret != 0) {
+      return ret;
     }
     iud->initialized = true;
   }
-  if (!mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_MPU9250_REG_CONFIG, MGOS_MPU9250_DLPF_41)) {
-    return false;
+  if (!mgos_imu_regcache_write_reg_b(&iud->regs, MGOS_MPU9250_REG_CONFIG, MGOS_MPU9250_DLPF_41)) {
+    return -1;
   }
-  return true;
+  return 0;
 }
 
 bool mgos_imu_mpu925x_gyro_read(struct mgos_imu_gyro *dev, void *imu_user_data) {
@@ -156,6 +188,7 @@ bool mgos_imu_mpu925x_gyro_read(struct mgos_imu_gyro *dev, void *imu_user_data)
   if (!mgos_i2c_read_reg_n(dev->i2c, dev->i2caddr, MGOS_MPU9250_REG_GYRO_XOUT_H, 6, data)) {
     return false;
   }
+  mgos_imu_stats_i2c(dev->stats, 6);
   dev->gx = (data[0] << 8) | (data[1]);
   dev->gy = (data[2] << 8) | (data[3]);
   dev->gz = (data[4] << 8) | (data[5]);
@@ -177,9 +210,10 @@ struct mgos_imu_mpu925x_userdata *mgos_imu_mpu925x_userdata_create(void) {
 }
 
 bool mgos_imu_mpu925x_acc_get_scale(struct mgos_imu_acc *dev, void *imu_user_data, float *scale) {
+  struct mgos_imu_mpu925x_userdata *iud = (struct mgos_imu_mpu925x_userdata *)imu_user_data;
   uint8_t sel;
 
-  if (!mgos_i2c_getbits_reg_b(dev->i2c, dev->i2caddr, MGOS_MPU9250_REG_ACCEL_CONFIG, 3, 2, &sel)) {
+  if (!mgos_imu_regcache_getbits_reg_b(&iud->regs, MGOS_MPU9250_REG_ACCEL_CONFIG, 3, 2, &sel)) {
     return false;
   }
   switch (sel) {
@@ -194,10 +228,11 @@ bool mgos_imu_mpu925x_acc_get_scale(struct mgos_imu_acc *dev, void *imu_user_dat
 
   return true;
 
-  (void)imu_user_data;
+  (void)dev;
 }
 
 bool mgos_imu_mpu925x_acc_set_scale(struct mgos_imu_acc *dev, void *imu_user_data, float scale) {
+  struct mgos_imu_mpu925x_userdata *iud = (struct mgos_imu_mpu925x_userdata *)imu_user_data;
   uint8_t sel;
 
   if (scale > 16) {
@@ -215,17 +250,17 @@ bool mgos_imu_mpu925x_acc_set_scale(struct mgos_imu_acc *dev, void *imu_user_dat
     sel = 0;  // 2G
     scale = 2.f;
   }
-  if (!mgos_i2c_setbits_reg_b(dev->i2c, dev->i2caddr, MGOS_MPU9250_REG_ACCEL_CONFIG, 3, 2, sel)) return false;
+  if (!mgos_imu_regcache_setbits_reg_b(&iud->regs, MGOS_MPU9250_REG_ACCEL_CONFIG, 3, 2, sel)) return false;
   dev->opts.scale = scale;
   dev->scale = scale / 32768.0f;
   return true;
-  (void)imu_user_data;
 }
 
 bool mgos_imu_mpu925x_gyro_get_scale(struct mgos_imu_gyro *dev, void *imu_user_data, float *scale) {
+  struct mgos_imu_mpu925x_userdata *iud = (struct mgos_imu_mpu925x_userdata *)imu_user_data;
   uint8_t sel;
 
-  if (!mgos_i2c_getbits_reg_b(dev->i2c, dev->i2caddr, MGOS_MPU9250_REG_GYRO_CONFIG, 3, 2, &sel)) {
+  if (!mgos_imu_regcache_getbits_reg_b(&iud->regs, MGOS_MPU9250_REG_GYRO_CONFIG, 3, 2, &sel)) {
     return false;
   }
   switch (sel) {
@@ -240,10 +275,11 @@ bool mgos_imu_mpu925x_gyro_get_scale(struct mgos_imu_gyro *dev, void *imu_user_d
 
   return true;
 
-  (void)imu_user_data;
+  (void)dev;
 }
 
 bool mgos_imu_mpu925x_gyro_set_scale(struct mgos_imu_gyro *dev, void *imu_user_data, float scale) {
+  struct mgos_imu_mpu925x_userdata *iud = (struct mgos_imu_mpu925x_userdata *)imu_user_data;
   uint8_t sel;
 
   if (scale > 2000) {
@@ -261,10 +297,212 @@ bool mgos_imu_mpu925x_gyro_set_scale(struct mgos_imu_gyro *dev, void *imu_user_d
     sel = 0;  // 250DPS
     scale = 250.f;
   }
-  if (!mgos_i2c_setbits_reg_b(dev->i2c, dev->i2caddr, MGOS_MPU9250_REG_GYRO_CONFIG, 3, 2, sel)) return false;
+  if (!mgos_imu_regcache_setbits_reg_b(&iud->regs, MGOS_MPU9250_REG_GYRO_CONFIG, 3, 2, sel)) return false;
   dev->opts.scale = scale;
   dev->scale = scale / 32768.0f;
   return true;
+}
+
+bool mgos_imu_mpu925x_acc_set_hw_offset(struct mgos_imu_acc *dev, void *imu_user_data, float x, float y, float z) {
+  struct mgos_imu_mpu925x_userdata *iud = (struct mgos_imu_mpu925x_userdata *)imu_user_data;
+  const uint8_t                     reg[3] = { MGOS_MPU9250_REG_XA_OFFSET_H, MGOS_MPU9250_REG_YA_OFFSET_H, MGOS_MPU9250_REG_ZA_OFFSET_H };
+  float                             o[3] = { x, y, z };
+  uint8_t                           data[2];
+  int32_t                           val[3];
+
+  if (!dev || !iud) {
+    return false;
+  }
+
+  // The accel offset registers hold a factory trim, which we keep and add to.
+  if (!iud->acc_trim_valid) {
+    for (int i = 0; i < 3; i++) {
+      if (!mgos_i2c_read_reg_n(dev->i2c, dev->i2caddr, reg[i], 2, data)) {
+        return false;
+      }
+      iud->acc_trim[i] = (int16_t)((data[0] << 8) | data[1]);
+    }
+    iud->acc_trim_valid = true;
+  }
+
+  // Offsets are in +-16G format (2048 LSB/g) and bit0 is reserved, so step
+  // in units of 2 LSB and leave bit0 alone.
+  for (int i = 0; i < 3; i++) {
+    val[i] = iud->acc_trim[i] + 2 * (int32_t)roundf(o[i] * 1024.f);
+    if (val[i] < INT16_MIN || val[i] > INT16_MAX) {
+      return false;
+    }
+  }
+  for (int i = 0; i < 3; i++) {
+    data[0] = (uint8_t)((val[i] >> 8) & 0xFF);
+    data[1] = (uint8_t)((val[i] & 0xFE) | (iud->acc_trim[i] & 0x01));
+    if (!mgos_i2c_write_reg_n(dev->i2c, dev->i2caddr, reg[i], 2, data)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool mgos_imu_mpu925x_acc_get_bandwidth(struct mgos_imu_acc *dev, void *imu_user_data, float *hertz) {
+  struct mgos_imu_mpu925x_userdata *iud = (struct mgos_imu_mpu925x_userdata *)imu_user_data;
+  int config2;
+
+  if (!iud) {
+    return false;
+  }
+  // While waiting for motion, ACCEL_CONFIG2 holds the wake on motion setup.
+  config2 = iud->wake_enabled ? iud->wake_accel_config2 : mgos_imu_regcache_read_reg_b(&iud->regs, MGOS_MPU9250_REG_ACCEL_CONFIG2);
+  if (config2 < 0) {
+    return false;
+  }
+  // ACCEL_FCHOICE_B=1 bypasses the filter.
+  *hertz = (config2 & 0x08) ? 1046.f : s_mpu925x_acc_bandwidth[config2 & 0x07];
+  return true;
+
+  (void)dev;
+}
+
+bool mgos_imu_mpu925x_acc_set_bandwidth(struct mgos_imu_acc *dev, void *imu_user_data, float hertz) {
+  struct mgos_imu_mpu925x_userdata *iud = (struct mgos_imu_mpu925x_userdata *)imu_user_data;
+  uint8_t dlpf;
+
+  if (!iud) {
+    return false;
+  }
+  // Value 0 has the same cutoff as 1.
+  dlpf = mgos_imu_bandwidth_pick(&s_mpu925x_acc_bandwidth[1], 7, hertz) + 1;
+  if (iud->wake_enabled) {
+    iud->wake_accel_config2 = dlpf;
+    return true;
+  }
+  return mgos_imu_regcache_write_reg_b(&iud->regs, MGOS_MPU9250_REG_ACCEL_CONFIG2, dlpf);
+
+  (void)dev;
+}
+
+bool mgos_imu_mpu925x_gyro_get_bandwidth(struct mgos_imu_gyro *dev, void *imu_user_data, float *hertz) {
+  struct mgos_imu_mpu925x_userdata *iud = (struct mgos_imu_mpu925x_userdata *)imu_user_data;
+  uint8_t dlpf;
+
+  if (!iud || !mgos_imu_regcache_getbits_reg_b(&iud->regs, MGOS_MPU9250_REG_CONFIG, 0, 3, &dlpf)) {
+    return false;
+  }
+  *hertz = s_mpu925x_gyro_bandwidth[dlpf];
+  return true;
+
+  (void)dev;
+}
+
+bool mgos_imu_mpu925x_gyro_set_bandwidth(struct mgos_imu_gyro *dev, void *imu_user_data, float hertz) {
+  struct mgos_imu_mpu925x_userdata *iud = (struct mgos_imu_mpu925x_userdata *)imu_user_data;
+  uint8_t dlpf;
+
+  if (!iud) {
+    return false;
+  }
+  dlpf = mgos_imu_bandwidth_pick(&s_mpu925x_gyro_bandwidth[1], 6, hertz) + 1;
+  return mgos_imu_regcache_setbits_reg_b(&iud->regs, MGOS_MPU9250_REG_CONFIG, 0, 3, dlpf);
+
+  (void)dev;
+}
+
+// Wake on motion, following the sequence from the MPU9250 datasheet: gyro in
+// standby, accelerometer cycling at LP_ACCEL_ODR and the WOM interrupt on INT.
+// The chip compares every sample to the one it took when cycling started, and
+// has no duration counter, so `duration_ms` is not used.
+bool mgos_imu_mpu925x_acc_set_wakeup(struct mgos_imu_acc *dev, void *imu_user_data, float threshold, uint32_t duration_ms) {
+  struct mgos_imu_mpu925x_userdata *iud = (struct mgos_imu_mpu925x_userdata *)imu_user_data;
+  int pwr1, pwr2, config2, int_enable;
+  int thr;
+
+  if (!dev || !iud) {
+    return false;
+  }
+
+  if (threshold <= 0) {
+    if (!iud->wake_enabled) {
+      return true;
+    }
+    iud->wake_enabled = false;
+    return mgos_imu_regcache_write_reg_b(&iud->regs, MGOS_MPU9250_REG_PWR_MGMT_1, iud->wake_pwr_mgmt_1) &&
+           mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_MPU9250_REG_MOT_DETECT_CTRL, 0x00) &&
+           mgos_imu_regcache_write_reg_b(&iud->regs, MGOS_MPU9250_REG_INT_ENABLE, iud->wake_int_enable) &&
+           mgos_imu_regcache_write_reg_b(&iud->regs, MGOS_MPU9250_REG_ACCEL_CONFIG2, iud->wake_accel_config2) &&
+           mgos_imu_regcache_write_reg_b(&iud->regs, MGOS_MPU9250_REG_PWR_MGMT_2, iud->wake_pwr_mgmt_2);
+  }
+
+  if (!iud->wake_enabled) {
+    pwr1       = mgos_imu_regcache_read_reg_b(&iud->regs, MGOS_MPU9250_REG_PWR_MGMT_1);
+    pwr2       = mgos_imu_regcache_read_reg_b(&iud->regs, MGOS_MPU9250_REG_PWR_MGMT_2);
+    config2    = mgos_imu_regcache_read_reg_b(&iud->regs, MGOS_MPU9250_REG_ACCEL_CONFIG2);
+    int_enable = mgos_imu_regcache_read_reg_b(&iud->regs, MGOS_MPU9250_REG_INT_ENABLE);
+    if (pwr1 < 0 || pwr2 < 0 || config2 < 0 || int_enable < 0) {
+      return false;
+    }
+    iud->wake_pwr_mgmt_1    = (uint8_t)pwr1;
+    iud->wake_pwr_mgmt_2    = (uint8_t)pwr2;
+    iud->wake_accel_config2 = (uint8_t)config2;
+    iud->wake_int_enable    = (uint8_t)int_enable;
+  }
+
+  // WOM_THR is in units of 4mg.
+  thr = (int)roundf(threshold * 250.f);
+  if (thr < 1) {
+    thr = 1;
+  } else if (thr > 255) {
+    thr = 255;
+  }
+  if (!mgos_imu_regcache_write_reg_b(&iud->regs, MGOS_MPU9250_REG_PWR_MGMT_1, iud->wake_pwr_mgmt_1 & ~0x70) ||
+      !mgos_imu_regcache_write_reg_b(&iud->regs, MGOS_MPU9250_REG_PWR_MGMT_2, 0x07) ||
+      !mgos_imu_regcache_write_reg_b(&iud->regs, MGOS_MPU9250_REG_ACCEL_CONFIG2, 0x08 | MGOS_MPU9250_DLPF_184) ||
+      !mgos_imu_regcache_write_reg_b(&iud->regs, MGOS_MPU9250_REG_INT_ENABLE, MGOS_MPU9250_INT_WOM) ||
+      !mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_MPU9250_REG_MOT_DETECT_CTRL, 0xC0) ||
+      !mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_MPU9250_REG_WOM_THR, (uint8_t)thr) ||
+      !mgos_i2c_write_reg_b(dev->i2c, dev->i2caddr, MGOS_MPU9250_REG_LP_ACCEL_ODR, MGOS_MPU9250_LP_ACCEL_ODR_31HZ)) {
+    return false;
+  }
+  iud->wake_enabled = true;
+  return mgos_imu_regcache_setbits_reg_b(&iud->regs, MGOS_MPU9250_REG_PWR_MGMT_1, 5, 1, 1);
+
+  (void)duration_ms;
+}
+
+bool mgos_imu_mpu925x_acc_get_wakeup(struct mgos_imu_acc *dev, void *imu_user_data, bool *woken) {
+  int status;
+
+  if (!dev || !woken) {
+    return false;
+  }
+  // Reading INT_STATUS clears it.
+  status = mgos_i2c_read_reg_b(dev->i2c, dev->i2caddr, MGOS_MPU9250_REG_INT_STATUS);
+  if (status < 0) {
+    return false;
+  }
+  *woken = (status & MGOS_MPU9250_INT_WOM);
+  return true;
+
+  (void)imu_user_data;
+}
+
+bool mgos_imu_mpu925x_gyro_set_hw_offset(struct mgos_imu_gyro *dev, void *imu_user_data, float x, float y, float z) {
+  float   o[3] = { x, y, z };
+  uint8_t data[6];
+  int32_t val;
+
+  if (!dev) {
+    return false;
+  }
+
+  // Offsets are in +-1000DPS format (32.8 LSB/dps), and are added to the output.
+  for (int i = 0; i < 3; i++) {
+    val = (int32_t)roundf(o[i] * 32.8f);
+    if (val < INT16_MIN || val > INT16_MAX) {
+      return false;
+    }
+    data[i * 2]     = (uint8_t)((val >> 8) & 0xFF);
+    data[i * 2 + 1] = (uint8_t)(val & 0xFF);
+  }
+  return mgos_i2c_write_reg_n(dev->i2c, dev->i2caddr, MGOS_MPU9250_REG_XG_OFFSET_H, 6, data);
 
   (void)imu_user_data;
 }
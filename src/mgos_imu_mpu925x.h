@@ -18,6 +18,7 @@
 
 #include "mgos.h"
 #include "mgos_imu_internal.h"
+#include "mgos_imu_regcache.h"
 
 #define MGOS_MPU9250_DEFAULT_I2CADDR        (0x68)
 
@@ -25,20 +26,27 @@
 #define MGOS_MPU9250_DEVID_9255             (0x73)
 
 // MPU9250 -- Accelerometer and Gyro registers
+#define MGOS_MPU9250_REG_XG_OFFSET_H        (0x13)
 #define MGOS_MPU9250_REG_SMPLRT_DIV         (0x19)
 #define MGOS_MPU9250_REG_CONFIG             (0x1A)
 #define MGOS_MPU9250_REG_GYRO_CONFIG        (0x1B)
 #define MGOS_MPU9250_REG_ACCEL_CONFIG       (0x1C)
 #define MGOS_MPU9250_REG_ACCEL_CONFIG2      (0x1D)
+#define MGOS_MPU9250_REG_LP_ACCEL_ODR       (0x1E)
+#define MGOS_MPU9250_REG_WOM_THR            (0x1F)
 #define MGOS_MPU9250_REG_INT_PIN_CFG        (0x37)
 #define MGOS_MPU9250_REG_INT_ENABLE         (0x38)
 #define MGOS_MPU9250_REG_INT_STATUS         (0x3A)
 #define MGOS_MPU9250_REG_ACCEL_XOUT_H       (0x3B)
 #define MGOS_MPU9250_REG_TEMP_OUT_H         (0x41)
 #define MGOS_MPU9250_REG_GYRO_XOUT_H        (0x43)
+#define MGOS_MPU9250_REG_MOT_DETECT_CTRL    (0x69)
 #define MGOS_MPU9250_REG_PWR_MGMT_1         (0x6B)
 #define MGOS_MPU9250_REG_PWR_MGMT_2         (0x6C)
 #define MGOS_MPU9250_REG_WHO_AM_I           (0x75)
+#define MGOS_MPU9250_REG_XA_OFFSET_H        (0x77)
+#define MGOS_MPU9250_REG_YA_OFFSET_H        (0x7A)
+#define MGOS_MPU9250_REG_ZA_OFFSET_H        (0x7D)
 
 #define MGOS_MPU9250_ACCEL_FS_SEL_2G        (0x00)
 #define MGOS_MPU9250_ACCEL_FS_SEL_4G        (0x08)
@@ -56,20 +64,42 @@
 #define MGOS_MPU9250_DLPF_10                (0x05)
 #define MGOS_MPU9250_DLPF_5                 (0x06)
 
+#define MGOS_MPU9250_INT_WOM                (0x40)
+// Low power accelerometer rate while waiting for motion, 31.25Hz.
+#define MGOS_MPU9250_LP_ACCEL_ODR_31HZ      (0x07)
+
 struct mgos_imu_mpu925x_userdata {
-  bool initialized;
+  bool                     initialized;
+  bool                     acc_trim_valid;
+  int16_t                  acc_trim[3];
+  struct mgos_imu_regcache regs;      // Configuration register shadow
+
+  // Wake on motion, with the registers it changes as they were before.
+  bool                     wake_enabled;
+  uint8_t                  wake_pwr_mgmt_1;
+  uint8_t                  wake_pwr_mgmt_2;
+  uint8_t                  wake_accel_config2;
+  uint8_t                  wake_int_enable;
 };
 
 struct mgos_imu_mpu925x_userdata *mgos_imu_mpu925x_userdata_create(void);
 
 bool mgos_imu_mpu925x_acc_detect(struct mgos_imu_acc *dev, void *imu_user_data);
-bool mgos_imu_mpu925x_acc_create(struct mgos_imu_acc *dev, void *imu_user_data);
+int32_t mgos_imu_mpu925x_acc_create_step(struct mgos_imu_acc *dev, void *imu_user_data, uint8_t step);
 bool mgos_imu_mpu925x_acc_read(struct mgos_imu_acc *dev, void *imu_user_data);
 bool mgos_imu_mpu925x_acc_get_scale(struct mgos_imu_acc *dev, void *imu_user_data, float *scale);
 bool mgos_imu_mpu925x_acc_set_scale(struct mgos_imu_acc *dev, void *imu_user_data, float scale);
+bool mgos_imu_mpu925x_acc_set_hw_offset(struct mgos_imu_acc *dev, void *imu_user_data, float x, float y, float z);
+bool mgos_imu_mpu925x_acc_get_bandwidth(struct mgos_imu_acc *dev, void *imu_user_data, float *hertz);
+bool mgos_imu_mpu925x_acc_set_bandwidth(struct mgos_imu_acc *dev, void *imu_user_data, float hertz);
+bool mgos_imu_mpu925x_acc_set_wakeup(struct mgos_imu_acc *dev, void *imu_user_data, float threshold, uint32_t duration_ms);
+bool mgos_imu_mpu925x_acc_get_wakeup(struct mgos_imu_acc *dev, void *imu_user_data, bool *woken);
 
 bool mgos_imu_mpu925x_gyro_detect(struct mgos_imu_gyro *dev, void *imu_user_data);
-bool mgos_imu_mpu925x_gyro_create(struct mgos_imu_gyro *dev, void *imu_user_data);
+int32_t mgos_imu_mpu925x_gyro_create_step(struct mgos_imu_gyro *dev, void *imu_user_data, uint8_t step);
 bool mgos_imu_mpu925x_gyro_read(struct mgos_imu_gyro *dev, void *imu_user_data);
 bool mgos_imu_mpu925x_gyro_get_scale(struct mgos_imu_gyro *dev, void *imu_user_data, float *scale);
 bool mgos_imu_mpu925x_gyro_set_scale(struct mgos_imu_gyro *dev, void *imu_user_data, float scale);
+bool mgos_imu_mpu925x_gyro_set_hw_offset(struct mgos_imu_gyro *dev, void *imu_user_data, float x, float y, float z);
+bool mgos_imu_mpu925x_gyro_get_bandwidth(struct mgos_imu_gyro *dev, void *imu_user_data, float *hertz);
+bool mgos_imu_mpu925x_gyro_set_bandwidth(struct mgos_imu_gyro *dev, void *imu_user_data, float hertz);
@@ -0,0 +1,227 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mgos.h"
+#include "mgos_imu_internal.h"
+#include "madgwick.h"
+#include <math.h>
+
+#define MGOS_IMU_ODR_DEFAULT_WINDOW    (16)
+
+struct mgos_imu_odr_ctrl {
+  struct mgos_imu_odr_ctrl_opts opts;
+  struct mgos_imu_madgwick *    filter;
+  mgos_imu_odr_cb               cb;
+  void *                        cb_arg;
+
+  uint8_t                       tier;
+  float                         alpha;
+  float                         gyro_mag;
+  bool                          have_acc;
+  float                         acc_mean;   // Moving averages of the accelerometer magnitude,
+  float                         acc_var;    // and of its squared deviation
+  int64_t                       low_since;  // When activity dropped under the step down level, 0 if it is not
+};
+
+// Private functions follow
+static bool mgos_imu_odr_ctrl_above(struct mgos_imu_odr_ctrl *c, const struct mgos_imu_odr_tier *t, float ratio) {
+  if (t->gyro_thr > 0 && c->gyro_mag > t->gyro_thr * ratio) {
+    return true;
+  }
+  if (t->acc_thr > 0 && sqrtf(c->acc_var) > t->acc_thr * ratio) {
+    return true;
+  }
+  return false;
+}
+
+static bool mgos_imu_odr_ctrl_apply(struct mgos_imu *imu) {
+  struct mgos_imu_odr_ctrl *      c = imu->odr_ctrl;
+  const struct mgos_imu_odr_tier *t = &c->opts.tiers[c->tier];
+  float odr;
+  bool  ret = true;
+
+  // Filters step at the rate the chip really runs at.
+  if (t->acc_odr > 0 && imu->acc && !imu->acc->pending && imu->acc->set_odr) {
+    ret = imu->acc->set_odr(imu->acc, imu->user_data, t->acc_odr) && ret;
+    odr = t->acc_odr;
+    if (imu->acc->get_odr) {
+      imu->acc->get_odr(imu->acc, imu->user_data, &odr);
+    }
+    if (imu->acc->filter && odr > 0) {
+      mgos_imu_filter_set_odr(imu->acc->filter, odr);
+    }
+  }
+  if (t->mag_odr > 0 && imu->mag && !imu->mag->pending && imu->mag->set_odr) {
+    ret = imu->mag->set_odr(imu->mag, imu->user_data, t->mag_odr) && ret;
+    odr = t->mag_odr;
+    if (imu->mag->get_odr) {
+      imu->mag->get_odr(imu->mag, imu->user_data, &odr);
+    }
+    if (imu->mag->filter && odr > 0) {
+      mgos_imu_filter_set_odr(imu->mag->filter, odr);
+    }
+  }
+  if (t->gyro_odr > 0 && imu->gyro && !imu->gyro->pending && imu->gyro->set_odr) {
+    ret = imu->gyro->set_odr(imu->gyro, imu->user_data, t->gyro_odr) && ret;
+    odr = t->gyro_odr;
+    if (imu->gyro->get_odr) {
+      imu->gyro->get_odr(imu->gyro, imu->user_data, &odr);
+    }
+    if (imu->gyro->filter && odr > 0) {
+      mgos_imu_filter_set_odr(imu->gyro->filter, odr);
+    }
+    if (c->filter && odr > 0) {
+      mgos_imu_madgwick_set_params(c->filter, odr, c->filter->beta);
+    }
+  }
+  if (!ret) {
+    LOG(LL_ERROR, ("Could not set all data rates of tier %u", c->tier));
+  }
+  return ret;
+}
+
+static void mgos_imu_odr_ctrl_step(struct mgos_imu *imu) {
+  struct mgos_imu_odr_ctrl *c = imu->odr_ctrl;
+  uint8_t tier = c->tier;
+  int64_t now;
+
+  // The rates of sleeping sensors belong to motion wakeup.
+  if (!mgos_imu_motion_is_awake(imu)) {
+    return;
+  }
+  while (tier + 1 < c->opts.num_tiers && mgos_imu_odr_ctrl_above(c, &c->opts.tiers[tier], 1.f)) {
+    tier++;
+  }
+  if (tier == c->tier && tier > 0) {
+    if (mgos_imu_odr_ctrl_above(c, &c->opts.tiers[tier - 1], c->opts.hysteresis)) {
+      c->low_since = 0;
+    } else {
+      now = mgos_uptime_micros();
+      if (c->low_since == 0) {
+        c->low_since = now;
+      } else if (now - c->low_since >= (int64_t)c->opts.hold_ms * 1000) {
+        tier--;
+      }
+    }
+  }
+  if (tier == c->tier) {
+    return;
+  }
+  LOG(LL_DEBUG, ("Data rate tier %u -> %u", c->tier, tier));
+  c->tier      = tier;
+  c->low_since = 0;
+  mgos_imu_odr_ctrl_apply(imu);
+  if (c->cb) {
+    c->cb(imu, c->tier, c->cb_arg);
+  }
+}
+
+// Private functions end
+
+// Public functions follow
+void mgos_imu_odr_ctrl_acc(struct mgos_imu *imu) {
+  struct mgos_imu_odr_ctrl *c;
+  float v[3], mag, d;
+
+  if (!imu || !imu->acc || !imu->odr_ctrl) {
+    return;
+  }
+  c    = imu->odr_ctrl;
+  v[0] = imu->acc->scale * imu->acc->ax;
+  v[1] = imu->acc->scale * imu->acc->ay;
+  v[2] = imu->acc->scale * imu->acc->az;
+  mag  = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+  if (!c->have_acc) {
+    c->acc_mean = mag;
+    c->acc_var  = 0;
+    c->have_acc = true;
+  } else {
+    d            = mag - c->acc_mean;
+    c->acc_mean += c->alpha * d;
+    c->acc_var   = (1.f - c->alpha) * (c->acc_var + c->alpha * d * d);
+  }
+  mgos_imu_odr_ctrl_step(imu);
+}
+
+void mgos_imu_odr_ctrl_gyro(struct mgos_imu *imu) {
+  struct mgos_imu_gyro *    g;
+  struct mgos_imu_odr_ctrl *c;
+  float v[3];
+
+  if (!imu || !imu->gyro || !imu->odr_ctrl) {
+    return;
+  }
+  g = imu->gyro;
+  c = imu->odr_ctrl;
+  // Offsets are along the oriented axes, as in mgos_imu_gyroscope_get().
+  v[0]        = g->scale * (g->gx * g->orientation[0] + g->gy * g->orientation[1] + g->gz * g->orientation[2]) + g->offset_gx;
+  v[1]        = g->scale * (g->gx * g->orientation[3] + g->gy * g->orientation[4] + g->gz * g->orientation[5]) + g->offset_gy;
+  v[2]        = g->scale * (g->gx * g->orientation[6] + g->gy * g->orientation[7] + g->gz * g->orientation[8]) + g->offset_gz;
+  c->gyro_mag = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+  mgos_imu_odr_ctrl_step(imu);
+}
+
+bool mgos_imu_set_odr_ctrl(struct mgos_imu *imu, const struct mgos_imu_odr_ctrl_opts *opts, struct mgos_imu_madgwick *filter, mgos_imu_odr_cb cb, void *user_data) {
+  struct mgos_imu_odr_ctrl *c;
+
+  if (!imu || !opts || opts->num_tiers < 1 || opts->num_tiers > MGOS_IMU_ODR_MAX_TIERS) {
+    return false;
+  }
+  if (opts->hysteresis < 0 || opts->hysteresis > 1) {
+    return false;
+  }
+  mgos_imu_clear_odr_ctrl(imu);
+
+  c = calloc(1, sizeof(struct mgos_imu_odr_ctrl));
+  if (!c) {
+    return false;
+  }
+  c->opts   = *opts;
+  c->filter = filter;
+  c->cb     = cb;
+  c->cb_arg = user_data;
+  if (c->opts.window == 0) {
+    c->opts.window = MGOS_IMU_ODR_DEFAULT_WINDOW;
+  }
+  c->alpha      = 2.f / (c->opts.window + 1);
+  imu->odr_ctrl = c;
+
+  if (!mgos_imu_odr_ctrl_apply(imu)) {
+    imu->odr_ctrl = NULL;
+    free(c);
+    return false;
+  }
+  return true;
+}
+
+bool mgos_imu_clear_odr_ctrl(struct mgos_imu *imu) {
+  if (!imu || !imu->odr_ctrl) {
+    return false;
+  }
+  free(imu->odr_ctrl);
+  imu->odr_ctrl = NULL;
+  return true;
+}
+
+bool mgos_imu_get_odr_tier(struct mgos_imu *imu, uint8_t *tier) {
+  if (!imu || !imu->odr_ctrl || !tier) {
+    return false;
+  }
+  *tier = imu->odr_ctrl->tier;
+  return true;
+}
+
+// Public functions end
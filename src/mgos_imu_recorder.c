@@ -0,0 +1,256 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mgos_imu_recorder.h"
+#include <stdio.h>
+
+struct mgos_imu_recorder {
+  struct mgos_imu *            imu;
+  struct mgos_imu_log_encoder *enc;
+  FILE *                       fp;
+
+  uint8_t *                    buf[2];
+  size_t                       buf_size;
+  size_t                       len[2];
+  bool                         busy[2];  // Full, waiting for the flush callback
+  int                          active;   // Buffer being filled
+
+  int                          cb_pending;  // Queued flush callbacks
+  bool                         stopped;
+  bool                         destroyed;
+
+  uint32_t                     read_errors;
+  uint32_t                     write_errors;
+  uint32_t                     flushes;
+  uint32_t                     bytes;
+  uint32_t                     write_us;
+  uint32_t                     max_write_us;
+};
+
+// Private functions follow
+static void recorder_free(struct mgos_imu_recorder *rec) {
+  mgos_imu_log_encoder_destroy(&rec->enc);
+  if (rec->fp) {
+    fclose(rec->fp);
+  }
+  free(rec->buf[0]);
+  free(rec->buf[1]);
+  free(rec);
+}
+
+static void recorder_write_buf(struct mgos_imu_recorder *rec, int i) {
+  int64_t  start;
+  uint32_t us;
+
+  if (rec->len[i] == 0 || !rec->fp) {
+    return;
+  }
+  start = mgos_uptime_micros();
+  if (fwrite(rec->buf[i], 1, rec->len[i], rec->fp) != rec->len[i]) {
+    LOG(LL_ERROR, ("Could not write %u bytes", (unsigned)rec->len[i]));
+    rec->write_errors++;
+  } else {
+    rec->bytes += rec->len[i];
+  }
+  us             = (uint32_t)(mgos_uptime_micros() - start);
+  rec->write_us += us;
+  if (us > rec->max_write_us) {
+    rec->max_write_us = us;
+  }
+  rec->flushes++;
+  rec->len[i] = 0;
+}
+
+static void recorder_flush_cb(void *arg) {
+  struct mgos_imu_recorder *rec = (struct mgos_imu_recorder *)arg;
+
+  // busy[] hands a buffer between the sampling task and the mgos task: the
+  // acquire sees the sampler's writes to it, and the release publishes len = 0
+  // before the sampler can take it back.
+  for (int i = 0; i < 2; i++) {
+    if (__atomic_load_n(&rec->busy[i], __ATOMIC_ACQUIRE)) {
+      recorder_write_buf(rec, i);
+      __atomic_store_n(&rec->busy[i], false, __ATOMIC_RELEASE);
+    }
+  }
+  if (__atomic_sub_fetch(&rec->cb_pending, 1, __ATOMIC_ACQ_REL) == 0 && rec->destroyed) {
+    recorder_free(rec);
+  }
+}
+
+// Hand the active buffer to the flush callback and continue in the other one.
+static bool recorder_swap(struct mgos_imu_recorder *rec) {
+  int next = rec->active ^ 1;
+
+  if (__atomic_load_n(&rec->busy[next], __ATOMIC_ACQUIRE)) {
+    return false;
+  }
+  __atomic_store_n(&rec->busy[rec->active], true, __ATOMIC_RELEASE);
+  rec->active = next;
+  __atomic_add_fetch(&rec->cb_pending, 1, __ATOMIC_ACQ_REL);
+  if (!mgos_invoke_cb(recorder_flush_cb, rec, false)) {
+    __atomic_sub_fetch(&rec->cb_pending, 1, __ATOMIC_ACQ_REL);
+    rec->active = next ^ 1;
+    __atomic_store_n(&rec->busy[rec->active], false, __ATOMIC_RELEASE);
+    return false;
+  }
+  return true;
+}
+
+// Encoder sink, called with the log header and each finished block.
+static bool recorder_write(void *ctx, const void *data, size_t len) {
+  struct mgos_imu_recorder *rec = (struct mgos_imu_recorder *)ctx;
+  int i;
+
+  if (rec->stopped || len > rec->buf_size) {
+    return false;
+  }
+  if (rec->len[rec->active] + len > rec->buf_size && !recorder_swap(rec)) {
+    return false;
+  }
+  i = rec->active;
+  memcpy(rec->buf[i] + rec->len[i], data, len);
+  rec->len[i] += len;
+  return true;
+}
+// Private functions end
+
+// Public functions follow
+struct mgos_imu_recorder *mgos_imu_recorder_create(struct mgos_imu *imu, const char *filename, size_t buf_size) {
+  struct mgos_imu_recorder * rec;
+  struct mgos_imu_log_config cfg;
+
+  if (!imu || !filename) {
+    return NULL;
+  }
+  if (buf_size == 0) {
+    buf_size = MGOS_IMU_RECORDER_BUF_SIZE;
+  }
+  if (buf_size < MGOS_IMU_RECORDER_BUF_MIN) {
+    LOG(LL_ERROR, ("Buffer size %u too small", (unsigned)buf_size));
+    return NULL;
+  }
+  if (!mgos_imu_log_config_from_imu(imu, &cfg)) {
+    return NULL;
+  }
+
+  rec = calloc(1, sizeof(struct mgos_imu_recorder));
+  if (!rec) {
+    return NULL;
+  }
+  rec->imu      = imu;
+  rec->buf_size = buf_size;
+  rec->buf[0]   = malloc(buf_size);
+  rec->buf[1]   = malloc(buf_size);
+  rec->enc      = mgos_imu_log_encoder_create(&cfg, 0, recorder_write, rec);
+  if (!rec->buf[0] || !rec->buf[1] || !rec->enc) {
+    recorder_free(rec);
+    return NULL;
+  }
+  rec->fp = fopen(filename, "wb");
+  if (!rec->fp) {
+    LOG(LL_ERROR, ("Could not open %s", filename));
+    recorder_free(rec);
+    return NULL;
+  }
+  LOG(LL_INFO, ("Recording to %s, 2x%u byte buffers", filename, (unsigned)buf_size));
+  return rec;
+}
+
+bool mgos_imu_recorder_destroy(struct mgos_imu_recorder **rec) {
+  if (!*rec) {
+    return false;
+  }
+  mgos_imu_recorder_stop(*rec);
+  if (__atomic_load_n(&(*rec)->cb_pending, __ATOMIC_ACQUIRE) > 0) {
+    // The queued flush callback frees the recorder.
+    (*rec)->destroyed = true;
+  } else {
+    recorder_free(*rec);
+  }
+  *rec = NULL;
+  return true;
+}
+
+bool mgos_imu_recorder_sample(struct mgos_imu_recorder *rec) {
+  struct mgos_imu_log_frame frame;
+
+  if (!rec) {
+    return false;
+  }
+  if (!mgos_imu_log_read_frame(rec->imu, &frame)) {
+    rec->read_errors++;
+    return false;
+  }
+  return mgos_imu_recorder_add(rec, &frame);
+}
+
+bool mgos_imu_recorder_add(struct mgos_imu_recorder *rec, const struct mgos_imu_log_frame *frame) {
+  if (!rec) {
+    return false;
+  }
+  return mgos_imu_log_encoder_add(rec->enc, frame);
+}
+
+bool mgos_imu_recorder_stop(struct mgos_imu_recorder *rec) {
+  bool ret;
+
+  if (!rec) {
+    return false;
+  }
+  if (rec->stopped) {
+    return true;
+  }
+  // A partial block may not fit the active buffer, so make room by writing
+  // out any buffer still waiting for its callback first.
+  for (int i = 0; i < 2; i++) {
+    if (__atomic_load_n(&rec->busy[i], __ATOMIC_ACQUIRE)) {
+      recorder_write_buf(rec, i);
+      __atomic_store_n(&rec->busy[i], false, __ATOMIC_RELEASE);
+    }
+  }
+  if (rec->len[rec->active] + MGOS_IMU_RECORDER_BUF_MIN > rec->buf_size) {
+    recorder_write_buf(rec, rec->active);
+  }
+  ret          = mgos_imu_log_encoder_flush(rec->enc);
+  rec->stopped = true;
+  recorder_write_buf(rec, rec->active);
+  if (rec->fp) {
+    ret     = (fclose(rec->fp) == 0) && ret;
+    rec->fp = NULL;
+  }
+  return ret && rec->write_errors == 0;
+}
+
+bool mgos_imu_recorder_get_stats(struct mgos_imu_recorder *rec, struct mgos_imu_recorder_stats *stats) {
+  if (!rec || !stats) {
+    return false;
+  }
+  memset(stats, 0, sizeof(*stats));
+  mgos_imu_log_encoder_get_stats(rec->enc, &stats->frames, &stats->frames_dropped, NULL);
+  stats->read_errors  = rec->read_errors;
+  stats->write_errors = rec->write_errors;
+  stats->flushes      = rec->flushes;
+  stats->bytes        = rec->bytes;
+  stats->write_us     = rec->write_us;
+  stats->max_write_us = rec->max_write_us;
+  if (rec->write_us > 0) {
+    stats->throughput = (float)rec->bytes * 1e6f / (float)rec->write_us;
+  }
+  return true;
+}
+
+// Public functions end
@@ -0,0 +1,86 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Double buffered recorder of raw IMU frames to a file, in the format of
+// mgos_imu_log.h. Frames are encoded into one of two RAM buffers; when it
+// fills up, the buffers are swapped and the full one is written to the
+// filesystem from the mgos task by way of mgos_invoke_cb(), while acquisition
+// carries on into the other. That only keeps file I/O off the sampling path
+// if sampling runs on a task of its own: on the mgos task, the flush runs
+// between two samples and holds up the next one for the whole write. All
+// memory is allocated by create(), so recording itself never allocates. If the
+// flush falls behind so that both buffers are full, frames are dropped and
+// counted rather than stalling the sampling loop.
+
+#pragma once
+
+#include "mgos.h"
+#include "mgos_imu.h"
+#include "mgos_imu_log.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MGOS_IMU_RECORDER_BUF_SIZE    (8192)
+#define MGOS_IMU_RECORDER_BUF_MIN     (1024)
+
+struct mgos_imu_recorder;
+
+struct mgos_imu_recorder_stats {
+  uint32_t frames;          // Frames handed to the recorder
+  uint32_t frames_dropped;  // Frames lost because both buffers were full
+  uint32_t read_errors;     // Failed sensor reads in mgos_imu_recorder_sample()
+  uint32_t write_errors;    // Buffers that could not be written to the file
+  uint32_t flushes;         // Buffers written to the file
+  uint32_t bytes;           // Bytes written to the file
+  uint32_t write_us;        // Total time spent writing, in microseconds
+  uint32_t max_write_us;    // Longest single buffer write, in microseconds
+  float    throughput;      // bytes / write_us, in bytes/sec
+};
+
+// Create a recorder writing to `filename`, which is truncated. The sensor
+// configuration of `imu` is stored in the log header. Each of the two RAM
+// buffers is `buf_size` bytes, 0 selects MGOS_IMU_RECORDER_BUF_SIZE, and at
+// least MGOS_IMU_RECORDER_BUF_MIN.
+// Returns a recorder, or NULL otherwise.
+struct mgos_imu_recorder *mgos_imu_recorder_create(struct mgos_imu *imu, const char *filename, size_t buf_size);
+
+// Stop recording, if not already done, and return memory for the recorder.
+// A flush that is still queued on the mgos task completes before the memory is
+// returned.
+bool mgos_imu_recorder_destroy(struct mgos_imu_recorder **rec);
+
+// Read all sensors of the recorder's `imu` and record the raw frame. Call it
+// from one sampling task other than the mgos task, where it never blocks on the
+// filesystem. It works on the mgos task too, but then buffer writes delay
+// sampling.
+// Returns false if the sensors could not be read or the frame was dropped.
+bool mgos_imu_recorder_sample(struct mgos_imu_recorder *rec);
+
+// Record a frame obtained elsewhere, eg drained from a sensor FIFO.
+// Returns false if the frame was dropped.
+bool mgos_imu_recorder_add(struct mgos_imu_recorder *rec, const struct mgos_imu_log_frame *frame);
+
+// Encode any partial block, write out both buffers synchronously and close
+// the file. Further frames are dropped. Must be called from the mgos task.
+bool mgos_imu_recorder_stop(struct mgos_imu_recorder *rec);
+
+bool mgos_imu_recorder_get_stats(struct mgos_imu_recorder *rec, struct mgos_imu_recorder_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,151 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mgos_imu_regcache.h"
+
+// Private functions follow
+// Returns the slot of `reg` in rc->regs, or -1 if it is not cached.
+static int mgos_imu_regcache_slot(const struct mgos_imu_regcache *rc, uint8_t reg) {
+  int base = 0;
+
+  if (!rc->valid) {
+    return -1;
+  }
+  for (int i = 0; i < rc->n_ranges; i++) {
+    if (reg >= rc->ranges[i].first && reg <= rc->ranges[i].last) {
+      return base + reg - rc->ranges[i].first;
+    }
+    base += rc->ranges[i].last - rc->ranges[i].first + 1;
+  }
+  return -1;
+}
+
+// Private functions end
+
+// Public functions follow
+bool mgos_imu_regcache_init(struct mgos_imu_regcache *rc, struct mgos_i2c *i2c, uint8_t i2caddr, const struct mgos_imu_regcache_range *ranges, uint8_t n_ranges) {
+  int size = 0;
+
+  if (!rc) {
+    return false;
+  }
+  memset(rc, 0, sizeof(*rc));
+  rc->i2c     = i2c;
+  rc->i2caddr = i2caddr;
+  if (!ranges || n_ranges > MGOS_IMU_REGCACHE_RANGES) {
+    return false;
+  }
+  for (int i = 0; i < n_ranges; i++) {
+    if (ranges[i].last < ranges[i].first) {
+      return false;
+    }
+    size += ranges[i].last - ranges[i].first + 1;
+  }
+  if (size > MGOS_IMU_REGCACHE_SIZE) {
+    LOG(LL_ERROR, ("Register cache of %d bytes exceeds %d", size, MGOS_IMU_REGCACHE_SIZE));
+    return false;
+  }
+  rc->ranges   = ranges;
+  rc->n_ranges = n_ranges;
+  return mgos_imu_regcache_load(rc);
+}
+
+bool mgos_imu_regcache_load(struct mgos_imu_regcache *rc) {
+  uint8_t *p;
+
+  if (!rc || !rc->ranges) {
+    return false;
+  }
+  rc->valid = false;
+  p         = rc->regs;
+  for (int i = 0; i < rc->n_ranges; i++) {
+    size_t len = rc->ranges[i].last - rc->ranges[i].first + 1;
+    if (!mgos_i2c_read_reg_n(rc->i2c, rc->i2caddr, rc->ranges[i].first, len, p)) {
+      return false;
+    }
+    p += len;
+  }
+  rc->valid = true;
+  return true;
+}
+
+int mgos_imu_regcache_read_reg_b(struct mgos_imu_regcache *rc, uint8_t reg) {
+  int slot = mgos_imu_regcache_slot(rc, reg);
+
+  if (slot < 0) {
+    return mgos_i2c_read_reg_b(rc->i2c, rc->i2caddr, reg);
+  }
+  return rc->regs[slot];
+}
+
+bool mgos_imu_regcache_write_reg_b(struct mgos_imu_regcache *rc, uint8_t reg, uint8_t value) {
+  int slot;
+
+  if (!mgos_i2c_write_reg_b(rc->i2c, rc->i2caddr, reg, value)) {
+    return false;
+  }
+  slot = mgos_imu_regcache_slot(rc, reg);
+  if (slot >= 0) {
+    rc->regs[slot] = value;
+  }
+  return true;
+}
+
+bool mgos_imu_regcache_write_reg_n(struct mgos_imu_regcache *rc, uint8_t reg, size_t n, const uint8_t *buf) {
+  int slot;
+
+  if (!mgos_i2c_write_reg_n(rc->i2c, rc->i2caddr, reg, n, buf)) {
+    return false;
+  }
+  for (size_t i = 0; i < n; i++) {
+    slot = mgos_imu_regcache_slot(rc, (uint8_t)(reg + i));
+    if (slot >= 0) {
+      rc->regs[slot] = buf[i];
+    }
+  }
+  return true;
+}
+
+bool mgos_imu_regcache_setbits_reg_b(struct mgos_imu_regcache *rc, uint8_t reg, uint8_t bitoffset, uint8_t bitlen, uint8_t value) {
+  int     old;
+  uint8_t mask;
+
+  if (bitoffset + bitlen > 8) {
+    return false;
+  }
+  old = mgos_imu_regcache_read_reg_b(rc, reg);
+  if (old < 0) {
+    return false;
+  }
+  mask = (uint8_t)(((1 << bitlen) - 1) << bitoffset);
+  return mgos_imu_regcache_write_reg_b(rc, reg, (uint8_t)((old & ~mask) | ((value << bitoffset) & mask)));
+}
+
+bool mgos_imu_regcache_getbits_reg_b(struct mgos_imu_regcache *rc, uint8_t reg, uint8_t bitoffset, uint8_t bitlen, uint8_t *value) {
+  int v;
+
+  if (bitoffset + bitlen > 8 || !value) {
+    return false;
+  }
+  v = mgos_imu_regcache_read_reg_b(rc, reg);
+  if (v < 0) {
+    return false;
+  }
+  *value = (uint8_t)((v >> bitoffset) & ((1 << bitlen) - 1));
+  return true;
+}
+
+// Public functions end
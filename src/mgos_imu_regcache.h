@@ -0,0 +1,71 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Shadow of a chip's configuration registers. The cache is populated in one
+// burst read per range at create time, and updated on every write, so getters
+// cost no bus traffic and bit updates are a single write instead of a read
+// plus a write. The calls mirror mgos_i2c_*_reg_*(), so drivers can switch
+// one call at a time. Registers outside the ranges go to the bus.
+//
+// Only registers that the chip does not change by itself belong in a range:
+// no status, output or FIFO registers. Self-clearing bits (resets, boot) are
+// cached as written, so call mgos_imu_regcache_load() after using them.
+
+#pragma once
+
+#include "mgos.h"
+#include "mgos_i2c.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MGOS_IMU_REGCACHE_SIZE      (48)
+#define MGOS_IMU_REGCACHE_RANGES    (4)
+
+struct mgos_imu_regcache_range {
+  uint8_t first;
+  uint8_t last;
+};
+
+struct mgos_imu_regcache {
+  struct mgos_i2c *                     i2c;
+  uint8_t                               i2caddr;
+  const struct mgos_imu_regcache_range *ranges;
+  uint8_t                               n_ranges;
+  bool                                  valid;
+  uint8_t                               regs[MGOS_IMU_REGCACHE_SIZE];
+};
+
+// Set up `rc` for the registers in `ranges`, which must stay valid for the
+// lifetime of the cache, and load them from the chip.
+// Returns true on success, false if the ranges do not fit, or if loading
+// failed, in which case all calls go to the bus until the next load.
+bool mgos_imu_regcache_init(struct mgos_imu_regcache *rc, struct mgos_i2c *i2c, uint8_t i2caddr, const struct mgos_imu_regcache_range *ranges, uint8_t n_ranges);
+
+// Reload all ranges from the chip, eg after a reset or boot.
+bool mgos_imu_regcache_load(struct mgos_imu_regcache *rc);
+
+// Same as the corresponding mgos_i2c_*() calls.
+int mgos_imu_regcache_read_reg_b(struct mgos_imu_regcache *rc, uint8_t reg);
+bool mgos_imu_regcache_write_reg_b(struct mgos_imu_regcache *rc, uint8_t reg, uint8_t value);
+bool mgos_imu_regcache_write_reg_n(struct mgos_imu_regcache *rc, uint8_t reg, size_t n, const uint8_t *buf);
+bool mgos_imu_regcache_setbits_reg_b(struct mgos_imu_regcache *rc, uint8_t reg, uint8_t bitoffset, uint8_t bitlen, uint8_t value);
+bool mgos_imu_regcache_getbits_reg_b(struct mgos_imu_regcache *rc, uint8_t reg, uint8_t bitoffset, uint8_t bitlen, uint8_t *value);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,445 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mgos_imu_replay.h"
+#include <ctype.h>
+#include <math.h>
+
+// Private functions follow
+static int replay_fread(void *ctx, void *buf, size_t len) {
+  FILE * fp = (FILE *)ctx;
+  size_t ret;
+
+  ret = fread(buf, 1, len, fp);
+  if (ret == 0 && ferror(fp)) {
+    return -1;
+  }
+  return (int)ret;
+}
+
+static int16_t replay_quantize(double v, float scale) {
+  double raw = v / scale;
+
+  if (raw > 32767.) {
+    return 32767;
+  }
+  if (raw < -32768.) {
+    return -32768;
+  }
+  return (int16_t)lround(raw);
+}
+
+// Parse one CSV line of ts_us followed by up to 9 values. Returns the number of
+// fields, or 0 for comment, header and empty lines.
+static int replay_csv_parse(const char *line, double *fields, int max) {
+  const char *p = line;
+  char *      end;
+  int         n = 0;
+
+  while (*p == ' ' || *p == '\t') {
+    p++;
+  }
+  if (*p == '#' || !(isdigit((unsigned char)*p) || *p == '-' || *p == '+' || *p == '.')) {
+    return 0;
+  }
+  while (n < max) {
+    fields[n] = strtod(p, &end);
+    if (end == p) {
+      break;
+    }
+    n++;
+    p = end;
+    while (*p == ' ' || *p == '\t' || *p == ',' || *p == ';') {
+      p++;
+    }
+  }
+  return n;
+}
+
+static int replay_csv_read(struct mgos_imu_replay_userdata *iud, double *fields) {
+  char line[256];
+  int  n;
+
+  while (fgets(line, sizeof(line), iud->fp)) {
+    n = replay_csv_parse(line, fields, 10);
+    if (n > 0) {
+      return n;
+    }
+  }
+  return 0;
+}
+
+static bool replay_csv_next(struct mgos_imu_replay_userdata *iud, struct mgos_imu_log_frame *frame) {
+  double fields[10] = { 0 };
+
+  if (replay_csv_read(iud, fields) == 0) {
+    return false;
+  }
+  frame->ts_us = (uint32_t)(int64_t)fields[0];
+  frame->ax    = replay_quantize(fields[1], MGOS_IMU_REPLAY_CSV_ACC_SCALE);
+  frame->ay    = replay_quantize(fields[2], MGOS_IMU_REPLAY_CSV_ACC_SCALE);
+  frame->az    = replay_quantize(fields[3], MGOS_IMU_REPLAY_CSV_ACC_SCALE);
+  frame->gx    = replay_quantize(fields[4], MGOS_IMU_REPLAY_CSV_GYRO_SCALE);
+  frame->gy    = replay_quantize(fields[5], MGOS_IMU_REPLAY_CSV_GYRO_SCALE);
+  frame->gz    = replay_quantize(fields[6], MGOS_IMU_REPLAY_CSV_GYRO_SCALE);
+  frame->mx    = replay_quantize(fields[7], MGOS_IMU_REPLAY_CSV_MAG_SCALE);
+  frame->my    = replay_quantize(fields[8], MGOS_IMU_REPLAY_CSV_MAG_SCALE);
+  frame->mz    = replay_quantize(fields[9], MGOS_IMU_REPLAY_CSV_MAG_SCALE);
+  return true;
+}
+
+static bool replay_rewind(struct mgos_imu_replay_userdata *iud) {
+  if (fseek(iud->fp, 0, SEEK_SET) != 0) {
+    return false;
+  }
+  if (iud->dec) {
+    mgos_imu_log_decoder_destroy(&iud->dec);
+    iud->dec = mgos_imu_log_decoder_create(replay_fread, iud->fp);
+    return iud->dec != NULL;
+  }
+  return true;
+}
+
+static bool replay_next(struct mgos_imu_replay_userdata *iud) {
+  bool ok;
+
+  iud->valid = false;
+  if (!iud->fp) {
+    return false;
+  }
+  ok = iud->dec ? mgos_imu_log_decoder_next(iud->dec, &iud->frame) : replay_csv_next(iud, &iud->frame);
+  if (!ok && iud->loop && iud->frames > 0 && replay_rewind(iud)) {
+    ok = iud->dec ? mgos_imu_log_decoder_next(iud->dec, &iud->frame) : replay_csv_next(iud, &iud->frame);
+  }
+  if (!ok) {
+    return false;
+  }
+  iud->valid    = true;
+  iud->consumed = 0;
+  iud->frames++;
+  return true;
+}
+
+// Sensors are kept in lockstep: a sensor that reads again, after having read
+// the current frame already, moves all of them on to the next frame.
+static bool replay_take(struct mgos_imu_replay_userdata *iud, uint8_t sensor) {
+  if (!iud->valid || (iud->consumed & sensor)) {
+    if (!replay_next(iud)) {
+      return false;
+    }
+  }
+  iud->consumed |= sensor;
+  return true;
+}
+
+static struct mgos_imu_replay_userdata *replay_userdata(void *imu_user_data, uint8_t sensor) {
+  struct mgos_imu_replay_userdata *iud = (struct mgos_imu_replay_userdata *)imu_user_data;
+
+  if (!iud || iud->magic != MGOS_IMU_REPLAY_MAGIC || !(iud->present & sensor)) {
+    return NULL;
+  }
+  return iud;
+}
+
+// The trace is closed once the last sensor created on it is destroyed.
+static void replay_release(struct mgos_imu_replay_userdata *iud, uint8_t sensor) {
+  if (!(iud->created & sensor)) {
+    return;
+  }
+  iud->created &= ~sensor;
+  if (iud->created) {
+    return;
+  }
+  mgos_imu_log_decoder_destroy(&iud->dec);
+  if (iud->fp) {
+    fclose(iud->fp);
+    iud->fp = NULL;
+  }
+  iud->valid = false;
+}
+
+static bool replay_get_odr(struct mgos_imu_log_sensor *s, float *odr) {
+  if (s->odr <= 0.f) {
+    return false;
+  }
+  *odr = s->odr;
+  return true;
+}
+// Private functions end
+
+// Public functions follow
+struct mgos_imu_replay_userdata *mgos_imu_replay_userdata_create(const char *filename, bool loop) {
+  struct mgos_imu_replay_userdata *iud;
+  char   magic[4];
+  double fields[10];
+  int    n;
+
+  iud = calloc(1, sizeof(struct mgos_imu_replay_userdata));
+  if (!iud) {
+    return NULL;
+  }
+  iud->magic = MGOS_IMU_REPLAY_MAGIC;
+  iud->loop  = loop;
+  iud->fp    = fopen(filename, "rb");
+  if (!iud->fp) {
+    LOG(LL_ERROR, ("Could not open %s", filename));
+    goto err;
+  }
+
+  if (fread(magic, 1, sizeof(magic), iud->fp) == sizeof(magic) && !memcmp(magic, "IMUL", 4)) {
+    rewind(iud->fp);
+    iud->dec = mgos_imu_log_decoder_create(replay_fread, iud->fp);
+    if (!iud->dec) {
+      goto err;
+    }
+    mgos_imu_log_decoder_get_config(iud->dec, &iud->config);
+    iud->present |= iud->config.acc.name[0] ? MGOS_IMU_REPLAY_ACC : 0;
+    iud->present |= iud->config.gyro.name[0] ? MGOS_IMU_REPLAY_GYRO : 0;
+    iud->present |= iud->config.mag.name[0] ? MGOS_IMU_REPLAY_MAG : 0;
+  } else {
+    // CSV: the columns present on the first data line decide the sensors.
+    rewind(iud->fp);
+    n = replay_csv_read(iud, fields);
+    rewind(iud->fp);
+    iud->present          |= (n >= 4) ? MGOS_IMU_REPLAY_ACC : 0;
+    iud->present          |= (n >= 7) ? MGOS_IMU_REPLAY_GYRO : 0;
+    iud->present          |= (n >= 10) ? MGOS_IMU_REPLAY_MAG : 0;
+    iud->config.acc.scale  = MGOS_IMU_REPLAY_CSV_ACC_SCALE;
+    iud->config.gyro.scale = MGOS_IMU_REPLAY_CSV_GYRO_SCALE;
+    iud->config.mag.scale  = MGOS_IMU_REPLAY_CSV_MAG_SCALE;
+    for (int axis = 0; axis < 3; axis++) {
+      iud->config.mag_sensitivity[axis] = 1.0;
+    }
+  }
+  if (!iud->present) {
+    LOG(LL_ERROR, ("No sensor data in %s", filename));
+    goto err;
+  }
+  LOG(LL_INFO, ("Replaying %s trace %s, sensors 0x%02x", iud->dec ? "binary" : "CSV", filename, iud->present));
+  return iud;
+
+err:
+  mgos_imu_log_decoder_destroy(&iud->dec);
+  if (iud->fp) {
+    fclose(iud->fp);
+  }
+  free(iud);
+  return NULL;
+}
+
+bool mgos_imu_replay_acc_detect(struct mgos_imu_acc *dev, void *imu_user_data) {
+  (void)dev;
+  return replay_userdata(imu_user_data, MGOS_IMU_REPLAY_ACC) != NULL;
+}
+
+bool mgos_imu_replay_acc_create(struct mgos_imu_acc *dev, void *imu_user_data) {
+  struct mgos_imu_replay_userdata *iud = replay_userdata(imu_user_data, MGOS_IMU_REPLAY_ACC);
+
+  if (!iud || !iud->fp) {
+    return false;
+  }
+  iud->created |= MGOS_IMU_REPLAY_ACC;
+  dev->scale    = iud->config.acc.scale;
+  return true;
+}
+
+bool mgos_imu_replay_acc_destroy(struct mgos_imu_acc *dev, void *imu_user_data) {
+  struct mgos_imu_replay_userdata *iud = replay_userdata(imu_user_data, MGOS_IMU_REPLAY_ACC);
+
+  if (!iud) {
+    return false;
+  }
+  replay_release(iud, MGOS_IMU_REPLAY_ACC);
+  (void)dev;
+  return true;
+}
+
+bool mgos_imu_replay_acc_read(struct mgos_imu_acc *dev, void *imu_user_data) {
+  struct mgos_imu_replay_userdata *iud = replay_userdata(imu_user_data, MGOS_IMU_REPLAY_ACC);
+
+  if (!iud || !replay_take(iud, MGOS_IMU_REPLAY_ACC)) {
+    return false;
+  }
+  dev->ax = iud->frame.ax;
+  dev->ay = iud->frame.ay;
+  dev->az = iud->frame.az;
+  return true;
+}
+
+bool mgos_imu_replay_acc_get_odr(struct mgos_imu_acc *dev, void *imu_user_data, float *odr) {
+  struct mgos_imu_replay_userdata *iud = replay_userdata(imu_user_data, MGOS_IMU_REPLAY_ACC);
+
+  if (!iud) {
+    return false;
+  }
+  (void)dev;
+  return replay_get_odr(&iud->config.acc, odr);
+}
+
+bool mgos_imu_replay_gyro_detect(struct mgos_imu_gyro *dev, void *imu_user_data) {
+  (void)dev;
+  return replay_userdata(imu_user_data, MGOS_IMU_REPLAY_GYRO) != NULL;
+}
+
+bool mgos_imu_replay_gyro_create(struct mgos_imu_gyro *dev, void *imu_user_data) {
+  struct mgos_imu_replay_userdata *iud = replay_userdata(imu_user_data, MGOS_IMU_REPLAY_GYRO);
+
+  if (!iud || !iud->fp) {
+    return false;
+  }
+  iud->created |= MGOS_IMU_REPLAY_GYRO;
+  dev->scale    = iud->config.gyro.scale;
+  return true;
+}
+
+bool mgos_imu_replay_gyro_destroy(struct mgos_imu_gyro *dev, void *imu_user_data) {
+  struct mgos_imu_replay_userdata *iud = replay_userdata(imu_user_data, MGOS_IMU_REPLAY_GYRO);
+
+  if (!iud) {
+    return false;
+  }
+  replay_release(iud, MGOS_IMU_REPLAY_GYRO);
+  (void)dev;
+  return true;
+}
+
+bool mgos_imu_replay_gyro_read(struct mgos_imu_gyro *dev, void *imu_user_data) {
+  struct mgos_imu_replay_userdata *iud = replay_userdata(imu_user_data, MGOS_IMU_REPLAY_GYRO);
+
+  if (!iud || !replay_take(iud, MGOS_IMU_REPLAY_GYRO)) {
+    return false;
+  }
+  dev->gx = iud->frame.gx;
+  dev->gy = iud->frame.gy;
+  dev->gz = iud->frame.gz;
+  return true;
+}
+
+bool mgos_imu_replay_gyro_get_odr(struct mgos_imu_gyro *dev, void *imu_user_data, float *odr) {
+  struct mgos_imu_replay_userdata *iud = replay_userdata(imu_user_data, MGOS_IMU_REPLAY_GYRO);
+
+  if (!iud) {
+    return false;
+  }
+  (void)dev;
+  return replay_get_odr(&iud->config.gyro, odr);
+}
+
+bool mgos_imu_replay_mag_detect(struct mgos_imu_mag *dev, void *imu_user_data) {
+  (void)dev;
+  return replay_userdata(imu_user_data, MGOS_IMU_REPLAY_MAG) != NULL;
+}
+
+bool mgos_imu_replay_mag_create(struct mgos_imu_mag *dev, void *imu_user_data) {
+  struct mgos_imu_replay_userdata *iud = replay_userdata(imu_user_data, MGOS_IMU_REPLAY_MAG);
+
+  if (!iud || !iud->fp) {
+    return false;
+  }
+  iud->created |= MGOS_IMU_REPLAY_MAG;
+  dev->scale    = iud->config.mag.scale;
+  dev->bias[0]  = iud->config.mag_sensitivity[0];
+  dev->bias[1]  = iud->config.mag_sensitivity[1];
+  dev->bias[2]  = iud->config.mag_sensitivity[2];
+  return true;
+}
+
+bool mgos_imu_replay_mag_destroy(struct mgos_imu_mag *dev, void *imu_user_data) {
+  struct mgos_imu_replay_userdata *iud = replay_userdata(imu_user_data, MGOS_IMU_REPLAY_MAG);
+
+  if (!iud) {
+    return false;
+  }
+  replay_release(iud, MGOS_IMU_REPLAY_MAG);
+  (void)dev;
+  return true;
+}
+
+bool mgos_imu_replay_mag_read(struct mgos_imu_mag *dev, void *imu_user_data) {
+  struct mgos_imu_replay_userdata *iud = replay_userdata(imu_user_data, MGOS_IMU_REPLAY_MAG);
+
+  if (!iud || !replay_take(iud, MGOS_IMU_REPLAY_MAG)) {
+    return false;
+  }
+  dev->mx = iud->frame.mx;
+  dev->my = iud->frame.my;
+  dev->mz = iud->frame.mz;
+  return true;
+}
+
+bool mgos_imu_replay_mag_get_odr(struct mgos_imu_mag *dev, void *imu_user_data, float *odr) {
+  struct mgos_imu_replay_userdata *iud = replay_userdata(imu_user_data, MGOS_IMU_REPLAY_MAG);
+
+  if (!iud) {
+    return false;
+  }
+  (void)dev;
+  return replay_get_odr(&iud->config.mag, odr);
+}
+
+bool mgos_imu_replay_create(struct mgos_imu *imu, const char *filename, bool loop) {
+  struct mgos_imu_replay_userdata *iud;
+  struct mgos_imu_acc_opts         acc_opts;
+  struct mgos_imu_gyro_opts        gyro_opts;
+  struct mgos_imu_mag_opts         mag_opts;
+  bool ret                         = true;
+
+  if (!imu || !filename) {
+    return false;
+  }
+  if (imu->user_data || imu->acc || imu->gyro || imu->mag) {
+    LOG(LL_ERROR, ("IMU already has sensors attached"));
+    return false;
+  }
+  iud = mgos_imu_replay_userdata_create(filename, loop);
+  if (!iud) {
+    return false;
+  }
+  imu->user_data = iud;
+
+  if (iud->present & MGOS_IMU_REPLAY_ACC) {
+    memset(&acc_opts, 0, sizeof(acc_opts));
+    acc_opts.type = ACC_REPLAY;
+    ret           = mgos_imu_accelerometer_create_i2c(imu, NULL, 0, &acc_opts) && ret;
+  }
+  if (iud->present & MGOS_IMU_REPLAY_GYRO) {
+    memset(&gyro_opts, 0, sizeof(gyro_opts));
+    gyro_opts.type = GYRO_REPLAY;
+    ret            = mgos_imu_gyroscope_create_i2c(imu, NULL, 0, &gyro_opts) && ret;
+  }
+  if (iud->present & MGOS_IMU_REPLAY_MAG) {
+    memset(&mag_opts, 0, sizeof(mag_opts));
+    mag_opts.type = MAG_REPLAY;
+    ret           = mgos_imu_magnetometer_create_i2c(imu, NULL, 0, &mag_opts) && ret;
+  }
+  return ret;
+}
+
+bool mgos_imu_replay_get_timestamp(struct mgos_imu *imu, uint32_t *ts_us) {
+  struct mgos_imu_replay_userdata *iud;
+
+  if (!imu || !ts_us) {
+    return false;
+  }
+  iud = (struct mgos_imu_replay_userdata *)imu->user_data;
+  if (!iud || iud->magic != MGOS_IMU_REPLAY_MAGIC || !iud->valid) {
+    return false;
+  }
+  *ts_us = iud->frame.ts_us;
+  return true;
+}
+
+// Public functions end
@@ -0,0 +1,69 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "mgos.h"
+#include "mgos_imu_internal.h"
+#include "mgos_imu_log.h"
+#include <stdio.h>
+
+#define MGOS_IMU_REPLAY_MAGIC           (0x59504552) /* "REPY" */
+
+// CSV traces are in G, degrees/sec and Gauss, and are quantized to these
+// ranges so that they flow through the same raw int16 path as the chips.
+#define MGOS_IMU_REPLAY_CSV_ACC_SCALE   (16.f / 32768.f)
+#define MGOS_IMU_REPLAY_CSV_GYRO_SCALE  (2000.f / 32768.f)
+#define MGOS_IMU_REPLAY_CSV_MAG_SCALE   (48.f / 32768.f)
+
+#define MGOS_IMU_REPLAY_ACC             (0x01)
+#define MGOS_IMU_REPLAY_GYRO            (0x02)
+#define MGOS_IMU_REPLAY_MAG             (0x04)
+
+struct mgos_imu_replay_userdata {
+  uint32_t                     magic;
+  FILE *                       fp;
+  struct mgos_imu_log_decoder *dec;     // NULL for CSV traces
+  struct mgos_imu_log_config   config;
+  bool                         loop;
+  uint8_t                      created; // MGOS_IMU_REPLAY_* created on this trace
+
+  struct mgos_imu_log_frame    frame;
+  uint8_t                      present; // MGOS_IMU_REPLAY_* in the trace
+  uint8_t                      consumed;
+  bool                         valid;
+  uint32_t                     frames;
+};
+
+struct mgos_imu_replay_userdata *mgos_imu_replay_userdata_create(const char *filename, bool loop);
+
+bool mgos_imu_replay_acc_detect(struct mgos_imu_acc *dev, void *imu_user_data);
+bool mgos_imu_replay_acc_create(struct mgos_imu_acc *dev, void *imu_user_data);
+bool mgos_imu_replay_acc_destroy(struct mgos_imu_acc *dev, void *imu_user_data);
+bool mgos_imu_replay_acc_read(struct mgos_imu_acc *dev, void *imu_user_data);
+bool mgos_imu_replay_acc_get_odr(struct mgos_imu_acc *dev, void *imu_user_data, float *odr);
+
+bool mgos_imu_replay_gyro_detect(struct mgos_imu_gyro *dev, void *imu_user_data);
+bool mgos_imu_replay_gyro_create(struct mgos_imu_gyro *dev, void *imu_user_data);
+bool mgos_imu_replay_gyro_destroy(struct mgos_imu_gyro *dev, void *imu_user_data);
+bool mgos_imu_replay_gyro_read(struct mgos_imu_gyro *dev, void *imu_user_data);
+bool mgos_imu_replay_gyro_get_odr(struct mgos_imu_gyro *dev, void *imu_user_data, float *odr);
+
+bool mgos_imu_replay_mag_detect(struct mgos_imu_mag *dev, void *imu_user_data);
+bool mgos_imu_replay_mag_create(struct mgos_imu_mag *dev, void *imu_user_data);
+bool mgos_imu_replay_mag_destroy(struct mgos_imu_mag *dev, void *imu_user_data);
+bool mgos_imu_replay_mag_read(struct mgos_imu_mag *dev, void *imu_user_data);
+bool mgos_imu_replay_mag_get_odr(struct mgos_imu_mag *dev, void *imu_user_data, float *odr);
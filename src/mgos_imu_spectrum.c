@@ -0,0 +1,465 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mgos.h"
+#include "mgos_imu_internal.h"
+#include <math.h>
+
+#define MGOS_IMU_SPECTRUM_MIN_SIZE         (16)
+#define MGOS_IMU_SPECTRUM_MAX_SIZE         (1024)
+#define MGOS_IMU_SPECTRUM_DEFAULT_RANGE    (16.f)
+#define MGOS_IMU_SPECTRUM_Q15_ONE          (32767)
+
+// Blocks are kept per axis, as floats, or as Q15 fractions of `range` for
+// fixed point. The N real samples of an axis are windowed and taken as N/2
+// complex ones (even samples real, odd ones imaginary), which go through an
+// N/2 point complex FFT that is then split into the N/2 + 1 bins of the real
+// FFT. So `work` holds N numbers, and `twiddle` the N/2 complex factors
+// exp(-2*pi*i*k/N) that both steps use.
+struct mgos_imu_spectrum {
+  struct mgos_imu_spectrum_opts     opts;
+  mgos_imu_spectrum_cb              cb;
+  void *                            cb_arg;
+
+  uint8_t                           log2n;
+  uint16_t                          fill;       // Samples in the current block
+  uint32_t                          blocks;
+  float                             win_sum;    // Sum of the window, and of its squares
+  float                             win_sum2;
+  bool                              have_features;
+  struct mgos_imu_spectrum_features features;
+
+  float *                           power;      // size / 2 + 1 bins, in G^2
+  float *                           fsamples;   // Float: [3][size]
+  float *                           fwindow;
+  float *                           ftwiddle;
+  float *                           fwork;
+  int16_t *                         qsamples;   // Fixed point: [3][size]
+  int16_t *                         qwindow;
+  int16_t *                         qtwiddle;
+  int16_t *                         qwork;
+};
+
+// Private functions follow
+static bool mgos_imu_spectrum_opts_valid(const struct mgos_imu_spectrum_opts *opts) {
+  if (opts->size < MGOS_IMU_SPECTRUM_MIN_SIZE || opts->size > MGOS_IMU_SPECTRUM_MAX_SIZE || (opts->size & (opts->size - 1))) {
+    return false;
+  }
+  if (opts->odr <= 0 || opts->range < 0 || opts->window > MGOS_IMU_SPECTRUM_WINDOW_RECT) {
+    return false;
+  }
+  if (opts->num_bands > MGOS_IMU_SPECTRUM_MAX_BANDS || opts->num_peaks > MGOS_IMU_SPECTRUM_MAX_PEAKS) {
+    return false;
+  }
+  for (uint8_t i = 0; i < opts->num_bands; i++) {
+    if (opts->band_edges[i] < 0 || opts->band_edges[i + 1] <= opts->band_edges[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static float mgos_imu_spectrum_window(enum mgos_imu_spectrum_window window, uint16_t n, uint16_t size) {
+  float c = cosf(2.f * (float)M_PI * n / size);
+
+  switch (window) {
+  case MGOS_IMU_SPECTRUM_WINDOW_HANN: return 0.5f - 0.5f * c;
+
+  case MGOS_IMU_SPECTRUM_WINDOW_HAMMING: return 0.54f - 0.46f * c;
+
+  case MGOS_IMU_SPECTRUM_WINDOW_RECT: return 1.f;
+  }
+  return 1.f;
+}
+
+static int16_t mgos_imu_spectrum_q15(float v) {
+  long q = lrintf(v * MGOS_IMU_SPECTRUM_Q15_ONE);
+
+  if (q > MGOS_IMU_SPECTRUM_Q15_ONE) {
+    return MGOS_IMU_SPECTRUM_Q15_ONE;
+  }
+  if (q < -MGOS_IMU_SPECTRUM_Q15_ONE) {
+    return -MGOS_IMU_SPECTRUM_Q15_ONE;
+  }
+  return (int16_t)q;
+}
+
+static uint16_t mgos_imu_spectrum_bitrev(uint16_t i, uint8_t bits) {
+  uint16_t r = 0;
+
+  for (uint8_t b = 0; b < bits; b++) {
+    r   = (r << 1) | (i & 1);
+    i >>= 1;
+  }
+  return r;
+}
+
+// In place radix-2 FFT of `m` complex numbers, stored as re,im pairs.
+static void mgos_imu_spectrum_fft_float(struct mgos_imu_spectrum *sp, float *z) {
+  uint16_t m = sp->opts.size / 2, a, b, r, step;
+  float    wr, wi, tr, ti, t;
+
+  for (uint16_t j = 0; j < m; j++) {
+    r = mgos_imu_spectrum_bitrev(j, sp->log2n - 1);
+    if (r > j) {
+      t = z[2 * j]; z[2 * j] = z[2 * r]; z[2 * r] = t;
+      t = z[2 * j + 1]; z[2 * j + 1] = z[2 * r + 1]; z[2 * r + 1] = t;
+    }
+  }
+  for (uint16_t half = 1; half < m; half *= 2) {
+    step = m / half;
+    for (uint16_t k = 0; k < m; k += 2 * half) {
+      for (uint16_t j = 0; j < half; j++) {
+        wr           = sp->ftwiddle[2 * j * step];
+        wi           = sp->ftwiddle[2 * j * step + 1];
+        a            = k + j;
+        b            = a + half;
+        tr           = wr * z[2 * b] - wi * z[2 * b + 1];
+        ti           = wr * z[2 * b + 1] + wi * z[2 * b];
+        z[2 * b]     = z[2 * a] - tr;
+        z[2 * b + 1] = z[2 * a + 1] - ti;
+        z[2 * a]    += tr;
+        z[2 * a + 1] += ti;
+      }
+    }
+  }
+}
+
+// As above, in Q15. Every stage halves its output so that nothing overflows,
+// which leaves the result divided by `m`. Inputs must be within +-16383, as
+// a butterfly can grow a component by sqrt(2).
+static void mgos_imu_spectrum_fft_q15(struct mgos_imu_spectrum *sp, int16_t *z) {
+  uint16_t m = sp->opts.size / 2, a, b, r, step;
+  int32_t  wr, wi, tr, ti;
+  int16_t  t;
+
+  for (uint16_t j = 0; j < m; j++) {
+    r = mgos_imu_spectrum_bitrev(j, sp->log2n - 1);
+    if (r > j) {
+      t = z[2 * j]; z[2 * j] = z[2 * r]; z[2 * r] = t;
+      t = z[2 * j + 1]; z[2 * j + 1] = z[2 * r + 1]; z[2 * r + 1] = t;
+    }
+  }
+  for (uint16_t half = 1; half < m; half *= 2) {
+    step = m / half;
+    for (uint16_t k = 0; k < m; k += 2 * half) {
+      for (uint16_t j = 0; j < half; j++) {
+        wr           = sp->qtwiddle[2 * j * step];
+        wi           = sp->qtwiddle[2 * j * step + 1];
+        a            = k + j;
+        b            = a + half;
+        tr           = (wr * z[2 * b] - wi * z[2 * b + 1] + (1 << 14)) >> 15;
+        ti           = (wr * z[2 * b + 1] + wi * z[2 * b] + (1 << 14)) >> 15;
+        z[2 * b]     = (int16_t)((z[2 * a] - tr) >> 1);
+        z[2 * b + 1] = (int16_t)((z[2 * a + 1] - ti) >> 1);
+        z[2 * a]     = (int16_t)((z[2 * a] + tr) >> 1);
+        z[2 * a + 1] = (int16_t)((z[2 * a + 1] + ti) >> 1);
+      }
+    }
+  }
+}
+
+// Window one axis of the block into `work` and transform it. Returns the
+// RMS of the axis, and leaves |X[k]|^2 of the real FFT in `power`, scaled by
+// `*coef` to G^2.
+static float mgos_imu_spectrum_transform_float(struct mgos_imu_spectrum *sp, int axis, float *coef) {
+  uint16_t n = sp->opts.size, m = n / 2;
+  float *  x = &sp->fsamples[axis * n], *z = sp->fwork;
+  float    mean = 0, ms = 0, d, even_r, even_i, odd_r, odd_i, wr, wi;
+
+  for (uint16_t i = 0; i < n; i++) {
+    mean += x[i];
+  }
+  mean /= n;
+  for (uint16_t i = 0; i < n; i++) {
+    d    = x[i] - mean;
+    ms  += d * d;
+    z[i] = d * sp->fwindow[i];
+  }
+  mgos_imu_spectrum_fft_float(sp, z);
+
+  sp->power[0] = (z[0] + z[1]) * (z[0] + z[1]);
+  sp->power[m] = (z[0] - z[1]) * (z[0] - z[1]);
+  for (uint16_t k = 1; k < m; k++) {
+    even_r       = (z[2 * k] + z[2 * (m - k)]) / 2;
+    even_i       = (z[2 * k + 1] - z[2 * (m - k) + 1]) / 2;
+    odd_r        = (z[2 * k] - z[2 * (m - k)]) / 2;
+    odd_i        = (z[2 * k + 1] + z[2 * (m - k) + 1]) / 2;
+    wr           = sp->ftwiddle[2 * k];
+    wi           = sp->ftwiddle[2 * k + 1];
+    d            = even_r + wr * odd_i + wi * odd_r;
+    even_i       = even_i - (wr * odd_r - wi * odd_i);
+    sp->power[k] = d * d + even_i * even_i;
+  }
+  *coef = 1.f;
+  return sqrtf(ms / n);
+}
+
+static float mgos_imu_spectrum_transform_q15(struct mgos_imu_spectrum *sp, int axis, float *coef) {
+  uint16_t n = sp->opts.size, m = n / 2;
+  int16_t *x = &sp->qsamples[axis * n], *z = sp->qwork;
+  int32_t  sum = 0, d, max = 0, even_r, even_i, odd_r, odd_i, wr, wi, xr, xi;
+  int64_t  ss = 0;
+  int      shift = 0;
+  float    lsb = sp->opts.range / MGOS_IMU_SPECTRUM_Q15_ONE;
+
+  for (uint16_t i = 0; i < n; i++) {
+    sum += x[i];
+  }
+  sum /= n;
+  // Windowed samples fit in 32 bits, and are scaled to use 14 of them, which
+  // leaves the FFT as much precision as it can have.
+  for (uint16_t i = 0; i < n; i++) {
+    d   = x[i] - sum;
+    ss += (int64_t)d * d;
+    d   = (d * sp->qwindow[i] + (1 << 14)) >> 15;
+    if (abs(d) > max) {
+      max = abs(d);
+    }
+  }
+  for (; max > 16383; max >>= 1) {
+    shift--;
+  }
+  for (; max > 0 && max <= 8191; max <<= 1) {
+    shift++;
+  }
+  for (uint16_t i = 0; i < n; i++) {
+    d    = ((x[i] - sum) * sp->qwindow[i] + (1 << 14)) >> 15;
+    z[i] = (int16_t)(shift >= 0 ? d * (1 << shift) : d >> -shift);
+  }
+  mgos_imu_spectrum_fft_q15(sp, z);
+
+  xr           = z[0] + z[1];
+  sp->power[0] = (float)xr * xr;
+  xr           = z[0] - z[1];
+  sp->power[m] = (float)xr * xr;
+  for (uint16_t k = 1; k < m; k++) {
+    even_r       = (z[2 * k] + z[2 * (m - k)]) >> 1;
+    even_i       = (z[2 * k + 1] - z[2 * (m - k) + 1]) >> 1;
+    odd_r        = (z[2 * k] - z[2 * (m - k)]) >> 1;
+    odd_i        = (z[2 * k + 1] + z[2 * (m - k) + 1]) >> 1;
+    wr           = sp->qtwiddle[2 * k];
+    wi           = sp->qtwiddle[2 * k + 1];
+    xr           = even_r + ((wr * odd_i + wi * odd_r + (1 << 14)) >> 15);
+    xi           = even_i - ((wr * odd_r - wi * odd_i + (1 << 14)) >> 15);
+    sp->power[k] = (float)xr * xr + (float)xi * xi;
+  }
+  // Undo the FFT's scaling by 1/m, the block scaling and the Q15 of `range`.
+  *coef = ldexpf(m * lsb, -shift);
+  *coef = *coef * *coef;
+  return lsb * sqrtf((float)ss / n);
+}
+
+static void mgos_imu_spectrum_features(struct mgos_imu_spectrum *sp, int axis) {
+  struct mgos_imu_spectrum_features *f = &sp->features;
+  uint16_t n = sp->opts.size, m = n / 2, peaks[MGOS_IMU_SPECTRUM_MAX_PEAKS], np = 0, lo, hi, j;
+  float    coef, bin = sp->opts.odr / n, a, b, c, delta, sum;
+
+  if (sp->opts.fixed_point) {
+    f->rms[axis] = mgos_imu_spectrum_transform_q15(sp, axis, &coef);
+  } else {
+    f->rms[axis] = mgos_imu_spectrum_transform_float(sp, axis, &coef);
+  }
+
+  // One sided mean square per bin, corrected for the power the window takes
+  // away, so that the bins of a block add up to its RMS squared.
+  coef *= 2.f / (n * sp->win_sum2);
+  for (uint16_t k = 0; k <= m; k++) {
+    sp->power[k] *= (k == 0 || k == m) ? coef / 2 : coef;
+  }
+
+  for (uint8_t i = 0; i < sp->opts.num_bands; i++) {
+    lo  = (uint16_t)ceilf(sp->opts.band_edges[i] / bin);
+    hi  = sp->opts.band_edges[i + 1] / bin > m ? m + 1 : (uint16_t)ceilf(sp->opts.band_edges[i + 1] / bin);
+    sum = 0;
+    for (uint16_t k = lo; k < hi; k++) {
+      sum += sp->power[k];
+    }
+    f->band_energy[axis][i] = sum;
+  }
+
+  // Strongest local maxima, by insertion into a short sorted list.
+  for (uint16_t k = 1; k < m && sp->opts.num_peaks > 0; k++) {
+    if (sp->power[k] <= sp->power[k - 1] || sp->power[k] < sp->power[k + 1]) {
+      continue;
+    }
+    if (np == sp->opts.num_peaks && sp->power[k] <= sp->power[peaks[np - 1]]) {
+      continue;
+    }
+    if (np < sp->opts.num_peaks) {
+      np++;
+    }
+    for (j = np - 1; j > 0 && sp->power[peaks[j - 1]] < sp->power[k]; j--) {
+      peaks[j] = peaks[j - 1];
+    }
+    peaks[j] = k;
+  }
+  // Interpolate between bins with a parabola through the peak's magnitudes.
+  for (uint16_t i = 0; i < np; i++) {
+    a     = sqrtf(sp->power[peaks[i] - 1]);
+    b     = sqrtf(sp->power[peaks[i]]);
+    c     = sqrtf(sp->power[peaks[i] + 1]);
+    delta = (a - 2 * b + c) != 0 ? 0.5f * (a - c) / (a - 2 * b + c) : 0;
+    f->peak_freq[axis][i] = (peaks[i] + delta) * bin;
+    // A sine of amplitude A shows as A * win_sum / 2 in its bin.
+    f->peak_amp[axis][i] = (b - (a - c) * delta / 4) * sqrtf(n * sp->win_sum2 / 2) * 2 / sp->win_sum;
+  }
+}
+
+static void mgos_imu_spectrum_block(struct mgos_imu_spectrum *sp) {
+  memset(&sp->features, 0, sizeof(sp->features));
+  sp->features.block = sp->blocks++;
+  for (int axis = 0; axis < 3; axis++) {
+    mgos_imu_spectrum_features(sp, axis);
+  }
+  sp->have_features = true;
+  if (sp->cb) {
+    sp->cb(sp, &sp->features, sp->cb_arg);
+  }
+}
+
+// Private functions end
+
+// Public functions follow
+struct mgos_imu_spectrum *mgos_imu_spectrum_create(const struct mgos_imu_spectrum_opts *opts, mgos_imu_spectrum_cb cb, void *user_data) {
+  struct mgos_imu_spectrum *sp;
+  uint16_t n;
+  size_t   floats, shorts;
+  float    w;
+
+  if (!opts || !mgos_imu_spectrum_opts_valid(opts)) {
+    return NULL;
+  }
+  n      = opts->size;
+  floats = n / 2 + 1;
+  shorts = 0;
+  if (opts->fixed_point) {
+    shorts += 3 * n + n + n + n;
+  } else {
+    floats += 3 * n + n + n + n;
+  }
+
+  sp = calloc(1, sizeof(struct mgos_imu_spectrum) + floats * sizeof(float) + shorts * sizeof(int16_t));
+  if (!sp) {
+    return NULL;
+  }
+  sp->opts   = *opts;
+  sp->cb     = cb;
+  sp->cb_arg = user_data;
+  if (sp->opts.range == 0) {
+    sp->opts.range = MGOS_IMU_SPECTRUM_DEFAULT_RANGE;
+  }
+  for (sp->log2n = 0; (1 << sp->log2n) < n; sp->log2n++) {
+  }
+
+  sp->power = (float *)(sp + 1);
+  if (opts->fixed_point) {
+    sp->qsamples = (int16_t *)(sp->power + n / 2 + 1);
+    sp->qwindow  = sp->qsamples + 3 * n;
+    sp->qtwiddle = sp->qwindow + n;
+    sp->qwork    = sp->qtwiddle + n;
+  } else {
+    sp->fsamples = sp->power + n / 2 + 1;
+    sp->fwindow  = sp->fsamples + 3 * n;
+    sp->ftwiddle = sp->fwindow + n;
+    sp->fwork    = sp->ftwiddle + n;
+  }
+
+  for (uint16_t i = 0; i < n; i++) {
+    w             = mgos_imu_spectrum_window(sp->opts.window, i, n);
+    sp->win_sum  += w;
+    sp->win_sum2 += w * w;
+    if (opts->fixed_point) {
+      sp->qwindow[i] = mgos_imu_spectrum_q15(w);
+    } else {
+      sp->fwindow[i] = w;
+    }
+  }
+  for (uint16_t k = 0; k < n / 2; k++) {
+    w = 2.f * (float)M_PI * k / n;
+    if (opts->fixed_point) {
+      sp->qtwiddle[2 * k]     = mgos_imu_spectrum_q15(cosf(w));
+      sp->qtwiddle[2 * k + 1] = mgos_imu_spectrum_q15(-sinf(w));
+    } else {
+      sp->ftwiddle[2 * k]     = cosf(w);
+      sp->ftwiddle[2 * k + 1] = -sinf(w);
+    }
+  }
+  return sp;
+}
+
+bool mgos_imu_spectrum_destroy(struct mgos_imu_spectrum **sp) {
+  if (!sp || !*sp) {
+    return false;
+  }
+  free(*sp);
+  *sp = NULL;
+  return true;
+}
+
+bool mgos_imu_spectrum_add(struct mgos_imu_spectrum *sp, const float *xyz, size_t n) {
+  uint16_t size;
+
+  if (!sp || (!xyz && n > 0)) {
+    return false;
+  }
+  size = sp->opts.size;
+  for (size_t i = 0; i < n; i++) {
+    for (int axis = 0; axis < 3; axis++) {
+      if (sp->opts.fixed_point) {
+        sp->qsamples[axis * size + sp->fill] = mgos_imu_spectrum_q15(xyz[i * 3 + axis] / sp->opts.range);
+      } else {
+        sp->fsamples[axis * size + sp->fill] = xyz[i * 3 + axis];
+      }
+    }
+    if (++sp->fill == size) {
+      sp->fill = 0;
+      mgos_imu_spectrum_block(sp);
+    }
+  }
+  return true;
+}
+
+bool mgos_imu_spectrum_read(struct mgos_imu *imu, struct mgos_imu_spectrum *sp) {
+  float v[3];
+
+  if (!sp || !mgos_imu_accelerometer_get(imu, &v[0], &v[1], &v[2])) {
+    return false;
+  }
+  // A repeat of the previous sample would skew the block's spectrum.
+  if (imu->acc->stale) {
+    return true;
+  }
+  return mgos_imu_spectrum_add(sp, v, 1);
+}
+
+bool mgos_imu_spectrum_reset(struct mgos_imu_spectrum *sp) {
+  if (!sp) {
+    return false;
+  }
+  sp->fill = 0;
+  return true;
+}
+
+bool mgos_imu_spectrum_get(struct mgos_imu_spectrum *sp, struct mgos_imu_spectrum_features *features) {
+  if (!sp || !features || !sp->have_features) {
+    return false;
+  }
+  *features = sp->features;
+  return true;
+}
+
+// Public functions end
@@ -0,0 +1,219 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mgos.h"
+#include "mgos_imu_internal.h"
+#include "madgwick.h"
+#include <stdio.h>
+
+#define MGOS_IMU_STATE_MAGIC      (0x53554d49) /* "IMUS" */
+#define MGOS_IMU_STATE_VERSION    (1)
+
+#define MGOS_IMU_STATE_F_GYRO     (0x01)
+#define MGOS_IMU_STATE_F_ACC      (0x02)
+#define MGOS_IMU_STATE_F_MAG      (0x04)
+#define MGOS_IMU_STATE_F_FILTER   (0x08)
+
+// All members are 4 bytes wide, so there is no padding to worry about.
+struct mgos_imu_state_blob {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t flags;
+
+  uint32_t gyro_key;
+  float    gyro_offset[3];
+  float    gyro_orientation[9];
+
+  uint32_t acc_key;
+  float    acc_offset[3];
+
+  uint32_t mag_key;
+  float    mag_bias[3];
+  float    mag_orientation[9];
+
+  float    q[4];
+  float    beta;
+  float    freq;
+
+  uint32_t checksum;
+};
+
+// Private functions follow
+// FNV-1a over everything but the trailing checksum.
+static uint32_t mgos_imu_state_checksum(const struct mgos_imu_state_blob *blob) {
+  const uint8_t *p   = (const uint8_t *)blob;
+  uint32_t       sum = 2166136261u;
+
+  for (size_t i = 0; i < offsetof(struct mgos_imu_state_blob, checksum); i++) {
+    sum ^= p[i];
+    sum *= 16777619u;
+  }
+  return sum;
+}
+
+// Sections are keyed by sensor type and I2C address, so that a blob is never
+// applied to a different chip than the one it was taken from.
+static uint32_t mgos_imu_state_key(uint32_t type, uint8_t i2caddr) {
+  return (type << 8) | i2caddr;
+}
+// Private functions end
+
+// Public functions follow
+bool mgos_imu_state_serialize(struct mgos_imu *imu, struct mgos_imu_madgwick *filter, void *buf, size_t *len) {
+  struct mgos_imu_state_blob blob;
+
+  if (!imu || !buf || !len) {
+    return false;
+  }
+  if (*len < sizeof(blob) || sizeof(blob) > MGOS_IMU_STATE_SIZE) {
+    return false;
+  }
+
+  memset(&blob, 0, sizeof(blob));
+  blob.magic   = MGOS_IMU_STATE_MAGIC;
+  blob.version = MGOS_IMU_STATE_VERSION;
+
+  if (imu->gyro) {
+    blob.flags         |= MGOS_IMU_STATE_F_GYRO;
+    blob.gyro_key       = mgos_imu_state_key(imu->gyro->opts.type, imu->gyro->i2caddr);
+    blob.gyro_offset[0] = imu->gyro->offset_gx;
+    blob.gyro_offset[1] = imu->gyro->offset_gy;
+    blob.gyro_offset[2] = imu->gyro->offset_gz;
+    memcpy(blob.gyro_orientation, imu->gyro->orientation, sizeof(blob.gyro_orientation));
+  }
+  if (imu->acc) {
+    blob.flags        |= MGOS_IMU_STATE_F_ACC;
+    blob.acc_key       = mgos_imu_state_key(imu->acc->opts.type, imu->acc->i2caddr);
+    blob.acc_offset[0] = imu->acc->offset_ax;
+    blob.acc_offset[1] = imu->acc->offset_ay;
+    blob.acc_offset[2] = imu->acc->offset_az;
+  }
+  if (imu->mag) {
+    blob.flags  |= MGOS_IMU_STATE_F_MAG;
+    blob.mag_key = mgos_imu_state_key(imu->mag->opts.type, imu->mag->i2caddr);
+    memcpy(blob.mag_bias, imu->mag->bias, sizeof(blob.mag_bias));
+    memcpy(blob.mag_orientation, imu->mag->orientation, sizeof(blob.mag_orientation));
+  }
+  if (filter) {
+    blob.flags |= MGOS_IMU_STATE_F_FILTER;
+    blob.q[0]   = filter->q0;
+    blob.q[1]   = filter->q1;
+    blob.q[2]   = filter->q2;
+    blob.q[3]   = filter->q3;
+    blob.beta   = filter->beta;
+    blob.freq   = filter->freq;
+  }
+  blob.checksum = mgos_imu_state_checksum(&blob);
+
+  memcpy(buf, &blob, sizeof(blob));
+  *len = sizeof(blob);
+  return true;
+}
+
+bool mgos_imu_state_restore(struct mgos_imu *imu, struct mgos_imu_madgwick *filter, const void *buf, size_t len) {
+  struct mgos_imu_state_blob blob;
+
+  if (!imu || !buf || len < sizeof(blob)) {
+    return false;
+  }
+  memcpy(&blob, buf, sizeof(blob));
+  if (blob.magic != MGOS_IMU_STATE_MAGIC || blob.version != MGOS_IMU_STATE_VERSION) {
+    LOG(LL_INFO, ("IMU state has unknown magic/version, ignoring"));
+    return false;
+  }
+  if (blob.checksum != mgos_imu_state_checksum(&blob)) {
+    LOG(LL_WARN, ("IMU state has bad checksum, ignoring"));
+    return false;
+  }
+
+  if (imu->gyro && (blob.flags & MGOS_IMU_STATE_F_GYRO)) {
+    if (blob.gyro_key == mgos_imu_state_key(imu->gyro->opts.type, imu->gyro->i2caddr)) {
+      imu->gyro->offset_gx = blob.gyro_offset[0];
+      imu->gyro->offset_gy = blob.gyro_offset[1];
+      imu->gyro->offset_gz = blob.gyro_offset[2];
+      memcpy(imu->gyro->orientation, blob.gyro_orientation, sizeof(blob.gyro_orientation));
+    } else {
+      LOG(LL_INFO, ("IMU state was taken from a different gyroscope, skipping"));
+    }
+  }
+  if (imu->acc && (blob.flags & MGOS_IMU_STATE_F_ACC)) {
+    if (blob.acc_key == mgos_imu_state_key(imu->acc->opts.type, imu->acc->i2caddr)) {
+      imu->acc->offset_ax = blob.acc_offset[0];
+      imu->acc->offset_ay = blob.acc_offset[1];
+      imu->acc->offset_az = blob.acc_offset[2];
+    } else {
+      LOG(LL_INFO, ("IMU state was taken from a different accelerometer, skipping"));
+    }
+  }
+  if (imu->mag && (blob.flags & MGOS_IMU_STATE_F_MAG)) {
+    if (blob.mag_key == mgos_imu_state_key(imu->mag->opts.type, imu->mag->i2caddr)) {
+      memcpy(imu->mag->bias, blob.mag_bias, sizeof(blob.mag_bias));
+      memcpy(imu->mag->orientation, blob.mag_orientation, sizeof(blob.mag_orientation));
+    } else {
+      LOG(LL_INFO, ("IMU state was taken from a different magnetometer, skipping"));
+    }
+  }
+  if (filter && (blob.flags & MGOS_IMU_STATE_F_FILTER)) {
+    mgos_imu_madgwick_set_params(filter, blob.freq, blob.beta);
+    filter->q0 = blob.q[0];
+    filter->q1 = blob.q[1];
+    filter->q2 = blob.q[2];
+    filter->q3 = blob.q[3];
+  }
+  return true;
+}
+
+bool mgos_imu_state_save(struct mgos_imu *imu, struct mgos_imu_madgwick *filter, const char *filename) {
+  uint8_t buf[MGOS_IMU_STATE_SIZE];
+  size_t  len = sizeof(buf);
+  FILE *  fp;
+  bool    ret;
+
+  if (!filename || !mgos_imu_state_serialize(imu, filter, buf, &len)) {
+    return false;
+  }
+  if (!(fp = fopen(filename, "wb"))) {
+    LOG(LL_ERROR, ("Could not open %s for writing", filename));
+    return false;
+  }
+  ret = (fwrite(buf, 1, len, fp) == len);
+  if (fclose(fp) != 0) {
+    ret = false;
+  }
+  if (!ret) {
+    LOG(LL_ERROR, ("Could not write IMU state to %s", filename));
+  }
+  return ret;
+}
+
+bool mgos_imu_state_load(struct mgos_imu *imu, struct mgos_imu_madgwick *filter, const char *filename) {
+  uint8_t buf[MGOS_IMU_STATE_SIZE];
+  size_t  len;
+  FILE *  fp;
+
+  if (!imu || !filename) {
+    return false;
+  }
+  if (!(fp = fopen(filename, "rb"))) {
+    LOG(LL_DEBUG, ("No IMU state in %s", filename));
+    return false;
+  }
+  len = fread(buf, 1, sizeof(buf), fp);
+  fclose(fp);
+  return mgos_imu_state_restore(imu, filter, buf, len);
+}
+
+// Public functions end
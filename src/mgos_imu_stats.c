@@ -0,0 +1,197 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mgos.h"
+#include "mgos_imu_internal.h"
+#include "madgwick.h"
+
+#define MGOS_IMU_STATS_BUCKET0_US    (64)
+
+// Private functions follow
+static void mgos_imu_stats_clear(struct mgos_imu_counters *stats) {
+  if (!stats) {
+    return;
+  }
+  memset(stats, 0, sizeof(*stats));
+  stats->latency_min_us = UINT32_MAX;
+}
+
+// Allocates or frees `*stats`, and resets it.
+static bool mgos_imu_stats_setup(struct mgos_imu_counters **stats, bool enable) {
+  if (!enable) {
+    free(*stats);
+    *stats = NULL;
+    return true;
+  }
+  if (!*stats) {
+    *stats = calloc(1, sizeof(struct mgos_imu_counters));
+    if (!*stats) {
+      return false;
+    }
+  }
+  mgos_imu_stats_clear(*stats);
+  return true;
+}
+
+static void mgos_imu_stats_copy(const struct mgos_imu_counters *stats, struct mgos_imu_sensor_stats *out) {
+  memset(out, 0, sizeof(*out));
+  if (!stats) {
+    return;
+  }
+  out->reads       = stats->reads;
+  out->read_errors = stats->read_errors;
+  out->i2c_bytes   = stats->i2c_bytes;
+  out->overruns    = stats->overruns;
+  out->clipped     = stats->clipped;
+  if (stats->reads + stats->read_errors > 0) {
+    out->latency_min_us = stats->latency_min_us;
+    out->latency_avg_us = (uint32_t)(stats->latency_sum_us / (stats->reads + stats->read_errors));
+    out->latency_max_us = stats->latency_max_us;
+  }
+  memcpy(out->latency_hist, stats->latency_hist, sizeof(out->latency_hist));
+}
+
+static void mgos_imu_stats_filter_clear(struct mgos_imu_madgwick *filter) {
+  filter->fusion_cycles = 0;
+  filter->fusion_max_us = 0;
+  filter->fusion_us     = 0;
+  filter->conversions   = 0;
+  filter->conversion_us = 0;
+}
+
+// Private functions end
+
+// Public functions follow
+int64_t mgos_imu_stats_start(struct mgos_imu_counters *stats) {
+  if (!stats) {
+    return 0;
+  }
+  return mgos_uptime_micros();
+}
+
+void mgos_imu_stats_read(struct mgos_imu_counters *stats, int64_t start, bool ok) {
+  uint32_t us;
+  int      bucket;
+
+  if (!stats) {
+    return;
+  }
+  us = (uint32_t)(mgos_uptime_micros() - start);
+  if (ok) {
+    stats->reads++;
+  } else {
+    stats->read_errors++;
+  }
+  stats->latency_sum_us += us;
+  if (us < stats->latency_min_us) {
+    stats->latency_min_us = us;
+  }
+  if (us > stats->latency_max_us) {
+    stats->latency_max_us = us;
+  }
+  for (bucket = 0; bucket < MGOS_IMU_STATS_BUCKETS - 1; bucket++) {
+    if (us < (uint32_t)(MGOS_IMU_STATS_BUCKET0_US << bucket)) {
+      break;
+    }
+  }
+  stats->latency_hist[bucket]++;
+}
+
+void mgos_imu_stats_i2c(struct mgos_imu_counters *stats, uint32_t bytes) {
+  if (!stats) {
+    return;
+  }
+  stats->i2c_bytes += bytes;
+}
+
+void mgos_imu_stats_overrun(struct mgos_imu_counters *stats) {
+  if (!stats) {
+    return;
+  }
+  stats->overruns++;
+}
+
+void mgos_imu_stats_clipped(struct mgos_imu_counters *stats) {
+  if (!stats) {
+    return;
+  }
+  stats->clipped++;
+}
+
+bool mgos_imu_stats_enable(struct mgos_imu *imu, struct mgos_imu_madgwick *filter, bool enable) {
+  bool ret = true;
+
+  if (!imu) {
+    return false;
+  }
+  if (imu->acc) {
+    ret &= mgos_imu_stats_setup(&imu->acc->stats, enable);
+  }
+  if (imu->gyro) {
+    ret &= mgos_imu_stats_setup(&imu->gyro->stats, enable);
+  }
+  if (imu->mag) {
+    ret &= mgos_imu_stats_setup(&imu->mag->stats, enable);
+  }
+  if (filter) {
+    filter->stats = enable;
+    mgos_imu_stats_filter_clear(filter);
+  }
+  return ret;
+}
+
+bool mgos_imu_get_stats(struct mgos_imu *imu, struct mgos_imu_madgwick *filter, struct mgos_imu_stats *stats) {
+  if (!imu || !stats) {
+    return false;
+  }
+  memset(stats, 0, sizeof(*stats));
+  mgos_imu_stats_copy(imu->acc ? imu->acc->stats : NULL, &stats->acc);
+  mgos_imu_stats_copy(imu->gyro ? imu->gyro->stats : NULL, &stats->gyro);
+  mgos_imu_stats_copy(imu->mag ? imu->mag->stats : NULL, &stats->mag);
+  if (filter) {
+    stats->fusion.cycles       = filter->fusion_cycles;
+    stats->fusion.cycle_max_us = filter->fusion_max_us;
+    stats->fusion.conversions  = filter->conversions;
+    if (filter->fusion_cycles) {
+      stats->fusion.cycle_avg_us = (uint32_t)(filter->fusion_us / filter->fusion_cycles);
+    }
+    if (filter->conversions) {
+      stats->fusion.conversion_avg_us = (uint32_t)(filter->conversion_us / filter->conversions);
+    }
+  }
+  return true;
+}
+
+bool mgos_imu_reset_stats(struct mgos_imu *imu, struct mgos_imu_madgwick *filter) {
+  if (!imu) {
+    return false;
+  }
+  if (imu->acc) {
+    mgos_imu_stats_clear(imu->acc->stats);
+  }
+  if (imu->gyro) {
+    mgos_imu_stats_clear(imu->gyro->stats);
+  }
+  if (imu->mag) {
+    mgos_imu_stats_clear(imu->mag->stats);
+  }
+  if (filter) {
+    mgos_imu_stats_filter_clear(filter);
+  }
+  return true;
+}
+
+// Public functions end
@@ -0,0 +1,129 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mgos.h"
+
+#define TEST_TIMERS    (16)
+
+struct test_timer {
+  bool           used;
+  int64_t        due;
+  int64_t        period;
+  timer_callback cb;
+  void *         arg;
+};
+
+static int64_t           s_now_us;
+static struct test_timer s_timers[TEST_TIMERS];
+
+mgos_timer_id mgos_set_timer(int msecs, int flags, timer_callback cb, void *arg) {
+  for (int i = 0; i < TEST_TIMERS; i++) {
+    struct test_timer *t = &s_timers[i];
+    if (t->used) {
+      continue;
+    }
+    t->used   = true;
+    t->due    = s_now_us + (int64_t)msecs * 1000;
+    t->period = (flags & MGOS_TIMER_REPEAT) ? (int64_t)msecs * 1000 : 0;
+    t->cb     = cb;
+    t->arg    = arg;
+    return i + 1;
+  }
+  return MGOS_INVALID_TIMER_ID;
+}
+
+void mgos_clear_timer(mgos_timer_id id) {
+  if (id > 0 && id <= TEST_TIMERS) {
+    s_timers[id - 1].used = false;
+  }
+}
+
+void mgos_usleep(uint32_t usecs) {
+  s_now_us += usecs;
+}
+
+int64_t mgos_uptime_micros(void) {
+  return s_now_us;
+}
+
+// There is no second task on the host, so callbacks run right away.
+bool mgos_invoke_cb(mgos_cb_t cb, void *arg, bool from_isr) {
+  cb(arg);
+  return true;
+
+  (void)from_isr;
+}
+
+bool mgos_gpio_setup_input(int pin, enum mgos_gpio_pull_type pull) {
+  return true;
+
+  (void)pin;
+  (void)pull;
+}
+
+bool mgos_gpio_set_int_handler(int pin, enum mgos_gpio_int_mode mode, mgos_gpio_int_handler_f cb, void *arg) {
+  return true;
+
+  (void)pin;
+  (void)mode;
+  (void)cb;
+  (void)arg;
+}
+
+bool mgos_gpio_enable_int(int pin) {
+  return true;
+
+  (void)pin;
+}
+
+bool mgos_gpio_disable_int(int pin) {
+  return true;
+
+  (void)pin;
+}
+
+void mgos_gpio_clear_int(int pin) {
+  (void)pin;
+}
+
+void mgos_gpio_remove_int_handler(int pin, mgos_gpio_int_handler_f *old_cb, void **old_arg) {
+  (void)pin;
+  (void)old_cb;
+  (void)old_arg;
+}
+
+void test_advance(uint32_t usecs) {
+  s_now_us += usecs;
+}
+
+int test_run_timers(void) {
+  int ran = 0;
+
+  for (int i = 0; i < TEST_TIMERS; i++) {
+    struct test_timer *t = &s_timers[i];
+    if (!t->used || t->due > s_now_us) {
+      continue;
+    }
+    if (t->period > 0) {
+      t->due += t->period;
+    } else {
+      t->used = false;
+    }
+    t->cb(t->arg);
+    ran++;
+  }
+  return ran;
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host stand-in for the parts of the mgos API used by the library, so that
+// the tests build with a plain C compiler. Time is virtual: it only moves in
+// mgos_usleep() and test_advance(), and timers fire from test_run_timers().
+
+#pragma once
+
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum cs_log_level {
+  LL_NONE          = -1,
+  LL_ERROR         = 0,
+  LL_WARN          = 1,
+  LL_INFO          = 2,
+  LL_DEBUG         = 3,
+  LL_VERBOSE_DEBUG = 4,
+};
+
+#define LOG(l, x)    do { if (0) { printf x; } } while (0)
+
+typedef uintptr_t mgos_timer_id;
+typedef void (*timer_callback)(void *arg);
+typedef void (*mgos_cb_t)(void *arg);
+
+#define MGOS_INVALID_TIMER_ID    (0)
+#define MGOS_TIMER_REPEAT        (1)
+
+mgos_timer_id mgos_set_timer(int msecs, int flags, timer_callback cb, void *arg);
+void mgos_clear_timer(mgos_timer_id id);
+void mgos_usleep(uint32_t usecs);
+int64_t mgos_uptime_micros(void);
+bool mgos_invoke_cb(mgos_cb_t cb, void *arg, bool from_isr);
+
+enum mgos_gpio_pull_type {
+  MGOS_GPIO_PULL_NONE,
+  MGOS_GPIO_PULL_UP,
+  MGOS_GPIO_PULL_DOWN,
+};
+
+enum mgos_gpio_int_mode {
+  MGOS_GPIO_INT_NONE,
+  MGOS_GPIO_INT_EDGE_POS,
+  MGOS_GPIO_INT_EDGE_NEG,
+  MGOS_GPIO_INT_EDGE_ANY,
+};
+
+typedef void (*mgos_gpio_int_handler_f)(int pin, void *arg);
+
+bool mgos_gpio_setup_input(int pin, enum mgos_gpio_pull_type pull);
+bool mgos_gpio_set_int_handler(int pin, enum mgos_gpio_int_mode mode, mgos_gpio_int_handler_f cb, void *arg);
+bool mgos_gpio_enable_int(int pin);
+bool mgos_gpio_disable_int(int pin);
+void mgos_gpio_clear_int(int pin);
+void mgos_gpio_remove_int_handler(int pin, mgos_gpio_int_handler_f *old_cb, void **old_arg);
+
+// Test helpers
+// Move the virtual clock forward by `usecs`.
+void test_advance(uint32_t usecs);
+
+// Run the timers that are due, in order. Returns the number run.
+int test_run_timers(void);
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Minimal checks for the host tests. A failed check prints its location and
+// marks the test as failed, and the test carries on with the next check.
+
+#pragma once
+
+#include <math.h>
+#include <stdio.h>
+
+static int s_test_failures;
+
+#define TEST_CHECK(cond)                                                \
+  do {                                                                  \
+    if (!(cond)) {                                                      \
+      printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);   \
+      s_test_failures++;                                                \
+    }                                                                   \
+  } while (0)
+
+#define TEST_CHECK_NEAR(a, b, tol)                                      \
+  do {                                                                  \
+    double _a = (a), _b = (b);                                          \
+    if (!(fabs(_a - _b) <= (tol))) {                                    \
+      printf("%s:%d: check failed: %s = %g, %s = %g, tolerance %g\n",   \
+             __FILE__, __LINE__, #a, _a, #b, _b, (double)(tol));        \
+      s_test_failures++;                                                \
+    }                                                                   \
+  } while (0)
+
+// Print the result of the test, and return its exit status.
+static inline int test_done(const char *name) {
+  printf("%s: %s\n", name, s_test_failures ? "FAIL" : "PASS");
+  return s_test_failures ? 1 : 0;
+}
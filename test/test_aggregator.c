@@ -0,0 +1,116 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Check the aggregator statistics on a small exact case, its accuracy over a
+// long window on a large offset, and closing windows by count, by time and by
+// flush.
+
+#include "mgos_imu.h"
+#include "test.h"
+
+static int                       s_closed;
+static struct mgos_imu_aggregate s_last;
+
+static void aggregator_cb(struct mgos_imu_aggregator *agg, const struct mgos_imu_aggregate *a, void *user_data) {
+  TEST_CHECK(a->window == (uint32_t)s_closed);
+  s_closed++;
+  s_last = *a;
+  (void)agg;
+  (void)user_data;
+}
+
+static void test_exact(void) {
+  struct mgos_imu_aggregator_opts opts = { .window_samples = 4 };
+  struct mgos_imu_aggregator *    agg;
+  struct mgos_imu_aggregate       a;
+  float xyz[4 * 3] = { 1, -1, 0, 2, -2, 0, 3, -3, 0, 4, -4, 0 };
+
+  TEST_CHECK(mgos_imu_aggregator_create(&(struct mgos_imu_aggregator_opts){ 0 }, NULL, NULL) == NULL);
+  agg      = mgos_imu_aggregator_create(&opts, aggregator_cb, NULL);
+  s_closed = 0;
+  TEST_CHECK(!mgos_imu_aggregator_get(agg, &a));
+  TEST_CHECK(mgos_imu_aggregator_add(agg, xyz, 4));
+  TEST_CHECK(s_closed == 1);
+  TEST_CHECK(mgos_imu_aggregator_get(agg, &a));
+  TEST_CHECK(a.count == 4);
+  TEST_CHECK(a.min[0] == 1 && a.max[0] == 4 && a.p2p[0] == 3);
+  TEST_CHECK(a.min[1] == -4 && a.max[1] == -1);
+  TEST_CHECK_NEAR(a.mean[0], 2.5, 1e-6);
+  TEST_CHECK_NEAR(a.mean[1], -2.5, 1e-6);
+  TEST_CHECK_NEAR(a.stddev[0], sqrt(1.25), 1e-6);
+  TEST_CHECK_NEAR(a.rms[0], sqrt(7.5), 1e-6);
+  TEST_CHECK(a.stddev[2] == 0 && a.rms[2] == 0);
+
+  // A partial window only closes on flush, and an empty one not at all.
+  TEST_CHECK(mgos_imu_aggregator_add(agg, xyz, 2));
+  TEST_CHECK(s_closed == 1);
+  TEST_CHECK(mgos_imu_aggregator_flush(agg));
+  TEST_CHECK(s_closed == 2);
+  TEST_CHECK(s_last.count == 2);
+  TEST_CHECK(mgos_imu_aggregator_flush(agg));
+  TEST_CHECK(s_closed == 2);
+  mgos_imu_aggregator_destroy(&agg);
+  TEST_CHECK(agg == NULL);
+}
+
+// Summing squares in float would lose the small variance under a 9.81 offset.
+static void test_accuracy(void) {
+  struct mgos_imu_aggregator_opts opts = { .window_samples = 100000 };
+  struct mgos_imu_aggregator *    agg  = mgos_imu_aggregator_create(&opts, NULL, NULL);
+  struct mgos_imu_aggregate       a;
+
+  for (int i = 0; i < 100000; i++) {
+    float v[3] = { 1.0f + 0.001f * sinf(i * 0.1f), 0, 9.81f + ((i & 1) ? 0.01f : -0.01f) };
+    mgos_imu_aggregator_add(agg, v, 1);
+  }
+  TEST_CHECK(mgos_imu_aggregator_get(agg, &a));
+  TEST_CHECK(a.count == 100000);
+  TEST_CHECK_NEAR(a.mean[2], 9.81, 1e-4);
+  TEST_CHECK_NEAR(a.stddev[2], 0.01, 1e-5);
+  TEST_CHECK_NEAR(a.p2p[2], 0.02, 1e-5);
+  TEST_CHECK_NEAR(a.rms[2], sqrt(9.81 * 9.81 + 0.0001), 1e-4);
+  TEST_CHECK_NEAR(a.stddev[0], 0.001 * M_SQRT1_2, 1e-5);
+  mgos_imu_aggregator_destroy(&agg);
+}
+
+// One sample every 10ms in 100ms windows: a window closes when the first
+// sample 100ms after its start arrives, which starts the next one.
+static void test_time_window(void) {
+  struct mgos_imu_aggregator_opts opts = { .window_ms = 100 };
+  struct mgos_imu_aggregator *    agg  = mgos_imu_aggregator_create(&opts, aggregator_cb, NULL);
+  float   v[3]  = { 0, 0, 1 };
+  int64_t start = mgos_uptime_micros();
+
+  s_closed = 0;
+  for (int i = 0; i < 35; i++) {
+    test_advance(10000);
+    mgos_imu_aggregator_add(agg, v, 1);
+  }
+  TEST_CHECK(s_closed == 3);
+  TEST_CHECK(s_last.count == 10);
+  TEST_CHECK(s_last.start_us == start + 210000);
+  mgos_imu_aggregator_flush(agg);
+  TEST_CHECK(s_closed == 4);
+  TEST_CHECK(s_last.count == 5);
+  mgos_imu_aggregator_destroy(&agg);
+}
+
+int main(void) {
+  test_exact();
+  test_accuracy();
+  test_time_window();
+  return test_done("aggregator");
+}
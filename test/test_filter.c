@@ -0,0 +1,153 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Check the filter chain stages against their design responses, and that a
+// magnetometer which returns its previous sample while converting only feeds
+// fresh samples into the chain and the aggregator.
+
+#include "mgos_i2c.h"
+#include "mgos_imu.h"
+#include "mgos_imu_i2c_sim.h"
+#include "test.h"
+
+#define ODR    (1000.0f)
+
+// Steady state peak gain of `stage` on `axis`, for a sine of `freq` Hz fed to
+// all axes.
+static float gain(const struct mgos_imu_filter_stage *stage, float freq, int axis) {
+  static float            buf[2000 * 3];
+  struct mgos_imu_filter *filter = mgos_imu_filter_create(stage, 1, ODR);
+  float peak = 0;
+
+  for (int i = 0; i < 2000; i++) {
+    buf[i * 3] = buf[i * 3 + 1] = buf[i * 3 + 2] = sinf(2 * M_PI * freq * i / ODR);
+  }
+  mgos_imu_filter_process(filter, buf, 2000);
+  for (int i = 1500; i < 2000; i++) {
+    peak = fmaxf(peak, fabsf(buf[i * 3 + axis]));
+  }
+  mgos_imu_filter_destroy(&filter);
+  return peak;
+}
+
+static void test_biquad(void) {
+  struct mgos_imu_filter_stage lowpass = { .type = MGOS_IMU_FILTER_LOWPASS, .freq = 20 };
+  struct mgos_imu_filter_stage notch   = { .type = MGOS_IMU_FILTER_NOTCH, .freq = 50, .q = 5, .axes = MGOS_IMU_FILTER_AXIS_Z };
+
+  TEST_CHECK_NEAR(gain(&lowpass, 2, 0), 1.0, 0.01);
+  TEST_CHECK_NEAR(gain(&lowpass, 20, 0), M_SQRT1_2, 0.01);
+  TEST_CHECK(gain(&lowpass, 200, 0) < 0.01);
+  TEST_CHECK(gain(&notch, 50, 2) < 0.001);
+  TEST_CHECK(gain(&notch, 30, 2) > 0.95);
+  TEST_CHECK(gain(&notch, 80, 2) > 0.95);
+  // Axes outside the mask pass through.
+  TEST_CHECK_NEAR(gain(&notch, 50, 0), 1.0, 1e-6);
+  // Cutoffs at or above Nyquist are refused.
+  TEST_CHECK(mgos_imu_filter_create(&lowpass, 1, 30) == NULL);
+}
+
+static void test_biquad_odr(void) {
+  struct mgos_imu_filter_stage lowpass = { .type = MGOS_IMU_FILTER_LOWPASS, .freq = 20 };
+  struct mgos_imu_filter *     filter  = mgos_imu_filter_create(&lowpass, 1, ODR);
+  float v[3] = { 3, 3, 3 };
+
+  // The first sample primes the state, so a constant input passes unchanged.
+  mgos_imu_filter_process(filter, v, 1);
+  TEST_CHECK(v[0] == 3);
+  // Below twice the cutoff the stage is bypassed, and primed again after.
+  mgos_imu_filter_set_odr(filter, 30);
+  v[0] = 9;
+  mgos_imu_filter_process(filter, v, 1);
+  TEST_CHECK(v[0] == 9);
+  mgos_imu_filter_set_odr(filter, ODR);
+  v[0] = 4;
+  mgos_imu_filter_process(filter, v, 1);
+  TEST_CHECK_NEAR(v[0], 4, 1e-5);
+  mgos_imu_filter_destroy(&filter);
+}
+
+static void test_median(void) {
+  struct mgos_imu_filter_stage stages[2] = {
+    { .type = MGOS_IMU_FILTER_MEDIAN,     .len = 3 },
+    { .type = MGOS_IMU_FILTER_MOVING_AVG, .len = 4 },
+  };
+  struct mgos_imu_filter *     filter;
+  float in[9]     = { 1, 1, 100, 1, 5, 5, 5, 5, 5 };
+  float expect[9] = { 1, 1, 1, 1, 2, 3, 4, 5, 5 };
+  float v[9 * 3];
+
+  // Even median lengths have no middle sample.
+  TEST_CHECK(mgos_imu_filter_create(&(struct mgos_imu_filter_stage){ .type = MGOS_IMU_FILTER_MEDIAN, .len = 4 }, 1, ODR) == NULL);
+  filter = mgos_imu_filter_create(stages, 2, 100);
+  TEST_CHECK(filter != NULL);
+  for (int i = 0; i < 9; i++) {
+    v[i * 3] = v[i * 3 + 1] = v[i * 3 + 2] = in[i];
+  }
+  mgos_imu_filter_process(filter, v, 9);
+  // The spike is rejected, and the step is averaged in over 4 samples.
+  for (int i = 0; i < 9; i++) {
+    TEST_CHECK_NEAR(v[i * 3], expect[i], 1e-5);
+    TEST_CHECK(v[i * 3 + 2] == v[i * 3]);
+  }
+  mgos_imu_filter_reset(filter);
+  v[0] = 7;
+  mgos_imu_filter_process(filter, v, 1);
+  TEST_CHECK(v[0] == 7);
+  mgos_imu_filter_destroy(&filter);
+}
+
+// The AK8975 takes several ms per conversion, and a read in between returns the
+// previous sample. Polled every 1ms, only the fresh samples are aggregated.
+static void test_stale(void) {
+  struct mgos_imu_aggregator_opts agg_opts = { .window_samples = 1000 };
+  struct mgos_imu_mag_opts        mag_opts = { .type = MAG_AK8975 };
+  struct mgos_imu_aggregator *    agg;
+  struct mgos_imu_aggregate       a;
+  struct mgos_imu *               imu;
+  struct mgos_i2c *               i2c;
+  float x, y, z;
+  int   reads = 0;
+
+  i2c = mgos_imu_i2c_sim_create(0);
+  TEST_CHECK(mgos_imu_i2c_sim_add(i2c, MGOS_IMU_I2C_SIM_AK8975, 0x0C, 100));
+  imu = mgos_imu_create();
+  TEST_CHECK(mgos_imu_magnetometer_create_i2c(imu, i2c, 0x0C, &mag_opts));
+  agg = mgos_imu_aggregator_create(&agg_opts, NULL, NULL);
+  TEST_CHECK(mgos_imu_magnetometer_set_aggregator(imu, agg));
+  for (int i = 0; i < 200; i++) {
+    mgos_imu_i2c_sim_advance(i2c, 1000);
+    test_advance(1000);
+    if (mgos_imu_magnetometer_get(imu, &x, &y, &z)) {
+      reads++;
+    }
+  }
+  mgos_imu_aggregator_flush(agg);
+  TEST_CHECK(mgos_imu_aggregator_get(agg, &a));
+  TEST_CHECK(reads > 150);
+  TEST_CHECK(a.count > 10);
+  TEST_CHECK(a.count < (uint32_t)reads / 4);
+  mgos_imu_destroy(&imu);
+  mgos_imu_aggregator_destroy(&agg);
+  mgos_imu_i2c_sim_destroy(&i2c);
+}
+
+int main(void) {
+  test_biquad();
+  test_biquad_odr();
+  test_median();
+  test_stale();
+  return test_done("filter");
+}
@@ -0,0 +1,144 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Encode frames into an IMUL log in memory and decode them again. The frames
+// mix steady and jittered timestamps with small and full scale deltas, so that
+// each delta width is exercised, and the last block is a partial one.
+
+#include "mgos_imu_log.h"
+#include "test.h"
+
+#define FRAMES    (100)
+#define BLOCK     (8)
+// Magic, version, block_frames and 3x (name, scale, odr).
+#define V1_HEADER (6 + 3 * (MGOS_IMU_LOG_NAME_LEN + 8))
+
+struct mem_file {
+  uint8_t buf[8192];
+  size_t  len;
+  size_t  pos;
+};
+
+static bool mem_write(void *ctx, const void *buf, size_t len) {
+  struct mem_file *f = (struct mem_file *)ctx;
+
+  if (f->len + len > sizeof(f->buf)) {
+    return false;
+  }
+  memcpy(f->buf + f->len, buf, len);
+  f->len += len;
+  return true;
+}
+
+static int mem_read(void *ctx, void *buf, size_t len) {
+  struct mem_file *f = (struct mem_file *)ctx;
+
+  if (len > f->len - f->pos) {
+    len = f->len - f->pos;
+  }
+  memcpy(buf, f->buf + f->pos, len);
+  f->pos += len;
+  return (int)len;
+}
+
+static void make_frame(int i, struct mgos_imu_log_frame *fr) {
+  int16_t *raw = &fr->ax;
+
+  // Steady 1kHz for the first half, then jittered.
+  fr->ts_us = 1000000u + 1000u * i + (i >= FRAMES / 2 ? (uint32_t)(i * 37) % 200 : 0);
+  for (int c = 0; c < 9; c++) {
+    raw[c] = (int16_t)(c * 1000 + (i % 7) * (c + 1));
+  }
+  // Full scale swings on one channel.
+  fr->mz = (i & 1) ? INT16_MAX : INT16_MIN;
+}
+
+int main(void) {
+  struct mgos_imu_log_config   cfg = {
+    .acc  = { .name = "MPU9250", .scale = 4.0f / 32768, .odr = 1000 },
+    .gyro = { .name = "MPU9250", .scale = 500.0f / 32768, .odr = 1000 },
+    .mag  = { .name = "AK8963", .scale = 0.0015f, .odr = 100 },
+    .mag_sensitivity = { 1.1875f, 1.1953125f, 1.15625f },
+  };
+  struct mgos_imu_log_config   got_cfg;
+  struct mgos_imu_log_frame    fr, got;
+  struct mgos_imu_log_encoder *enc;
+  struct mgos_imu_log_decoder *dec;
+  static struct mem_file       f;
+  uint32_t frames, dropped, bytes;
+  int n;
+
+  enc = mgos_imu_log_encoder_create(&cfg, BLOCK, mem_write, &f);
+  TEST_CHECK(enc != NULL);
+  for (int i = 0; i < FRAMES; i++) {
+    make_frame(i, &fr);
+    TEST_CHECK(mgos_imu_log_encoder_add(enc, &fr));
+  }
+  TEST_CHECK(mgos_imu_log_encoder_flush(enc));
+  TEST_CHECK(mgos_imu_log_encoder_get_stats(enc, &frames, &dropped, &bytes));
+  TEST_CHECK(frames == FRAMES);
+  TEST_CHECK(dropped == 0);
+  TEST_CHECK(bytes == f.len);
+  // Deltas must pack smaller than the raw 22 bytes per frame.
+  TEST_CHECK(f.len < FRAMES * 22);
+  mgos_imu_log_encoder_destroy(&enc);
+
+  dec = mgos_imu_log_decoder_create(mem_read, &f);
+  TEST_CHECK(dec != NULL);
+  TEST_CHECK(mgos_imu_log_decoder_get_config(dec, &got_cfg));
+  TEST_CHECK(strcmp(got_cfg.acc.name, "MPU9250") == 0);
+  TEST_CHECK(strcmp(got_cfg.mag.name, "AK8963") == 0);
+  TEST_CHECK(got_cfg.gyro.scale == cfg.gyro.scale);
+  TEST_CHECK(got_cfg.mag.odr == cfg.mag.odr);
+  TEST_CHECK(memcmp(got_cfg.mag_sensitivity, cfg.mag_sensitivity, sizeof(cfg.mag_sensitivity)) == 0);
+  for (n = 0; mgos_imu_log_decoder_next(dec, &got); n++) {
+    make_frame(n, &fr);
+    TEST_CHECK(got.ts_us == fr.ts_us);
+    TEST_CHECK(memcmp(&got.ax, &fr.ax, 9 * sizeof(int16_t)) == 0);
+  }
+  TEST_CHECK(n == FRAMES);
+  mgos_imu_log_decoder_destroy(&dec);
+
+  // Version 1 logs have no sensitivity in the header, which reads as 1.0.
+  memmove(f.buf + V1_HEADER, f.buf + V1_HEADER + 12, f.len - V1_HEADER - 12);
+  f.len   -= 12;
+  f.pos    = 0;
+  f.buf[4] = 1;
+  dec      = mgos_imu_log_decoder_create(mem_read, &f);
+  TEST_CHECK(dec != NULL);
+  TEST_CHECK(mgos_imu_log_decoder_get_config(dec, &got_cfg));
+  TEST_CHECK(got_cfg.mag_sensitivity[0] == 1.0f && got_cfg.mag_sensitivity[2] == 1.0f);
+  TEST_CHECK(got_cfg.mag.odr == cfg.mag.odr);
+  for (n = 0; mgos_imu_log_decoder_next(dec, &got); n++) {
+  }
+  TEST_CHECK(n == FRAMES);
+  mgos_imu_log_decoder_destroy(&dec);
+
+  // A truncated block ends the log at the last complete one.
+  f.len -= 3;
+  f.pos  = 0;
+  dec    = mgos_imu_log_decoder_create(mem_read, &f);
+  for (n = 0; mgos_imu_log_decoder_next(dec, &got); n++) {
+  }
+  TEST_CHECK(n == FRAMES - FRAMES % BLOCK);
+  mgos_imu_log_decoder_destroy(&dec);
+
+  // Anything but a log is refused.
+  f.buf[0] = 'X';
+  f.pos    = 0;
+  TEST_CHECK(mgos_imu_log_decoder_create(mem_read, &f) == NULL);
+  return test_done("log");
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// The batch engine must track the scalar filter on the same inputs, for any
+// number of filters (including a partial SIMD step), with and without
+// magnetometer, and through the beta schedule.
+
+#include "madgwick.h"
+#include "madgwick_batch.h"
+#include "test.h"
+
+#define FILTERS    (13)
+#define STEPS      (2000)
+
+int main(void) {
+  struct mgos_imu_madgwick *      f[FILTERS];
+  struct mgos_imu_madgwick        out;
+  struct mgos_imu_madgwick_batch *batch;
+  float gx[FILTERS], gy[FILTERS], gz[FILTERS];
+  float ax[FILTERS], ay[FILTERS], az[FILTERS];
+  float mx[FILTERS], my[FILTERS], mz[FILTERS];
+  struct mgos_imu_madgwick_batch_input in = {
+    .gx = gx, .gy = gy, .gz = gz, .ax = ax, .ay = ay, .az = az, .mx = mx, .my = my, .mz = mz,
+  };
+
+  batch = mgos_imu_madgwick_batch_create(FILTERS);
+  TEST_CHECK(batch != NULL);
+  TEST_CHECK(mgos_imu_madgwick_batch_width() >= 1);
+  for (int i = 0; i < FILTERS; i++) {
+    f[i] = mgos_imu_madgwick_create();
+    mgos_imu_madgwick_set_params(f[i], 100.0f + 10.0f * i, 0.05f + 0.01f * i);
+    if (i % 3 == 0) {
+      mgos_imu_madgwick_set_beta_schedule(f[i], 2.5f, 50);
+    }
+    TEST_CHECK(mgos_imu_madgwick_batch_set(batch, i, f[i]));
+  }
+  TEST_CHECK(!mgos_imu_madgwick_batch_set(batch, FILTERS, f[0]));
+
+  for (int s = 0; s < STEPS; s++) {
+    for (int i = 0; i < FILTERS; i++) {
+      float t = s * 0.01f + i;
+
+      gx[i] = 0.3f * sinf(t);
+      gy[i] = 0.2f * cosf(1.3f * t);
+      gz[i] = 0.1f * sinf(0.7f * t + i);
+      ax[i] = 0.1f * sinf(t + 1);
+      ay[i] = -0.2f + 0.05f * cosf(t);
+      az[i] = 0.97f;
+      // Every other filter runs the IMU algorithm.
+      mx[i] = (i & 1) ? 0.0f : 0.2f + 0.02f * sinf(t);
+      my[i] = (i & 1) ? 0.0f : 0.1f;
+      mz[i] = (i & 1) ? 0.0f : -0.4f;
+      mgos_imu_madgwick_update(f[i], gx[i], gy[i], gz[i], ax[i], ay[i], az[i], mx[i], my[i], mz[i]);
+    }
+    TEST_CHECK(mgos_imu_madgwick_batch_update(batch, &in));
+  }
+
+  for (int i = 0; i < FILTERS; i++) {
+    TEST_CHECK(mgos_imu_madgwick_batch_get(batch, i, &out));
+    TEST_CHECK_NEAR(out.q0, f[i]->q0, 1e-4);
+    TEST_CHECK_NEAR(out.q1, f[i]->q1, 1e-4);
+    TEST_CHECK_NEAR(out.q2, f[i]->q2, 1e-4);
+    TEST_CHECK_NEAR(out.q3, f[i]->q3, 1e-4);
+    TEST_CHECK(out.counter == f[i]->counter);
+    mgos_imu_madgwick_destroy(&f[i]);
+  }
+  TEST_CHECK(mgos_imu_madgwick_batch_destroy(&batch));
+  TEST_CHECK(batch == NULL);
+  return test_done("madgwick_batch");
+}
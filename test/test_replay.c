@@ -0,0 +1,129 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Record raw frames from a simulated MPU9250 and its AK8963 to a file, with
+// buffers small enough to flush several times, then replay the file and check
+// that every frame comes back through mgos_imu_*_get() with its raw values,
+// scale and timestamp, and that the replay ends with the recording.
+
+#include "mgos_i2c.h"
+#include "mgos_imu.h"
+#include "mgos_imu_i2c_sim.h"
+#include "mgos_imu_internal.h"
+#include "mgos_imu_recorder.h"
+#include "test.h"
+
+#define FRAMES       (500)
+#define FILENAME     "test_replay.imul"
+
+struct raw {
+  uint32_t ts_us;
+  int16_t  ax, ay, az;
+  int16_t  gx, gy, gz;
+  int16_t  mx, my, mz;
+};
+
+int main(void) {
+  struct mgos_imu_i2c_sim_wave   wave = {
+    .offset    = { 0, 0, 8192 },
+    .amplitude = { 4096, 1024, 512 },
+    .freq      = 7,
+    .noise     = 50,
+  };
+  struct mgos_imu_acc_opts       acc_opts  = { .type = ACC_MPU9250, .scale = 4, .odr = 1000 };
+  struct mgos_imu_gyro_opts      gyro_opts = { .type = GYRO_MPU9250, .scale = 500, .odr = 1000 };
+  struct mgos_imu_mag_opts       mag_opts  = { .type = MAG_AK8963 };
+  struct mgos_imu_recorder_stats stats;
+  struct mgos_imu_recorder *     rec;
+  struct mgos_imu *              imu;
+  struct mgos_i2c *              i2c;
+  static struct raw              raw[FRAMES];
+  float    acc_scale, gyro_scale, mag_scale, mag_bias[3], x, y, z;
+  uint32_t ts;
+  int      n;
+
+  i2c = mgos_imu_i2c_sim_create(0);
+  TEST_CHECK(mgos_imu_i2c_sim_add(i2c, MGOS_IMU_I2C_SIM_MPU9250, 0x68, 1000));
+  TEST_CHECK(mgos_imu_i2c_sim_set_wave(i2c, 0x68, MGOS_IMU_I2C_SIM_ACC, &wave));
+  TEST_CHECK(mgos_imu_i2c_sim_set_wave(i2c, 0x68, MGOS_IMU_I2C_SIM_GYRO, &wave));
+  TEST_CHECK(mgos_imu_i2c_sim_add(i2c, MGOS_IMU_I2C_SIM_AK8963, 0x0C, 100));
+  TEST_CHECK(mgos_imu_i2c_sim_set_wave(i2c, 0x0C, MGOS_IMU_I2C_SIM_MAG, &wave));
+  imu = mgos_imu_create();
+  TEST_CHECK(mgos_imu_accelerometer_create_i2c(imu, i2c, 0x68, &acc_opts));
+  TEST_CHECK(mgos_imu_gyroscope_create_i2c(imu, i2c, 0x68, &gyro_opts));
+  TEST_CHECK(mgos_imu_magnetometer_create_i2c(imu, i2c, 0x0C, &mag_opts));
+  acc_scale  = imu->acc->scale;
+  gyro_scale = imu->gyro->scale;
+  mag_scale  = imu->mag->scale;
+  memcpy(mag_bias, imu->mag->bias, sizeof(mag_bias));
+  // The sim's ASA fuse ROM is not neutral, so the trim must be carried over.
+  TEST_CHECK(mag_bias[0] != 1.0f);
+
+  rec = mgos_imu_recorder_create(imu, FILENAME, MGOS_IMU_RECORDER_BUF_MIN);
+  TEST_CHECK(rec != NULL);
+  for (int i = 0; i < FRAMES; i++) {
+    mgos_imu_i2c_sim_advance(i2c, 1000);
+    test_advance(1000);
+    TEST_CHECK(mgos_imu_recorder_sample(rec));
+    raw[i].ts_us = (uint32_t)mgos_uptime_micros();
+    raw[i].ax    = imu->acc->ax;
+    raw[i].ay    = imu->acc->ay;
+    raw[i].az    = imu->acc->az;
+    raw[i].gx    = imu->gyro->gx;
+    raw[i].gy    = imu->gyro->gy;
+    raw[i].gz    = imu->gyro->gz;
+    raw[i].mx    = imu->mag->mx;
+    raw[i].my    = imu->mag->my;
+    raw[i].mz    = imu->mag->mz;
+  }
+  TEST_CHECK(mgos_imu_recorder_stop(rec));
+  TEST_CHECK(mgos_imu_recorder_get_stats(rec, &stats));
+  TEST_CHECK(stats.frames == FRAMES);
+  TEST_CHECK(stats.frames_dropped == 0);
+  TEST_CHECK(stats.read_errors == 0);
+  TEST_CHECK(stats.write_errors == 0);
+  TEST_CHECK(stats.flushes > 2);
+  mgos_imu_recorder_destroy(&rec);
+  mgos_imu_destroy(&imu);
+  mgos_imu_i2c_sim_destroy(&i2c);
+
+  imu = mgos_imu_create();
+  TEST_CHECK(mgos_imu_replay_create(imu, FILENAME, false));
+  TEST_CHECK(mgos_imu_accelerometer_present(imu));
+  TEST_CHECK(mgos_imu_gyroscope_present(imu));
+  TEST_CHECK(mgos_imu_magnetometer_present(imu));
+  for (n = 0; mgos_imu_accelerometer_get(imu, &x, &y, &z); n++) {
+    if (n >= FRAMES) {
+      break;
+    }
+    TEST_CHECK(mgos_imu_replay_get_timestamp(imu, &ts));
+    TEST_CHECK(ts == raw[n].ts_us);
+    TEST_CHECK(imu->acc->ax == raw[n].ax && imu->acc->ay == raw[n].ay && imu->acc->az == raw[n].az);
+    TEST_CHECK_NEAR(z, acc_scale * raw[n].az, 1e-6);
+    TEST_CHECK(mgos_imu_gyroscope_get(imu, &x, &y, &z));
+    TEST_CHECK(imu->gyro->gx == raw[n].gx && imu->gyro->gy == raw[n].gy && imu->gyro->gz == raw[n].gz);
+    TEST_CHECK_NEAR(x, gyro_scale * raw[n].gx, 1e-4);
+    TEST_CHECK(mgos_imu_magnetometer_get(imu, &x, &y, &z));
+    TEST_CHECK(imu->mag->mx == raw[n].mx && imu->mag->my == raw[n].my && imu->mag->mz == raw[n].mz);
+    TEST_CHECK_NEAR(x, mag_bias[0] * raw[n].mx * mag_scale, 1e-3);
+    TEST_CHECK_NEAR(y, mag_bias[1] * raw[n].my * mag_scale, 1e-3);
+    TEST_CHECK_NEAR(z, mag_bias[2] * raw[n].mz * mag_scale, 1e-3);
+  }
+  TEST_CHECK(n == FRAMES);
+  mgos_imu_destroy(&imu);
+  remove(FILENAME);
+  return test_done("replay");
+}
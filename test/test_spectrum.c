@@ -0,0 +1,117 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Feed a known mix of sines through the float and Q15 spectrum paths, with
+// each window, and check RMS, band energies and peaks against the signal, and
+// the Q15 features against the float ones.
+
+#include "mgos_imu.h"
+#include "test.h"
+
+#define ODR    (1000.0f)
+
+static int s_blocks;
+
+static void spectrum_cb(struct mgos_imu_spectrum *sp, const struct mgos_imu_spectrum_features *f, void *user_data) {
+  TEST_CHECK(f->block == (uint32_t)s_blocks);
+  s_blocks++;
+  (void)sp;
+  (void)user_data;
+}
+
+// X: 0.5G at 50.3Hz and 0.1G at 200Hz. Y: 0.2G at 120Hz on a 1G offset,
+// which is removed. Z: a small 10Hz tone on -1G.
+static void run(const struct mgos_imu_spectrum_opts *opts, struct mgos_imu_spectrum_features *f) {
+  struct mgos_imu_spectrum *sp = mgos_imu_spectrum_create(opts, spectrum_cb, NULL);
+  float xyz[3];
+
+  TEST_CHECK(sp != NULL);
+  s_blocks = 0;
+  for (int i = 0; i < opts->size * 2; i++) {
+    float t = i / opts->odr;
+
+    xyz[0] = 0.5f * sinf(2 * M_PI * 50.3f * t) + 0.1f * sinf(2 * M_PI * 200 * t);
+    xyz[1] = 1.0f + 0.2f * sinf(2 * M_PI * 120 * t);
+    xyz[2] = -1.0f + 0.001f * sinf(2 * M_PI * 10 * t);
+    TEST_CHECK(mgos_imu_spectrum_add(sp, xyz, 1));
+  }
+  TEST_CHECK(s_blocks == 2);
+  TEST_CHECK(mgos_imu_spectrum_get(sp, f));
+  TEST_CHECK(f->block == 1);
+  mgos_imu_spectrum_destroy(&sp);
+}
+
+static void check(const struct mgos_imu_spectrum_opts *opts, const struct mgos_imu_spectrum_features *f) {
+  float bin = opts->odr / opts->size;
+
+  TEST_CHECK_NEAR(f->rms[0], sqrtf(0.125f + 0.005f), 0.01);
+  TEST_CHECK_NEAR(f->rms[1], sqrtf(0.02f), 0.005);
+  TEST_CHECK(f->rms[2] < 0.001);
+  // Bands of 0-30, 30-100, 100-300 and 300-500Hz.
+  TEST_CHECK(f->band_energy[0][0] < 0.001);
+  TEST_CHECK_NEAR(f->band_energy[0][1], 0.125, 0.005);
+  TEST_CHECK_NEAR(f->band_energy[0][2], 0.005, 0.0005);
+  TEST_CHECK(f->band_energy[0][3] < 0.0005);
+  TEST_CHECK_NEAR(f->band_energy[1][2], 0.02, 0.001);
+  TEST_CHECK(f->band_energy[1][0] < 0.0005);
+  // Peak amplitudes lose up to ~15% to scalloping between bins.
+  TEST_CHECK_NEAR(f->peak_freq[0][0], 50.3, bin);
+  TEST_CHECK_NEAR(f->peak_amp[0][0], 0.5, 0.075);
+  TEST_CHECK_NEAR(f->peak_freq[0][1], 200, bin);
+  TEST_CHECK_NEAR(f->peak_amp[0][1], 0.1, 0.015);
+  TEST_CHECK_NEAR(f->peak_freq[1][0], 120, bin);
+  TEST_CHECK_NEAR(f->peak_amp[1][0], 0.2, 0.03);
+}
+
+int main(void) {
+  struct mgos_imu_spectrum_opts       opts = {
+    .odr        = ODR,
+    .num_bands  = 4,
+    .band_edges = { 0, 30, 100, 300, 500 },
+    .num_peaks  = 3,
+  };
+  struct mgos_imu_spectrum_features   f, q;
+  const uint16_t                      sizes[]   = { 256, 1024 };
+  const enum mgos_imu_spectrum_window windows[] = { MGOS_IMU_SPECTRUM_WINDOW_HANN, MGOS_IMU_SPECTRUM_WINDOW_HAMMING };
+
+  for (int s = 0; s < 2; s++) {
+    for (int w = 0; w < 2; w++) {
+      opts.size        = sizes[s];
+      opts.window      = windows[w];
+      opts.fixed_point = false;
+      run(&opts, &f);
+      check(&opts, &f);
+      opts.fixed_point = true;
+      opts.range       = 4;
+      run(&opts, &q);
+      check(&opts, &q);
+      for (int a = 0; a < 3; a++) {
+        TEST_CHECK_NEAR(q.rms[a], f.rms[a], 0.001);
+        for (int b = 0; b < opts.num_bands; b++) {
+          TEST_CHECK_NEAR(q.band_energy[a][b], f.band_energy[a][b], 0.0002);
+        }
+      }
+      // Peaks are interpolated between bins, so allow for Q15 rounding.
+      TEST_CHECK_NEAR(q.peak_freq[0][0], f.peak_freq[0][0], 0.1f * opts.odr / opts.size);
+      TEST_CHECK_NEAR(q.peak_freq[1][0], f.peak_freq[1][0], 0.1f * opts.odr / opts.size);
+    }
+  }
+
+  // Block sizes must be powers of 2.
+  opts.size = 100;
+  TEST_CHECK(mgos_imu_spectrum_create(&opts, NULL, NULL) == NULL);
+  return test_done("spectrum");
+}